@@ -0,0 +1,450 @@
+/*
+ * chindex.c -- chunk-offset index stored in a sidecar file.
+ *
+ * If a file is not a history-file, GT3_seek() and GT3_countChunk()
+ * have to scan the file from the beginning. The index holds the
+ * position, format, and dimension-length of every chunk, so that
+ * they become O(1).
+ *
+ * The index of "foo.gt" is stored in "foo.gt.idx". It is used only if
+ * the size, the modification time (in nanoseconds where available),
+ * and the i-node number of the file are unchanged.
+ *
+ * Layout (all words are 32-bit big-endian):
+ *   "GT3CHIDX" (8 bytes)
+ *   version, # of chunks, size (2 words), mtime (2 words),
+ *   nanoseconds of mtime, i-node number (2 words)
+ *   entry[0] ... entry[N-1]: offset (2 words), fmt, dimlen[3]
+ */
+#include "internal.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtool3.h"
+#include "debug.h"
+
+#define INDEX_MAGIC   "GT3CHIDX"
+#define INDEX_VERSION 2
+#define INDEX_SUFFIX  ".idx"
+#define HEAD_WORDS    9
+#define ENTRY_WORDS   6
+
+
+static char *
+index_path(const char *path)
+{
+    char *ipath;
+
+    if ((ipath = malloc(strlen(path) + sizeof INDEX_SUFFIX)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return NULL;
+    }
+    strcpy(ipath, path);
+    strcat(ipath, INDEX_SUFFIX);
+    return ipath;
+}
+
+
+static void
+split64(uint32_t *w, uint64_t val)
+{
+    w[0] = (uint32_t)(val >> 32);
+    w[1] = (uint32_t)(val & 0xffffffffU);
+}
+
+
+static uint64_t
+join64(const uint32_t *w)
+{
+    return (uint64_t)w[0] << 32 | w[1];
+}
+
+
+/*
+ * set_stamp() sets the words identifying the version of the file:
+ * size, mtime, nanoseconds of mtime, and i-node number.
+ */
+static void
+set_stamp(uint32_t *w, const file_stat_t *sb)
+{
+    split64(w, (uint64_t)sb->st_size);
+    split64(w + 2, (uint64_t)sb->st_mtime);
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    w[4] = (uint32_t)sb->st_mtim.tv_nsec;
+#else
+    w[4] = 0;
+#endif
+    split64(w + 5, (uint64_t)sb->st_ino);
+}
+
+
+void
+free_chunk_index(chunk_index *idx)
+{
+    if (idx) {
+        free(idx->entry);
+        free(idx);
+    }
+}
+
+
+/*
+ * load_chunk_index() loads the index of 'path'.
+ * NULL is returned (without an error) if the index does not exist
+ * or is out of date.
+ */
+chunk_index *
+load_chunk_index(const char *path, const file_stat_t *sb)
+{
+    FILE *fp = NULL;
+    char *ipath, magic[8];
+    uint32_t head[HEAD_WORDS], w[ENTRY_WORDS], stamp[HEAD_WORDS - 2];
+    chunk_index *idx = NULL;
+    chunk_entry *ent = NULL;
+    int i, num;
+
+    if ((ipath = index_path(path)) == NULL)
+        return NULL;
+
+    fp = fopen(ipath, "rb");
+    free(ipath);
+    if (fp == NULL)
+        return NULL;
+
+    if (fread(magic, 1, sizeof magic, fp) != sizeof magic
+        || memcmp(magic, INDEX_MAGIC, sizeof magic) != 0
+        || fread(head, 4, HEAD_WORDS, fp) != HEAD_WORDS)
+        goto stale;
+
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(head, HEAD_WORDS);
+
+    num = (int)head[1];
+    set_stamp(stamp, sb);
+    if (head[0] != INDEX_VERSION
+        || num < 1
+        || memcmp(head + 2, stamp, sizeof stamp) != 0)
+        goto stale;
+
+    if ((idx = malloc(sizeof(chunk_index))) == NULL
+        || (ent = malloc(sizeof(chunk_entry) * num)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        goto stale;
+    }
+
+    for (i = 0; i < num; i++) {
+        if (fread(w, 4, ENTRY_WORDS, fp) != ENTRY_WORDS)
+            goto stale;
+
+        if (IS_LITTLE_ENDIAN)
+            reverse_words(w, ENTRY_WORDS);
+
+        ent[i].off = (off_t)join64(w);
+        ent[i].fmt = (int)w[2];
+        ent[i].dimlen[0] = (int)w[3];
+        ent[i].dimlen[1] = (int)w[4];
+        ent[i].dimlen[2] = (int)w[5];
+
+        /* a broken index must not be used (cf. read_fptr[]) */
+        if (ent[i].off >= sb->st_size
+            || (i == 0 && ent[i].off != 0)
+            || (i > 0 && ent[i].off <= ent[i-1].off)
+            || ent[i].fmt < 0
+            || (ent[i].fmt & GT3_FMT_MASK) >= GT3_FMT_NULL
+            || ent[i].dimlen[0] <= 0
+            || ent[i].dimlen[1] <= 0
+            || ent[i].dimlen[2] <= 0)
+            goto stale;
+    }
+    fclose(fp);
+
+    idx->num = num;
+    idx->entry = ent;
+    debug2("load_chunk_index(): %s: %d chunks", path, num);
+    return idx;
+
+stale:
+    fclose(fp);
+    free(ent);
+    free(idx);
+    return NULL;
+}
+
+
+/*
+ * chunk_index_size() returns the size of the i-th chunk.
+ */
+size_t
+chunk_index_size(const chunk_index *idx, int i, off_t fsize)
+{
+    assert(i >= 0 && i < idx->num);
+
+    return (i < idx->num - 1)
+        ? idx->entry[i + 1].off - idx->entry[i].off
+        : fsize - idx->entry[i].off;
+}
+
+
+static int
+save_index(const char *path, const chunk_entry *ent, int num,
+           const file_stat_t *sb)
+{
+    FILE *fp;
+    char *ipath = NULL, *tmp = NULL;
+    uint32_t head[HEAD_WORDS], w[ENTRY_WORDS];
+    int i, rval = -1;
+
+    if ((ipath = index_path(path)) == NULL
+        || (tmp = malloc(strlen(ipath) + 5)) == NULL)
+        goto finish;
+
+    /* write into a temporary file, and then rename it. */
+    sprintf(tmp, "%s.tmp", ipath);
+    if ((fp = fopen(tmp, "wb")) == NULL) {
+        gt3_error(SYSERR, tmp);
+        goto finish;
+    }
+
+    head[0] = INDEX_VERSION;
+    head[1] = (uint32_t)num;
+    set_stamp(head + 2, sb);
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(head, HEAD_WORDS);
+
+    if (fwrite(INDEX_MAGIC, 1, 8, fp) != 8
+        || fwrite(head, 4, HEAD_WORDS, fp) != HEAD_WORDS) {
+        gt3_error(SYSERR, tmp);
+        fclose(fp);
+        goto finish;
+    }
+
+    for (i = 0; i < num; i++) {
+        split64(w, (uint64_t)ent[i].off);
+        w[2] = (uint32_t)ent[i].fmt;
+        w[3] = (uint32_t)ent[i].dimlen[0];
+        w[4] = (uint32_t)ent[i].dimlen[1];
+        w[5] = (uint32_t)ent[i].dimlen[2];
+        if (IS_LITTLE_ENDIAN)
+            reverse_words(w, ENTRY_WORDS);
+
+        if (fwrite(w, 4, ENTRY_WORDS, fp) != ENTRY_WORDS) {
+            gt3_error(SYSERR, tmp);
+            fclose(fp);
+            goto finish;
+        }
+    }
+
+    if (fclose(fp) < 0 || rename(tmp, ipath) < 0) {
+        gt3_error(SYSERR, ipath);
+        goto finish;
+    }
+    rval = 0;
+
+finish:
+    if (rval < 0 && tmp)
+        remove(tmp);
+    free(tmp);
+    free(ipath);
+    return rval;
+}
+
+
+/*
+ * GT3_writeIndex() scans a file and saves its chunk index.
+ *
+ * return value: the number of chunks (-1 on error).
+ */
+int
+GT3_writeIndex(const char *path)
+{
+    GT3_File *fp;
+    file_stat_t sb;
+    chunk_entry *ent = NULL, *ptr;
+    int reserved = 0, num = 0, rval = -1;
+
+    if (file_stat(path, &sb) < 0) {
+        gt3_error(SYSERR, path);
+        return -1;
+    }
+    if ((fp = GT3_open(path)) == NULL)
+        return -1;
+
+    while (!GT3_eof(fp)) {
+        if (num == reserved) {
+            reserved += reserved ? reserved : 1024;
+            if ((ptr = realloc(ent, sizeof(chunk_entry) * reserved)) == NULL) {
+                gt3_error(SYSERR, NULL);
+                goto finish;
+            }
+            ent = ptr;
+        }
+        ent[num].off = fp->off;
+        ent[num].fmt = fp->fmt;
+        ent[num].dimlen[0] = fp->dimlen[0];
+        ent[num].dimlen[1] = fp->dimlen[1];
+        ent[num].dimlen[2] = fp->dimlen[2];
+        num++;
+
+        if (GT3_next(fp) < 0)
+            goto finish;
+    }
+
+    if (save_index(path, ent, num, &sb) == 0)
+        rval = num;
+
+finish:
+    GT3_close(fp);
+    free(ent);
+    return rval;
+}
+
+
+#ifdef TEST_MAIN
+static void
+write_test_file(const char *path, double value)
+{
+    const char *fmts[] = { "UR4", "UR8", "URY16" };
+    double data[6 * 5];
+    GT3_HEADER head;
+    FILE *output;
+    int i, n;
+
+    for (i = 0; i < 6 * 5; i++)
+        data[i] = value + i;
+
+    GT3_initHeader(&head);
+    output = fopen(path, "wb");
+    assert(output);
+    for (n = 0; n < 3; n++)
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 6, 5, 1,
+                         &head, fmts[n], output) == 0);
+    fclose(output);
+}
+
+
+/*
+ * test_corrupt() overwrites a word at 'pos' in the index of 'path',
+ * and checks that the index is rejected.
+ */
+static int
+test_corrupt(const char *path, long pos, uint32_t val)
+{
+    const char *ipath = "chindex-test.gt.idx";
+    file_stat_t sb;
+    GT3_File *fp;
+    FILE *out;
+    double x;
+    GT3_Varbuf *var;
+
+    assert(GT3_writeIndex(path) == 3);
+    assert(file_stat(path, &sb) == 0);
+
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(&val, 1);
+    out = fopen(ipath, "r+b");
+    assert(out);
+    assert(fseek(out, pos, SEEK_SET) == 0);
+    assert(fwrite(&val, 4, 1, out) == 1);
+    fclose(out);
+
+    if (load_chunk_index(path, &sb) != NULL)
+        return -1;
+
+    fp = GT3_open(path);
+    assert(fp && fp->index_ == NULL);
+    assert(GT3_seek(fp, 1, SEEK_SET) == 0);
+    assert(fp->fmt == GT3_FMT_UR8 && fp->dimlen[1] == 5);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    assert(GT3_readVarZ(var, 0) == 0);
+    assert(GT3_readVar(&x, var, 1, 1, 0) == 0 && x == 1. + 7);
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    return 0;
+}
+
+
+/*
+ * The index is rejected if the file has been rewritten.
+ */
+static void
+test_stale(void)
+{
+    const char *path = "chindex-test.gt";
+    const char *tmp = "chindex-test.gt.new";
+    chunk_index *idx;
+    file_stat_t sb, sb2;
+    GT3_File *fp;
+
+    write_test_file(path, 1.);
+    assert(GT3_writeIndex(path) == 3);
+
+    assert(file_stat(path, &sb) == 0);
+    idx = load_chunk_index(path, &sb);
+    assert(idx && idx->num == 3 && idx->entry[0].off == 0);
+    assert(idx->entry[2].fmt == GT3_format("URY16"));
+    free_chunk_index(idx);
+
+    fp = GT3_open(path);
+    assert(fp && fp->index_ != NULL);
+    GT3_close(fp);
+
+    /* changed in nanoseconds of mtime, or in i-node */
+    sb2 = sb;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    sb2.st_mtim.tv_nsec = (sb2.st_mtim.tv_nsec + 1) % 1000000000;
+    assert(load_chunk_index(path, &sb2) == NULL);
+    sb2 = sb;
+#endif
+    sb2.st_ino++;
+    assert(load_chunk_index(path, &sb2) == NULL);
+
+    /*
+     * broken entries (fmt, dimlen[1], and offset of the 2nd chunk)
+     * with the valid stamp: the file is scanned instead.
+     */
+    assert(test_corrupt(path, 8 + 4 * HEAD_WORDS + 4 * (ENTRY_WORDS + 2),
+                        0x000000ffU) == 0);
+    assert(test_corrupt(path, 8 + 4 * HEAD_WORDS + 4 * (ENTRY_WORDS + 4),
+                        0) == 0);
+    assert(test_corrupt(path, 8 + 4 * HEAD_WORDS + 4 * (ENTRY_WORDS + 1),
+                        (uint32_t)sb.st_size) == 0);
+    assert(GT3_writeIndex(path) == 3);
+
+    /*
+     * rewritten (with the same size, possibly in the same second).
+     */
+    write_test_file(tmp, 2.);
+    assert(rename(tmp, path) == 0);
+    assert(file_stat(path, &sb2) == 0);
+    assert(sb2.st_size == sb.st_size);
+    assert(load_chunk_index(path, &sb2) == NULL);
+
+    fp = GT3_open(path);
+    assert(fp && fp->index_ == NULL);
+    GT3_close(fp);
+
+    remove(path);
+    remove("chindex-test.gt.idx");
+}
+
+
+int
+main(int argc, char **argv)
+{
+    uint32_t w[2];
+
+    split64(w, 0x123456789abcdef0ULL);
+    assert(w[0] == 0x12345678U && w[1] == 0x9abcdef0U);
+    assert(join64(w) == 0x123456789abcdef0ULL);
+
+    test_stale();
+    return 0;
+}
+#endif
@@ -0,0 +1,773 @@
+/*
+ * chunkmap.c -- parallel map-reduce over chunks.
+ *
+ * Tasks (z-planes or whole chunks) are run by a pool of threads, each of
+ * which has its own GT3_File, GT3_Varbuf, and data of the tool.
+ * The tasks are run in "waves" of WAVE_BLOCKS blocks per thread, and
+ * idle threads pick up the next block from the shared counter.
+ */
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtool3.h"
+#include "fileiter.h"
+#include "chunkmap.h"
+
+#define WAVE_BLOCKS 2
+#define MAX_LEVEL   64          /* > log2(# of blocks) */
+
+struct worker {
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    int file;                   /* the file opened (-1 if none) */
+    void *local;
+    int has_local;
+};
+
+struct slot {
+    void *part;
+    int failed;
+    int errcode, errnum;
+    char errmsg[256];
+};
+
+struct chunkmap {
+    const struct chunkmap_ops *ops;
+    void *arg;
+    int nthreads;
+
+    char **path;
+    int npath, path_size;
+
+    struct cm_task *task;
+    size_t ntask, task_size;
+
+    struct worker *worker;      /* [nthreads] */
+
+    /* current wave */
+    int reduce;                 /* a slot for each block (or task) */
+    size_t task0;               /* the first task in the wave */
+    size_t ntask_wave;
+    struct slot *slot;
+    size_t nslot;
+};
+
+
+chunkmap *
+new_chunkmap(const struct chunkmap_ops *ops, void *arg, int nthreads)
+{
+    chunkmap *cm;
+    int i;
+
+    if (nthreads < 1)
+        nthreads = 1;
+
+    if ((cm = malloc(sizeof(chunkmap))) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return NULL;
+    }
+    memset(cm, 0, sizeof(chunkmap));
+    cm->ops = ops;
+    cm->arg = arg;
+    cm->nthreads = nthreads;
+
+    if ((cm->worker = malloc(sizeof(struct worker) * nthreads)) == NULL
+        || (cm->slot = malloc(sizeof(struct slot) * CHUNKMAP_BLOCK
+                              * WAVE_BLOCKS * nthreads)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        free(cm->worker);
+        free(cm);
+        return NULL;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        cm->worker[i].fp = NULL;
+        cm->worker[i].var = NULL;
+        cm->worker[i].file = -1;
+        cm->worker[i].local = NULL;
+        cm->worker[i].has_local = 0;
+    }
+    return cm;
+}
+
+
+void
+free_chunkmap(chunkmap *cm)
+{
+    struct worker *w;
+    int i;
+
+    if (cm == NULL)
+        return;
+
+    for (i = 0; i < cm->nthreads; i++) {
+        w = cm->worker + i;
+        if (w->has_local && cm->ops->free_local)
+            cm->ops->free_local(w->local, cm->arg);
+        GT3_freeVarbuf(w->var);
+        GT3_close(w->fp);
+    }
+    for (i = 0; i < cm->npath; i++)
+        free(cm->path[i]);
+
+    free(cm->path);
+    free(cm->task);
+    free(cm->slot);
+    free(cm->worker);
+    free(cm);
+}
+
+
+const char *
+chunkmap_path(const chunkmap *cm, int file)
+{
+    return file >= 0 && file < cm->npath ? cm->path[file] : NULL;
+}
+
+
+/*
+ * chunkmap_add() adds a task of the chunk in the last added file.
+ */
+int
+chunkmap_add(chunkmap *cm, int chunk, int z)
+{
+    struct cm_task *task;
+    size_t size;
+
+    if (cm->npath == 0) {
+        gt3_error(GT3_ERR_CALL, "chunkmap_add(): No file");
+        return -1;
+    }
+
+    if (cm->ntask == cm->task_size) {
+        size = cm->task_size > 0 ? 2 * cm->task_size : 256;
+        if ((task = realloc(cm->task, sizeof(struct cm_task) * size))
+            == NULL) {
+            gt3_error(SYSERR, NULL);
+            return -1;
+        }
+        cm->task = task;
+        cm->task_size = size;
+    }
+
+    task = cm->task + cm->ntask++;
+    task->file = cm->npath - 1;
+    task->chunk = chunk;
+    task->z = z;
+    task->final = 0;
+    return 0;
+}
+
+
+/*
+ * chunkmap_add_file() adds tasks of the chunks in 'path' specified by
+ * 'seq' (all the chunks if NULL).
+ */
+int
+chunkmap_add_file(chunkmap *cm, const char *path, struct sequence *seq)
+{
+    GT3_File *fp;
+    file_iterator it;
+    char **pp;
+    int size, stat, rval = -1;
+
+    if ((fp = cm->ops->open ? cm->ops->open(path) : GT3_open(path)) == NULL)
+        return -1;
+
+    if (cm->npath == cm->path_size) {
+        size = cm->path_size > 0 ? 2 * cm->path_size : 16;
+        if ((pp = realloc(cm->path, sizeof(char *) * size)) == NULL) {
+            gt3_error(SYSERR, NULL);
+            goto finish;
+        }
+        cm->path = pp;
+        cm->path_size = size;
+    }
+    if ((cm->path[cm->npath] = strdup(path)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        goto finish;
+    }
+    cm->npath++;
+
+    setup_file_iterator(&it, fp, seq);
+    while ((stat = iterate_file(&it)) != ITER_END) {
+        if (stat == ITER_ERROR || stat == ITER_ERRORCHUNK)
+            goto finish;
+        if (stat == ITER_OUTRANGE)
+            continue;
+
+        if (cm->ops->plan) {
+            if (cm->ops->plan(cm, fp, cm->arg) < 0)
+                goto finish;
+        } else
+            if (chunkmap_add(cm, fp->curr, -1) < 0)
+                goto finish;
+    }
+    rval = 0;
+
+finish:
+    GT3_close(fp);
+    return rval;
+}
+
+
+/*
+ * attach() sets the chunk of 'task' to the Varbuf of the worker.
+ */
+static int
+attach(struct worker *w, const chunkmap *cm, const struct cm_task *task)
+{
+    GT3_File *fp;
+    const char *path = cm->path[task->file];
+
+    if (w->file != task->file) {
+        if ((fp = cm->ops->open ? cm->ops->open(path) : GT3_open(path))
+            == NULL)
+            return -1;
+
+        if (w->var == NULL)
+            w->var = GT3_getVarbuf(fp);
+        else if (GT3_reattachVarbuf(w->var, fp) < 0) {
+            GT3_close(fp);
+            return -1;
+        }
+        if (w->var == NULL) {
+            GT3_close(fp);
+            return -1;
+        }
+
+        GT3_close(w->fp);
+        w->fp = fp;
+        w->file = task->file;
+    }
+
+    if (w->fp->curr != task->chunk
+        && GT3_seek(w->fp, task->chunk, SEEK_SET) < 0)
+        return -1;
+    return 0;
+}
+
+
+/*
+ * run_block() runs the i-th block in the wave.
+ */
+static int
+run_block(size_t i, int id, void *ptr)
+{
+    chunkmap *cm = ptr;
+    struct worker *w = cm->worker + id;
+    const struct cm_task *task;
+    struct slot *s;
+    size_t t, tend;
+
+    t = i * CHUNKMAP_BLOCK;
+    tend = t + CHUNKMAP_BLOCK;
+    if (tend > cm->ntask_wave)
+        tend = cm->ntask_wave;
+
+    for (; t < tend; t++) {
+        task = cm->task + cm->task0 + t;
+        s = cm->slot + (cm->reduce ? i : t);
+
+        if (!w->has_local && cm->ops->new_local) {
+            if (cm->ops->new_local(&w->local, cm->arg) < 0)
+                goto error;
+            w->has_local = 1;
+        }
+
+        if (attach(w, cm, task) < 0
+            || cm->ops->map(s->part, w->var, task, w->local, cm->arg) < 0)
+            goto error;
+    }
+    return 0;
+
+error:
+    /*
+     * The error is raised again in the main thread.
+     */
+    s->failed = 1;
+    s->errcode = copy_last_error(&s->errnum, s->errmsg, sizeof s->errmsg);
+    if (s->errcode != 0)
+        GT3_clearLastError();
+    return -1;
+}
+
+
+static void
+clear_slots(chunkmap *cm)
+{
+    size_t i;
+
+    for (i = 0; i < cm->nslot; i++)
+        if (cm->slot[i].part) {
+            cm->ops->free_part(cm->slot[i].part, cm->arg);
+            cm->slot[i].part = NULL;
+        }
+    cm->nslot = 0;
+}
+
+
+static int
+raise_slot(const struct slot *s)
+{
+    if (s->errcode != 0)
+        raise_error(s->errcode, s->errnum, s->errmsg);
+    return -1;
+}
+
+
+/*
+ * run_wave() runs tasks from 'task0' to 'task0 + ntask - 1' (a whole
+ * number of blocks unless it is the last wave).
+ */
+static int
+run_wave(chunkmap *cm, size_t task0, size_t ntask)
+{
+    size_t i, nblock;
+
+    nblock = (ntask + CHUNKMAP_BLOCK - 1) / CHUNKMAP_BLOCK;
+
+    cm->task0 = task0;
+    cm->ntask_wave = ntask;
+    cm->nslot = cm->reduce ? nblock : ntask;
+    for (i = 0; i < cm->nslot; i++) {
+        cm->slot[i].failed = 0;
+        cm->slot[i].errcode = 0;
+        if ((cm->slot[i].part = cm->ops->new_part(cm->arg)) == NULL) {
+            cm->nslot = i;
+            clear_slots(cm);
+            return -1;
+        }
+    }
+
+    parallel_run(cm->nthreads, nblock, run_block, cm);
+    return 0;
+}
+
+
+static size_t
+wave_size(const chunkmap *cm)
+{
+    return (size_t)CHUNKMAP_BLOCK * WAVE_BLOCKS * cm->nthreads;
+}
+
+
+/*
+ * chunkmap_reduce() maps all the tasks, and merges the partials into
+ * '*result', which is to be freed by ops->free_part().
+ *
+ * The partials of blocks are merged as a binary counter does: a new
+ * partial is merged with the previous one of the same level (the # of
+ * blocks merged is 2^level).  So the order of merging depends only on
+ * the # of tasks.
+ */
+int
+chunkmap_reduce(void **result, chunkmap *cm)
+{
+    void *stack[MAX_LEVEL];
+    int level[MAX_LEVEL];
+    int sp = 0, lv;
+    void *part = NULL;
+    size_t t0, n, i;
+    int rval = -1;
+
+    cm->reduce = 1;
+    for (t0 = 0; t0 < cm->ntask; t0 += n) {
+        n = cm->ntask - t0;
+        if (n > wave_size(cm))
+            n = wave_size(cm);
+
+        if (run_wave(cm, t0, n) < 0)
+            goto finish;
+
+        for (i = 0; i < cm->nslot; i++)
+            if (cm->slot[i].failed) {
+                raise_slot(cm->slot + i);
+                goto finish;
+            }
+
+        for (i = 0; i < cm->nslot; i++) {
+            part = cm->slot[i].part;
+            cm->slot[i].part = NULL;
+
+            for (lv = 0; sp > 0 && level[sp - 1] == lv; lv++) {
+                if (cm->ops->merge(stack[sp - 1], part, cm->arg) < 0)
+                    goto finish;
+
+                cm->ops->free_part(part, cm->arg);
+                part = stack[--sp];
+            }
+            stack[sp] = part;
+            level[sp] = lv;
+            sp++;
+            part = NULL;
+        }
+        cm->nslot = 0;
+    }
+
+    /*
+     * the rest of the tree.
+     */
+    for (; sp > 1; sp--) {
+        if (cm->ops->merge(stack[sp - 2], stack[sp - 1], cm->arg) < 0)
+            goto finish;
+        cm->ops->free_part(stack[sp - 1], cm->arg);
+    }
+    if (sp == 0 && (stack[sp++] = cm->ops->new_part(cm->arg)) == NULL)
+        goto finish;
+
+    *result = stack[0];
+    sp = 0;
+    rval = 0;
+
+finish:
+    if (part)
+        cm->ops->free_part(part, cm->arg);
+    while (sp > 0)
+        cm->ops->free_part(stack[--sp], cm->arg);
+    clear_slots(cm);
+    return rval;
+}
+
+
+/*
+ * chunkmap_each() maps each task into its own partial, which is passed
+ * to ops->emit() in the order of the tasks.
+ * If a task fails, the tasks after it are not emitted.
+ */
+int
+chunkmap_each(chunkmap *cm)
+{
+    const struct cm_task *task;
+    size_t t0, n, i;
+    int rval = -1;
+
+    for (i = 0; i < cm->ntask; i++) {
+        task = cm->task + i;
+        cm->task[i].final = i + 1 == cm->ntask
+            || task[1].file != task->file || task[1].chunk != task->chunk;
+    }
+
+    cm->reduce = 0;
+    for (t0 = 0; t0 < cm->ntask; t0 += n) {
+        n = cm->ntask - t0;
+        if (n > wave_size(cm))
+            n = wave_size(cm);
+
+        if (run_wave(cm, t0, n) < 0)
+            goto finish;
+
+        for (i = 0; i < n; i++) {
+            if (cm->slot[i].failed) {
+                raise_slot(cm->slot + i);
+                goto finish;
+            }
+            if (cm->ops->emit(cm->slot[i].part, cm->task + t0 + i,
+                              cm->arg) < 0)
+                goto finish;
+        }
+        clear_slots(cm);
+    }
+    rval = 0;
+
+finish:
+    clear_slots(cm);
+    return rval;
+}
+
+
+/*
+ * get_nthreads() parses the argument of -j option: the # of threads
+ * (0: the # of processors).  It returns -1 if invalid.
+ */
+int
+get_nthreads(const char *str)
+{
+    char *endptr;
+    long n;
+
+    n = strtol(str, &endptr, 10);
+    if (str == endptr || *endptr != '\0' || n < 0 || n > 256)
+        return -1;
+
+    return n == 0 ? num_processors() : (int)n;
+}
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+#include <math.h>
+
+static const char *test_path = "chunkmap-test.gt";
+
+struct test_part {
+    size_t ntask;
+    double sum;
+    char order[64];             /* chunk No. of tasks */
+};
+
+
+static void *
+test_new_part(void *arg)
+{
+    struct test_part *p;
+
+    if ((p = malloc(sizeof(struct test_part))) != NULL) {
+        p->ntask = 0;
+        p->sum = 0.;
+        p->order[0] = '\0';
+    }
+    return p;
+}
+
+
+static void
+test_free_part(void *part, void *arg)
+{
+    free(part);
+}
+
+
+static int
+test_map(void *ptr, GT3_Varbuf *var, const struct cm_task *task,
+         void *local, void *arg)
+{
+    struct test_part *p = ptr;
+    double x;
+    size_t len;
+    int z, z0, z1;
+
+    assert(var->fp->curr == task->chunk);
+    z0 = task->z < 0 ? 0 : task->z;
+    z1 = task->z < 0 ? var->dimlen[2] : task->z + 1;
+    for (z = z0; z < z1; z++) {
+        if (GT3_readVarZ(var, z) < 0)
+            return -1;
+        GT3_readVar(&x, var, 0, 0, z);
+        p->sum += x;
+    }
+
+    len = strlen(p->order);
+    if (len + 2 < sizeof p->order)
+        snprintf(p->order + len, sizeof p->order - len, "%c",
+                 'a' + task->chunk);
+    p->ntask++;
+    return 0;
+}
+
+
+static int
+test_merge(void *dest, void *src, void *arg)
+{
+    struct test_part *p = dest, *q = src;
+    size_t len;
+
+    len = strlen(p->order);
+    snprintf(p->order + len, sizeof p->order - len, "%s", q->order);
+    p->ntask += q->ntask;
+    p->sum += q->sum;
+    return 0;
+}
+
+
+static int
+test_emit(void *ptr, const struct cm_task *task, void *arg)
+{
+    struct test_part *p = ptr;
+    int *count = arg;
+
+    assert(p->ntask == 1);
+    assert(p->sum == 100. * task->chunk + task->z);
+    assert(task->final == (task->z == 2));
+    *count += 1;
+    return 0;
+}
+
+
+static int
+test_plan(chunkmap *cm, const GT3_File *fp, void *arg)
+{
+    int z;
+
+    for (z = 0; z < fp->dimlen[2]; z++)
+        if (chunkmap_add(cm, fp->curr, z) < 0)
+            return -1;
+    return 0;
+}
+
+
+/*
+ * masked files: the mask differs in each file.
+ */
+#define MASKED_NFILES 4
+#define MASKED_NELEM (6 * 4 * 3)
+
+static double
+masked_value(int n, int i)
+{
+    return (i % (3 + n) == n % 3) ? -999. : 10. * n + 0.25 * i;
+}
+
+
+static int
+test_map_masked(void *ptr, GT3_Varbuf *var, const struct cm_task *task,
+                void *local, void *arg)
+{
+    struct test_part *p = ptr;
+    double x;
+    int i, j, z;
+
+    for (z = 0; z < var->dimlen[2]; z++) {
+        if (GT3_readVarZ(var, z) < 0)
+            return -1;
+        for (j = 0; j < var->dimlen[1]; j++)
+            for (i = 0; i < var->dimlen[0]; i++) {
+                GT3_readVar(&x, var, i, j, z);
+                if (x != var->miss)
+                    p->sum += x;
+            }
+    }
+    p->ntask++;
+    return 0;
+}
+
+
+/*
+ * A worker reattaches its Varbuf to the same chunk (No. 0) of
+ * the files (MR4 and MRY16) with different masks.
+ */
+static void
+test_masked(int nth)
+{
+    struct chunkmap_ops ops;
+    struct test_part *result;
+    GT3_HEADER head;
+    double data[MASKED_NELEM], expect = 0.;
+    FILE *output;
+    chunkmap *cm;
+    char path[32];
+    int i, n;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    for (n = 0; n < MASKED_NFILES; n++) {
+        for (i = 0; i < MASKED_NELEM; i++) {
+            data[i] = masked_value(n, i);
+            if (data[i] != -999.)
+                expect += data[i];
+        }
+        snprintf(path, sizeof path, "chunkmap-mask%d.gt", n);
+        output = fopen(path, "wb");
+        assert(output);
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 6, 4, 3, &head,
+                         n < 2 ? "MR4" : "MRY16", output) == 0);
+        fclose(output);
+    }
+
+    memset(&ops, 0, sizeof ops);
+    ops.new_part = test_new_part;
+    ops.free_part = test_free_part;
+    ops.map = test_map_masked;
+    ops.merge = test_merge;
+
+    cm = new_chunkmap(&ops, NULL, nth);
+    assert(cm);
+    for (n = 0; n < MASKED_NFILES; n++) {
+        snprintf(path, sizeof path, "chunkmap-mask%d.gt", n);
+        assert(chunkmap_add_file(cm, path, NULL) == 0);
+    }
+    assert(chunkmap_reduce((void **)&result, cm) == 0);
+    assert(result->ntask == MASKED_NFILES);
+    assert(fabs(result->sum - expect) < 0.1);
+    free(result);
+    free_chunkmap(cm);
+
+    for (n = 0; n < MASKED_NFILES; n++) {
+        snprintf(path, sizeof path, "chunkmap-mask%d.gt", n);
+        remove(path);
+    }
+}
+
+
+int
+main(int argc, char **argv)
+{
+    struct chunkmap_ops ops;
+    struct test_part *result;
+    GT3_HEADER head;
+    double data[4 * 3];
+    FILE *output;
+    chunkmap *cm;
+    int i, n, nth, count;
+    char order[64];
+
+    GT3_initHeader(&head);
+    output = fopen(test_path, "wb");
+    assert(output);
+    for (n = 0; n < 26; n++) {
+        for (i = 0; i < 12; i++)
+            data[i] = 100. * n + i / 4;
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 2, 2, 3,
+                         &head, "UR8", output) == 0);
+    }
+    fclose(output);
+
+    memset(&ops, 0, sizeof ops);
+    ops.new_part = test_new_part;
+    ops.free_part = test_free_part;
+    ops.map = test_map;
+    ops.merge = test_merge;
+    ops.emit = test_emit;
+
+    for (i = 0; i < 26; i++)
+        order[i] = 'a' + i;
+    order[26] = '\0';
+
+    for (nth = 1; nth < 8; nth++) {
+        /* reduce (twice for the same file) */
+        ops.plan = NULL;
+        cm = new_chunkmap(&ops, NULL, nth);
+        assert(cm);
+        assert(chunkmap_add_file(cm, test_path, NULL) == 0);
+        assert(chunkmap_add_file(cm, test_path, NULL) == 0);
+        assert(chunkmap_reduce((void **)&result, cm) == 0);
+        assert(result->ntask == 52);
+        assert(strncmp(result->order, order, 26) == 0);
+        assert(strcmp(result->order + 26, order) == 0);
+        assert(result->sum == 2. * (26 * (100. * 25 / 2 * 3 + 3)));
+        free(result);
+        free_chunkmap(cm);
+
+        /* each */
+        ops.plan = test_plan;
+        count = 0;
+        cm = new_chunkmap(&ops, &count, nth);
+        assert(cm);
+        assert(chunkmap_add_file(cm, test_path, NULL) == 0);
+        assert(chunkmap_each(cm) == 0);
+        assert(count == 26 * 3);
+        free_chunkmap(cm);
+
+        test_masked(nth);
+
+        /* empty */
+        cm = new_chunkmap(&ops, NULL, nth);
+        assert(chunkmap_reduce((void **)&result, cm) == 0);
+        assert(result->ntask == 0);
+        free(result);
+        free_chunkmap(cm);
+    }
+
+    /* no such file */
+    cm = new_chunkmap(&ops, NULL, 2);
+    assert(chunkmap_add_file(cm, "chunkmap-none.gt", NULL) < 0);
+    free_chunkmap(cm);
+    GT3_clearLastError();
+
+    remove(test_path);
+    return 0;
+}
+#endif /* TEST_MAIN */
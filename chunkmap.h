@@ -0,0 +1,67 @@
+/*
+ * chunkmap.h -- parallel map-reduce over chunks.
+ */
+#ifndef CHUNKMAP__H
+#define CHUNKMAP__H
+
+#include "gtool3.h"
+#include "seq.h"
+
+/*
+ * A task is a z-plane of a chunk in a file (or the whole chunk if z < 0).
+ */
+struct cm_task {
+    int file;                   /* index of the file */
+    int chunk;                  /* 0-offset chunk No. */
+    int z;                      /* 0-offset z-plane (or -1) */
+    int final;                  /* the last task of the chunk */
+};
+
+/*
+ * Tasks are grouped into blocks of CHUNKMAP_BLOCK consecutive tasks,
+ * which are the unit of scheduling.
+ * In chunkmap_reduce(), each block is mapped into its own partial,
+ * and the partials are merged in the fixed order, so the result does
+ * not depend on the number of threads.
+ */
+#define CHUNKMAP_BLOCK 4
+
+typedef struct chunkmap chunkmap;
+
+struct chunkmap_ops {
+    /* opener of input files (GT3_open() if NULL) */
+    GT3_File *(*open)(const char *path);
+
+    /* adds tasks of the current chunk 'fp' (a whole-chunk task if NULL) */
+    int (*plan)(chunkmap *cm, const GT3_File *fp, void *arg);
+
+    /* an empty partial result */
+    void *(*new_part)(void *arg);
+    void (*free_part)(void *part, void *arg);
+
+    /* data of each thread (optional) */
+    int (*new_local)(void **local, void *arg);
+    void (*free_local)(void *local, void *arg);
+
+    /* accumulates a task into 'part'; 'var' is attached to the chunk */
+    int (*map)(void *part, GT3_Varbuf *var, const struct cm_task *task,
+               void *local, void *arg);
+
+    /* merges 'src' (later tasks) into 'dest' (in chunkmap_reduce()) */
+    int (*merge)(void *dest, void *src, void *arg);
+
+    /* consumes the partial of each task in order (in chunkmap_each()) */
+    int (*emit)(void *part, const struct cm_task *task, void *arg);
+};
+
+chunkmap *new_chunkmap(const struct chunkmap_ops *ops, void *arg,
+                       int nthreads);
+void free_chunkmap(chunkmap *cm);
+int chunkmap_add_file(chunkmap *cm, const char *path, struct sequence *seq);
+int chunkmap_add(chunkmap *cm, int chunk, int z);
+const char *chunkmap_path(const chunkmap *cm, int file);
+int chunkmap_reduce(void **result, chunkmap *cm);
+int chunkmap_each(chunkmap *cm);
+int get_nthreads(const char *str);
+
+#endif /* !CHUNKMAP__H */
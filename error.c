@@ -11,7 +11,22 @@
 
 #include "gtool3.h"
 
-static int err_count = 0;
+/*
+ * The error stack is thread-local, so that each thread can report
+ * (and get) its own errors without locking.
+ * Without thread-local storage, it is shared by all threads.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#  define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#  define THREAD_LOCAL __thread
+#else
+#  define THREAD_LOCAL
+#endif
+
+/*
+ * These flags are process-wide. Set them before starting threads.
+ */
 static int exit_on_err  = 0;    /* flag */
 static int print_on_err = 0;    /* flag */
 
@@ -23,10 +38,11 @@ static char *progname = NULL;
  */
 #define MSGBUF_LEN 256
 #define NUM_ESTACK 16
-static int err_sp = 0;
-static int err_code[NUM_ESTACK];
-static int my_errno[NUM_ESTACK];
-static char auxmsg[NUM_ESTACK][MSGBUF_LEN];
+static THREAD_LOCAL int err_count = 0;
+static THREAD_LOCAL int err_sp = 0;
+static THREAD_LOCAL int err_code[NUM_ESTACK];
+static THREAD_LOCAL int my_errno[NUM_ESTACK];
+static THREAD_LOCAL char auxmsg[NUM_ESTACK][MSGBUF_LEN];
 
 static const char *messages[] = {
     "No error",
@@ -178,6 +194,41 @@ gt3_error(int code, const char *fmt, ...)
 }
 
 
+/*
+ * copy_last_error() gets the last error (not popped) to pass it to
+ * another thread, where raise_error() pushes it again.
+ * raise_error() neither prints nor exits, since it has been done
+ * by gt3_error() in the original thread.
+ */
+int
+copy_last_error(int *errnum, char *aux, size_t auxlen)
+{
+    int sp;
+
+    if (err_count <= 0)
+        return 0;
+
+    sp = err_sp - 1;
+    if (sp < 0)
+        sp = NUM_ESTACK - 1;
+
+    *errnum = my_errno[sp];
+    snprintf(aux, auxlen, "%s", auxmsg[sp]);
+    return err_code[sp];
+}
+
+
+void
+raise_error(int code, int errnum, const char *aux)
+{
+    if (code > GT3_ERR_UNDEF || code <= 0)
+        code = GT3_ERR_UNDEF;
+
+    errno = errnum;
+    push_errcode(code, aux);
+}
+
+
 int
 GT3_ErrorCount(void)
 {
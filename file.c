@@ -5,6 +5,9 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 
 #include <assert.h>
 #include <stdio.h>
@@ -17,6 +20,13 @@
 
 #define CHNUM_UNKNOWN -1
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#  define USE_MMAP
+#endif
+
+/* the GTOOL3 header and its record separators */
+#define HEADER_RECORD_SIZE (GT3_HEADER_SIZE + 2 * sizeof(fort_size_t))
+
 
 static int
 get_dimsize(int dim[], const GT3_HEADER *hh)
@@ -76,19 +86,38 @@ chunk_size_urx(size_t nelem, size_t nz, unsigned nbit)
 
 
 /*
- * chunk size of MR4 or MR8.
+ * read two words next to the GTOOL3 header record of the chunk
+ * at 'off' (the first record of MR4, MR8, and MRY).
  *
- * FIXME: It is assumed that the current file position is next to
- * GTOOL3 header record.
+ * FIXME: If the file is not mapped, it is assumed that the current
+ * file position is next to GTOOL3 header record.
  */
-static size_t
-chunk_size_mask(size_t nelem, size_t size, GT3_File *fp)
+static void
+read_nnn(uint32_t num[], GT3_File *fp, off_t off)
 {
-    uint32_t num[] = {0, 0};    /* XXX: uint32_t, not size_t */
+    num[0] = num[1] = 0;
+
+    if (fp->map_) {
+        off += HEADER_RECORD_SIZE;
+        if (off + 8 <= fp->size)
+            memcpy(num, (const char *)fp->map_ + off, 8);
+    } else
+        fread(num, 4, 2, fp->fp);
 
-    fread(&num, 4, 2, fp->fp);
     if (IS_LITTLE_ENDIAN)
-        reverse_words(&num, 2);
+        reverse_words(num, 2);
+}
+
+
+/*
+ * chunk size of MR4 or MR8.
+ */
+static size_t
+chunk_size_mask(size_t nelem, size_t size, GT3_File *fp, off_t off)
+{
+    uint32_t num[2];            /* XXX: uint32_t, not size_t */
+
+    read_nnn(num, fp, off);
 
     return 8 * sizeof(fort_size_t) /* 4 records */
         + GT3_HEADER_SIZE       /* header */
@@ -100,18 +129,13 @@ chunk_size_mask(size_t nelem, size_t size, GT3_File *fp)
 
 /*
  * chunk size of MRY.
- *
- * FIXME: It is assumed that the current file position is next to
- * GTOOL3 header record.
  */
 static size_t
-chunk_size_maskx(size_t nelem, size_t nz, GT3_File *fp)
+chunk_size_maskx(size_t nelem, size_t nz, GT3_File *fp, off_t off)
 {
-    uint32_t num[] = {0, 0};    /* XXX: uint32_t, not size_t */
+    uint32_t num[2];            /* XXX: uint32_t, not size_t */
 
-    fread(&num, 4, 2, fp->fp);
-    if (IS_LITTLE_ENDIAN)
-        reverse_words(&num, 2);
+    read_nnn(num, fp, off);
 
     return 14 * sizeof(fort_size_t)  /* 7 records */
         + GT3_HEADER_SIZE       /* header */
@@ -124,12 +148,31 @@ chunk_size_maskx(size_t nelem, size_t nz, GT3_File *fp)
 }
 
 
+/*
+ * chunk size of ZR4 or ZR8.
+ */
+static size_t
+chunk_size_zr(size_t nz, GT3_File *fp, off_t off)
+{
+    uint32_t num[2];            /* XXX: uint32_t, not size_t */
+
+    read_nnn(num, fp, off);
+
+    return 8 * sizeof(fort_size_t) /* 4 records */
+        + GT3_HEADER_SIZE       /* header */
+        + 4                     /* NNN */
+        + 4 * nz                /* IZLEN */
+        + 4 * num[1];           /* body */
+}
+
+
 /*
  * chunk_size() returns a current chunk-size.
  * The chunk comprises the gtool3-header and the data-body.
+ * 'off' is the position of the chunk.
  */
 static size_t
-chunk_size(GT3_File *fp)
+chunk_size(GT3_File *fp, off_t off)
 {
     int fmt;
     size_t nxy, nz, siz = 0;
@@ -158,16 +201,21 @@ chunk_size(GT3_File *fp)
         break;
 
     case GT3_FMT_MR4:
-        siz = chunk_size_mask(nxy * nz, 4, fp);
+        siz = chunk_size_mask(nxy * nz, 4, fp, off);
         break;
 
     case GT3_FMT_MR8:
-        siz = chunk_size_mask(nxy * nz, 8, fp);
+        siz = chunk_size_mask(nxy * nz, 8, fp, off);
         break;
 
     case GT3_FMT_MRX:
     case GT3_FMT_MRY:
-        siz = chunk_size_maskx(nxy, nz, fp);
+        siz = chunk_size_maskx(nxy, nz, fp, off);
+        break;
+
+    case GT3_FMT_ZR4:
+    case GT3_FMT_ZR8:
+        siz = chunk_size_zr(nz, fp, off);
         break;
 
     default:
@@ -181,9 +229,10 @@ chunk_size(GT3_File *fp)
 
 /*
  * Updates GT3_File with a header (when going into a new chunk).
+ * 'off' is the position of the new chunk.
  */
 static int
-update(GT3_File *fp, const GT3_HEADER *headp)
+update(GT3_File *fp, const GT3_HEADER *headp, off_t off)
 {
     char dfmt[8];
     int dim[3];
@@ -213,19 +262,29 @@ update(GT3_File *fp, const GT3_HEADER *headp)
     fp->dimlen[0] = dim[0];
     fp->dimlen[1] = dim[1];
     fp->dimlen[2] = dim[2];
-    fp->chsize = chunk_size(fp); /* XXX */
+    fp->chsize = chunk_size(fp, off); /* XXX */
 
     return 0;
 }
 
 
+/*
+ * activate() reopens 'fp' if it is pooled and has been closed.
+ */
+static int
+activate(GT3_File *fp)
+{
+    return (fp->pool_ && file_stream(fp) == NULL) ? -1 : 0;
+}
+
+
 static int
 seekhist(GT3_File *fp, int ch)
 {
     off_t nextoff = ch;
 
     nextoff *= fp->chsize;
-    if (fseeko(fp->fp, nextoff, SEEK_SET) < 0) {
+    if (!fp->map_ && fseeko(fp->fp, nextoff, SEEK_SET) < 0) {
         gt3_error(SYSERR, NULL);
         return -1;
     }
@@ -236,15 +295,45 @@ seekhist(GT3_File *fp, int ch)
 }
 
 
+/*
+ * seek to the chunk 'ch' by using the chunk index.
+ */
 static int
-read_header(GT3_HEADER *header, FILE *fp)
+seekindex(GT3_File *fp, int ch)
+{
+    const chunk_index *idx = fp->index_;
+    const chunk_entry *ent;
+    int i;
+
+    /* at EOF, the last chunk remains as the current. */
+    i = (ch < idx->num) ? ch : idx->num - 1;
+    ent = idx->entry + i;
+
+    fp->fmt = ent->fmt;
+    fp->dimlen[0] = ent->dimlen[0];
+    fp->dimlen[1] = ent->dimlen[1];
+    fp->dimlen[2] = ent->dimlen[2];
+    fp->chsize = chunk_index_size(idx, i, fp->size);
+    fp->curr = ch;
+    fp->off = (ch < idx->num) ? ent->off : fp->size;
+
+    if (!fp->map_ && fseeko(fp->fp, fp->off, SEEK_SET) < 0) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * decode the header record (HEADER_RECORD_SIZE bytes) in 'temp'.
+ */
+static int
+decode_header(GT3_HEADER *header, const char *temp)
 {
     const char *magic = "            9010";
-    char temp[GT3_HEADER_SIZE + 2 * sizeof(fort_size_t)];
-    size_t siz;
 
-    if ((siz = fread(temp, 1, sizeof temp, fp)) != sizeof temp
-        || temp[0]    != 0 || temp[1]    != 0
+    if (   temp[0]    != 0 || temp[1]    != 0
         || temp[2]    != 4 || temp[3]    != 0
         || temp[1028] != 0 || temp[1029] != 0
         || temp[1030] != 4 || temp[1031] != 0
@@ -258,6 +347,63 @@ read_header(GT3_HEADER *header, FILE *fp)
 }
 
 
+static int
+read_header(GT3_HEADER *header, FILE *fp)
+{
+    char temp[HEADER_RECORD_SIZE];
+
+    if (fread(temp, 1, sizeof temp, fp) != sizeof temp)
+        return -1;
+
+    return decode_header(header, temp);
+}
+
+
+/*
+ * read the header of a chunk at 'off' from the mapped image.
+ */
+static int
+read_header_mapped(GT3_HEADER *header, const GT3_File *fp, off_t off)
+{
+    if (off < 0 || off + HEADER_RECORD_SIZE > fp->size)
+        return -1;
+
+    return decode_header(header, (const char *)fp->map_ + off);
+}
+
+
+/*
+ * mapped_range() returns the address of 'len' bytes at 'off'
+ * in the mapped image (NULL if out of the file).
+ */
+const void *
+mapped_range(off_t off, size_t len, const GT3_File *fp)
+{
+    assert(fp->map_);
+
+    if (off < 0 || off + len > fp->size) {
+        gt3_error(GT3_ERR_BROKEN, "Unexpected EOF");
+        return NULL;
+    }
+    return (const char *)fp->map_ + off;
+}
+
+
+/*
+ * copy_mapped() copies 'len' bytes at 'off' from the mapped image.
+ */
+int
+copy_mapped(void *ptr, size_t len, off_t off, const GT3_File *fp)
+{
+    const void *src;
+
+    if ((src = mapped_range(off, len, fp)) == NULL)
+        return -1;
+    memcpy(ptr, src, len);
+    return 0;
+}
+
+
 /*
  * offset of each z-slice indexed 'zpos'.
  */
@@ -295,6 +441,11 @@ zslice_offset(GT3_File *fp, int zpos)
         off += 4 * pack32_len(nelem * fp->dimlen[2], 1)
             + 2 * sizeof(fort_size_t);
         break;
+    case GT3_FMT_ZR4:
+    case GT3_FMT_ZR8:
+        off += 4 + 2 * sizeof(fort_size_t);
+        off += 4 * fp->dimlen[2] + 2 * sizeof(fort_size_t);
+        break;
     default:
         assert(!"Unknown format");
     }
@@ -305,6 +456,16 @@ zslice_offset(GT3_File *fp, int zpos)
 int
 GT3_readHeader(GT3_HEADER *header, GT3_File *fp)
 {
+    if (fp->map_) {
+        if (read_header_mapped(header, fp, fp->off) < 0) {
+            gt3_error(GT3_ERR_BROKEN, fp->path);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (activate(fp) < 0)
+        return -1;
     if (fseeko(fp->fp, fp->off, SEEK_SET) < 0) {
         gt3_error(SYSERR, fp->path);
         return -1;
@@ -335,6 +496,8 @@ GT3_format(const char *str)
         { "UR8",  GT3_FMT_UR8   },
         { "MR4",  GT3_FMT_MR4   },
         { "MR8",  GT3_FMT_MR8   },
+        { "ZR4",  GT3_FMT_ZR4   },
+        { "ZR8",  GT3_FMT_ZR8   },
     };
     struct { const char *key; int val; } ftab2[] = {
         { "URX",  GT3_FMT_URX   },
@@ -380,7 +543,9 @@ GT3_format_string(char *str, int fmt)
         { GT3_FMT_MR8,  "MR8"  },
         { GT3_FMT_MRX,  "MRX"  },
         { GT3_FMT_URY,  "URY"  },
-        { GT3_FMT_MRY,  "MRY"  }
+        { GT3_FMT_MRY,  "MRY"  },
+        { GT3_FMT_ZR4,  "ZR4"  },
+        { GT3_FMT_ZR8,  "ZR8"  }
     };
     int i;
     unsigned nbits;
@@ -410,14 +575,23 @@ GT3_format_string(char *str, int fmt)
 
 
 /*
- * This operation might take some time.
+ * This operation might take some time (unless the file is indexed).
  */
 int
 GT3_countChunk(const char *path)
 {
     GT3_File *fp;
+    file_stat_t sb;
+    chunk_index *idx;
     int cnt, err = 0;
 
+    if (file_stat(path, &sb) == 0
+        && (idx = load_chunk_index(path, &sb)) != NULL) {
+        cnt = idx->num;
+        free_chunk_index(idx);
+        return cnt;
+    }
+
     if ((fp = GT3_open(path)) == NULL)
         return -1;
 
@@ -471,10 +645,19 @@ open_gt3file(const char *path, const char *mode)
     gp->off = 0;
     gp->num_chunk = CHNUM_UNKNOWN;
     gp->mask = NULL;
+    gp->map_ = NULL;
+    gp->index_ = NULL;
+    gp->pool_ = NULL;
 
-    if (update(gp, &head) < 0)
+    if (update(gp, &head, 0) < 0)
         goto error;
 
+    /*
+     * use the chunk index if it is up-to-date.
+     */
+    if ((gp->index_ = load_chunk_index(path, &sb)) != NULL)
+        gp->num_chunk = ((chunk_index *)gp->index_)->num;
+
     return gp;
 
 error:
@@ -504,19 +687,14 @@ GT3_openRW(const char *path)
 
 
 /*
- * GT3_openHistFile() opens a GTOOL3 file as well as GT3_open().
- * In addition, this checks whether all the chunks have the same size.
- * If so, seeking file will become very fast.
+ * check whether all the chunks have the same size.
  */
-GT3_File *
-GT3_openHistFile(const char *path)
+static int
+check_histfile(GT3_File *fp)
 {
-    GT3_File *fp;
     GT3_HEADER head;
     off_t pos;
-
-    if ((fp = GT3_open(path)) == NULL)
-        return NULL;
+    int rval;
 
     if (fp->size % fp->chsize == 0) {
         /*
@@ -524,16 +702,85 @@ GT3_openHistFile(const char *path)
          */
         pos = fp->chsize * (fp->size / fp->chsize - 1);
 
-        if (fseeko(fp->fp, pos, SEEK_SET) == 0
-            && read_header(&head, fp->fp) == 0) {
+        if (fp->map_)
+            rval = read_header_mapped(&head, fp, pos);
+        else
+            rval = (fseeko(fp->fp, pos, SEEK_SET) == 0)
+                ? read_header(&head, fp->fp)
+                : -1;
+
+        if (rval == 0) {
             fp->mode |= GT3_CONST_CHUNK_SIZE;
             fp->num_chunk = fp->size / fp->chsize;
         }
 
-        if (GT3_rewind(fp) < 0) {
-            GT3_close(fp);
-            return NULL;
-        }
+        if (GT3_rewind(fp) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * GT3_openHistFile() opens a GTOOL3 file as well as GT3_open().
+ * In addition, this checks whether all the chunks have the same size.
+ * If so, seeking file will become very fast.
+ */
+GT3_File *
+GT3_openHistFile(const char *path)
+{
+    GT3_File *fp;
+
+    if ((fp = GT3_open(path)) == NULL)
+        return NULL;
+
+    if (check_histfile(fp) < 0) {
+        GT3_close(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+
+/*
+ * GT3_openMapped() opens a GTOOL3 file as well as GT3_openHistFile(),
+ * and maps the whole file into memory (read-only).
+ *
+ * The headers and data are read directly from the mapped image
+ * (no fseeko/fread).
+ * If mmap(2) is unavailable, this is equivalent to GT3_openHistFile().
+ */
+GT3_File *
+GT3_openMapped(const char *path)
+{
+    GT3_File *fp;
+#ifdef USE_MMAP
+    void *map;
+#endif
+
+    if ((fp = GT3_open(path)) == NULL)
+        return NULL;
+
+#ifdef USE_MMAP
+    if ((off_t)(size_t)fp->size != fp->size) {
+        gt3_error(GT3_ERR_TOOLONG, "%s: Cannot be mapped", path);
+        GT3_close(fp);
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)fp->size, PROT_READ, MAP_SHARED,
+               fileno(fp->fp), 0);
+    if (map == MAP_FAILED) {
+        gt3_error(SYSERR, path);
+        GT3_close(fp);
+        return NULL;
+    }
+    fp->map_ = map;
+    fp->mode |= GT3_FILE_MAPPED;
+#endif
+
+    if (check_histfile(fp) < 0) {
+        GT3_close(fp);
+        return NULL;
     }
     return fp;
 }
@@ -564,8 +811,10 @@ GT3_next(GT3_File *fp)
         gt3_error(GT3_ERR_BROKEN, "%s", fp->path);
         return -1;
     }
+    if (!fp->map_ && activate(fp) < 0)
+        return -1;
 
-    if (fseeko(fp->fp, nextoff, SEEK_SET) < 0) {
+    if (!fp->map_ && fseeko(fp->fp, nextoff, SEEK_SET) < 0) {
         gt3_error(SYSERR, NULL);
         return -1;
     }
@@ -575,10 +824,12 @@ GT3_next(GT3_File *fp)
      */
     broken = 0;
     if (nextoff < fp->size) { /* not EOF yet */
-        if (read_header(&head, fp->fp) < 0) {
+        if ((fp->map_
+             ? read_header_mapped(&head, fp, nextoff)
+             : read_header(&head, fp->fp)) < 0) {
             gt3_error(GT3_ERR_BROKEN, fp->path);
             broken = 1;
-        } else if (update(fp, &head) < 0)
+        } else if (update(fp, &head, nextoff) < 0)
             broken = 1;
         else if (nextoff + fp->chsize > fp->size) {
             gt3_error(GT3_ERR_BROKEN, "unexpected EOF(%s)", fp->path);
@@ -613,11 +864,17 @@ void
 GT3_close(GT3_File *fp)
 {
     if (fp) {
+        release_pooled(fp);
         if (fp->mask)
             GT3_freeMask(fp->mask);
         free(fp->mask);
+#ifdef USE_MMAP
+        if (fp->map_)
+            munmap(fp->map_, (size_t)fp->size);
+#endif
         if (fp->fp)
             fclose(fp->fp);
+        free_chunk_index(fp->index_);
         free(fp->path);
         free(fp);
     }
@@ -629,13 +886,18 @@ GT3_rewind(GT3_File *fp)
 {
     GT3_HEADER head;
 
-    if (fseeko(fp->fp, 0, SEEK_SET) < 0) {
-        gt3_error(SYSERR, NULL);
-        return -1;
+    if (fp->map_)
+        read_header_mapped(&head, fp, 0);
+    else {
+        if (activate(fp) < 0)
+            return -1;
+        if (fseeko(fp->fp, 0, SEEK_SET) < 0) {
+            gt3_error(SYSERR, NULL);
+            return -1;
+        }
+        read_header(&head, fp->fp);
     }
-
-    read_header(&head, fp->fp);
-    update(fp, &head);
+    update(fp, &head, 0);
     fp->curr = 0;
     fp->off  = 0;
     return 0;
@@ -679,9 +941,15 @@ GT3_seek(GT3_File *fp, int dest, int whence)
         return -1;
     }
 
+    if (!fp->map_ && activate(fp) < 0)
+        return -1;
+
     if (GT3_isHistfile(fp))
         return seekhist(fp, dest);
 
+    if (fp->index_)
+        return seekindex(fp, dest);
+
     if (dest < fp->curr && GT3_rewind(fp) < 0) /* backward */
         return -1;
 
@@ -694,7 +962,7 @@ GT3_seek(GT3_File *fp, int dest, int whence)
         return -1;
     }
 
-    if (fseeko(fp->fp, fp->off, SEEK_SET) < 0) {
+    if (!fp->map_ && fseeko(fp->fp, fp->off, SEEK_SET) < 0) {
         gt3_error(SYSERR, NULL);
         return -1;
     }
@@ -713,6 +981,8 @@ GT3_skipZ(GT3_File *fp, int z)
     }
 
     off = fp->off + zslice_offset(fp, z);
+    if (activate(fp) < 0)
+        return -1;
     if (fseeko(fp->fp, off, SEEK_SET) < 0) {
         gt3_error(SYSERR, NULL);
         return -1;
@@ -728,6 +998,9 @@ GT3_skipZ(GT3_File *fp, int z)
 int
 GT3_suspend(GT3_File *fp)
 {
+    if (fp->pool_)
+        return suspend_pooled(fp);
+
     if (fp->fp && fclose(fp->fp) < 0) {
         gt3_error(SYSERR, fp->path);
         return -1;
@@ -753,6 +1026,8 @@ GT3_resume(GT3_File *fp)
         gt3_error(GT3_ERR_CALL, "GT3_resume(): Broken GT3_File");
         return -1;
     }
+    if (fp->pool_)
+        return activate(fp);
 
     mode = (fp->mode & GT3_FILE_WRITABLE) ? "r+b" :  "rb";
     if ((fp->fp = fopen(fp->path, mode)) == NULL) {
@@ -764,6 +1039,77 @@ GT3_resume(GT3_File *fp)
 
 
 #ifdef TEST_MAIN
+/*
+ * GT3_openMapped() reads the same headers and data as GT3_open().
+ */
+static void
+test_mapped(void)
+{
+    const char *path = "file-test.gt";
+    const char *fmts[] = { "UR4", "UR8", "MR4", "URY16", "MRY16", "ZR4" };
+    double data[17 * 5 * 3], v1, v2;
+    GT3_HEADER head, head2;
+    GT3_File *fp, *mfp;
+    GT3_Varbuf *var, *mvar;
+    FILE *output;
+    int i, n, x, y, z;
+
+    for (i = 0; i < 17 * 5 * 3; i++)
+        data[i] = (i % 7 == 3) ? -999. : 250. + 0.1 * (i % 17) - 1e-3 * i;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    for (n = 0; n < sizeof fmts / sizeof fmts[0]; n++)
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 17, 5, 3,
+                         &head, fmts[n], output) == 0);
+    fclose(output);
+
+    fp = GT3_open(path);
+    mfp = GT3_openMapped(path);
+    assert(fp && mfp);
+#ifdef USE_MMAP
+    assert(mfp->map_ != NULL && (mfp->mode & GT3_FILE_MAPPED));
+#endif
+    var = GT3_getVarbuf(fp);
+    mvar = GT3_getVarbuf(mfp);
+    assert(var && mvar);
+
+    /* backward, so that GT3_seek() is also tested. */
+    for (n = sizeof fmts / sizeof fmts[0] - 1; n >= 0; n--) {
+        assert(GT3_seek(fp, n, SEEK_SET) == 0);
+        assert(GT3_seek(mfp, n, SEEK_SET) == 0);
+        assert(mfp->fmt == fp->fmt && mfp->off == fp->off);
+        assert(GT3_readHeader(&head, fp) == 0);
+        assert(GT3_readHeader(&head2, mfp) == 0);
+        assert(memcmp(&head, &head2, sizeof head) == 0);
+
+        for (z = 0; z < 3; z++) {
+            assert(GT3_readVarZ(var, z) == 0);
+            assert(GT3_readVarZ(mvar, z) == 0);
+            for (y = 0; y < 5; y++)
+                for (x = 0; x < 17; x++) {
+                    assert(GT3_readVar(&v1, var, x, y, z) == 0);
+                    assert(GT3_readVar(&v2, mvar, x, y, z) == 0);
+                    assert(v1 == v2);
+                    if (n < 3 || n == 5)
+                        assert((float)v2
+                               == (float)data[x + 17 * (y + 5 * z)]);
+                }
+        }
+    }
+    assert(GT3_seek(mfp, sizeof fmts / sizeof fmts[0] - 1, SEEK_SET) == 0);
+    assert(GT3_next(mfp) == 0 && GT3_eof(mfp));
+
+    GT3_freeVarbuf(var);
+    GT3_freeVarbuf(mvar);
+    GT3_close(fp);
+    GT3_close(mfp);
+    remove(path);
+}
+
+
 int
 main(int argc, char **argv)
 {
@@ -792,6 +1138,8 @@ main(int argc, char **argv)
     printf("sizeof(size_t): %d\n", sizeof(size_t));
     if (sizeof sb.st_size != 8 || sizeof(off_t) != 8)
         printf("Waring: cannot support a LARGEFILE?");
+
+    test_mapped();
     return 0;
 }
 #endif
@@ -0,0 +1,460 @@
+/*
+ * fpool.c -- a pool of file descriptors for GT3_File.
+ *
+ * A pooled GT3_File holds its FILE only while it is among the most
+ * recently used ones; the others are closed, and reopened transparently
+ * when they are accessed again.
+ *
+ * The pool is guarded by a mutex, and a file being read by xpread()
+ * is not closed, so that Varbufs can read pooled files concurrently.
+ */
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_LIBPTHREAD
+#  include <pthread.h>
+#endif
+#ifdef HAVE_SYS_RESOURCE_H
+#  include <sys/resource.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#include "gtool3.h"
+
+/* # of descriptors left for the others (outputs, axis-files, ...) */
+#define POOL_RESERVED 16
+#define POOL_LIMIT_MAX 4096
+
+typedef struct pool_entry pool_entry;
+struct pool_entry {
+    GT3_File *owner;            /* fp->fp is the descriptor (or NULL) */
+    pool_entry *prev, *next;    /* in the LRU list (if opened) */
+    int busy;                   /* # of reads in progress */
+};
+
+static int pool_limit = 0;      /* 0: not determined yet */
+static int pool_num = 0;        /* # of opened entries */
+static pool_entry *pool_head = NULL; /* most recently used */
+static pool_entry *pool_tail = NULL; /* least recently used */
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+static void
+lock_pool(void)
+{
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_lock(&pool_lock);
+#endif
+}
+
+
+static void
+unlock_pool(void)
+{
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_unlock(&pool_lock);
+#endif
+}
+
+
+static int
+default_limit(void)
+{
+    long nmax = 64;
+
+#if defined(HAVE_GETRLIMIT) && defined(HAVE_SYS_RESOURCE_H)
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        nmax = (long)rl.rlim_cur;
+    else
+        nmax = POOL_LIMIT_MAX;
+#elif defined(HAVE_SYSCONF)
+    nmax = sysconf(_SC_OPEN_MAX);
+#endif
+
+    nmax -= POOL_RESERVED;
+    if (nmax > POOL_LIMIT_MAX)
+        nmax = POOL_LIMIT_MAX;
+    if (nmax < 1)
+        nmax = 1;
+    return (int)nmax;
+}
+
+
+static void
+unlink_entry(pool_entry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        pool_head = e->next;
+
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        pool_tail = e->prev;
+
+    e->prev = e->next = NULL;
+}
+
+
+static void
+push_entry(pool_entry *e)
+{
+    e->prev = NULL;
+    e->next = pool_head;
+    if (pool_head)
+        pool_head->prev = e;
+    else
+        pool_tail = e;
+    pool_head = e;
+}
+
+
+static int
+close_entry(pool_entry *e)
+{
+    int rval = 0;
+
+    if (e->owner->fp == NULL)
+        return 0;
+
+    unlink_entry(e);
+    pool_num--;
+    if (fclose(e->owner->fp) < 0) {
+        gt3_error(SYSERR, e->owner->path);
+        rval = -1;
+    }
+    e->owner->fp = NULL;
+    return rval;
+}
+
+
+/*
+ * close the least recently used ones to leave room for 'nopen' files.
+ * The files being read are skipped (the limit can be exceeded
+ * temporarily).
+ */
+static int
+evict(int nopen)
+{
+    pool_entry *e = pool_tail, *prev;
+    int rval = 0;
+
+    if (pool_limit == 0)
+        pool_limit = default_limit();
+
+    while (e && pool_num + nopen > pool_limit) {
+        prev = e->prev;
+        if (e->busy == 0 && close_entry(e) < 0)
+            rval = -1;
+        e = prev;
+    }
+    return rval;
+}
+
+
+static int
+open_entry(pool_entry *e)
+{
+    GT3_File *fp = e->owner;
+    const char *mode;
+
+    if (evict(1) < 0)
+        return -1;
+
+    mode = (fp->mode & GT3_FILE_WRITABLE) ? "r+b" : "rb";
+    if ((fp->fp = fopen(fp->path, mode)) == NULL) {
+        gt3_error(SYSERR, fp->path);
+        return -1;
+    }
+    push_entry(e);
+    pool_num++;
+    return 0;
+}
+
+
+/*
+ * file_stream() returns the FILE of 'fp', which is reopened if 'fp'
+ * is pooled and has been closed.  NULL is returned (with an error) if
+ * 'fp' is not pooled and is suspended (GT3_suspend()).
+ * 'fp' can be a copy of a GT3_File (a Varbuf's one), which shares
+ * the pool entry with the original.
+ */
+static FILE *
+use_entry(pool_entry *e)
+{
+    if (e->owner->fp == NULL) {
+        if (open_entry(e) < 0)
+            return NULL;
+    } else if (e != pool_head) {
+        unlink_entry(e);
+        push_entry(e);
+    }
+    return e->owner->fp;
+}
+
+
+FILE *
+file_stream(const GT3_File *fp)
+{
+    pool_entry *e = fp->pool_;
+    FILE *stream;
+
+    if (e == NULL) {
+        if (fp->fp == NULL)
+            gt3_error(GT3_ERR_CALL, "%s: Suspended", fp->path);
+        return fp->fp;
+    }
+
+    lock_pool();
+    stream = use_entry(e);
+    unlock_pool();
+    return stream;
+}
+
+
+/*
+ * acquire_stream() is file_stream() for a read (by xpread()), during
+ * which the FILE is not closed by the other threads.
+ * release_stream() must be called after the read.
+ */
+FILE *
+acquire_stream(const GT3_File *fp)
+{
+    pool_entry *e = fp->pool_;
+    FILE *stream;
+
+    if (e == NULL)
+        return file_stream(fp);
+
+    lock_pool();
+    if ((stream = use_entry(e)) != NULL)
+        e->busy++;
+    unlock_pool();
+    return stream;
+}
+
+
+void
+release_stream(const GT3_File *fp)
+{
+    pool_entry *e = fp->pool_;
+
+    if (e) {
+        lock_pool();
+        e->busy--;
+        unlock_pool();
+    }
+}
+
+
+/*
+ * suspend_pooled() closes the FILE of a pooled 'fp' (GT3_suspend()).
+ */
+int
+suspend_pooled(GT3_File *fp)
+{
+    int rval;
+
+    lock_pool();
+    rval = close_entry(fp->pool_);
+    unlock_pool();
+    return rval;
+}
+
+
+/*
+ * release_pooled() takes 'fp' out of the pool (GT3_close()).
+ * The FILE, if opened, is left to the caller.
+ */
+void
+release_pooled(GT3_File *fp)
+{
+    pool_entry *e = fp->pool_;
+
+    if (e) {
+        lock_pool();
+        if (fp->fp) {
+            unlink_entry(e);
+            pool_num--;
+        }
+        unlock_pool();
+        free(e);
+        fp->pool_ = NULL;
+    }
+}
+
+
+/*
+ * GT3_setFileLimit() sets the max. number of files opened in the pool.
+ * If 'limit' <= 0, it is determined from RLIMIT_NOFILE.
+ * The least recently used files are closed if they exceed the limit.
+ * This returns the new limit.
+ */
+int
+GT3_setFileLimit(int limit)
+{
+    lock_pool();
+    pool_limit = (limit > 0) ? limit : default_limit();
+    evict(0);
+    limit = pool_limit;
+    unlock_pool();
+    return limit;
+}
+
+
+/*
+ * GT3_poolFile() puts 'fp' into the pool.
+ *
+ * Then, 'fp' is closed when other pooled files are used, and it is
+ * reopened on demand: there is no need to call GT3_suspend() and
+ * GT3_resume() to handle many input files.
+ */
+int
+GT3_poolFile(GT3_File *fp)
+{
+    pool_entry *e;
+    int rval = 0;
+
+    if (fp->pool_)
+        return 0;
+
+    if ((e = malloc(sizeof(pool_entry))) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
+    e->owner = fp;
+    e->prev = e->next = NULL;
+    e->busy = 0;
+    fp->pool_ = e;
+
+    if (fp->fp) {
+        lock_pool();
+        push_entry(e);
+        pool_num++;
+        rval = evict(0);
+        unlock_pool();
+    }
+    return rval;
+}
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+#include <math.h>
+
+#define NFILES 7
+
+static int
+num_opened(GT3_File **fp, int num)
+{
+    int i, cnt = 0;
+
+    for (i = 0; i < num; i++)
+        if (fp[i]->fp)
+            cnt++;
+    return cnt;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    GT3_File *fp[NFILES];
+    GT3_Varbuf *var[NFILES];
+    GT3_HEADER head;
+    FILE *output;
+    double data[12], x;
+    char path[32];
+    int i, j, n;
+
+    GT3_initHeader(&head);
+    for (i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof path, "fpool-test%d.gt", i);
+        output = fopen(path, "wb");
+        assert(output);
+        for (n = 0; n < 3; n++) {
+            for (j = 0; j < 12; j++)
+                data[j] = 100. * i + 10. * n + j;
+            assert(GT3_write(data, GT3_TYPE_DOUBLE, 3, 2, 2,
+                             &head, n == 1 ? "URY16" : "UR8", output) == 0);
+        }
+        fclose(output);
+    }
+
+    assert(GT3_setFileLimit(3) == 3);
+    for (i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof path, "fpool-test%d.gt", i);
+        fp[i] = GT3_open(path);
+        assert(fp[i]);
+        assert(GT3_poolFile(fp[i]) == 0);
+        assert(GT3_poolFile(fp[i]) == 0);
+        assert(num_opened(fp, i + 1) == (i < 3 ? i + 1 : 3));
+
+        var[i] = GT3_getVarbuf(fp[i]);
+        assert(var[i]);
+    }
+
+    /* the 4 least recently used are closed. */
+    for (i = 0; i < NFILES - 3; i++)
+        assert(fp[i]->fp == NULL);
+
+    for (n = 0; n < 3; n++)
+        for (i = 0; i < NFILES; i++) {
+            if (n > 0)
+                assert(GT3_next(fp[i]) == 0);
+            assert(GT3_readVarZ(var[i], 0) == 0);
+            assert(GT3_readVar(&x, var[i], 2, 1, 0) == 0);
+            assert(fabs(x - (100. * i + 10. * n + 5.)) < 0.01);
+            assert(fp[i]->fp != NULL);
+            assert(num_opened(fp, NFILES) == 3);
+        }
+
+    /* reading by a Varbuf (with a copy of GT3_File) reopens the file. */
+    assert(fp[0]->fp == NULL);
+    assert(GT3_readVarZ(var[0], 1) == 0);
+    assert(GT3_readVar(&x, var[0], 2, 1, 1) == 0);
+    assert(fabs(x - 31.) < 0.01);
+    assert(fp[0]->fp != NULL);
+    assert(num_opened(fp, NFILES) == 3);
+
+    /* GT3_suspend() and GT3_resume() still work. */
+    assert(GT3_suspend(fp[0]) == 0);
+    assert(fp[0]->fp == NULL && num_opened(fp, NFILES) == 2);
+    assert(GT3_resume(fp[0]) == 0);
+    assert(GT3_resume(fp[0]) < 0);
+    GT3_clearLastError();
+    assert(GT3_rewind(fp[1]) == 0);
+    assert(fp[1]->fp != NULL && num_opened(fp, NFILES) == 3);
+
+    assert(GT3_setFileLimit(1) == 1);
+    assert(num_opened(fp, NFILES) == 1 && fp[1]->fp != NULL);
+
+    for (i = 0; i < NFILES; i++) {
+        assert(GT3_seek(fp[i], 1, SEEK_SET) == 0);
+        assert(GT3_readVarZ(var[i], 0) == 0);
+        assert(GT3_readVar(&x, var[i], 0, 0, 0) == 0);
+        assert(fabs(x - (100. * i + 10.)) < 0.01);
+    }
+
+    for (i = 0; i < NFILES; i++) {
+        GT3_freeVarbuf(var[i]);
+        GT3_close(fp[i]);
+    }
+    assert(pool_num == 0 && pool_head == NULL && pool_tail == NULL);
+
+    for (i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof path, "fpool-test%d.gt", i);
+        remove(path);
+    }
+    return 0;
+}
+#endif /* TEST_MAIN */
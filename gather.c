@@ -0,0 +1,331 @@
+/*
+ * gather.c -- gather values at given points from successive chunks
+ *             (e.g., time series at stations).
+ */
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gtool3.h"
+
+
+/*
+ * index of the point 'p' (x, y, z) in a chunk.
+ */
+static size_t
+point_index(const int *p, const GT3_File *fp)
+{
+    return p[0]
+        + (size_t)fp->dimlen[0] * (p[1] + (size_t)fp->dimlen[1] * p[2]);
+}
+
+
+/*
+ * UR4 (size == 4) or UR8 (size == 8).
+ */
+static int
+gather_URn(double *outp, const int *pts, int npts, size_t size,
+           GT3_File *fp)
+{
+    off_t body;
+    size_t idx;
+    float vf;
+    double vd;
+    int i;
+
+    body = fp->off + GT3_HEADER_SIZE + 3 * sizeof(fort_size_t);
+    for (i = 0; i < npts; i++) {
+        idx = point_index(pts + 3 * i, fp);
+
+        if (size == 4) {
+            if (xpread_words(&vf, 1, body + 4 * idx, fp) < 0)
+                return -1;
+            outp[i] = vf;
+        } else {
+            if (xpread_dwords(&vd, 1, body + 8 * idx, fp) < 0)
+                return -1;
+            outp[i] = vd;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * MR4 (size == 4) or MR8 (size == 8).
+ * The position of each point in the data-body is the number of
+ * MASK-ON elements before it.
+ */
+static int
+gather_MRn(double *outp, const int *pts, int npts, size_t size,
+           double miss, GT3_File *fp)
+{
+    GT3_Datamask *mask;
+    off_t body;
+    size_t idx, rank;
+    float vf;
+    double vd;
+    int i;
+
+    mask = fp->mask;
+    if (!mask && (mask = GT3_newMask()) == NULL)
+        return -1;
+    if (GT3_loadMask(mask, fp) != 0)
+        return -1;
+    fp->mask = mask;
+
+    if (GT3_updateMaskIndex(mask, fp->dimlen[0]) < 0)
+        return -1;
+
+    body = fp->off + 7 * sizeof(fort_size_t)
+        + GT3_HEADER_SIZE       /* header */
+        + 4                     /* NNN */
+        + 4 * ((mask->nelem + 31) / 32); /* MASK */
+
+    for (i = 0; i < npts; i++) {
+        idx = point_index(pts + 3 * i, fp);
+
+        if (!getMaskValue(mask, idx)) {
+            outp[i] = miss;
+            continue;
+        }
+
+        rank = GT3_getMaskRank(mask, idx);
+
+        if (size == 4) {
+            if (xpread_words(&vf, 1, body + 4 * rank, fp) < 0)
+                return -1;
+            outp[i] = vf;
+        } else {
+            if (xpread_dwords(&vd, 1, body + 8 * rank, fp) < 0)
+                return -1;
+            outp[i] = vd;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * other formats: via GT3_Varbuf (which follows the current chunk).
+ */
+static int
+gather_varbuf(double *outp, const int *pts, int npts, GT3_Varbuf **var,
+              GT3_File *fp)
+{
+    int i;
+
+    if (*var == NULL && (*var = GT3_getVarbuf(fp)) == NULL)
+        return -1;
+
+    for (i = 0; i < npts; i++)
+        if (GT3_readVar(outp + i, *var,
+                        pts[3 * i], pts[3 * i + 1], pts[3 * i + 2]) < 0)
+            return -1;
+
+    return 0;
+}
+
+
+static int
+check_points(const int *pts, int npts, const GT3_File *fp)
+{
+    int i, j;
+
+    for (i = 0; i < npts; i++)
+        for (j = 0; j < 3; j++)
+            if (pts[3 * i + j] < 0 || pts[3 * i + j] >= fp->dimlen[j]) {
+                gt3_error(GT3_ERR_INDEX,
+                          "GT3_gatherPoints(): (%d, %d, %d) at %d",
+                          pts[3 * i], pts[3 * i + 1], pts[3 * i + 2],
+                          fp->curr);
+                return -1;
+            }
+    return 0;
+}
+
+
+/*
+ * GT3_gatherPoints() reads values at 'npts' points from the chunks
+ * from 'tstr' to 'tend - 1', and stores them in 'buf' as
+ * buf[(t - tstr) * npts + i].
+ * The points are given as (x, y, z) triplets (0-based) in 'pts'.
+ *
+ * For UR4, UR8, MR4, MR8, URY, and URX, only the words containing
+ * the points are read (the offsets are computed, and the mask is
+ * used to find them in MR4 and MR8).
+ * The other formats are read via GT3_Varbuf.
+ *
+ * The current chunk of 'fp' is moved to 'tend - 1'.
+ *
+ * return value: the number of chunks read (-1 on error).
+ */
+int
+GT3_gatherPoints(double *buf, GT3_File *fp,
+                 const int *pts, int npts, int tstr, int tend)
+{
+    GT3_HEADER head;
+    GT3_Varbuf *var = NULL;
+    double miss = -999.;
+    int t, fmt, miss_ch = -1, rc, rval = -1;
+
+    if (tstr < 0 || tstr >= tend) {
+        gt3_error(GT3_ERR_INDEX, "GT3_gatherPoints(): t=%d:%d", tstr, tend);
+        return -1;
+    }
+
+    for (t = tstr; t < tend; t++, buf += npts) {
+        if ((t == tstr ? GT3_seek(fp, t, SEEK_SET) : GT3_next(fp)) < 0)
+            goto finish;
+
+        if (GT3_eof(fp)) {
+            gt3_error(GT3_ERR_INDEX, "GT3_gatherPoints(): t=%d", t);
+            goto finish;
+        }
+
+        if (check_points(pts, npts, fp) < 0)
+            goto finish;
+
+        fmt = fp->fmt & GT3_FMT_MASK;
+
+        /*
+         * MISS is read only once in a history-file.
+         */
+        if (fmt != GT3_FMT_UR4 && fmt != GT3_FMT_UR8
+            && (miss_ch < 0 || !GT3_isHistfile(fp))) {
+            if (GT3_readHeader(&head, fp) < 0)
+                goto finish;
+            if (GT3_decodeHeaderDouble(&miss, &head, "MISS") < 0)
+                miss = -999.;
+            miss_ch = fp->curr;
+        }
+
+        switch (fmt) {
+        case GT3_FMT_UR4:
+            rc = gather_URn(buf, pts, npts, 4, fp);
+            break;
+        case GT3_FMT_UR8:
+            rc = gather_URn(buf, pts, npts, 8, fp);
+            break;
+        case GT3_FMT_MR4:
+            rc = gather_MRn(buf, pts, npts, 4, miss, fp);
+            break;
+        case GT3_FMT_MR8:
+            rc = gather_MRn(buf, pts, npts, 8, miss, fp);
+            break;
+        case GT3_FMT_URY:
+            rc = read_URY_points(buf, pts, npts, miss, fp);
+            break;
+        case GT3_FMT_URX:
+            rc = read_URX_points(buf, pts, npts, miss, fp);
+            break;
+        default:
+            rc = gather_varbuf(buf, pts, npts, &var, fp);
+            break;
+        }
+        if (rc < 0)
+            goto finish;
+    }
+    rval = tend - tstr;
+
+finish:
+    GT3_freeVarbuf(var);
+    return rval;
+}
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+#include <string.h>
+
+#define NX 13
+#define NY 4
+#define NZ 3
+
+int
+main(int argc, char **argv)
+{
+    const char *path = "gather-test.gt";
+    const char *fmts[] = {
+        "UR4", "UR8", "MR4", "URY16", "MRY16", "ZR4", "MR8", "URX12"
+    };
+    int pts[] = {
+        0, 0, 0,
+        NX - 1, NY - 1, NZ - 1,
+        3, 0, 0,                /* MISS */
+        5, 2, 1,
+        12, 1, 2,
+        7, 3, 0,
+        5, 2, 1                 /* again */
+    };
+    int npts = sizeof pts / sizeof pts[0] / 3;
+    enum { NCHUNK = sizeof fmts / sizeof fmts[0] };
+    double data[NX * NY * NZ], buf[NCHUNK * 7], value;
+    GT3_HEADER head;
+    GT3_File *fp, *ref;
+    GT3_Varbuf *var;
+    FILE *output;
+    int i, n, bad[3];
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    for (n = 0; n < NCHUNK; n++) {
+        for (i = 0; i < NX * NY * NZ; i++)
+            data[i] = (i % 5 == 3) ? -999. : 10. * n + 0.01 * i;
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, NX, NY, NZ,
+                         &head, fmts[n], output) == 0);
+    }
+    fclose(output);
+
+    fp = GT3_open(path);
+    ref = GT3_open(path);
+    assert(fp && ref);
+    var = GT3_getVarbuf(ref);
+    assert(var);
+
+    assert(GT3_gatherPoints(buf, fp, pts, npts, 0, NCHUNK) == NCHUNK);
+    assert(fp->curr == NCHUNK - 1);
+    for (n = 0; n < NCHUNK; n++) {
+        for (i = 0; i < npts; i++) {
+            assert(GT3_readVarZ(var, pts[3 * i + 2]) == 0);
+            assert(GT3_readVar(&value, var, pts[3 * i],
+                               pts[3 * i + 1], pts[3 * i + 2]) == 0);
+            assert(buf[n * npts + i] == value);
+        }
+        assert(buf[n * npts + 2] == -999.);
+        GT3_next(ref);
+    }
+
+    /* a part of chunks */
+    memset(buf, 0, sizeof buf);
+    assert(GT3_gatherPoints(buf, fp, pts + 9, 2, 2, 5) == 3);
+    assert(GT3_seek(ref, 2, SEEK_SET) == 0);
+    for (n = 0; n < 3; n++) {
+        for (i = 0; i < 2; i++) {
+            assert(GT3_readVarZ(var, pts[9 + 3 * i + 2]) == 0);
+            assert(GT3_readVar(&value, var, pts[9 + 3 * i],
+                               pts[9 + 3 * i + 1], pts[9 + 3 * i + 2]) == 0);
+            assert(buf[2 * n + i] == value);
+        }
+        GT3_next(ref);
+    }
+
+    /* errors */
+    bad[0] = NX;
+    bad[1] = 0;
+    bad[2] = 0;
+    assert(GT3_gatherPoints(buf, fp, bad, 1, 0, 1) < 0);
+    assert(GT3_gatherPoints(buf, fp, pts, npts, 1, 1) < 0);
+    assert(GT3_gatherPoints(buf, fp, pts, npts, 0, NCHUNK + 1) < 0);
+    GT3_clearLastError();
+
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    GT3_close(ref);
+    remove(path);
+    return 0;
+}
+#endif /* TEST_MAIN */
@@ -51,6 +51,8 @@ enum {
     GT3_FMT_MRX,                /* deprecated */
     GT3_FMT_URY,
     GT3_FMT_MRY,
+    GT3_FMT_ZR4,                /* lossless compression */
+    GT3_FMT_ZR8,                /* lossless compression */
     GT3_FMT_NULL
 };
 
@@ -64,7 +66,8 @@ enum {
 /* for mode in GT3_File */
 enum {
     GT3_CONST_CHUNK_SIZE = 1U,
-    GT3_FILE_WRITABLE = 2U
+    GT3_FILE_WRITABLE = 2U,
+    GT3_FILE_MAPPED = 4U
 };
 
 /*
@@ -115,8 +118,19 @@ struct GT3_Datamask {
 
     int loaded;                 /* the chunk number mask is loaded */
     int indexed;                /* Index up-to-date?  */
-    size_t *index;
+    size_t *index;              /* rank at each 2048 bits (superblock) */
     size_t index_len;           /* length of index */
+    unsigned short *rank_;      /* rank at each word in its superblock */
+
+    uint32_t *raw_;             /* [2*] words as stored in the file */
+    size_t nkept_;              /* # of words kept in raw_ (0: none) */
+
+    /* the other z-planes of MRY/MRX (swapped with the above) */
+    struct GT3_Datamask *plane_;
+    int nplane_;
+    int zcur_;                  /* z-plane held above */
+    unsigned long nload_;       /* # of masks loaded */
+    unsigned long nreuse_;      /* # of them identical to the previous */
 };
 typedef struct GT3_Datamask GT3_Datamask;
 
@@ -144,6 +158,10 @@ struct GT3_File {
     off_t size;                 /* file size (in bytes) */
 
     GT3_Datamask *mask;
+
+    void *map_;                 /* mapped image (GT3_openMapped) */
+    void *index_;               /* chunk index (chindex.c) */
+    void *pool_;                /* entry in the file pool (fpool.c) */
 };
 typedef struct GT3_File GT3_File;
 
@@ -164,6 +182,17 @@ struct GT3_Varbuf {
 };
 typedef struct GT3_Varbuf GT3_Varbuf;
 
+/*
+ * Statistics of non-missing values (GT3_reduceVarRows()).
+ */
+struct GT3_Reduction {
+    size_t count;               /* # of non-missing values */
+    double sum;                 /* sum of the values */
+    double ssd;                 /* sum of squared deviations from the mean */
+    double min, max;            /* min > max if count == 0 */
+};
+typedef struct GT3_Reduction GT3_Reduction;
+
 /*
  * for Date(Time), TimeDuration...
  *
@@ -199,6 +228,11 @@ struct GT3_VCatFile {
 };
 typedef struct GT3_VCatFile GT3_VCatFile;
 
+/*
+ * GT3_Writer: buffered output (opaque).
+ */
+typedef struct GT3_Writer GT3_Writer;
+
 /* Calendar type */
 enum {
     GT3_CAL_GREGORIAN,
@@ -227,6 +261,7 @@ int GT3_countChunk(const char *path);
 int GT3_getNumChunk(const GT3_File *fp);
 GT3_File *GT3_open(const char *path);
 GT3_File *GT3_openHistFile(const char *path);
+GT3_File *GT3_openMapped(const char *path);
 GT3_File *GT3_openRW(const char *path);
 int GT3_eof(GT3_File *fp);
 int GT3_next(GT3_File *fp);
@@ -237,6 +272,25 @@ int GT3_skipZ(GT3_File *fp, int z);
 int GT3_suspend(GT3_File *fp);
 int GT3_resume(GT3_File *fp);
 
+/*
+ * fpool.c
+ *
+ * The stream of a pooled file can be closed when other pooled files
+ * are used. Reading pooled files with Varbufs is thread-safe, but
+ * the other operations on pooled files (GT3_next(), GT3_seek(),
+ * GT3_readHeader(), ...) must not be used from more than one thread
+ * at a time.
+ */
+int GT3_setFileLimit(int limit);
+int GT3_poolFile(GT3_File *fp);
+
+/* gather.c */
+int GT3_gatherPoints(double *buf, GT3_File *fp,
+                     const int *pts, int npts, int tstr, int tend);
+
+/* chindex.c */
+int GT3_writeIndex(const char *path);
+
 /* varbuf.c */
 void GT3_freeVarbuf(GT3_Varbuf *var);
 GT3_Varbuf *GT3_getVarbuf(GT3_File *fp);
@@ -244,6 +298,17 @@ GT3_Varbuf *GT3_getVarbuf2(GT3_Varbuf *old, GT3_File *fp);
 int GT3_readVarZ(GT3_Varbuf *var, int zpos);
 int GT3_readVarZY(GT3_Varbuf *var, int zpos, int ypos);
 int GT3_readVar(double *rval, GT3_Varbuf *var, int x, int y, int z);
+int GT3_readVarZRangeDouble(double *buf, size_t buflen,
+                            GT3_Varbuf *var, int zstr, int zend);
+int GT3_readVarZRangeFloat(float *buf, size_t buflen,
+                           GT3_Varbuf *var, int zstr, int zend);
+int GT3_readVarSlab(double *buf, size_t buflen, GT3_Varbuf *var,
+                    int x0, int x1, int y0, int y1, int z0, int z1,
+                    int stride);
+int GT3_readVarPacked(GT3_Varbuf *var, int zpos, const int **index);
+int GT3_reduceVarRows(GT3_Reduction *red, GT3_Varbuf *var, int zpos,
+                      int x0, int x1, int y0, int y1);
+void GT3_mergeReduction(GT3_Reduction *dest, const GT3_Reduction *src);
 int GT3_copyVarDouble(double *, size_t, const GT3_Varbuf *, int, int);
 int GT3_copyVarFloat(float *, size_t, const GT3_Varbuf *, int, int);
 
@@ -252,6 +317,12 @@ char *GT3_getVarAttrStr(char *attr, int len, const GT3_Varbuf *var,
 int GT3_getVarAttrInt(int *attr, const GT3_Varbuf *var, const char *key);
 int GT3_getVarAttrDouble(double *attr, const GT3_Varbuf *var, const char *key);
 int GT3_reattachVarbuf(GT3_Varbuf *var, GT3_File *fp);
+int GT3_pinVarbuf(GT3_Varbuf *var, GT3_File *fp);
+int GT3_setVarbufCache(GT3_Varbuf *var, size_t maxbytes);
+void GT3_getVarbufCacheStats(const GT3_Varbuf *var,
+                             unsigned long *hits, unsigned long *misses);
+void GT3_getVarbufMaskStats(const GT3_Varbuf *var,
+                            unsigned long *loaded, unsigned long *reused);
 
 /* mask.c */
 GT3_Datamask *GT3_newMask(void);
@@ -259,6 +330,9 @@ void GT3_freeMask(GT3_Datamask *ptr);
 int GT3_setMaskSize(GT3_Datamask *ptr, size_t nelem);
 int GT3_updateMaskIndex(GT3_Datamask *mask, int interval);
 int GT3_getMaskValue(const GT3_Datamask *mask, int i);
+size_t GT3_getMaskRank(const GT3_Datamask *mask, size_t i);
+void GT3_getMaskStats(const GT3_Datamask *mask,
+                      unsigned long *loaded, unsigned long *reused);
 int GT3_loadMask(GT3_Datamask *mask, GT3_File *fp);
 int GT3_loadMaskX(GT3_Datamask *mask, int zpos, GT3_File *fp);
 
@@ -301,6 +375,9 @@ int GT3_getHeaderItemID(const char *name);
 
 /* write.c */
 int GT3_output_format(char *dfmt, const char *str);
+int GT3_chooseFormat(char *dfmt, const char *str,
+                     const void *ptr, int type, int nx, int ny, int nz,
+                     double miss);
 int GT3_write(const void *ptr, int type,
               int nx, int ny, int nz,
               const GT3_HEADER *headin,
@@ -311,6 +388,24 @@ int GT3_write_bitpack(const void *ptr, int type,
                       double offset, double scale,
                       unsigned nbits, unsigned is_mask,
                       FILE *fp);
+void GT3_setEncodeThreads(int nthreads);
+
+/* writer.c */
+GT3_Writer *GT3_openWriter(const char *path, const char *mode,
+                           size_t bufsize);
+GT3_Writer *GT3_openAsyncWriter(const char *path, const char *mode,
+                                size_t bufsize);
+int GT3_writerWrite(GT3_Writer *w, const void *ptr, int type,
+                    int nx, int ny, int nz,
+                    const GT3_HEADER *head, const char *dfmt);
+int GT3_writerWriteBitpack(GT3_Writer *w, const void *ptr, int type,
+                           int nx, int ny, int nz,
+                           const GT3_HEADER *head,
+                           double offset, double scale,
+                           unsigned nbits, unsigned is_mask);
+int GT3_writerFlush(GT3_Writer *w);
+FILE *GT3_writerStream(GT3_Writer *w);
+int GT3_writerClose(GT3_Writer *w);
 
 /* error.c */
 void GT3_clearLastError(void);
@@ -61,33 +61,287 @@ pack_bits_into32(uint32_t *packed,
 }
 
 
+/*
+ * Unpacking N-bit integers.
+ *
+ * Every 32 values (a group) occupy just N words, so that a group can
+ * be unpacked by straight-line code without division.  The kernels
+ * for each N are generated from unpack_group() (which is expanded with
+ * a constant 'nbit'), and those for 8, 12, and 16 are hand-written
+ * (with the vector extension of GCC if available).
+ * The rest of a group is unpacked by the generic code.
+ */
+#if defined(__GNUC__)
+#  define ALWAYS_INLINE __inline__ __attribute__((always_inline))
+#else
+#  define ALWAYS_INLINE
+#endif
+
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#  define USE_VECTOR_EXT
+#endif
+
+typedef void (*unpack_func)(unsigned *, const uint32_t *);
+
+
+static void
+unpack_generic(unsigned *data, size_t len, const uint32_t *packed,
+               unsigned nbit, unsigned bitoff)
+{
+    size_t i, ipos, bpos;
+    unsigned off;
+    unsigned mask;
+
+    mask = (1U << nbit) - 1U;
+
+    for (i = 0, bpos = bitoff; i < len; i++, bpos += nbit) {
+        ipos = bpos / BWIDTH;
+        off = (unsigned)(bpos % BWIDTH) + nbit;
+
+        if (off > BWIDTH)
+            data[i] = ((packed[ipos] << (off - BWIDTH))
+                       | (packed[ipos+1] >> (2 * BWIDTH - off))) & mask;
+        else
+            data[i] = (packed[ipos] >> (BWIDTH - off)) & mask;
+    }
+}
+
+
+static ALWAYS_INLINE void
+unpack_group(unsigned *data, const uint32_t *packed, unsigned nbit)
+{
+    uint64_t buf = 0;
+    unsigned avail = 0, mask = (1U << nbit) - 1U;
+    int i;
+
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 8)
+#  pragma GCC unroll 32
+#endif
+    for (i = 0; i < 32; i++) {
+        if (avail < nbit) {
+            buf = buf << 32 | *packed++;
+            avail += 32;
+        }
+        avail -= nbit;
+        data[i] = (unsigned)(buf >> avail) & mask;
+    }
+}
+
+
+#define DEFINE_UNPACK(N) \
+static void \
+unpack32_##N(unsigned *data, const uint32_t *packed) \
+{ \
+    unpack_group(data, packed, N); \
+}
+
+DEFINE_UNPACK(1)
+DEFINE_UNPACK(2)
+DEFINE_UNPACK(3)
+DEFINE_UNPACK(4)
+DEFINE_UNPACK(5)
+DEFINE_UNPACK(6)
+DEFINE_UNPACK(7)
+DEFINE_UNPACK(9)
+DEFINE_UNPACK(10)
+DEFINE_UNPACK(11)
+DEFINE_UNPACK(13)
+DEFINE_UNPACK(14)
+DEFINE_UNPACK(15)
+DEFINE_UNPACK(17)
+DEFINE_UNPACK(18)
+DEFINE_UNPACK(19)
+DEFINE_UNPACK(20)
+DEFINE_UNPACK(21)
+DEFINE_UNPACK(22)
+DEFINE_UNPACK(23)
+DEFINE_UNPACK(24)
+DEFINE_UNPACK(25)
+DEFINE_UNPACK(26)
+DEFINE_UNPACK(27)
+DEFINE_UNPACK(28)
+DEFINE_UNPACK(29)
+DEFINE_UNPACK(30)
+DEFINE_UNPACK(31)
+
+
+#ifdef USE_VECTOR_EXT
+typedef unsigned v4su_t __attribute__((vector_size(16)));
+
+#ifdef __clang__
+#  define INTERLEAVE(a, b, i0, i1, i2, i3) \
+    __builtin_shufflevector(a, b, i0, i1, i2, i3)
+#else
+#  define INTERLEAVE(a, b, i0, i1, i2, i3) \
+    __builtin_shuffle(a, b, (v4su_t){ i0, i1, i2, i3 })
+#endif
+
+
+static void
+unpack32_8(unsigned *data, const uint32_t *packed)
+{
+    v4su_t w, a, b, c, d, ab, cd;
+    const v4su_t m8 = { 0xff, 0xff, 0xff, 0xff };
+    int i;
+
+    for (i = 0; i < 8; i += 4, packed += 4, data += 16) {
+        memcpy(&w, packed, 16);
+        a = w >> 24;
+        b = (w >> 16) & m8;
+        c = (w >> 8) & m8;
+        d = w & m8;
+
+        ab = INTERLEAVE(a, b, 0, 4, 1, 5);
+        cd = INTERLEAVE(c, d, 0, 4, 1, 5);
+        w = INTERLEAVE(ab, cd, 0, 1, 4, 5);
+        memcpy(data, &w, 16);
+        w = INTERLEAVE(ab, cd, 2, 3, 6, 7);
+        memcpy(data + 4, &w, 16);
+
+        ab = INTERLEAVE(a, b, 2, 6, 3, 7);
+        cd = INTERLEAVE(c, d, 2, 6, 3, 7);
+        w = INTERLEAVE(ab, cd, 0, 1, 4, 5);
+        memcpy(data + 8, &w, 16);
+        w = INTERLEAVE(ab, cd, 2, 3, 6, 7);
+        memcpy(data + 12, &w, 16);
+    }
+}
+
+
+static void
+unpack32_16(unsigned *data, const uint32_t *packed)
+{
+    v4su_t w, hi, lo;
+    const v4su_t m16 = { 0xffff, 0xffff, 0xffff, 0xffff };
+    int i;
+
+    for (i = 0; i < 16; i += 4, packed += 4, data += 8) {
+        memcpy(&w, packed, 16);
+        hi = w >> 16;
+        lo = w & m16;
+
+        w = INTERLEAVE(hi, lo, 0, 4, 1, 5);
+        memcpy(data, &w, 16);
+        w = INTERLEAVE(hi, lo, 2, 6, 3, 7);
+        memcpy(data + 4, &w, 16);
+    }
+}
+
+#else /* !USE_VECTOR_EXT */
+
+static void
+unpack32_8(unsigned *data, const uint32_t *packed)
+{
+    int i;
+
+    for (i = 0; i < 8; i++, data += 4) {
+        data[0] = packed[i] >> 24;
+        data[1] = (packed[i] >> 16) & 0xffU;
+        data[2] = (packed[i] >> 8) & 0xffU;
+        data[3] = packed[i] & 0xffU;
+    }
+}
+
+
+static void
+unpack32_16(unsigned *data, const uint32_t *packed)
+{
+    int i;
+
+    for (i = 0; i < 16; i++, data += 2) {
+        data[0] = packed[i] >> 16;
+        data[1] = packed[i] & 0xffffU;
+    }
+}
+#endif /* USE_VECTOR_EXT */
+
+
+/*
+ * 12-bit: 3 words have 8 values.
+ */
+static void
+unpack32_12(unsigned *data, const uint32_t *packed)
+{
+    uint32_t w0, w1, w2;
+    int i;
+
+    for (i = 0; i < 4; i++, packed += 3, data += 8) {
+        w0 = packed[0];
+        w1 = packed[1];
+        w2 = packed[2];
+
+        data[0] = w0 >> 20;
+        data[1] = (w0 >> 8) & 0xfffU;
+        data[2] = (w0 & 0xffU) << 4 | w1 >> 28;
+        data[3] = (w1 >> 16) & 0xfffU;
+        data[4] = (w1 >> 4) & 0xfffU;
+        data[5] = (w1 & 0xfU) << 8 | w2 >> 24;
+        data[6] = (w2 >> 12) & 0xfffU;
+        data[7] = w2 & 0xfffU;
+    }
+}
+
+
+static const unpack_func unpack32_table[] = {
+    NULL,
+    unpack32_1,  unpack32_2,  unpack32_3,  unpack32_4,
+    unpack32_5,  unpack32_6,  unpack32_7,  unpack32_8,
+    unpack32_9,  unpack32_10, unpack32_11, unpack32_12,
+    unpack32_13, unpack32_14, unpack32_15, unpack32_16,
+    unpack32_17, unpack32_18, unpack32_19, unpack32_20,
+    unpack32_21, unpack32_22, unpack32_23, unpack32_24,
+    unpack32_25, unpack32_26, unpack32_27, unpack32_28,
+    unpack32_29, unpack32_30, unpack32_31
+};
+
+
 void
 unpack_bits_from32(unsigned *data,
                    size_t len,
                    const uint32_t *packed, unsigned nbit)
 {
-    size_t i, i2, ipos;
-    unsigned i3, off;
-    unsigned value, mask;
+    unpack_func func;
+    size_t i, ngroup;
 
     assert(nbit > 0 && nbit < 32);
-    mask = (1U << nbit) - 1U;
 
-    for (i = 0; i < len; i++) {
-        i2 = i / BWIDTH;
-        i3 = i % BWIDTH;
+    func = unpack32_table[nbit];
+    ngroup = len / BWIDTH;
+    for (i = 0; i < ngroup; i++, data += BWIDTH, packed += nbit)
+        func(data, packed);
 
-        ipos = nbit * i2 + nbit * i3 / BWIDTH;
-        off = nbit + (nbit * i3) % BWIDTH;
+    unpack_generic(data, len - ngroup * BWIDTH, packed, nbit, 0);
+}
 
-        if (off > BWIDTH)
-            value = ((packed[ipos] << (off - BWIDTH)) & mask)
-                | ((packed[ipos+1] >> (2 * BWIDTH - off)) & mask);
-        else
-            value = (packed[ipos] >> (BWIDTH - off)) & mask;
 
-        data[i] = value;
-    }
+/*
+ * unpack_bits_from32_at() unpacks 'len' N-bit integers which start
+ * at the 'bitoff'-th bit (0...31) of packed[0].
+ * This is used to unpack a part of the packed array.
+ */
+void
+unpack_bits_from32_at(unsigned *data,
+                      size_t len,
+                      const uint32_t *packed, unsigned nbit,
+                      unsigned bitoff)
+{
+    size_t head;
+    unsigned bpos;
+
+    assert(nbit > 0 && nbit < 32);
+    assert(bitoff < BWIDTH);
+
+    /*
+     * 'head': the # of values before a word boundary,
+     * from which unpack_bits_from32() can be used.
+     */
+    for (head = 0, bpos = bitoff; bpos % BWIDTH != 0 && head < len; head++)
+        bpos += nbit;
+
+    unpack_generic(data, head, packed, nbit, bitoff);
+    if (head < len)
+        unpack_bits_from32(data + head, len - head,
+                           packed + bpos / BWIDTH, nbit);
 }
 
 
@@ -279,6 +533,16 @@ test2(unsigned nbit)
 
     for (i = 0; i < NELEM; i++)
         assert(data[i] == data2[i]);
+
+    /* unpack a part. */
+    for (i = 0; i < 100; i++) {
+        size_t bpos = (size_t)nbit * (17 * i);
+        int j;
+
+        unpack_bits_from32_at(data2, 51, packed + bpos / 32, nbit, bpos % 32);
+        for (j = 0; j < 51; j++)
+            assert(data[17 * i + j] == data2[j]);
+    }
 }
 
 
@@ -363,6 +627,34 @@ test3(void)
 }
 
 
+/*
+ * compare the kernels with the generic code (for various lengths).
+ */
+void
+test4(unsigned nbit)
+{
+    unsigned data[200], data2[200];
+    uint32_t packed[200];
+    unsigned u = 12345;
+    size_t i, len;
+
+    for (i = 0; i < 200; i++) {
+        u = u * 1103515245U + 12345U;
+        packed[i] = u;
+    }
+
+    for (len = 0; len < 130; len++) {
+        unpack_generic(data, len, packed, nbit, 0);
+        unpack_bits_from32(data2, len, packed, nbit);
+        assert(memcmp(data, data2, sizeof(unsigned) * len) == 0);
+
+        unpack_generic(data, len, packed, nbit, 7);
+        unpack_bits_from32_at(data2, len, packed, nbit, 7);
+        assert(memcmp(data, data2, sizeof(unsigned) * len) == 0);
+    }
+}
+
+
 int
 main(int argc, char **argv)
 {
@@ -372,6 +664,7 @@ main(int argc, char **argv)
     test();
     for (nbit = 1; nbit < 32; nbit++) {
         test2(nbit);
+        test4(nbit);
     }
     test3();
     return 0;
@@ -13,4 +13,8 @@ size_t pack_bools_into32(uint32_t *packed,
 void unpack_bits_from32(unsigned *data,
                         size_t len,
                         const uint32_t *packed, unsigned nbit);
+void unpack_bits_from32_at(unsigned *data,
+                           size_t len,
+                           const uint32_t *packed, unsigned nbit,
+                           unsigned bitoff);
 #endif
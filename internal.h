@@ -90,9 +90,104 @@ void urc2_unpack(const uint32_t *packed, int packed_len,
                  double ref, int ne, int nd,
                  double miss, float *data);
 
+/*
+ * zr_pack.c (ZR4 & ZR8)
+ */
+#define ZR_BLOCK 128            /* # of bytes in a packing block */
+
+size_t zr_nblocks(size_t n);
+size_t zr_maxlen(size_t n, size_t width);
+void zr_shuffle(unsigned char *bytes, const void *ptr, size_t size,
+                size_t width, size_t n);
+void zr_unshuffle(void *ptr, const unsigned char *bytes,
+                  size_t width, size_t n);
+void zr_delta(unsigned char *bytes, size_t n, size_t width);
+size_t zr_packed_len(unsigned char *nbits, const unsigned char *bytes,
+                     size_t n, size_t width);
+size_t zr_pack(uint32_t *packed, const unsigned char *bytes,
+               const unsigned char *nbits, size_t n, size_t width);
+int zr_unpack(unsigned char *bytes, size_t n, size_t width,
+              const uint32_t *packed, size_t plen);
+
+/*
+ * the range of non-missing values (vrange.c).
+ */
+struct vrange {
+    double vmin, vmax;          /* vmin > vmax if no value */
+    size_t count;               /* # of non-missing values */
+    size_t nnan;                /* # of NaNs (included in count) */
+};
+typedef struct vrange vrange;
+
+void get_vrange(vrange *r, const void *ptr, size_t size, size_t nelems,
+                double miss, int nthreads);
+
+/*
+ * chunk index (chindex.c).
+ */
+struct chunk_entry {
+    off_t off;                  /* position of the chunk */
+    int fmt;
+    int dimlen[3];
+};
+typedef struct chunk_entry chunk_entry;
+
+struct chunk_index {
+    int num;                    /* # of chunks */
+    chunk_entry *entry;         /* [0] ... [num-1] */
+};
+typedef struct chunk_index chunk_index;
+
+chunk_index *load_chunk_index(const char *path, const file_stat_t *sb);
+void free_chunk_index(chunk_index *idx);
+size_t chunk_index_size(const chunk_index *idx, int i, off_t fsize);
+
+/*
+ * LRU cache of decoded z-planes (pcache.c).
+ */
+typedef struct plane_entry plane_entry;
+struct plane_cache {
+    size_t budget;              /* max. size in bytes */
+    size_t used;                /* current size in bytes */
+    int num;                    /* # of planes */
+
+    unsigned long hits, misses;
+
+    plane_entry *head;          /* most recently used */
+    plane_entry *tail;          /* least recently used */
+};
+typedef struct plane_cache plane_cache;
+
+plane_cache *new_plane_cache(size_t budget);
+void free_plane_cache(plane_cache *pc);
+void clear_plane_cache(plane_cache *pc);
+void resize_plane_cache(plane_cache *pc, size_t budget);
+const void *lookup_plane(plane_cache *pc, int ch, int z, size_t size);
+int store_plane(plane_cache *pc, int ch, int z, const void *data, size_t size);
+
+/* file.c */
+const void *mapped_range(off_t off, size_t len, const GT3_File *fp);
+int copy_mapped(void *ptr, size_t len, off_t off, const GT3_File *fp);
+
+/* fpool.c */
+FILE *file_stream(const GT3_File *fp);
+FILE *acquire_stream(const GT3_File *fp);
+void release_stream(const GT3_File *fp);
+int suspend_pooled(GT3_File *fp);
+void release_pooled(GT3_File *fp);
+
 /* reverse.c */
 void *reverse_words(void *vptr, size_t nwords);
 void *reverse_dwords(void *vptr, size_t nwords);
+void *copy_reverse_words(void *dest, const void *src, size_t nwords);
+void *copy_reverse_dwords(void *dest, const void *src, size_t nwords);
+
+/* parallel.c */
+int num_processors(void);
+int parallel_run(int nthreads, size_t ntasks,
+                 int (*func)(size_t, int, void *), void *arg);
+int parallel_for(int nthreads, size_t ntasks,
+                 int (*func)(size_t, void *), void *arg);
 
 /* grid.c */
 int uniform_center(double *grid, double x0, double x1, int len);
@@ -104,6 +199,8 @@ void gauss_legendre(double sol[], double wght[], int nth);
 /* error.c */
 #define SYSERR GT3_ERR_SYS
 void gt3_error(int code, const char *fmt, ...);
+int copy_last_error(int *errnum, char *aux, size_t auxlen);
+void raise_error(int code, int errnum, const char *aux);
 
 /* scaling.c */
 void scaling(unsigned *dest,
@@ -133,28 +230,85 @@ size_t masked_scalingf(unsigned *dest,
 double step_size(double minv, double maxv, int nbits);
 void scaling_parameters(double *dma, double dmin, double dmax, int num);
 
+/* mask.c */
+size_t expand_masked(double *dest, size_t nout,
+                     const double *src, size_t nsrc,
+                     const uint32_t *mask, size_t pos, double miss,
+                     size_t *nused);
+size_t expand_maskedf(float *dest, size_t nout,
+                      const float *src, size_t nsrc,
+                      const uint32_t *mask, size_t pos, float miss,
+                      size_t *nused);
+size_t mask_positions(int *index, const uint32_t *mask,
+                      size_t pos, size_t nelem);
+
 /* record.c */
-int read_words_from_record(void *ptr, size_t skip, size_t nelem, FILE *fp);
-int read_dwords_from_record(void *ptr, size_t skip, size_t nelem, FILE *fp);
+int read_words_from_record(void *ptr, size_t skip, size_t nelem,
+                           off_t *off, const GT3_File *fp);
+int read_dwords_from_record(void *ptr, size_t skip, size_t nelem,
+                            off_t *off, const GT3_File *fp);
 int write_record_sep(uint64_t size, FILE *fp);
 int write_words_into_record(const void *ptr, size_t nelem, FILE *fp);
 int write_dwords_into_record(const void *ptr, size_t nelem, FILE *fp);
 int write_bytes_into_record(const void *ptr, size_t nelem, FILE *fp);
 
+/* write.c */
+int write_chunk(const void *ptr, int type,
+                int nx, int ny, int nz,
+                const GT3_HEADER *headin, const char *dfmt, FILE *fp);
+
 /* xfread.c */
 int xfread(void *ptr, size_t size, size_t nmemb, FILE *fp);
+int xpread(void *ptr, size_t size, size_t nmemb, off_t off,
+           const GT3_File *fp);
+int xpread_words(void *ptr, size_t nmemb, off_t off, const GT3_File *fp);
+int xpread_dwords(void *ptr, size_t nmemb, off_t off, const GT3_File *fp);
 
+/*
+ * Readers of each format (read_XXX).
+ * 'fp' is the chunk to read, which is owned by the Varbuf.
+ */
 /* read_urc */
-int read_URC1(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp);
-int read_URC2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp);
+int read_URC1(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+              GT3_File *fp);
+int read_URC2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+              GT3_File *fp);
 
 /* read_urx.c */
-int read_URX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp);
-int read_MRX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp);
+int read_URX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+              GT3_File *fp);
+int read_MRX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+              GT3_File *fp);
 
 /* read_ury.c */
-int read_URY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp);
-int read_MRY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp);
+int read_URY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+              GT3_File *fp);
+int read_MRY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+              GT3_File *fp);
+int read_URY_slab(double *outp, GT3_Varbuf *var, int zpos,
+                  int x0, int nx, int y0, int ny, int stride, GT3_File *fp);
+int read_MRY_slab(double *outp, GT3_Varbuf *var, int zpos,
+                  int x0, int nx, int y0, int ny, int stride, GT3_File *fp);
+int read_URX_slab(double *outp, GT3_Varbuf *var, int zpos,
+                  int x0, int nx, int y0, int ny, int stride, GT3_File *fp);
+int read_MRX_slab(double *outp, GT3_Varbuf *var, int zpos,
+                  int x0, int nx, int y0, int ny, int stride, GT3_File *fp);
+int read_MRY_packed(GT3_Varbuf *var, int zpos, size_t *num, GT3_File *fp);
+int read_MRX_packed(GT3_Varbuf *var, int zpos, size_t *num, GT3_File *fp);
+int reduce_URY_rows(GT3_Reduction *red, int zpos,
+                    int x0, int x1, int y0, int y1, GT3_File *fp);
+int reduce_MRY_rows(GT3_Reduction *red, int zpos,
+                    int x0, int x1, int y0, int y1, GT3_File *fp);
+int read_URY_points(double *outp, const int *pts, int npts, double miss,
+                    GT3_File *fp);
+int read_URX_points(double *outp, const int *pts, int npts, double miss,
+                    GT3_File *fp);
+
+/* read_zr.c */
+int read_ZR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+             GT3_File *fp);
+int read_ZR8(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+             GT3_File *fp);
 
 /* timedim.c */
 int guess_calendar(double sec, const GT3_Date *date);
@@ -15,6 +15,7 @@ reset_mask(GT3_Datamask *ptr)
 {
     ptr->loaded = -1;
     ptr->indexed = 0;
+    ptr->nkept_ = 0;
 }
 
 
@@ -25,6 +26,16 @@ getbit(const uint32_t *mask, unsigned i)
 }
 
 
+static unsigned
+popcount32(uint32_t w)
+{
+    w = w - ((w >> 1) & 0x55555555U);
+    w = (w & 0x33333333U) + ((w >> 2) & 0x33333333U);
+    w = (w + (w >> 4)) & 0x0f0f0f0fU;
+    return (w * 0x01010101U) >> 24;
+}
+
+
 /*
  * allocate a new GT3_Datamask.
  */
@@ -44,39 +55,147 @@ GT3_newMask(void)
     mask->mask = NULL;
     mask->index = NULL;
     mask->index_len = 0;
+    mask->rank_ = NULL;
+    mask->raw_ = NULL;
+    mask->nload_ = 0;
+    mask->nreuse_ = 0;
+    mask->plane_ = NULL;
+    mask->nplane_ = 0;
+    mask->zcur_ = 0;
     return mask;
 }
 
 
-void
-GT3_freeMask(GT3_Datamask *ptr)
+/*
+ * free_plane() frees the buffers of the current z-plane.
+ */
+static void
+free_plane(GT3_Datamask *ptr)
 {
     free(ptr->mask);
     free(ptr->index);
+    free(ptr->rank_);
+    free(ptr->raw_);
 
     reset_mask(ptr);
     ptr->reserved = 0;
     ptr->index_len = 0;
     ptr->mask = NULL;
     ptr->index = NULL;
+    ptr->rank_ = NULL;
+    ptr->raw_ = NULL;
+}
+
+
+void
+GT3_freeMask(GT3_Datamask *ptr)
+{
+    int i;
+
+    free_plane(ptr);
+    for (i = 0; i < ptr->nplane_; i++)
+        free_plane(ptr->plane_ + i);
+    free(ptr->plane_);
+    ptr->plane_ = NULL;
+    ptr->nplane_ = 0;
+    ptr->zcur_ = 0;
+}
+
+
+/*
+ * swap_plane() exchanges the buffers of the current z-plane with
+ * those in 'slot' (the other members are left).
+ */
+static void
+swap_plane(GT3_Datamask *mask, GT3_Datamask *slot)
+{
+    GT3_Datamask temp = *slot;
+
+    slot->nelem = mask->nelem;
+    slot->reserved = mask->reserved;
+    slot->mask = mask->mask;
+    slot->indexed = mask->indexed;
+    slot->index = mask->index;
+    slot->index_len = mask->index_len;
+    slot->rank_ = mask->rank_;
+    slot->raw_ = mask->raw_;
+    slot->nkept_ = mask->nkept_;
+
+    mask->nelem = temp.nelem;
+    mask->reserved = temp.reserved;
+    mask->mask = temp.mask;
+    mask->indexed = temp.indexed;
+    mask->index = temp.index;
+    mask->index_len = temp.index_len;
+    mask->rank_ = temp.rank_;
+    mask->raw_ = temp.raw_;
+    mask->nkept_ = temp.nkept_;
+}
+
+
+/*
+ * switch_plane() makes the 'z'-th plane current, which has been kept
+ * in plane_[z].  The current one is put in plane_[zcur_], whose
+ * (empty) buffers are moved to plane_[z].
+ * In MRY/MRX, the mask of each z-plane is compared with that of the
+ * same z-plane in the previous chunk, so that the index of a mask
+ * varying with z but not with time is reused.
+ */
+static int
+switch_plane(GT3_Datamask *mask, int z)
+{
+    GT3_Datamask *ptr;
+    int num, i;
+
+    if (z == mask->zcur_)
+        return 0;
+
+    num = (z > mask->zcur_ ? z : mask->zcur_) + 1;
+    if (num > mask->nplane_) {
+        if ((ptr = realloc(mask->plane_, sizeof(GT3_Datamask) * num))
+            == NULL) {
+            gt3_error(SYSERR, NULL);
+            return -1;
+        }
+        for (i = mask->nplane_; i < num; i++) {
+            memset(ptr + i, 0, sizeof(GT3_Datamask));
+            ptr[i].indexed = 0;
+            ptr[i].mask = NULL;
+            ptr[i].index = NULL;
+            ptr[i].rank_ = NULL;
+            ptr[i].raw_ = NULL;
+        }
+        mask->plane_ = ptr;
+        mask->nplane_ = num;
+    }
+
+    swap_plane(mask, mask->plane_ + mask->zcur_);
+    swap_plane(mask, mask->plane_ + z);
+    mask->zcur_ = z;
+    mask->loaded = -1;
+    return 0;
 }
 
 
 int
 GT3_setMaskSize(GT3_Datamask *ptr, size_t nelem)
 {
-    uint32_t *mask = NULL;
+    uint32_t *mask = NULL, *raw;
     size_t mlen;
 
     if (ptr->reserved >= nelem) {
+        if (ptr->nelem != nelem)
+            reset_mask(ptr);
         ptr->nelem = nelem;
         return 0;
     }
 
-    GT3_freeMask(ptr);
+    free_plane(ptr);
     mlen = (nelem + 31) / 32;
-    if ((mask = malloc(sizeof(uint32_t) * mlen)) == NULL) {
+    if ((mask = malloc(sizeof(uint32_t) * mlen)) == NULL
+        || (raw = malloc(sizeof(uint32_t) * 2 * mlen)) == NULL) {
         gt3_error(SYSERR, NULL);
+        free(mask);
         return -1;
     }
 
@@ -85,52 +204,265 @@ GT3_setMaskSize(GT3_Datamask *ptr, size_t nelem)
     ptr->nelem = nelem;
     ptr->reserved = nelem;
     ptr->mask = mask;
+    ptr->raw_ = raw;
     return 0;
 }
 
 
 /*
- * XXX: Mask index are used only when MR4/MR8.
+ * GT3_updateMaskIndex() builds the rank index of the mask, by which
+ * GT3_getMaskRank() counts MASK-ON elements in O(1).
+ *
+ * The index consists of the rank at every 64 words (superblock) and
+ * the rank at each word relative to its superblock.  Both are
+ * computed by popcount of each word.
+ *
+ * 'interval' is not used any longer (kept for compatibility).
  */
 int
 GT3_updateMaskIndex(GT3_Datamask *mask, int interval)
 {
-    size_t i, j, m, idx, idxlen;
+    size_t w, mlen, nsuper, total;
+    uint32_t last;
 
     assert(mask->loaded != -1);
     if (mask->indexed)
         return 0;                 /* no need to update */
 
-    if (interval <= 0 || mask->nelem % interval != 0)
-        return -1;
-
-    idxlen = mask->nelem / interval + 1;
-    if (idxlen > mask->index_len) {
+    mlen = (mask->nelem + 31) / 32;
+    nsuper = mlen / 64 + 1;
+    if (nsuper > mask->index_len) {
         size_t *ptr;
 
-        if ((ptr = malloc(sizeof(size_t) * idxlen)) == NULL) {
+        if ((ptr = malloc(sizeof(size_t) * nsuper)) == NULL) {
             gt3_error(SYSERR, NULL);
             return -1;
         }
         free(mask->index);
         mask->index = ptr;
-        mask->index_len = idxlen;
+        mask->index_len = nsuper;
     }
 
-    for (j = 0, idx = 0; j < idxlen - 1; j++) {
-        mask->index[j] = idx;
+    /*
+     * 'rank_' is (re)allocated with the mask in GT3_setMaskSize().
+     */
+    if (!mask->rank_
+        && (mask->rank_ = malloc(sizeof(unsigned short)
+                                 * ((mask->reserved + 31) / 32 + 1)))
+        == NULL) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
 
-        for (m = 0, i = j * interval; m < interval; m++)
-            if (getbit(mask->mask, i + m))
-                idx++;
+    for (w = 0, total = 0; w < mlen; w++) {
+        if (w % 64 == 0)
+            mask->index[w / 64] = total;
+        mask->rank_[w] = (unsigned short)(total - mask->index[w / 64]);
+
+        if (w == mlen - 1 && mask->nelem % 32 != 0) {
+            /* ignore the bits beyond 'nelem' */
+            last = mask->mask[w] & ~(0xffffffffU >> (mask->nelem % 32));
+            total += popcount32(last);
+        } else
+            total += popcount32(mask->mask[w]);
     }
+    if (mlen % 64 == 0)
+        mask->index[mlen / 64] = total;
+    mask->rank_[mlen] = (unsigned short)(total - mask->index[mlen / 64]);
 
-    mask->index[idxlen - 1] = idx;
     mask->indexed = 1;
     return 0;
 }
 
 
+/*
+ * GT3_getMaskRank() returns the # of MASK-ON elements before the
+ * 'i'-th (0 <= i <= nelem).
+ * GT3_updateMaskIndex() must be called in advance.
+ */
+size_t
+GT3_getMaskRank(const GT3_Datamask *mask, size_t i)
+{
+    size_t w = i / 32;
+    unsigned r = (unsigned)(i % 32);
+    size_t rank;
+
+    assert(mask->indexed && i <= mask->nelem);
+
+    rank = mask->index[w / 64] + mask->rank_[w];
+    if (r > 0)
+        rank += popcount32(mask->mask[w] >> (32U - r));
+    return rank;
+}
+
+
+/*
+ * mask_positions() stores the positions (relative to 'pos') of MASK-ON
+ * elements in [pos, pos + nelem) into 'index' in ascending order, and
+ * returns the # of them.
+ *
+ * Each word is processed by its MASK-ON bits (the lowest first, which
+ * is the last element in the word), so that the work is proportional
+ * to nelem / 32 plus the # of MASK-ON elements.
+ */
+size_t
+mask_positions(int *index, const uint32_t *mask, size_t pos, size_t nelem)
+{
+    static const unsigned char debruijn[] = {
+        0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+        31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9
+    };
+    size_t end = pos + nelem, base, w, k, cnt = 0;
+    uint32_t bits, low;
+
+    for (w = pos / 32; 32 * w < end; w++) {
+        base = 32 * w;
+        bits = mask[w];
+        if (base < pos)
+            bits &= 0xffffffffU >> (pos - base);
+        if (end - base < 32)
+            bits &= ~(0xffffffffU >> (end - base));
+
+        cnt += popcount32(bits);
+        for (k = cnt; bits; bits &= bits - 1) {
+            low = bits & (~bits + 1U);
+            index[--k] = (int)(base + 31U
+                               - debruijn[(uint32_t)(low * 0x077cb531U) >> 27]
+                               - pos);
+        }
+    }
+    return cnt;
+}
+
+
+/*
+ * expand_masked() stores MASK-ON values taken from 'src' (up to 'nsrc')
+ * and MISS at MASK-OFF elements into 'dest' (up to 'nout'), following
+ * the mask bits from the 'pos'-th.
+ * It stops when 'nout' elements are stored, or at the MASK-ON element
+ * after 'nsrc' values are used up.
+ *
+ * The mask is processed by 32 bits: all-zero and all-one words are
+ * filled and copied as a block, and the other words are expanded
+ * without branch.  Only the bits before the first word boundary and
+ * those after the last full word are tested one by one.
+ *
+ * '*nused' is set to the # of values used.
+ * return value: the # of elements stored.
+ */
+size_t
+expand_masked(double *dest, size_t nout, const double *src, size_t nsrc,
+              const uint32_t *mask, size_t pos, double miss, size_t *nused)
+{
+    size_t i = 0, k = 0;
+    uint32_t w;
+    unsigned b, bit;
+
+    for (; i < nout && (pos + i) % 32 != 0; i++)
+        if (!getbit_m(mask, pos + i))
+            dest[i] = miss;
+        else if (k < nsrc)
+            dest[i] = src[k++];
+        else
+            goto finish;
+
+    for (; nout - i >= 32; i += 32) {
+        w = mask[(pos + i) / 32];
+        if (w == 0U) {
+            for (b = 0; b < 32; b++)
+                dest[i + b] = miss;
+        } else if (w == 0xffffffffU && nsrc - k >= 32) {
+            memcpy(dest + i, src + k, 32 * sizeof(double));
+            k += 32;
+        } else if (w != 0xffffffffU && popcount32(w) < nsrc - k) {
+            /* src[k] is always in range here. */
+            for (b = 0; b < 32; b++) {
+                bit = (w >> (31U - b)) & 1U;
+                dest[i + b] = bit ? src[k] : miss;
+                k += bit;
+            }
+        } else
+            break;
+    }
+
+    for (; i < nout; i++)
+        if (!getbit_m(mask, pos + i))
+            dest[i] = miss;
+        else if (k < nsrc)
+            dest[i] = src[k++];
+        else
+            break;
+
+finish:
+    *nused = k;
+    return i;
+}
+
+
+/*
+ * float version of expand_masked().
+ */
+size_t
+expand_maskedf(float *dest, size_t nout, const float *src, size_t nsrc,
+               const uint32_t *mask, size_t pos, float miss, size_t *nused)
+{
+    size_t i = 0, k = 0;
+    uint32_t w;
+    unsigned b, bit;
+
+    for (; i < nout && (pos + i) % 32 != 0; i++)
+        if (!getbit_m(mask, pos + i))
+            dest[i] = miss;
+        else if (k < nsrc)
+            dest[i] = src[k++];
+        else
+            goto finish;
+
+    for (; nout - i >= 32; i += 32) {
+        w = mask[(pos + i) / 32];
+        if (w == 0U) {
+            for (b = 0; b < 32; b++)
+                dest[i + b] = miss;
+        } else if (w == 0xffffffffU && nsrc - k >= 32) {
+            memcpy(dest + i, src + k, 32 * sizeof(float));
+            k += 32;
+        } else if (w != 0xffffffffU && popcount32(w) < nsrc - k) {
+            for (b = 0; b < 32; b++) {
+                bit = (w >> (31U - b)) & 1U;
+                dest[i + b] = bit ? src[k] : miss;
+                k += bit;
+            }
+        } else
+            break;
+    }
+
+    for (; i < nout; i++)
+        if (!getbit_m(mask, pos + i))
+            dest[i] = miss;
+        else if (k < nsrc)
+            dest[i] = src[k++];
+        else
+            break;
+
+finish:
+    *nused = k;
+    return i;
+}
+
+
+/*
+ * GT3_getMaskStats() gets the # of masks loaded, and the # of them
+ * found identical to the previous one (whose index has been reused).
+ */
+void
+GT3_getMaskStats(const GT3_Datamask *mask,
+                 unsigned long *loaded, unsigned long *reused)
+{
+    *loaded = mask->nload_;
+    *reused = mask->nreuse_;
+}
+
+
 int
 GT3_getMaskValue(const GT3_Datamask *mask, int i)
 {
@@ -139,6 +471,63 @@ GT3_getMaskValue(const GT3_Datamask *mask, int i)
 }
 
 
+/*
+ * same_words() compares two sequences of mask words as stored in
+ * the file (big-endian), ignoring the padding bits.
+ */
+static int
+same_words(const uint32_t *w1, const uint32_t *w2, size_t mlen, size_t nelem)
+{
+    uint32_t v1, v2, pad;
+
+    if (mlen == 0)
+        return 1;
+    if (memcmp(w1, w2, 4 * (mlen - 1)) != 0)
+        return 0;
+
+    v1 = w1[mlen - 1];
+    v2 = w2[mlen - 1];
+    if (IS_LITTLE_ENDIAN) {
+        reverse_words(&v1, 1);
+        reverse_words(&v2, 1);
+    }
+    pad = nelem % 32 != 0 ? 0xffffffffU >> (nelem % 32) : 0;
+    return (v1 & ~pad) == (v2 & ~pad);
+}
+
+
+/*
+ * keep_or_reset() is called after new mask words are read in the
+ * second half of raw_.
+ * If they are identical to the previous ones (kept in the first half),
+ * the mask and its index are kept; otherwise the words are decoded
+ * and the index is reset.
+ * The index is valid for the kept words even if 'loaded' has been
+ * invalidated by the caller (reset_mask() clears 'nkept_').
+ * In output of ocean models etc., the mask is usually the same
+ * in all the chunks.
+ */
+static void
+keep_or_reset(GT3_Datamask *mask, size_t mlen)
+{
+    uint32_t *kept = mask->raw_, *temp = mask->raw_ + mlen;
+
+    mask->nload_++;
+    if (mask->nkept_ == mlen && same_words(kept, temp, mlen, mask->nelem)) {
+        mask->nreuse_++;
+        return;
+    }
+
+    reset_mask(mask);
+    memcpy(kept, temp, 4 * mlen);
+    if (IS_LITTLE_ENDIAN)
+        copy_reverse_words(mask->mask, temp, mlen);
+    else
+        memcpy(mask->mask, temp, 4 * mlen);
+    mask->nkept_ = mlen;
+}
+
+
 /*
  * load mask data from MR4 or MR8.
  */
@@ -149,27 +538,23 @@ GT3_loadMask(GT3_Datamask *mask, GT3_File *fp)
 
     assert(fp->fmt == GT3_FMT_MR4 || fp->fmt == GT3_FMT_MR8);
 
-    if (mask->loaded == fp->curr)
+    if (mask->loaded == fp->curr && mask->zcur_ == 0)
         return 0;
 
     nelem = fp->dimlen[0] * fp->dimlen[1] * fp->dimlen[2];
     mlen = (nelem + 31) / 32;
-    if (GT3_setMaskSize(mask, nelem) < 0)
+    if (switch_plane(mask, 0) < 0 || GT3_setMaskSize(mask, nelem) < 0)
         return -1;
 
-    if (fseeko(fp->fp,
+    if (xpread(mask->raw_ + mlen, 4, mlen,
                fp->off + GT3_HEADER_SIZE + 4
-               + 5 * sizeof(fort_size_t),
-               SEEK_SET) < 0
-        || fread(mask->mask, 4, mlen, fp->fp) != mlen) {
+               + 5 * sizeof(fort_size_t), fp) < 0) {
+        reset_mask(mask);
         gt3_error(GT3_ERR_BROKEN, fp->path);
         return -1;
     }
 
-    if (IS_LITTLE_ENDIAN)
-        reverse_words(mask->mask, mlen);
-
-    reset_mask(mask);
+    keep_or_reset(mask, mlen);
     mask->loaded = fp->curr;
     return 0;
 }
@@ -191,26 +576,23 @@ GT3_loadMaskX(GT3_Datamask *mask, int zpos, GT3_File *fp)
 
     nelem = fp->dimlen[0] * fp->dimlen[1];
     mlen = (nelem + 31) / 32;
-    if (GT3_setMaskSize(mask, nelem) < 0)
+    if (switch_plane(mask, zpos) < 0 || GT3_setMaskSize(mask, nelem) < 0)
         return -1;
 
-    if (fseeko(fp->fp,
+    if (xpread(mask->raw_ + mlen, 4, mlen,
                fp->off + 10 * sizeof(fort_size_t)
                + GT3_HEADER_SIZE
                + 4
                + 4 * fp->dimlen[2]
                + 4 * fp->dimlen[2]
                + 2 * 8 * fp->dimlen[2]
-               + sizeof(fort_size_t) + 4 * mlen * zpos,
-               SEEK_SET) < 0
-        || fread(mask->mask, 4, mlen, fp->fp) != mlen) {
+               + sizeof(fort_size_t) + 4 * mlen * zpos, fp) < 0) {
+        reset_mask(mask);
         gt3_error(GT3_ERR_BROKEN, fp->path);
         return -1;
     }
-    if (IS_LITTLE_ENDIAN)
-        reverse_words(mask->mask, mlen);
 
-    reset_mask(mask);
+    keep_or_reset(mask, mlen);
     mask->loaded = (fp->curr << 16 | zpos);
     return 0;
 }
@@ -218,6 +600,251 @@ GT3_loadMaskX(GT3_Datamask *mask, int zpos, GT3_File *fp)
 
 #ifdef TEST_MAIN
 #include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+/*
+ * compare expand_masked() with bit-by-bit expansion.
+ */
+static void
+test_expand(void)
+{
+    uint32_t mask[8];
+    double src[256], dest[256 + 1], expect[256 + 1];
+    float srcf[256], destf[256 + 1];
+    size_t pos, nout, nsrc, nused, n, i, k;
+    unsigned u = 1;
+
+    mask[0] = 0x00000000;
+    mask[1] = 0xffffffff;
+    mask[2] = 0x0f0f1234;
+    mask[3] = 0xffffffff;
+    mask[4] = 0x00000000;
+    for (i = 5; i < 8; i++) {
+        u = u * 1103515245U + 12345U;
+        mask[i] = u;
+    }
+    for (i = 0; i < 256; i++) {
+        src[i] = i + 1.;
+        srcf[i] = (float)(i + 1);
+    }
+
+    for (pos = 0; pos < 40; pos += 3)
+        for (nout = 0; nout <= 256 - pos; nout += 7)
+            for (nsrc = 0; nsrc < 200; nsrc += 13) {
+                for (i = 0, k = 0; i < nout; i++) {
+                    if (!getbit(mask, pos + i))
+                        expect[i] = -999.;
+                    else if (k < nsrc)
+                        expect[i] = src[k++];
+                    else
+                        break;
+                }
+                expect[i] = dest[i] = 0.;
+
+                n = expand_masked(dest, nout, src, nsrc, mask, pos,
+                                  -999., &nused);
+                assert(n == i && nused == k);
+                assert(memcmp(dest, expect, sizeof(double) * (n + 1)) == 0);
+
+                n = expand_maskedf(destf, nout, srcf, nsrc, mask, pos,
+                                   -999.f, &nused);
+                assert(n == i && nused == k);
+                for (i = 0; i < n; i++)
+                    assert(destf[i] == (float)expect[i]);
+            }
+}
+
+
+/*
+ * compare GT3_getMaskRank() with counting bits.
+ */
+static void
+test_rank(void)
+{
+    GT3_Datamask *mask;
+    size_t nelem, i, mlen, rank;
+    unsigned u = 7;
+
+    mask = GT3_newMask();
+    for (nelem = 0; nelem < 10000; nelem += 997) {
+        assert(GT3_setMaskSize(mask, nelem) == 0);
+        mlen = (nelem + 31) / 32;
+        for (i = 0; i < mlen; i++) {
+            u = u * 1103515245U + 12345U;
+            mask->mask[i] = (i % 5 == 0) ? 0xffffffffU : u;
+        }
+        mask->loaded = 0;
+        mask->indexed = 0;
+        assert(GT3_updateMaskIndex(mask, 1) == 0);
+
+        for (i = 0, rank = 0; i <= nelem; i++) {
+            assert(GT3_getMaskRank(mask, i) == rank);
+            if (i < nelem)
+                rank += getbit(mask->mask, i);
+        }
+    }
+    GT3_freeMask(mask);
+    free(mask);
+}
+
+
+/*
+ * compare mask_positions() with testing bits.
+ */
+static void
+test_positions(void)
+{
+    uint32_t mask[8];
+    int index[256];
+    size_t pos, nelem, n, i, k;
+    unsigned u = 3;
+
+    mask[0] = 0x00000000;
+    mask[1] = 0xffffffff;
+    mask[2] = 0x80000001;
+    for (i = 3; i < 8; i++) {
+        u = u * 1103515245U + 12345U;
+        mask[i] = u;
+    }
+
+    for (pos = 0; pos < 70; pos++)
+        for (nelem = 0; nelem <= 256 - pos; nelem += 5) {
+            n = mask_positions(index, mask, pos, nelem);
+            for (i = 0, k = 0; i < nelem; i++)
+                if (getbit(mask, pos + i)) {
+                    assert(k < n && index[k] == i);
+                    k++;
+                }
+            assert(k == n);
+        }
+}
+
+
+/*
+ * the index is kept if the same mask is loaded again.
+ */
+static void
+test_reuse(void)
+{
+    GT3_Datamask *mask;
+    unsigned long nload, nreuse;
+    size_t i, nelem = 1000, mlen = (nelem + 31) / 32;
+
+    uint32_t *temp;
+
+    mask = GT3_newMask();
+    assert(GT3_setMaskSize(mask, nelem) == 0);
+    temp = mask->raw_ + mlen;   /* words as read from the file */
+    for (i = 0; i < mlen; i++)
+        temp[i] = 0xf0f0f0f0U;
+
+    keep_or_reset(mask, mlen);
+    assert(mask->mask[mlen - 1] == 0xf0f0f0f0U);
+    mask->loaded = 1;
+    assert(GT3_updateMaskIndex(mask, 1) == 0);
+
+    /* the same (except the padding) */
+    temp[mlen - 1] = 0xf0f0f0f1U;
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(temp + mlen - 1, 1);
+    keep_or_reset(mask, mlen);
+    assert(mask->indexed);
+
+    /* 'loaded' invalidated: still kept if the same. */
+    mask->loaded = -1;
+    keep_or_reset(mask, mlen);
+    assert(mask->indexed);
+    mask->loaded = 1;
+
+    /* different */
+    temp[3] = 0;
+    keep_or_reset(mask, mlen);
+    assert(!mask->indexed);
+    assert(mask->mask[3] == 0 && mask->mask[4] == 0xf0f0f0f0U);
+
+    /* resized */
+    mask->loaded = 1;
+    assert(GT3_updateMaskIndex(mask, 1) == 0);
+    assert(GT3_setMaskSize(mask, nelem - 1) == 0);
+    temp = mask->raw_ + mlen;
+    keep_or_reset(mask, mlen);
+    assert(!mask->indexed);
+
+    GT3_getMaskStats(mask, &nload, &nreuse);
+    assert(nload == 5 && nreuse == 2);
+
+    GT3_freeMask(mask);
+    free(mask);
+}
+
+
+/*
+ * In MRY, the mask varying with z is reused in each z-plane.
+ */
+static double
+level_value(int t, int i, int z)
+{
+    int cut = (t == 2 && z == 1) ? 5 : 0; /* changed in the 3rd */
+
+    return ((i + cut) % (z + 2) == 0) ? -999. : 100. * t + z + 0.01 * i;
+}
+
+
+static void
+test_levels(void)
+{
+    const char *path = "mask-test.gt";
+    const char *fmts[] = { "MRY16", "MRY12", "MRY16", "MR4", "MRY16" };
+    double data[40 * 3 * 4], value;
+    GT3_HEADER head;
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    FILE *output;
+    unsigned long nload, nreuse;
+    /*
+     * # of loaded and reused: all z-planes are reused in the 2nd,
+     * but z = 1 in the 3rd.  In the 5th, z = 2 and 3 are reused
+     * across the MR4 chunk.
+     */
+    unsigned long expect[][2] = {
+        { 4, 0 }, { 8, 4 }, { 12, 7 }, { 13, 7 }, { 17, 9 }
+    };
+    int i, t, z;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    for (t = 0; t < 5; t++) {
+        for (z = 0; z < 4; z++)
+            for (i = 0; i < 40 * 3; i++)
+                data[i + 40 * 3 * z] = level_value(t % 3, i, z);
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 40, 3, 4,
+                         &head, fmts[t], output) == 0);
+    }
+    fclose(output);
+
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    for (t = 0; t < 5; t++) {
+        for (z = 0; z < 4; z++) {
+            assert(GT3_readVarZ(var, z) == 0);
+            for (i = 0; i < 40 * 3; i++) {
+                assert(GT3_readVar(&value, var, i % 40, i / 40, z) == 0);
+                assert(fabs(value - level_value(t % 3, i, z)) < 0.01);
+            }
+        }
+        GT3_getVarbufMaskStats(var, &nload, &nreuse);
+        assert(nload == expect[t][0] && nreuse == expect[t][1]);
+        GT3_next(fp);
+    }
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    remove(path);
+}
 
 
 int
@@ -258,6 +885,12 @@ main(int argc, char **argv)
     assert(getbit(mask, 93) == 0);
     assert(getbit(mask, 94));
     assert(getbit(mask, 95) == 0);
+
+    test_expand();
+    test_rank();
+    test_positions();
+    test_reuse();
+    test_levels();
     return 0;
 }
 #endif
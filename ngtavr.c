@@ -15,6 +15,7 @@
 #include "gtool3.h"
 #include "seq.h"
 #include "fileiter.h"
+#include "chunkmap.h"
 #include "myutils.h"
 #include "dateiter.h"
 #include "logging.h"
@@ -40,6 +41,7 @@ struct average {
     unsigned count;
     double duration;            /* in HOUR */
     double total_wght;
+    int zero_dt;                /* including zero time-duration */
     GT3_Date date1, date2;
     GT3_HEADER head;
 };
@@ -56,24 +58,11 @@ static int calendar_type = GT3_CAL_GREGORIAN;
 static int ignore_tdur = 0;
 static double limit_factor = 0.;
 static char *g_format = "UR4";
-static int alive_limit = 10;
 
 static int integrating_mode = 0;
 static double timedur_factor = 0.;
 static int skip_leapday = 0;
-
-
-static void
-set_alive_limit(void)
-{
-#ifdef HAVE_SYSCONF
-    alive_limit = sysconf(_SC_OPEN_MAX) / 2;
-#elif defined(OPEN_MAX)
-    alive_limit = OPEN_MAX / 2;
-#endif
-
-    alive_limit = min(alive_limit, 100);
-}
+static int nthreads = 0;        /* -j (0: not parallel) */
 
 
 static int
@@ -140,6 +129,7 @@ clear_average(struct average *avr)
     avr->count = 0;
     avr->duration = 0.;
     avr->total_wght = 0.;
+    avr->zero_dt = 0;
 
     GT3_setDate(&avr->date1, 0, 1, 1, 0, 0, 0);
     GT3_setDate(&avr->date2, 9999, 1, 1, 0, 0, 0);
@@ -200,32 +190,40 @@ get_calendar_type(const char *path)
 }
 
 
+/*
+ * 'zseq' is g_zseq, or a copy of it in each thread.
+ */
 static int
 integrate(double *vsum, double *tsum,
           int len, int nz,
-          GT3_Varbuf *var, double weight)
+          GT3_Varbuf *var, double weight, struct sequence *zseq)
 {
     int len2;
     int rval = 0;
-    int i, n, z;
+    int i, k, n, z, num;
+    const int *index;
 
     len2 = min(len, var->fp->dimlen[0] * var->fp->dimlen[1]);
     if (len != len2)
         logging(LOG_WARN, "# of horizontal grids has changed.");
 
-    if (g_zseq)
-        reinitSeq(g_zseq, 1, var->fp->dimlen[2]);
+    if (zseq)
+        reinitSeq(zseq, 1, var->fp->dimlen[2]);
 
     for (n = 0; n < nz; n++) {
-        if (g_zseq) {
-            if (nextSeq(g_zseq) < 0) {
+        if (zseq) {
+            if (nextSeq(zseq) < 0) {
                 assert(!"NOTREACHED");
             }
-            z = g_zseq->curr - 1;
+            z = zseq->curr - 1;
         } else
             z = g_zrange.str + n;
 
-        if (GT3_readVarZ(var, z) < 0) {
+        /*
+         * Masked data are read as they are packed, and 'index' is the
+         * position of each value (NULL if not masked).
+         */
+        if ((num = GT3_readVarPacked(var, z, &index)) < 0) {
             GT3_printErrorMessages(stderr);
             continue;
         }
@@ -234,20 +232,28 @@ integrate(double *vsum, double *tsum,
             double miss = var->miss;
             double *data = var->data;
 
-            for (i = 0; i < len2; i++)
-                if (data[i] != miss) {
-                    vsum[i] += data[i] * weight;
+            for (k = 0; k < num; k++) {
+                i = index ? index[k] : k;
+                if (i >= len2)
+                    break;
+                if (data[k] != miss) {
+                    vsum[i] += data[k] * weight;
                     tsum[i] += weight;
                 }
+            }
         } else {
             float miss = var->miss;
             float *data = var->data;
 
-            for (i = 0; i < len2; i++)
-                if (data[i] != miss) {
-                    vsum[i] += data[i] * weight;
+            for (k = 0; k < num; k++) {
+                i = index ? index[k] : k;
+                if (i >= len2)
+                    break;
+                if (data[k] != miss) {
+                    vsum[i] += data[k] * weight;
                     tsum[i] += weight;
                 }
+            }
         }
         vsum += len; /* XXX: NOT len2 */
         tsum += len; /* XXX: NOT len2 */
@@ -335,7 +341,7 @@ get_tstepsize(const GT3_HEADER *head,
 
 
 static int
-write_average(const struct average *avr, FILE *fp)
+write_average(const struct average *avr, GT3_Writer *fp)
 {
     int rval;
     GT3_Date date, origin;
@@ -405,9 +411,9 @@ write_average(const struct average *avr, FILE *fp)
             avr->date2.year, avr->date2.mon, avr->date2.day,
             avr->date2.hour, avr->date2.min, avr->date2.sec);
 
-    rval = GT3_write(avr->data, GT3_TYPE_DOUBLE,
-                     avr->shape[0], avr->shape[1], avr->shape[2],
-                     &head, g_format, fp);
+    rval = GT3_writerWrite(fp, avr->data, GT3_TYPE_DOUBLE,
+                           avr->shape[0], avr->shape[1], avr->shape[2],
+                           &head, g_format);
     if (rval < 0)
         GT3_printErrorMessages(stderr);
 
@@ -440,7 +446,7 @@ average(struct average *avr)
  * integrate_chunk() integrates a current chunk.
  */
 static int
-integrate_chunk(struct average *avr, GT3_Varbuf *var)
+integrate_chunk(struct average *avr, GT3_Varbuf *var, struct sequence *zseq)
 {
     double dt;
     GT3_HEADER head;
@@ -482,6 +488,8 @@ integrate_chunk(struct average *avr, GT3_Varbuf *var)
         logging(LOG_ERR, "Use \"-n\" option to work around.");
         return -1;
     }
+    if (dt == 0.)
+        avr->zero_dt = 1;
 
     /*
      * integral
@@ -489,7 +497,7 @@ integrate_chunk(struct average *avr, GT3_Varbuf *var)
     wght = (ignore_tdur || dt == 0.) ? 1. : dt;
     if (integrate(avr->data, avr->wght,
                   avr->shape[0] * avr->shape[1], avr->shape[2],
-                  var, wght) < 0)
+                  var, wght, zseq) < 0)
         return -1;
 
 
@@ -551,7 +559,7 @@ ngtavr_seq(struct average *avr, const char *path, struct sequence *seq)
         if (stat == ITER_OUTRANGE)
             continue;
 
-        if (integrate_chunk(avr, var) < 0)
+        if (integrate_chunk(avr, var, g_zseq) < 0)
             goto finish;
     }
     rval = 0;
@@ -568,7 +576,7 @@ finish:
 static int
 ngtavr_eachstep(struct average *avr,
                 const char *path, const GT3_Date *step,
-                struct sequence *seq, FILE *output)
+                struct sequence *seq, GT3_Writer *output)
 {
     static GT3_Varbuf *var = NULL;
     static DateIterator it;
@@ -628,7 +636,7 @@ ngtavr_eachstep(struct average *avr,
     }
 
     while (!GT3_eof(fp) && fp->curr < last) {
-        if (integrate_chunk(avr, var) < 0)
+        if (integrate_chunk(avr, var, g_zseq) < 0)
             goto finish;
 
         diff = cmpDateIterator(&it, &avr->date2);
@@ -662,11 +670,10 @@ finish:
  * Process each chunk from the beginning of the file.
  */
 static int
-ngtavr_cyc(char **paths, int nfiles, FILE *ofp)
+ngtavr_cyc(char **paths, int nfiles, GT3_Writer *ofp)
 {
     GT3_File **inputs = NULL;
     GT3_Varbuf *var = NULL;
-    int keep_alive = (nfiles <= alive_limit);
     GT3_File *fp;
     struct average avr;
     int n, rval = -1;
@@ -685,7 +692,7 @@ ngtavr_cyc(char **paths, int nfiles, FILE *ofp)
             GT3_printErrorMessages(stderr);
             goto finish;
         }
-        if (!keep_alive && GT3_suspend(inputs[n]) < 0) {
+        if (GT3_poolFile(inputs[n]) < 0) {
             GT3_printErrorMessages(stderr);
             goto finish;
         }
@@ -698,10 +705,6 @@ ngtavr_cyc(char **paths, int nfiles, FILE *ofp)
             if (GT3_eof(fp))
                 continue;
 
-            if (!keep_alive && GT3_resume(fp) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
             if (var == NULL) {
                 if ((var = GT3_getVarbuf(fp)) == NULL) {
                     GT3_printErrorMessages(stderr);
@@ -729,17 +732,13 @@ ngtavr_cyc(char **paths, int nfiles, FILE *ofp)
                 first_data = 0;
             }
 
-            if (!GT3_eof(fp) && integrate_chunk(&avr, var) < 0)
+            if (!GT3_eof(fp) && integrate_chunk(&avr, var, g_zseq) < 0)
                 goto finish;
 
             if (GT3_next(fp) < 0) {
                 GT3_printErrorMessages(stderr);
                 goto finish;
             }
-            if (!keep_alive && GT3_suspend(fp) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
         }
         if (first_data)
             break;
@@ -765,11 +764,11 @@ finish:
  * (`skip_leayday` is not supported in this func).
  */
 static int
-ngtavr_cyc_seq(char **paths, int nfiles, struct sequence *seq, FILE *ofp)
+ngtavr_cyc_seq(char **paths, int nfiles, struct sequence *seq,
+               GT3_Writer *ofp)
 {
     GT3_File **inputs = NULL;
     GT3_Varbuf *var = NULL;
-    int keep_alive = (nfiles <= alive_limit);
     GT3_File *fp;
     struct average avr;
     int n, rval = -1;
@@ -787,7 +786,7 @@ ngtavr_cyc_seq(char **paths, int nfiles, struct sequence *seq, FILE *ofp)
             GT3_printErrorMessages(stderr);
             goto finish;
         }
-        if (!keep_alive && GT3_suspend(inputs[n]) < 0) {
+        if (GT3_poolFile(inputs[n]) < 0) {
             GT3_printErrorMessages(stderr);
             goto finish;
         }
@@ -797,11 +796,6 @@ ngtavr_cyc_seq(char **paths, int nfiles, struct sequence *seq, FILE *ofp)
         for (n = 0; n < nfiles; n++) {
             fp = inputs[n];
 
-            if (!keep_alive && GT3_resume(fp) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
-
             if (GT3_seek(fp, seq->curr - 1, SEEK_SET) < 0) {
                 GT3_printErrorMessages(stderr);
                 goto finish;
@@ -821,13 +815,8 @@ ngtavr_cyc_seq(char **paths, int nfiles, struct sequence *seq, FILE *ofp)
             if (n == 0 && setup_average(&avr, var) < 0)
                 goto finish;
 
-            if (integrate_chunk(&avr, var) < 0)
-                goto finish;
-
-            if (!keep_alive && GT3_suspend(fp) < 0) {
-                GT3_printErrorMessages(stderr);
+            if (integrate_chunk(&avr, var, g_zseq) < 0)
                 goto finish;
-            }
         }
 
         average(&avr);
@@ -846,6 +835,173 @@ finish:
 }
 
 
+/*
+ * Parallel mode (-j) of ngtavr_seq(): each block of chunks is integrated
+ * in its own average, and they are merged in the fixed order
+ * (see chunkmap.c).
+ */
+static void *
+new_part(void *arg)
+{
+    const struct average *tmpl = arg;
+    struct average *avr;
+
+    if ((avr = malloc(sizeof(struct average))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return NULL;
+    }
+    init_average(avr);
+    if (alloc_average(avr, tmpl->len) < 0) {
+        free(avr);
+        return NULL;
+    }
+    memcpy(avr->shape, tmpl->shape, sizeof avr->shape);
+    avr->miss = tmpl->miss;
+    clear_average(avr);
+    return avr;
+}
+
+
+static void
+free_part(void *part, void *arg)
+{
+    free_average(part);
+    free(part);
+}
+
+
+static int
+new_zseq(void **local, void *arg)
+{
+    *local = NULL;
+    if (g_zseq && (*local = initSeq(g_zseq->spec, 1, RANGE_MAX)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void
+free_zseq(void *local, void *arg)
+{
+    if (local) {
+        freeSeq(local);
+        free(local);
+    }
+}
+
+
+static int
+map_chunk(void *part, GT3_Varbuf *var, const struct cm_task *task,
+          void *local, void *arg)
+{
+    return integrate_chunk(part, var, local);
+}
+
+
+static int
+merge_average(void *dest, void *src, void *arg)
+{
+    struct average *avr = dest, *avr2 = src, tmp;
+    size_t i;
+
+    if (avr2->count == 0)
+        return 0;
+    if (avr->count == 0) {
+        tmp = *avr;
+        *avr = *avr2;
+        *avr2 = tmp;
+        return 0;
+    }
+
+    if (avr2->zero_dt && avr->duration > 0. && !ignore_tdur) {
+        logging(LOG_ERR, "Time-duration has changed from non-zero to zero.");
+        logging(LOG_ERR, "Use \"-n\" option to work around.");
+        return -1;
+    }
+    cmp_heads(&avr->head, &avr2->head);
+
+    for (i = 0; i < avr->len; i++) {
+        avr->data[i] += avr2->data[i];
+        avr->wght[i] += avr2->wght[i];
+    }
+    avr->date2 = avr2->date2;
+    avr->count += avr2->count;
+    avr->duration += avr2->duration;
+    avr->total_wght += avr2->total_wght;
+    avr->zero_dt |= avr2->zero_dt;
+    return 0;
+}
+
+
+static int
+ngtavr_parallel(char **paths, int nfiles, struct sequence *seq,
+                GT3_Writer *ofp)
+{
+    struct chunkmap_ops ops;
+    struct average tmpl, *avr = NULL;
+    chunkmap *cm = NULL;
+    GT3_File *fp;
+    GT3_Varbuf *var = NULL;
+    int n, rval = -1;
+
+    memset(&ops, 0, sizeof ops);
+    ops.new_part = new_part;
+    ops.free_part = free_part;
+    ops.new_local = new_zseq;
+    ops.free_local = free_zseq;
+    ops.map = map_chunk;
+    ops.merge = merge_average;
+
+    /*
+     * The shape is of the first chunk in the first file.
+     */
+    init_average(&tmpl);
+    if ((fp = GT3_open(paths[0])) == NULL
+        || (var = GT3_getVarbuf(fp)) == NULL) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+    calendar_type = get_calendar_type(paths[0]);
+    if (setup_average(&tmpl, var) < 0)
+        goto finish;
+
+    if ((cm = new_chunkmap(&ops, &tmpl, nthreads)) == NULL) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+    for (n = 0; n < nfiles; n++) {
+        if (chunkmap_add_file(cm, paths[n], seq) < 0) {
+            GT3_printErrorMessages(stderr);
+            logging(LOG_ERR, "failed to process %s.", paths[n]);
+            goto finish;
+        }
+        if (seq)
+            reinitSeq(seq, 1, RANGE_MAX);
+    }
+
+    if (chunkmap_reduce((void **)&avr, cm) < 0) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+
+    average(avr);
+    if (write_average(avr, ofp) < 0)
+        goto finish;
+    rval = 0;
+
+finish:
+    if (avr)
+        free_part(avr, NULL);
+    free_chunkmap(cm);
+    free_average(&tmpl);
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    return rval;
+}
+
+
 /*
  * parse an argument of the -m option.
  */
@@ -936,6 +1092,7 @@ usage(void)
         "    -a        append to output file\n"
         "    -c        cyclic mode\n"
         "    -f fmt    specify output format\n"
+        "    -j NUM    use NUM threads (0: all processors)\n"
         "    -k        skip leap day\n"
         "    -l dble   specify limit factor (by default 0.)\n"
         "    -m tdur   specify time-duration\n"
@@ -970,7 +1127,7 @@ main(int argc, char **argv)
     int ch, exitval = 0;
     const char *ofile = NULL;
     GT3_Date step;
-    FILE *ofp;
+    GT3_Writer *ofp;
     char *mode = "wb";
     enum { SEQUENCE_MODE, EACH_TIMESTEP_MODE, CYCLIC_MODE };
     int avrmode = SEQUENCE_MODE;
@@ -979,9 +1136,8 @@ main(int argc, char **argv)
 
     open_logging(stderr, PROGNAME);
     GT3_setProgname(PROGNAME);
-    set_alive_limit();
 
-    while ((ch = getopt(argc, argv, "acf:kl:hm:no:s:t:vz:")) != -1)
+    while ((ch = getopt(argc, argv, "acf:j:kl:hm:no:s:t:vz:")) != -1)
         switch (ch) {
         case 'a':
             mode = "ab";
@@ -1000,6 +1156,13 @@ main(int argc, char **argv)
             g_format = strdup(optarg);
             break;
 
+        case 'j':
+            if ((nthreads = get_nthreads(optarg)) < 0) {
+                logging(LOG_ERR, "-j: invalid argument: %s", optarg);
+                exit(1);
+            }
+            break;
+
         case 'k':
             skip_leapday = 1;
             break;
@@ -1077,8 +1240,8 @@ main(int argc, char **argv)
         exit(1);
     }
 
-    if ((ofp = fopen(ofile, mode)) == NULL) {
-        logging(LOG_SYSERR, ofile);
+    if ((ofp = GT3_openAsyncWriter(ofile, mode, 0)) == NULL) {
+        GT3_printErrorMessages(stderr);
         exit(1);
     }
 
@@ -1124,6 +1287,9 @@ main(int argc, char **argv)
             logging(LOG_ERR, "failed to process in cyclic mode.");
             exitval = 1;
         }
+    } else if (nthreads > 0) {
+        if (ngtavr_parallel(argv, argc, seq, ofp) < 0)
+            exit(1);
     } else {
         struct average avr;
 
@@ -1143,7 +1309,9 @@ main(int argc, char **argv)
             exitval = 1;
         }
     }
-    fclose(ofp);
-
+    if (GT3_writerClose(ofp) < 0) {
+        GT3_printErrorMessages(stderr);
+        exitval = 1;
+    }
     return exitval;
 }
@@ -317,12 +317,12 @@ unmasked_format(char *fmt)
 
 
 static int
-conv_chunk(FILE *output, const char *dfmt, int optype,
+conv_chunk(GT3_Writer *output, const char *dfmt, int optype,
            GT3_Varbuf *var, GT3_File *fp)
 {
     GT3_HEADER head;
     int nx, ny, nz;
-    int i, n, y, z;
+    int i, n, y, z, zdone = 0;
     size_t offset, nelems;
     struct range range[3];
     int astr[] = { 1, 1, 1 };
@@ -364,7 +364,21 @@ conv_chunk(FILE *output, const char *dfmt, int optype,
         return -1;
     }
 
-    for (n = 0; n < nz; n++) {
+    /*
+     * whole horizontal domain and contiguous z: read at once.
+     */
+    if (!g_zseq
+        && nx == fp->dimlen[0] && ny == fp->dimlen[1]) {
+        if (GT3_readVarZRangeDouble(g_buffer.ptr, g_buffer.reserved, var,
+                                    range[2].str, range[2].end) < 0) {
+            GT3_printErrorMessages(stderr);
+            return -1;
+        }
+        g_buffer.curr = (size_t)nx * ny * nz;
+        zdone = nz;
+    }
+
+    for (n = zdone; n < nz; n++) {
         if (g_zseq) {
             if (nextSeq(g_zseq) < 0) {
                 assert(!"NOTREACHED");
@@ -397,9 +411,14 @@ conv_chunk(FILE *output, const char *dfmt, int optype,
      * output in raw binary format {4-byte,8-byte} {big,little}.
      */
     if (raw_output) {
-        nelems = (size_t)nx * ny * nz;
+        FILE *stream;
 
-        if (raw_output(g_buffer.ptr, nelems, output) != nelems) {
+        nelems = (size_t)nx * ny * nz;
+        if ((stream = GT3_writerStream(output)) == NULL) {
+            GT3_printErrorMessages(stderr);
+            return -1;
+        }
+        if (raw_output(g_buffer.ptr, nelems, stream) != nelems) {
             logging(LOG_SYSERR, NULL);
             return -1;
         }
@@ -430,16 +449,36 @@ conv_chunk(FILE *output, const char *dfmt, int optype,
             logging(LOG_ERR, "INT/MASK_INT is not available (overflow).");
             return -1;
         }
-        rval = GT3_write_bitpack(g_buffer.ptr, GT3_TYPE_DOUBLE,
-                                 nx, ny, nz, &head,
-                                 offset, scale,
-                                 nbits, optype == OP_MASKINT,
-                                 output);
+        rval = GT3_writerWriteBitpack(output, g_buffer.ptr, GT3_TYPE_DOUBLE,
+                                      nx, ny, nz, &head,
+                                      offset, scale,
+                                      nbits, optype == OP_MASKINT);
     } else {
         char asis[17];
         const char *p;
 
-        if (optype == OP_NONE) {
+        if (optype == OP_NONE && strchr(dfmt, ':')) {
+            double miss = -999.;
+            int fmt;
+
+            /*
+             * error-bounded URY/MRY: report the chosen nbits.
+             */
+            GT3_decodeHeaderDouble(&miss, &head, "MISS");
+            if ((fmt = GT3_chooseFormat(asis, dfmt, g_buffer.ptr,
+                                        GT3_TYPE_DOUBLE,
+                                        nx, ny, nz, miss)) < 0) {
+                GT3_printErrorMessages(stderr);
+                return -1;
+            }
+            fmt &= GT3_FMT_MASK;
+            if (fmt != GT3_FMT_URY && fmt != GT3_FMT_MRY)
+                logging(LOG_WARN, "%s: Too small bound, written in %s",
+                        dfmt, asis);
+            else
+                logging(LOG_INFO, "%s -> %s", dfmt, asis);
+            p = asis;
+        } else if (optype == OP_NONE) {
             p = dfmt;
         } else {
             p = asis;
@@ -451,8 +490,8 @@ conv_chunk(FILE *output, const char *dfmt, int optype,
             if (optype == OP_UNMASK)
                 unmasked_format(asis);
         }
-        rval = GT3_write(g_buffer.ptr, GT3_TYPE_DOUBLE,
-                         nx, ny, nz, &head, p, output);
+        rval = GT3_writerWrite(output, g_buffer.ptr, GT3_TYPE_DOUBLE,
+                               nx, ny, nz, &head, p);
     }
     if (rval < 0)
         GT3_printErrorMessages(stderr);
@@ -462,7 +501,7 @@ conv_chunk(FILE *output, const char *dfmt, int optype,
 
 
 static int
-conv_file(const char *path, const char *fmt, int optype, FILE *output,
+conv_file(const char *path, const char *fmt, int optype, GT3_Writer *output,
           struct sequence *seq)
 {
     GT3_File *fp;
@@ -509,6 +548,7 @@ usage(void)
         "    -h        print help message\n"
         "    -a        output in append mode\n"
         "    -f fmt    specify output format (default: UR4)\n"
+        "    -j NUM    encode z-planes with NUM threads (0: all processors)\n"
         "    -v        be verbose\n"
         "    -t LIST   specify data No.\n"
         "    -x RANGE  specify X-range\n"
@@ -521,6 +561,9 @@ usage(void)
         "    GTOOL3 formats:\n"
         "       ur4, ur8, mr4, mr8\n"
         "       ury{01,02,...,31}, mry{01,02,...,31}\n"
+        "       ury:tol=X, mry:tol=X (absolute error <= X)\n"
+        "       ury:rel=X, mry:rel=X (relative error <= X)\n"
+        "       zr4, zr8 (lossless compression)\n"
         "\n"
         "    Special operations:\n"
         "       asis, mask, unmask, int, maskint\n"
@@ -546,14 +589,16 @@ main(int argc, char **argv)
     char *fmt = "UR4";
     int optype = OP_NONE;
     char *outpath = NULL;
-    FILE *output;
+    GT3_Writer *output;
     char dummy[17];
+    char *endptr;
+    long nthreads;
     int i, num_inputs;
     int rval = 0;
 
     open_logging(stderr, PROGNAME);
     GT3_setProgname(PROGNAME);
-    while ((ch = getopt(argc, argv, "af:o:t:vx:y:z:h")) != -1)
+    while ((ch = getopt(argc, argv, "af:j:o:t:vx:y:z:h")) != -1)
         switch (ch) {
         case 'a':
             mode = "ab";
@@ -568,6 +613,14 @@ main(int argc, char **argv)
             }
             fmt = optarg;
             break;
+        case 'j':
+            nthreads = strtol(optarg, &endptr, 10);
+            if (optarg == endptr || *endptr != '\0' || nthreads < 0) {
+                logging(LOG_ERR, "-j: invalid argument: %s", optarg);
+                exit(1);
+            }
+            GT3_setEncodeThreads((int)nthreads);
+            break;
         case 'o':
             outpath = optarg;
             break;
@@ -641,8 +694,8 @@ main(int argc, char **argv)
             exit(1);
         }
 
-    if ((output = fopen(outpath, mode)) == NULL) {
-        logging(LOG_SYSERR, outpath);
+    if ((output = GT3_openAsyncWriter(outpath, mode, 0)) == NULL) {
+        GT3_printErrorMessages(stderr);
         exit(1);
     }
 
@@ -655,6 +708,9 @@ main(int argc, char **argv)
             break;
     }
 
-    fclose(output);
+    if (GT3_writerClose(output) < 0) {
+        GT3_printErrorMessages(stderr);
+        rval = -1;
+    }
     return rval < 0 ? 1 : 0;
 }
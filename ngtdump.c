@@ -173,6 +173,7 @@ dump_var(GT3_Varbuf *var, const GT3_HEADER *head)
      */
     switch (var->fp->fmt) {
     case GT3_FMT_UR8:
+    case GT3_FMT_ZR8:
         nprec = 17;
         break;
     case GT3_FMT_URC:
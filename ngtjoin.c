@@ -20,7 +20,6 @@
 #define RANGE_MAX 0x7fffffff
 
 #define PROGNAME "ngtjoin"
-static int alive_limit = 15;
 
 
 /*
@@ -30,7 +29,6 @@ struct input_set {
     int num;
     GT3_File **fp;              /* lenght: num */
     size_t *offset;             /* length: num */
-    unsigned keep_alive;
 
     GT3_Varbuf *vbuf;
 };
@@ -217,11 +215,6 @@ join_chunk(struct buffer *dest, struct input_set *inset, const int *pattern)
         /*
          * switch input and update varbuf.
          */
-        if (!inset->keep_alive && n > 0 && GT3_resume(inset->fp[n]) < 0) {
-            GT3_printErrorMessages(stderr);
-            return -1;
-        }
-
         if (GT3_reattachVarbuf(inset->vbuf, inset->fp[n]) < 0) {
             GT3_printErrorMessages(stderr);
             return -1;
@@ -247,14 +240,6 @@ join_chunk(struct buffer *dest, struct input_set *inset, const int *pattern)
                                             1);
             }
         }
-
-        /*
-         * suspend input if not keep_alive.
-         */
-        if (!inset->keep_alive && n > 0 && GT3_suspend(inset->fp[n]) < 0) {
-            GT3_printErrorMessages(stderr);
-            return -1;
-        }
     }
     return 0;
 }
@@ -291,7 +276,6 @@ new_input_set(void)
     inset->num = 0;
     inset->fp = NULL;
     inset->offset = NULL;
-    inset->keep_alive = 1;
     inset->vbuf = NULL;
     return inset;
 }
@@ -318,7 +302,6 @@ make_input_set(char * const paths[], int ninputs)
     /*
      * set members in input set.
      */
-    inset->keep_alive = ninputs <= alive_limit;
     for (i = 0; i < ninputs; i++) {
         if ((inset->fp[i] = GT3_open(paths[i])) == NULL) {
             GT3_printErrorMessages(stderr);
@@ -326,8 +309,8 @@ make_input_set(char * const paths[], int ninputs)
         }
         inset->num++;
 
-        /* Note: inset->fp[0] is never suspended. */
-        if (!inset->keep_alive && i > 0 && GT3_suspend(inset->fp[i]) < 0) {
+        /* Note: the inputs are reopened on demand if too many. */
+        if (GT3_poolFile(inset->fp[i]) < 0) {
             GT3_printErrorMessages(stderr);
             goto error;
         }
@@ -349,7 +332,7 @@ error:
  * join main process.
  */
 static int
-join(FILE *output, struct input_set *inset,
+join(GT3_Writer *output, struct input_set *inset,
      struct sequence *seq, const int *pattern, const char *fmt)
 {
     GT3_HEADER head;
@@ -375,23 +358,12 @@ join(FILE *output, struct input_set *inset,
         /*
          * move to the same position to inset->fp[0].
          */
-        for (n = 1; n < inset->num; n++) {
-            if (!inset->keep_alive && GT3_resume(inset->fp[n]) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
-
+        for (n = 1; n < inset->num; n++)
             if (GT3_seek(inset->fp[n], inset->fp[0]->curr, SEEK_SET) < 0) {
                 GT3_printErrorMessages(stderr);
                 goto finish;
             }
 
-            if (!inset->keep_alive && GT3_suspend(inset->fp[n]) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
-        }
-
         if (join_chunk(wkbuf, inset, pattern) < 0)
             goto finish;
 
@@ -404,11 +376,10 @@ join(FILE *output, struct input_set *inset,
         }
         if (fmt == NULL)
             GT3_copyHeaderItem(fmt_asis, sizeof fmt_asis, &head, "DFMT");
-        if (GT3_write(wkbuf->data, GT3_TYPE_DOUBLE,
-                      wkbuf->shape[0], wkbuf->shape[1], wkbuf->shape[2],
-                      &head,
-                      fmt ? fmt : fmt_asis,
-                      output) < 0) {
+        if (GT3_writerWrite(output, wkbuf->data, GT3_TYPE_DOUBLE,
+                            wkbuf->shape[0], wkbuf->shape[1], wkbuf->shape[2],
+                            &head,
+                            fmt ? fmt : fmt_asis) < 0) {
             GT3_printErrorMessages(stderr);
             goto finish;
         }
@@ -448,7 +419,7 @@ main(int argc, char **argv)
 {
     char *format = NULL;
     char *output_path = "gtool.out";
-    FILE *output;
+    GT3_Writer *output;
     struct input_set *inset;
     struct sequence *seq = NULL;
     int pattern[3], rval, ch;
@@ -458,9 +429,6 @@ main(int argc, char **argv)
 
     open_logging(stderr, PROGNAME);
     GT3_setProgname(PROGNAME);
-#ifdef HAVE_SYSCONF
-    alive_limit = sysconf(_SC_OPEN_MAX) / 2;
-#endif
 
     while ((ch = getopt(argc, argv, "f:o:s:t:vxyzh")) != -1)
         switch (ch) {
@@ -558,12 +526,15 @@ main(int argc, char **argv)
     /*
      * main process: join & output.
      */
-    if ((output = fopen(output_path, "wb")) == NULL) {
-        logging(LOG_SYSERR, output_path);
+    if ((output = GT3_openAsyncWriter(output_path, "wb", 0)) == NULL) {
+        GT3_printErrorMessages(stderr);
         exit(1);
     }
     rval = join(output, inset, seq, pattern, format);
-    fclose(output);
+    if (GT3_writerClose(output) < 0) {
+        GT3_printErrorMessages(stderr);
+        rval = -1;
+    }
 
     free_input_set(inset);
     return rval < 0 ? 1 : 0;
@@ -13,6 +13,7 @@
 #include "fileiter.h"
 
 static int quick_mode = 0;
+static int index_mode = 0;
 static int print_fileinfo = 0;
 static int (*print_item)(int cnt, GT3_File *fp);
 
@@ -168,6 +169,7 @@ usage(void)
         "Usage: ngtls [options] [files...]\n"
         "\n"
         "Options:\n"
+        "    -I          write the chunk index (FILE.idx) instead of listing\n"
         "    -Q          quick access mode\n"
         "    -h          print help message\n"
         "    -n          print axis-length instead of axis-name\n"
@@ -188,8 +190,12 @@ main(int argc, char **argv)
 
     print_item = print_item1;
 
-    while ((ch = getopt(argc, argv, "Qnht:uv")) != -1)
+    while ((ch = getopt(argc, argv, "IQnht:uv")) != -1)
         switch (ch) {
+        case 'I':
+            index_mode = 1;
+            break;
+
         case 'Q':
             quick_mode = 1;
             break;
@@ -223,6 +229,16 @@ main(int argc, char **argv)
 
     rval = 0;
     while (argc > 0 && *argv) {
+        if (index_mode) {
+            if (GT3_writeIndex(*argv) < 0) {
+                GT3_printErrorMessages(stderr);
+                rval = 1;
+            }
+            --argc;
+            ++argv;
+            continue;
+        }
+
         if (seq)
             reinitSeq(seq, 1, 0x7fffffff);
         if (print_list(*argv, seq) < 0)
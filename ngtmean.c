@@ -10,6 +10,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "chunkmap.h"
 #include "fileiter.h"
 #include "gtool3.h"
 #include "logging.h"
@@ -56,6 +57,7 @@ static struct range g_range[3] = {
 static int shift_flag = 1;
 static struct sequence *g_zseq = NULL;
 static int sum_flag = 0;
+static int nthreads = 0;        /* -j (0: not parallel) */
 
 /* mean flags */
 #define X_MEAN   1U
@@ -105,8 +107,12 @@ shift_var(struct mdata *mdata, unsigned mode)
 }
 
 
+/*
+ * 'zseq' is g_zseq, or a copy of it in each thread.
+ */
 static int
-calc_mean(struct mdata *mdata, GT3_Varbuf *vbuf, unsigned mode)
+calc_mean(struct mdata *mdata, GT3_Varbuf *vbuf, unsigned mode,
+          struct sequence *zseq)
 {
     double wz, wght;
     int x, y, z;
@@ -116,7 +122,9 @@ calc_mean(struct mdata *mdata, GT3_Varbuf *vbuf, unsigned mode)
     size_t i;
     double value;
     double *wghtx = NULL, *wghty = NULL, *wghtz = NULL;
-    double wyz;
+    double wyz, wx = 1.;
+    GT3_Reduction *red = NULL;
+    int fmt, rval = -1;
 
     wz = 1.;
     for (i = 0; i < mdata->size; i++) {
@@ -136,26 +144,62 @@ calc_mean(struct mdata *mdata, GT3_Varbuf *vbuf, unsigned mode)
     y0 = mdata->range[1].str;
     y1 = mdata->range[1].end;
 
-    if (g_zseq)
-        reinitSeq(g_zseq, 1, vbuf->fp->dimlen[2]);
+    /*
+     * In URY and MRY, x-mean with a uniform weight is the sum of
+     * each row, which is computed without decoding values.
+     */
+    fmt = vbuf->fp->fmt & GT3_FMT_MASK;
+    if ((X_MEAN & mode) && x0 < x1 && y0 < y1
+        && (fmt == GT3_FMT_URY || fmt == GT3_FMT_MRY)) {
+        wx = wghtx ? wghtx[x0] : 1.;
+        for (x = x0; x < x1; x++)
+            if (wghtx && wghtx[x] != wx)
+                break;
+
+        if (x == x1
+            && (red = malloc(sizeof(GT3_Reduction) * (y1 - y0))) == NULL) {
+            logging(LOG_SYSERR, NULL);
+            return -1;
+        }
+    }
+
+    if (zseq)
+        reinitSeq(zseq, 1, vbuf->fp->dimlen[2]);
 
     for (n = 0; n < mdata->range[2].end - mdata->range[2].str; n++) {
-        if (g_zseq) {
-            if (nextSeq(g_zseq) < 0) {
+        if (zseq) {
+            if (nextSeq(zseq) < 0) {
                 assert(!"NOTREACHED");
             }
-            z = g_zseq->curr - 1;
+            z = zseq->curr - 1;
         } else
             z = n + mdata->range[2].str;
 
-        if (GT3_readVarZ(vbuf, z) < 0) {
-            GT3_printErrorMessages(stderr);
-            return -1;
-        }
         zm = (Z_MEAN & mode) ? 0 : n;
         if (wghtz)
             wz = wghtz[z];
 
+        if (red) {
+            if (GT3_reduceVarRows(red, vbuf, z, x0, x1, y0, y1) < 0) {
+                GT3_printErrorMessages(stderr);
+                goto finish;
+            }
+            for (y = y0; y < y1; y++) {
+                ym = (Y_MEAN & mode) ? 0 : y - y0;
+                wght = (wghty ? wghty[y] * wz : wz) * wx;
+
+                idest = mdata->shape[0] * (ym + mdata->shape[1] * zm);
+                mdata->data[idest] += wght * red[y - y0].sum;
+                mdata->wsum[idest] += wght * red[y - y0].count;
+            }
+            continue;
+        }
+
+        if (GT3_readVarZ(vbuf, z) < 0) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
+        }
+
         for (y = y0; y < y1; y++) {
             ym = (Y_MEAN & mode) ? 0 : y - y0;
             wyz = wghty ? wghty[y] * wz : wz;
@@ -185,8 +229,11 @@ calc_mean(struct mdata *mdata, GT3_Varbuf *vbuf, unsigned mode)
         for (i = 0; i < mdata->size; i++)
             if (mdata->wsum[i] == 0.)
                 mdata->data[i] = mdata->miss;
+    rval = 0;
 
-    return 0;
+finish:
+    free(red);
+    return rval;
 }
 
 
@@ -281,7 +328,8 @@ static int
 setup_mdata(struct mdata *var,
             const int *dimlen,
             const GT3_HEADER *head,
-            unsigned mode)
+            unsigned mode,
+            struct sequence *zseq)
 {
     double miss;
 
@@ -293,10 +341,10 @@ setup_mdata(struct mdata *var,
     /*
      * z-slicing.
      */
-    if (g_zseq) {
-        reinitSeq(g_zseq, 1, dimlen[2]);
+    if (zseq) {
+        reinitSeq(zseq, 1, dimlen[2]);
         var->range[2].str = 0;
-        var->range[2].end = countSeq(g_zseq);
+        var->range[2].end = countSeq(zseq);
     }
     var->shape[0] = mode & X_MEAN ? 1 : var->range[0].end - var->range[0].str;
     var->shape[1] = mode & Y_MEAN ? 1 : var->range[1].end - var->range[1].str;
@@ -374,7 +422,7 @@ modify_head(GT3_HEADER *head, const struct mdata *mdata, unsigned mode)
 
 
 static int
-write_mean(FILE *output, const struct mdata *mdata,
+write_mean(GT3_Writer *output, const struct mdata *mdata,
            const GT3_HEADER *headin,
            unsigned mode,
            const char *fmt)
@@ -401,13 +449,12 @@ write_mean(FILE *output, const struct mdata *mdata,
     GT3_setHeaderInt(&head, "ASTR2", 1 + mdata->off[1] + mdata->range[1].str);
     GT3_setHeaderInt(&head, "ASTR3", 1 + mdata->off[2] + mdata->range[2].str);
 
-    if ((rval = GT3_write(mdata->data, GT3_TYPE_DOUBLE,
-                          mdata->shape[0],
-                          mdata->shape[1],
-                          mdata->shape[2],
-                          &head,
-                          fmt ? fmt : fmt_asis,
-                          output)) < 0)
+    if ((rval = GT3_writerWrite(output, mdata->data, GT3_TYPE_DOUBLE,
+                                mdata->shape[0],
+                                mdata->shape[1],
+                                mdata->shape[2],
+                                &head,
+                                fmt ? fmt : fmt_asis)) < 0)
         GT3_printErrorMessages(stderr);
 
     return rval;
@@ -415,7 +462,7 @@ write_mean(FILE *output, const struct mdata *mdata,
 
 
 static int
-ngtmean(FILE *output, const char *path,
+ngtmean(GT3_Writer *output, const char *path,
         struct mdata *mdata, unsigned mode, const char *fmt,
         struct sequence *tseq)
 {
@@ -442,9 +489,9 @@ ngtmean(FILE *output, const char *path,
             GT3_printErrorMessages(stderr);
             goto finish;
         }
-        if (setup_mdata(mdata, fp->dimlen, &head, mode) < 0
+        if (setup_mdata(mdata, fp->dimlen, &head, mode, g_zseq) < 0
             || realloc_var(mdata) < 0
-            || calc_mean(mdata, vbuf, mode) < 0
+            || calc_mean(mdata, vbuf, mode, g_zseq) < 0
             || modify_head(&head, mdata, mode) < 0
             || (shift_flag && shift_var(mdata, mode) < 0)
             || write_mean(output, mdata, &head, mode, fmt) < 0)
@@ -459,6 +506,171 @@ finish:
 }
 
 
+/*
+ * Parallel mode (-j): each chunk is averaged in a thread with its own
+ * mdata, and the results are written in order (see chunkmap.c).
+ */
+struct mean_arg {
+    unsigned mode;
+    const char *fmt;
+    GT3_Writer *output;
+};
+
+struct mean_local {
+    struct mdata mdata;
+    struct sequence *zseq;      /* a copy of g_zseq */
+};
+
+struct mean_part {
+    GT3_HEADER head;
+    struct mdata mdata;         /* the result (without weights) */
+};
+
+
+static void *
+new_part(void *arg)
+{
+    struct mean_part *mp;
+
+    if ((mp = malloc(sizeof(struct mean_part))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return NULL;
+    }
+    memset(&mp->mdata, 0, sizeof(struct mdata));
+    return mp;
+}
+
+
+static void
+free_part(void *part, void *arg)
+{
+    struct mean_part *mp = part;
+
+    free(mp->mdata.data);
+    free(mp);
+}
+
+
+static int
+new_local(void **local, void *arg)
+{
+    struct mean_local *ml;
+
+    if ((ml = malloc(sizeof(struct mean_local))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    memset(&ml->mdata, 0, sizeof(struct mdata));
+    ml->zseq = NULL;
+    if (g_zseq && (ml->zseq = initSeq(g_zseq->spec, 1, RANGE_MAX)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        free(ml);
+        return -1;
+    }
+    *local = ml;
+    return 0;
+}
+
+
+static void
+free_local(void *local, void *arg)
+{
+    struct mean_local *ml = local;
+    int i;
+
+    for (i = 0; i < 3; i++)
+        free(ml->mdata.wght[i]);
+    free(ml->mdata.data);
+    if (ml->zseq) {
+        freeSeq(ml->zseq);
+        free(ml->zseq);
+    }
+    free(ml);
+}
+
+
+static int
+map_chunk(void *part, GT3_Varbuf *vbuf, const struct cm_task *task,
+          void *local, void *arg)
+{
+    struct mean_part *mp = part;
+    struct mean_local *ml = local;
+    struct mean_arg *ma = arg;
+    struct mdata *mdata = &ml->mdata;
+
+    if (GT3_readHeader(&mp->head, vbuf->fp) < 0) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+    if (setup_mdata(mdata, vbuf->fp->dimlen, &mp->head, ma->mode,
+                    ml->zseq) < 0
+        || realloc_var(mdata) < 0
+        || calc_mean(mdata, vbuf, ma->mode, ml->zseq) < 0)
+        return -1;
+
+    mp->mdata = *mdata;
+    memset(mp->mdata.wght, 0, sizeof mp->mdata.wght);
+    mp->mdata.wsum = NULL;
+    mp->mdata.reserved_size = mdata->size;
+    if ((mp->mdata.data = malloc(sizeof(double) * mdata->size)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    memcpy(mp->mdata.data, mdata->data, sizeof(double) * mdata->size);
+    return 0;
+}
+
+
+static int
+emit_chunk(void *part, const struct cm_task *task, void *arg)
+{
+    struct mean_part *mp = part;
+    struct mean_arg *ma = arg;
+
+    if (modify_head(&mp->head, &mp->mdata, ma->mode) < 0
+        || (shift_flag && shift_var(&mp->mdata, ma->mode) < 0)
+        || write_mean(ma->output, &mp->mdata, &mp->head,
+                      ma->mode, ma->fmt) < 0)
+        return -1;
+    return 0;
+}
+
+
+static int
+ngtmean_parallel(GT3_Writer *output, const char *path,
+                 unsigned mode, const char *fmt, struct sequence *tseq)
+{
+    struct chunkmap_ops ops;
+    struct mean_arg arg;
+    chunkmap *cm;
+    int rval = -1;
+
+    memset(&ops, 0, sizeof ops);
+    ops.new_part = new_part;
+    ops.free_part = free_part;
+    ops.new_local = new_local;
+    ops.free_local = free_local;
+    ops.map = map_chunk;
+    ops.emit = emit_chunk;
+
+    arg.mode = mode;
+    arg.fmt = fmt;
+    arg.output = output;
+
+    if ((cm = new_chunkmap(&ops, &arg, nthreads)) == NULL
+        || chunkmap_add_file(cm, path, tseq) < 0
+        || chunkmap_each(cm) < 0) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+    rval = 0;
+
+finish:
+    free_chunkmap(cm);
+    return rval;
+}
+
+
 static unsigned
 set_mmode(const char *str)
 {
@@ -494,6 +706,7 @@ usage(void)
         "Options:\n"
         "    -a        append to output file\n"
         "    -f fmt    output GTOOL3 format (default: UR4)\n"
+        "    -j NUM    use NUM threads (0: all processors)\n"
         "    -m MODE   mean mode (any combination \"xyzXYZ\")\n"
         "    -n        no shift axes\n"
         "    -o PATH   specify output file\n"
@@ -519,7 +732,7 @@ main(int argc, char **argv)
     char dummy[17];
     char *fmode = "wb";
     char *fmt = "UR4";
-    FILE *output = NULL;
+    GT3_Writer *output = NULL;
     struct sequence *tseq = NULL;
     int ch;
     int exitval = 0;
@@ -527,7 +740,7 @@ main(int argc, char **argv)
     open_logging(stderr, PROGNAME);
     GT3_setProgname(PROGNAME);
 
-    while ((ch = getopt(argc, argv, "af:m:no:st:x:y:z:h")) != -1)
+    while ((ch = getopt(argc, argv, "af:j:m:no:st:x:y:z:h")) != -1)
         switch (ch) {
         case 'a':
             fmode = "ab";
@@ -545,6 +758,12 @@ main(int argc, char **argv)
                 fmt = optarg;
             }
             break;
+        case 'j':
+            if ((nthreads = get_nthreads(optarg)) < 0) {
+                logging(LOG_ERR, "-j: invalid argument: %s", optarg);
+                exit(1);
+            }
+            break;
         case 'm':
             mode = set_mmode(optarg);
             break;
@@ -589,8 +808,8 @@ main(int argc, char **argv)
             break;
         }
 
-    if ((output = fopen(filename, fmode)) == NULL) {
-        logging(LOG_SYSERR, filename);
+    if ((output = GT3_openAsyncWriter(filename, fmode, 0)) == NULL) {
+        GT3_printErrorMessages(stderr);
         exit(1);
     }
 
@@ -602,15 +821,17 @@ main(int argc, char **argv)
         if (tseq)
             reinitSeq(tseq, 1, 0x7ffffff);
 
-        if (ngtmean(output, *argv, &mdata, mode, fmt, tseq) < 0) {
+        if (nthreads > 0
+            ? ngtmean_parallel(output, *argv, mode, fmt, tseq) < 0
+            : ngtmean(output, *argv, &mdata, mode, fmt, tseq) < 0) {
             logging(LOG_ERR, "in %s.", *argv);
             exitval = 1;
             break;
         }
     }
 
-    if (fclose(output) < 0) {
-        logging(LOG_SYSERR, NULL);
+    if (GT3_writerClose(output) < 0) {
+        GT3_printErrorMessages(stderr);
         exitval = 1;
     }
     return exitval;
@@ -13,6 +13,7 @@
 #include "gtool3.h"
 #include "seq.h"
 #include "fileiter.h"
+#include "chunkmap.h"
 #include "myutils.h"
 #include "logging.h"
 #include "range.h"
@@ -26,9 +27,15 @@
 
 #define PROGNAME "ngtsd"
 
+/*
+ * The accumulators of each grid are updated by Welford's method, and
+ * two of them are combined by Chan's formula (merge_point()), so that
+ * the samples can be split into parts: blocks of chunks with -j, or
+ * runs of ngtsd with -p, which are merged later with -M.
+ */
 struct stddev {
-    double *data1;              /* sum of X[i] */
-    double *data2;              /* sum of X[i]**2 */
+    double *mean;               /* mean of X[i] */
+    double *m2;                 /* sum of (X[i] - mean)**2 */
     unsigned *cnt;              /* N[i]: number of samples (each grid) */
     int shape[3];               /* data shape */
     size_t len;                 /* current data area size */
@@ -48,21 +55,13 @@ static struct range g_zrange = { 0, RANGE_MAX };
 static struct sequence *g_zseq = NULL;
 static const char *default_opath = "gtool.out";
 static char *g_format = "UR4";
-static int alive_limit = 10;
 static int skip_leapday = 0;
+static int nthreads = 0;        /* -j (0: not parallel) */
+static int dump_partial = 0;    /* -p */
 
-
-static void
-set_alive_limit(void)
-{
-#ifdef HAVE_SYSCONF
-    alive_limit = sysconf(_SC_OPEN_MAX) / 2;
-#elif defined(OPEN_MAX)
-    alive_limit = OPEN_MAX / 2;
-#endif
-
-    alive_limit = min(alive_limit, 100);
-}
+/* EDIT and ETTL of partial sums (-p) */
+#define PARTIAL_EDIT "SDACC"
+static const char *partial_ettl[] = { "sdacc N=", "sdacc mean", "sdacc m2" };
 
 
 static int
@@ -80,13 +79,14 @@ is_leapday(GT3_File *fp)
 
 /*
  * required_zlevel() returns the number of vetical levels to be processed.
+ * 'zseq' is g_zseq, or a copy of it in each thread.
  */
 static int
-required_zlevel(int zmax)
+required_zlevel(int zmax, struct sequence *zseq)
 {
-    if (g_zseq) {
-        reinitSeq(g_zseq, 1, zmax);
-        zmax = countSeq(g_zseq);
+    if (zseq) {
+        reinitSeq(zseq, 1, zmax);
+        zmax = countSeq(zseq);
     } else
         zmax = min(zmax, g_zrange.end) - max(0, g_zrange.str);
 
@@ -104,7 +104,7 @@ init_stddev(struct stddev *sd)
 static void
 free_stddev(struct stddev *sd)
 {
-    free(sd->data1);
+    free(sd->mean);
     free(sd->cnt);
     init_stddev(sd);
 }
@@ -136,8 +136,8 @@ resize_stddev(struct stddev *sd, const int *dimlen)
 
         sd->reserved = len;
 
-        sd->data1 = dptr;
-        sd->data2 = dptr + len;
+        sd->mean = dptr;
+        sd->m2 = dptr + len;
         sd->cnt = uptr;
     }
 
@@ -153,14 +153,14 @@ resize_stddev(struct stddev *sd, const int *dimlen)
  * Reinit stddev data.
  */
 static int
-reinit_stddev(struct stddev *sd, GT3_Varbuf *var)
+reinit_stddev(struct stddev *sd, GT3_Varbuf *var, struct sequence *zseq)
 {
     size_t i;
     int dimlen[3];
 
     dimlen[0] = var->fp->dimlen[0];
     dimlen[1] = var->fp->dimlen[1];
-    if ((dimlen[2] = required_zlevel(var->fp->dimlen[2])) <= 0) {
+    if ((dimlen[2] = required_zlevel(var->fp->dimlen[2], zseq)) <= 0) {
         logging(LOG_ERR, "Invalid z-level is specified with -z option.");
         return -1;
     }
@@ -174,9 +174,16 @@ reinit_stddev(struct stddev *sd, GT3_Varbuf *var)
     }
     sd->miss = var->miss;
 
+    /* ASTR3 */
+    GT3_setHeaderInt(&sd->head, "ASTR3", g_zrange.str + 1);
+    if (g_zseq) {
+        GT3_setHeaderString(&sd->head, "AITM3", "NUMBER1000");
+        GT3_setHeaderInt(&sd->head, "ASTR3", 1);
+    }
+
     for (i = 0; i < sd->len; i++) {
-        sd->data1[i] = 0.;
-        sd->data2[i] = 0.;
+        sd->mean[i] = 0.;
+        sd->m2[i] = 0.;
         sd->cnt[i] = 0;
     }
     sd->numset = 0;
@@ -189,12 +196,13 @@ reinit_stddev(struct stddev *sd, GT3_Varbuf *var)
  * Add a new dataset into stddev.
  */
 static int
-add_newdata(struct stddev *sd, GT3_Varbuf *var)
+add_newdata(struct stddev *sd, GT3_Varbuf *var, struct sequence *zseq)
 {
-    double x, *a1, *a2;
+    double x, d, *mean, *m2;
     unsigned *cnt;
     size_t i, hlen;
-    int n, z, zlen;
+    const int *index;
+    int k, n, z, zlen, num;
 
     /*
      * Check the shape of the input (var).
@@ -207,7 +215,7 @@ add_newdata(struct stddev *sd, GT3_Varbuf *var)
                 var->fp->dimlen[0], var->fp->dimlen[1]);
         return -1;
     }
-    zlen = required_zlevel(var->fp->dimlen[2]);
+    zlen = required_zlevel(var->fp->dimlen[2], zseq);
     if (sd->shape[2] != zlen) {
         logging(LOG_ERR, "Vertical level is changed: from %d to %d.",
                 sd->shape[2], zlen);
@@ -219,43 +227,48 @@ add_newdata(struct stddev *sd, GT3_Varbuf *var)
      */
     hlen = (size_t)sd->shape[0] * sd->shape[1];
     for (n = 0; n < sd->shape[2]; n++) {
-        if (g_zseq) {
-            if (nextSeq(g_zseq) < 0) {
+        if (zseq) {
+            if (nextSeq(zseq) < 0) {
                 assert(!"NOTREACHED");
             }
-            z = g_zseq->curr - 1;
+            z = zseq->curr - 1;
         } else
             z = g_zrange.str + n;
 
-        if (GT3_readVarZ(var, z) < 0) {
+        /* masked data are not expanded (see GT3_readVarPacked()). */
+        if ((num = GT3_readVarPacked(var, z, &index)) < 0) {
             GT3_printErrorMessages(stderr);
             return -1;
         }
 
-        a1 = sd->data1 + n * hlen;
-        a2 = sd->data2 + n * hlen;
+        mean = sd->mean + n * hlen;
+        m2 = sd->m2 + n * hlen;
         cnt = sd->cnt + n * hlen;
 
         if (var->type == GT3_TYPE_FLOAT) {
             float *data = var->data;
 
-            for (i = 0; i < hlen; i++) {
-                x = (double)data[i];
+            for (k = 0; k < num; k++) {
+                i = index ? index[k] : k;
+                x = (double)data[k];
                 if (x != var->miss) {
-                    a1[i] += x;
-                    a2[i] += x * x;
                     cnt[i]++;
+                    d = x - mean[i];
+                    mean[i] += d / cnt[i];
+                    m2[i] += d * (x - mean[i]);
                 }
             }
         } else {
             double *data = var->data;
 
-            for (i = 0; i < hlen; i++) {
-                x = data[i];
+            for (k = 0; k < num; k++) {
+                i = index ? index[k] : k;
+                x = data[k];
                 if (x != var->miss) {
-                    a1[i] += x;
-                    a2[i] += x * x;
                     cnt[i]++;
+                    d = x - mean[i];
+                    mean[i] += d / cnt[i];
+                    m2[i] += d * (x - mean[i]);
                 }
             }
         }
@@ -269,34 +282,53 @@ add_newdata(struct stddev *sd, GT3_Varbuf *var)
 }
 
 
+/*
+ * merge_point() merges a sample set (n2, mean2, m2) into the i-th grid.
+ */
+static void
+merge_point(struct stddev *sd, size_t i, unsigned n2, double mean2, double m2)
+{
+    unsigned n1 = sd->cnt[i];
+    double d, n;
+
+    if (n2 == 0)
+        return;
+    if (n1 == 0) {
+        sd->mean[i] = mean2;
+        sd->m2[i] = m2;
+        sd->cnt[i] = n2;
+        return;
+    }
+
+    n = (double)n1 + n2;
+    d = mean2 - sd->mean[i];
+    sd->mean[i] += d * (n2 / n);
+    sd->m2[i] += m2 + d * d * (n1 * (n2 / n));
+    sd->cnt[i] = n1 + n2;
+}
+
+
 /*
  * Calculate the final result.
+ * sd->mean and sd->m2 are replaced with MEAN and SD.
  */
 static void
 calc_stddev(struct stddev *sd)
 {
-    double r, a, v;
     size_t i;
 
-    for (i = 0; i < sd->len; i++) {
-        if (sd->cnt[i] > 0) {
-            r = 1. / sd->cnt[i];
-            a = sd->data1[i] * r;
-            v = sd->data2[i] * r - a * a;
-            v = sqrt(max(v, 0.));
-        } else {
-            a = sd->miss;
-            v = sd->miss;
+    for (i = 0; i < sd->len; i++)
+        if (sd->cnt[i] > 0)
+            sd->m2[i] = sqrt(sd->m2[i] / sd->cnt[i]);
+        else {
+            sd->mean[i] = sd->miss;
+            sd->m2[i] = sd->miss;
         }
-
-        sd->data1[i] = a;       /* MEAN */
-        sd->data2[i] = v;       /* SD */
-    }
 }
 
 
 static int
-write_stddev(const struct stddev *sd, FILE *fp, FILE *mfp)
+write_stddev(const struct stddev *sd, GT3_Writer *fp, GT3_Writer *mfp)
 {
     GT3_HEADER head, head2;
     char field[17];
@@ -306,13 +338,6 @@ write_stddev(const struct stddev *sd, FILE *fp, FILE *mfp)
 
     GT3_copyHeader(&head, &sd->head);
 
-    /* ASTR3 */
-    GT3_setHeaderInt(&head, "ASTR3", g_zrange.str + 1);
-    if (g_zseq) {
-        GT3_setHeaderString(&head, "AITM3", "NUMBER1000");
-        GT3_setHeaderInt(&head, "ASTR3", 1);
-    }
-
     /* MISS */
     GT3_setHeaderMiss(&head, sd->miss);
 
@@ -325,9 +350,9 @@ write_stddev(const struct stddev *sd, FILE *fp, FILE *mfp)
     GT3_setHeaderEttl(&head, field);
 
     logging(LOG_INFO, "Write %s", field);
-    if (GT3_write(sd->data2, GT3_TYPE_DOUBLE,
-                  sd->shape[0], sd->shape[1], sd->shape[2],
-                  &head, g_format, fp) < 0) {
+    if (GT3_writerWrite(fp, sd->m2, GT3_TYPE_DOUBLE,
+                        sd->shape[0], sd->shape[1], sd->shape[2],
+                        &head, g_format) < 0) {
         GT3_printErrorMessages(stderr);
         return -1;
     }
@@ -339,9 +364,9 @@ write_stddev(const struct stddev *sd, FILE *fp, FILE *mfp)
         GT3_setHeaderEttl(&head2, field);
 
         logging(LOG_INFO, "Write %s", field);
-        if (GT3_write(sd->data1, GT3_TYPE_DOUBLE,
-                      sd->shape[0], sd->shape[1], sd->shape[2],
-                      &head2, g_format, mfp) < 0) {
+        if (GT3_writerWrite(mfp, sd->mean, GT3_TYPE_DOUBLE,
+                            sd->shape[0], sd->shape[1], sd->shape[2],
+                            &head2, g_format) < 0) {
             GT3_printErrorMessages(stderr);
             return -1;
         }
@@ -350,6 +375,74 @@ write_stddev(const struct stddev *sd, FILE *fp, FILE *mfp)
 }
 
 
+/*
+ * write_partial() writes the accumulators in three chunks (N, mean,
+ * and M2) in UR8, to be merged later with -M.
+ */
+static int
+write_partial(const struct stddev *sd, GT3_Writer *fp)
+{
+    GT3_HEADER head;
+    const double *data[3];
+    double *cnt;
+    char field[17];
+    size_t i;
+    int n, rval = -1;
+
+    if (sd->numset == 0)
+        return 0;               /* do nothing */
+
+    if ((cnt = malloc(sizeof(double) * sd->len)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    for (i = 0; i < sd->len; i++)
+        cnt[i] = sd->cnt[i];
+
+    data[0] = cnt;
+    data[1] = sd->mean;
+    data[2] = sd->m2;
+    for (n = 0; n < 3; n++) {
+        GT3_copyHeader(&head, &sd->head);
+        GT3_setHeaderMiss(&head, sd->miss);
+
+        GT3_setHeaderEdit(&head, PARTIAL_EDIT);
+        if (n == 0)
+            snprintf(field, sizeof field, "%s%u", partial_ettl[0], sd->numset);
+        else
+            snprintf(field, sizeof field, "%s", partial_ettl[n]);
+        GT3_setHeaderEttl(&head, field);
+
+        if (GT3_writerWrite(fp, data[n], GT3_TYPE_DOUBLE,
+                            sd->shape[0], sd->shape[1], sd->shape[2],
+                            &head, "UR8") < 0) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
+        }
+    }
+    logging(LOG_INFO, "Write partial sums N=%u", sd->numset);
+    rval = 0;
+
+finish:
+    free(cnt);
+    return rval;
+}
+
+
+/*
+ * output_stddev() writes SD (and MEAN), or the partial sums with -p.
+ */
+static int
+output_stddev(struct stddev *sd, GT3_Writer *fp, GT3_Writer *mfp)
+{
+    if (dump_partial)
+        return write_partial(sd, fp);
+
+    calc_stddev(sd);
+    return write_stddev(sd, fp, mfp);
+}
+
+
 static int
 ngtsd_seq(struct stddev *sd, const char *path, struct sequence *seq)
 {
@@ -383,10 +476,10 @@ ngtsd_seq(struct stddev *sd, const char *path, struct sequence *seq)
         if (stat == ITER_OUTRANGE)
             continue;
 
-        if (sd->numset == 0 && reinit_stddev(sd, var) < 0)
+        if (sd->numset == 0 && reinit_stddev(sd, var, g_zseq) < 0)
             goto finish;
 
-        if (add_newdata(sd, var) < 0)
+        if (add_newdata(sd, var, g_zseq) < 0)
             goto finish;
     }
     rval = 0;
@@ -398,12 +491,11 @@ finish:
 
 
 static int
-ngtsd_cyc(char **paths, int nfiles, FILE *ofp, FILE *ofp2)
+ngtsd_cyc(char **paths, int nfiles, GT3_Writer *ofp, GT3_Writer *ofp2)
 {
     GT3_File **inputs = NULL;
     GT3_File *fp = NULL;
     GT3_Varbuf *var = NULL;
-    int keep_alive = nfiles <= alive_limit;
     struct stddev sd;
     int n, rval = -1;
     int first_data;
@@ -421,7 +513,7 @@ ngtsd_cyc(char **paths, int nfiles, FILE *ofp, FILE *ofp2)
             GT3_printErrorMessages(stderr);
             goto finish;
         }
-        if (!keep_alive && GT3_suspend(inputs[n]) < 0) {
+        if (GT3_poolFile(inputs[n]) < 0) {
             GT3_printErrorMessages(stderr);
             goto finish;
         }
@@ -434,11 +526,6 @@ ngtsd_cyc(char **paths, int nfiles, FILE *ofp, FILE *ofp2)
             if (GT3_eof(fp))
                 continue;
 
-            if (!keep_alive && GT3_resume(fp) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
-
             if (var == NULL) {
                 if ((var = GT3_getVarbuf(fp)) == NULL) {
                     GT3_printErrorMessages(stderr);
@@ -461,28 +548,23 @@ ngtsd_cyc(char **paths, int nfiles, FILE *ofp, FILE *ofp2)
             }
 
             if (first_data) {
-                if (reinit_stddev(&sd, var) < 0)
+                if (reinit_stddev(&sd, var, g_zseq) < 0)
                     goto finish;
                 first_data = 0;
             }
 
-            if (!GT3_eof(fp) && add_newdata(&sd, var) < 0)
+            if (!GT3_eof(fp) && add_newdata(&sd, var, g_zseq) < 0)
                 goto finish;
 
             if (GT3_next(fp) < 0) {
                 GT3_printErrorMessages(stderr);
                 goto finish;
             }
-            if (!keep_alive && GT3_suspend(fp) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
         }
         if (first_data)
             break;
 
-        calc_stddev(&sd);
-        if (write_stddev(&sd, ofp, ofp2) < 0)
+        if (output_stddev(&sd, ofp, ofp2) < 0)
             goto finish;
     }
     rval = 0;
@@ -503,12 +585,11 @@ finish:
 
 static int
 ngtsd_cyc_seq(char **paths, int nfiles, struct sequence *seq,
-              FILE *ofp, FILE *ofp2)
+              GT3_Writer *ofp, GT3_Writer *ofp2)
 {
     GT3_File **inputs = NULL;
     GT3_File *fp = NULL;
     GT3_Varbuf *var = NULL;
-    int keep_alive = nfiles <= alive_limit;
     struct stddev sd;
     int n, rval = -1;
 
@@ -525,7 +606,7 @@ ngtsd_cyc_seq(char **paths, int nfiles, struct sequence *seq,
             GT3_printErrorMessages(stderr);
             goto finish;
         }
-        if (!keep_alive && GT3_suspend(inputs[n]) < 0) {
+        if (GT3_poolFile(inputs[n]) < 0) {
             GT3_printErrorMessages(stderr);
             goto finish;
         }
@@ -535,11 +616,6 @@ ngtsd_cyc_seq(char **paths, int nfiles, struct sequence *seq,
         for (n = 0; n < nfiles; n++) {
             fp = inputs[n];
 
-            if (!keep_alive && GT3_resume(fp) < 0) {
-                GT3_printErrorMessages(stderr);
-                goto finish;
-            }
-
             if (GT3_seek(fp, seq->curr - 1, SEEK_SET) < 0) {
                 GT3_printErrorMessages(stderr);
                 goto finish;
@@ -556,20 +632,355 @@ ngtsd_cyc_seq(char **paths, int nfiles, struct sequence *seq,
                     goto finish;
                 }
 
-            if (n == 0 && reinit_stddev(&sd, var) < 0)
+            if (n == 0 && reinit_stddev(&sd, var, g_zseq) < 0)
                 goto finish;
 
-            if (add_newdata(&sd, var) < 0)
+            if (add_newdata(&sd, var, g_zseq) < 0)
                 goto finish;
+        }
+
+        if (output_stddev(&sd, ofp, ofp2) < 0)
+            goto finish;
+    }
+    rval = 0;
+
+finish:
+    if (rval < 0 && n >= 0 && n < nfiles)
+        logging(LOG_ERR, "%s: failed.", paths[n]);
+
+    GT3_freeVarbuf(var);
+    for (n = 0; n < nfiles; n++)
+        GT3_close(inputs[n]);
+
+    free(inputs);
+    free_stddev(&sd);
+    return rval;
+}
+
+
+/*
+ * Parallel mode (-j): each block of chunks is summed up in its own
+ * stddev, and they are merged in the fixed order (see chunkmap.c).
+ */
+static void *
+new_part(void *arg)
+{
+    struct stddev *sd;
+
+    if ((sd = malloc(sizeof(struct stddev))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return NULL;
+    }
+    init_stddev(sd);
+    return sd;
+}
+
+
+static void
+free_part(void *part, void *arg)
+{
+    free_stddev(part);
+    free(part);
+}
+
+
+static int
+new_zseq(void **local, void *arg)
+{
+    *local = NULL;
+    if (g_zseq && (*local = initSeq(g_zseq->spec, 1, RANGE_MAX)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void
+free_zseq(void *local, void *arg)
+{
+    if (local) {
+        freeSeq(local);
+        free(local);
+    }
+}
+
+
+static int
+map_chunk(void *part, GT3_Varbuf *var, const struct cm_task *task,
+          void *local, void *arg)
+{
+    struct stddev *sd = part;
+
+    if (sd->numset == 0 && reinit_stddev(sd, var, local) < 0)
+        return -1;
+
+    return add_newdata(sd, var, local);
+}
+
+
+static int
+merge_stddev(void *dest, void *src, void *arg)
+{
+    struct stddev *sd = dest, *sd2 = src, tmp;
+    size_t i;
+
+    if (sd2->numset == 0)
+        return 0;
+    if (sd->numset == 0) {
+        tmp = *sd;
+        *sd = *sd2;
+        *sd2 = tmp;
+        return 0;
+    }
 
-            if (!keep_alive && GT3_suspend(fp) < 0) {
+    if (sd->shape[0] != sd2->shape[0] || sd->shape[1] != sd2->shape[1]) {
+        logging(LOG_ERR,
+                "Horizontal shape is changed: from (%dx%d) to (%dx%d).",
+                sd->shape[0], sd->shape[1], sd2->shape[0], sd2->shape[1]);
+        return -1;
+    }
+    if (sd->shape[2] != sd2->shape[2]) {
+        logging(LOG_ERR, "Vertical level is changed: from %d to %d.",
+                sd->shape[2], sd2->shape[2]);
+        return -1;
+    }
+
+    for (i = 0; i < sd->len; i++)
+        merge_point(sd, i, sd2->cnt[i], sd2->mean[i], sd2->m2[i]);
+    sd->numset += sd2->numset;
+    return 0;
+}
+
+
+static int
+ngtsd_parallel(char **paths, int nfiles, struct sequence *seq,
+               GT3_Writer *ofp, GT3_Writer *ofp2)
+{
+    struct chunkmap_ops ops;
+    chunkmap *cm;
+    struct stddev *sd = NULL;
+    int n, rval = -1;
+
+    memset(&ops, 0, sizeof ops);
+    ops.new_part = new_part;
+    ops.free_part = free_part;
+    ops.new_local = new_zseq;
+    ops.free_local = free_zseq;
+    ops.map = map_chunk;
+    ops.merge = merge_stddev;
+
+    if ((cm = new_chunkmap(&ops, NULL, nthreads)) == NULL) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+
+    for (n = 0; n < nfiles; n++) {
+        if (chunkmap_add_file(cm, paths[n], seq) < 0) {
+            GT3_printErrorMessages(stderr);
+            logging(LOG_ERR, "%s: failed.", paths[n]);
+            goto finish;
+        }
+        if (seq)
+            reinitSeq(seq, 1, RANGE_MAX);
+    }
+
+    if (chunkmap_reduce((void **)&sd, cm) < 0) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+
+    if (output_stddev(sd, ofp, ofp2) < 0)
+        goto finish;
+    rval = 0;
+
+finish:
+    if (sd)
+        free_part(sd, NULL);
+    free_chunkmap(cm);
+    return rval;
+}
+
+
+/*
+ * Merge mode (-M): the partial sums written with -p are merged.
+ *
+ * pop_edit() removes EDIT1 and ETTL1 set by write_partial().
+ */
+static void
+pop_edit(GT3_HEADER *head)
+{
+    const char *name[] = { "EDIT", "ETTL" };
+    char key[8], key2[8], item[17];
+    int i, k;
+
+    for (k = 0; k < 2; k++) {
+        for (i = 1; i < 8; i++) {
+            snprintf(key, sizeof key, "%s%d", name[k], i);
+            snprintf(key2, sizeof key2, "%s%d", name[k], i + 1);
+            GT3_copyHeaderItem(item, sizeof item, head, key2);
+            GT3_setHeaderString(head, key, item);
+        }
+        GT3_setHeaderString(head, key2, "");
+    }
+}
+
+
+/*
+ * read_partial() reads the partial sums (three chunks) from the current
+ * position of 'fp', and merges them into 'sd'.
+ */
+static int
+read_partial(struct stddev *sd, GT3_File *fp, GT3_Varbuf **var)
+{
+    GT3_HEADER head, head0;
+    char ettl[17];
+    double *data;
+    unsigned numset = 0;
+    size_t i, len;
+    int n, dimlen[3], rval = -1;
+
+    dimlen[0] = fp->dimlen[0];
+    dimlen[1] = fp->dimlen[1];
+    dimlen[2] = fp->dimlen[2];
+    len = (size_t)dimlen[0] * dimlen[1] * dimlen[2];
+    if ((data = malloc(3 * sizeof(double) * len)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+
+    for (n = 0; n < 3; n++) {
+        if (GT3_eof(fp)) {
+            logging(LOG_ERR, "%s: Unexpected EOF.", fp->path);
+            goto finish;
+        }
+        if (GT3_readHeader(&head, fp) < 0) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
+        }
+        GT3_copyHeaderItem(ettl, sizeof ettl, &head, "ETTL1");
+        if (strncmp(ettl, partial_ettl[n], strlen(partial_ettl[n])) != 0
+            || (n == 0 && sscanf(ettl + strlen(partial_ettl[0]),
+                                 "%u", &numset) != 1)) {
+            logging(LOG_ERR, "%s (No.%d): Not partial sums.",
+                    fp->path, fp->curr + 1);
+            goto finish;
+        }
+        if (fp->dimlen[0] != dimlen[0]
+            || fp->dimlen[1] != dimlen[1]
+            || fp->dimlen[2] != dimlen[2]) {
+            logging(LOG_ERR, "%s (No.%d): Shape is changed.",
+                    fp->path, fp->curr + 1);
+            goto finish;
+        }
+        if (n == 0)
+            GT3_copyHeader(&head0, &head);
+
+        if (*var == NULL) {
+            if ((*var = GT3_getVarbuf(fp)) == NULL) {
+                GT3_printErrorMessages(stderr);
+                goto finish;
+            }
+        } else
+            if (GT3_reattachVarbuf(*var, fp) < 0) {
                 GT3_printErrorMessages(stderr);
                 goto finish;
             }
+
+        if (GT3_readVarZRangeDouble(data + n * len, len, *var,
+                                    0, dimlen[2]) < 0
+            || GT3_next(fp) < 0) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
         }
+    }
 
-        calc_stddev(&sd);
-        if (write_stddev(&sd, ofp, ofp2) < 0)
+    if (sd->numset == 0) {
+        if (resize_stddev(sd, dimlen) < 0)
+            goto finish;
+
+        pop_edit(&head0);
+        GT3_copyHeader(&sd->head, &head0);
+        sd->miss = (*var)->miss;
+        for (i = 0; i < sd->len; i++) {
+            sd->mean[i] = 0.;
+            sd->m2[i] = 0.;
+            sd->cnt[i] = 0;
+        }
+    } else if (sd->shape[0] != dimlen[0] || sd->shape[1] != dimlen[1]) {
+        logging(LOG_ERR,
+                "Horizontal shape is changed: from (%dx%d) to (%dx%d).",
+                sd->shape[0], sd->shape[1], dimlen[0], dimlen[1]);
+        goto finish;
+    } else if (sd->shape[2] != dimlen[2]) {
+        logging(LOG_ERR, "Vertical level is changed: from %d to %d.",
+                sd->shape[2], dimlen[2]);
+        goto finish;
+    }
+
+    for (i = 0; i < len; i++)
+        merge_point(sd, i, (unsigned)data[i],
+                    data[len + i], data[2 * len + i]);
+    sd->numset += numset;
+
+    logging(LOG_INFO, "Read partial sums N=%u from %s.", numset, fp->path);
+    rval = 0;
+
+finish:
+    free(data);
+    return rval;
+}
+
+
+/*
+ * ngtsd_merge() merges the i-th partial sums of all the files into
+ * the i-th output.
+ */
+static int
+ngtsd_merge(char **paths, int nfiles, GT3_Writer *ofp, GT3_Writer *ofp2)
+{
+    GT3_File **inputs = NULL;
+    GT3_Varbuf *var = NULL;
+    struct stddev sd;
+    int n, neof, rval = -1;
+
+    if ((inputs = malloc(sizeof(GT3_File *) * nfiles)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    memset(inputs, 0, sizeof(GT3_File *) * nfiles);
+
+    init_stddev(&sd);
+
+    for (n = 0; n < nfiles; n++) {
+        if ((inputs[n] = GT3_open(paths[n])) == NULL) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
+        }
+        if (GT3_poolFile(inputs[n]) < 0) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
+        }
+    }
+
+    for (;;) {
+        for (n = neof = 0; n < nfiles; n++)
+            if (GT3_eof(inputs[n]))
+                neof++;
+        n = -1;
+        if (neof == nfiles)
+            break;
+        if (neof > 0) {
+            logging(LOG_ERR, "The number of partial sums differs.");
+            goto finish;
+        }
+
+        sd.numset = 0;
+        for (n = 0; n < nfiles; n++)
+            if (read_partial(&sd, inputs[n], &var) < 0)
+                goto finish;
+
+        if (output_stddev(&sd, ofp, ofp2) < 0)
             goto finish;
     }
     rval = 0;
@@ -601,9 +1012,12 @@ usage(void)
         "    -a        append to output file\n"
         "    -c        cyclic mode\n"
         "    -f fmt    specify output format\n"
+        "    -j NUM    use NUM threads (0: all processors)\n"
         "    -k        skip leap day\n"
         "    -m path   specify output filename (for Mean)\n"
         "    -o path   specify output filename (for SD)\n"
+        "    -p        output partial sums, instead of SD\n"
+        "    -M        merge partial sums (output by -p)\n"
         "    -t LIST   specify data No.\n"
         "    -v        be verbose\n"
         "    -z LIST   specify z-level\n";
@@ -620,17 +1034,17 @@ main(int argc, char **argv)
     int ch, exitval = 1;
     const char *opath = NULL;
     const char *mpath = NULL;
-    FILE *output, *output2 = NULL;
+    GT3_Writer *output, *output2 = NULL;
     char *mode = "wb";
     enum { SEQUENCE_MODE, CYCLIC_MODE };
     int sdmode = SEQUENCE_MODE;
+    int merge_mode = 0;
     char dummy[17];
 
     open_logging(stderr, PROGNAME);
     GT3_setProgname(PROGNAME);
-    set_alive_limit();
 
-    while ((ch = getopt(argc, argv, "acf:hkm:o:t:vz:")) != -1)
+    while ((ch = getopt(argc, argv, "acf:hj:kMm:o:pt:vz:")) != -1)
         switch (ch) {
         case 'a':
             mode = "ab";
@@ -649,10 +1063,21 @@ main(int argc, char **argv)
             g_format = strdup(optarg);
             break;
 
+        case 'j':
+            if ((nthreads = get_nthreads(optarg)) < 0) {
+                logging(LOG_ERR, "-j: invalid argument: %s", optarg);
+                exit(1);
+            }
+            break;
+
         case 'k':
             skip_leapday = 1;
             break;
 
+        case 'M':
+            merge_mode = 1;
+            break;
+
         case 'm':
             mpath = optarg;
             break;
@@ -661,6 +1086,10 @@ main(int argc, char **argv)
             opath = optarg;
             break;
 
+        case 'p':
+            dump_partial = 1;
+            break;
+
         case 't':
             seq = initSeq(optarg, 1, RANGE_MAX);
             break;
@@ -697,23 +1126,30 @@ main(int argc, char **argv)
         exit(1);
     }
 
-    if ((output = fopen(opath, mode)) == NULL) {
-        logging(LOG_SYSERR, opath);
+    if ((output = GT3_openAsyncWriter(opath, mode, 0)) == NULL) {
+        GT3_printErrorMessages(stderr);
         exit(1);
     }
 
+    if (mpath && dump_partial) {
+        logging(LOG_WARN, "'-m' option is ignored with '-p' option.");
+        mpath = NULL;
+    }
     if (mpath) {
         if (strcmp(mpath, "-") == 0 || strcmp(mpath, opath) == 0) {
             output2 = output;
         } else {
-            if ((output2 = fopen(mpath, mode)) == NULL) {
-                logging(LOG_SYSERR, mpath);
+            if ((output2 = GT3_openAsyncWriter(mpath, mode, 0)) == NULL) {
+                GT3_printErrorMessages(stderr);
                 exit(1);
             }
         }
     }
 
-    if (sdmode == CYCLIC_MODE) {
+    if (merge_mode) {
+        if (ngtsd_merge(argv, argc, output, output2) < 0)
+            goto finish;
+    } else if (sdmode == CYCLIC_MODE) {
         int rc;
 
         if (seq) {
@@ -736,6 +1172,9 @@ main(int argc, char **argv)
             logging(LOG_ERR, "failed in cyclic mode.");
             goto finish;
         }
+    } else if (nthreads > 0) {
+        if (ngtsd_parallel(argv, argc, seq, output, output2) < 0)
+            goto finish;
     } else {
         struct stddev sd;
 
@@ -749,8 +1188,7 @@ main(int argc, char **argv)
                 reinitSeq(seq, 1, RANGE_MAX);
         }
 
-        calc_stddev(&sd);
-        if (write_stddev(&sd, output, output2) < 0) {
+        if (output_stddev(&sd, output, output2) < 0) {
             logging(LOG_ERR, opath);
             goto finish;
         }
@@ -758,8 +1196,13 @@ main(int argc, char **argv)
     exitval = 0;
 
 finish:
-    if (output2 && output2 != output)
-        fclose(output2);
-    fclose(output);
+    if (output2 && output2 != output && GT3_writerClose(output2) < 0) {
+        GT3_printErrorMessages(stderr);
+        exitval = 1;
+    }
+    if (GT3_writerClose(output) < 0) {
+        GT3_printErrorMessages(stderr);
+        exitval = 1;
+    }
     return exitval;
 }
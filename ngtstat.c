@@ -13,6 +13,7 @@
 #include "gtool3.h"
 #include "seq.h"
 #include "fileiter.h"
+#include "chunkmap.h"
 #include "functmpl.h"
 #include "myutils.h"
 #include "logging.h"
@@ -36,6 +37,7 @@ static struct sequence *g_zseq = NULL;
 static int slicing = 0;
 static int each_plane = 1;
 static int quick_mode = 0;
+static int nthreads = 0;        /* -j (0: not parallel) */
 
 /* stat for each layer */
 struct statics {
@@ -46,12 +48,20 @@ struct statics {
     double min, max;            /* min & max */
 };
 
+/* work buffers (for each thread) */
+struct workbuf {
+    void *work;
+    size_t worksize;
+    GT3_Reduction *red;
+    int max_rows;
+};
+
 static void (*print_stat)(const struct statics *,
                           int, int,const GT3_HEADER *);
 
 #define FUNCTMPL_PACK(TYPE, NAME) \
 int \
-NAME(void *ptr, const GT3_Varbuf *var, const struct range *range) \
+NAME(void *ptr, const GT3_Varbuf *var, const struct range *range, int num) \
 { \
     const TYPE *data = (const TYPE *)var->data; \
     TYPE *output = (TYPE *)ptr; \
@@ -59,7 +69,7 @@ NAME(void *ptr, const GT3_Varbuf *var, const struct range *range) \
     size_t i, j, off; \
  \
     if (!slicing) \
-        for (i = 0; i < var->dimlen[0] * var->dimlen[1]; i++) { \
+        for (i = 0; i < num; i++) { \
             if (data[i] == miss) \
                 continue; \
             *output++ = data[i]; \
@@ -133,16 +143,20 @@ sumup_stat(struct statics *stat, const struct statics sz[], int len)
 }
 
 
+/*
+ * 'num' is the # of values in varbuf->data if not slicing, which are
+ * packed if masked (see GT3_readVarPacked()).
+ */
 static void
 calc_stat(struct statics *stat, const GT3_Varbuf *varbuf,
           void *work,
-          const struct range *range)
+          const struct range *range, int num)
 {
     double avr = 0., sd = 0.;
     int len;
     int (*avr_func)(double *, const void *, int);
     int (*sd_func)(double *, const void *, double, int);
-    int (*pack_func)(void *, const GT3_Varbuf *, const struct range *);
+    int (*pack_func)(void *, const GT3_Varbuf *, const struct range *, int);
     double (*min_func)(const void *, int);
     double (*max_func)(const void *, int);
 
@@ -160,7 +174,7 @@ calc_stat(struct statics *stat, const GT3_Varbuf *varbuf,
         sd_func  = std_deviation;
     }
 
-    len = pack_func(work, varbuf, range);
+    len = pack_func(work, varbuf, range, num);
 
     stat->min = min_func(work, len);
     stat->max = max_func(work, len);
@@ -177,6 +191,119 @@ calc_stat(struct statics *stat, const GT3_Varbuf *varbuf,
 }
 
 
+/*
+ * calc_stat() for URY and MRY, without decoding values
+ * (see GT3_reduceVarRows()).
+ */
+static int
+reduce_stat(struct statics *stat, GT3_Varbuf *varbuf, int z,
+            const struct range *range, struct workbuf *wb)
+{
+    GT3_Reduction *red;
+    GT3_Reduction all;
+    int j, nrows;
+
+    nrows = range[1].end - range[1].str;
+    if (nrows > wb->max_rows) {
+        free(wb->red);
+        if ((wb->red = malloc(sizeof(GT3_Reduction) * nrows)) == NULL) {
+            wb->max_rows = 0;
+            logging(LOG_SYSERR, NULL);
+            return -1;
+        }
+        wb->max_rows = nrows;
+    }
+    red = wb->red;
+
+    if (GT3_reduceVarRows(red, varbuf, z,
+                          range[0].str, range[0].end,
+                          range[1].str, range[1].end) < 0) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+
+    all.count = 0;
+    for (j = 0; j < nrows; j++)
+        GT3_mergeReduction(&all, red + j);
+
+    stat->count = all.count;
+    stat->avr = stat->sd = 0.;
+    stat->min = HUGE_VAL;
+    stat->max = -HUGE_VAL;
+    if (all.count > 0) {
+        stat->min = all.min;
+        stat->max = all.max;
+        if (stat->min == stat->max)
+            stat->avr = stat->min;
+        else {
+            stat->avr = all.sum / all.count;
+            stat->sd = sqrt(all.ssd / all.count);
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * set_range() clips the ranges by the shape of 'fp', and returns
+ * whether the data are reduced without decoding.
+ */
+static int
+set_range(struct range *range, const GT3_File *fp)
+{
+    int n, fmt;
+
+    for (n = 0; n < 3; n++) {
+        range[n].str = max(0, g_range[n].str);
+        range[n].end = min(fp->dimlen[n], g_range[n].end);
+    }
+
+    /* URY and MRY are reduced without decoding. */
+    fmt = fp->fmt & GT3_FMT_MASK;
+    return (fmt == GT3_FMT_URY || fmt == GT3_FMT_MRY)
+        && range[0].str < range[0].end && range[1].str < range[1].end;
+}
+
+
+/*
+ * stat_plane() calculates 'stat' of the z-plane.
+ */
+static int
+stat_plane(struct statics *stat, GT3_Varbuf *varbuf, int z,
+           const struct range *range, int packed, struct workbuf *wb)
+{
+    const int *index;
+    int num;
+
+    if (packed)
+        return reduce_stat(stat, varbuf, z, range, wb);
+
+    num = slicing
+        ? GT3_readVarZ(varbuf, z) /* 'num' is not used */
+        : GT3_readVarPacked(varbuf, z, &index);
+    if (num < 0) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+
+    /*
+     * (re)allocate work buffer.
+     */
+    if (varbuf->bufsize > wb->worksize) {
+        free(wb->work);
+        if ((wb->work = malloc(varbuf->bufsize)) == NULL) {
+            wb->worksize = 0;
+            logging(LOG_SYSERR, NULL);
+            return -1;
+        }
+        wb->worksize = varbuf->bufsize;
+    }
+
+    calc_stat(stat, varbuf, wb->work, range, num);
+    return 0;
+}
+
+
 static void
 print_stat1(const struct statics *stat, int num, int tidx,
             const GT3_HEADER *head)
@@ -291,13 +418,12 @@ print_caption(const char *name)
 int
 ngtstat_var(GT3_Varbuf *varbuf)
 {
-    static void *work = NULL;
-    static size_t worksize = 0;
+    static struct workbuf wbuf;
     static struct statics *stat = NULL;
     static int max_num_plane = 0;
     GT3_HEADER head;
     struct range range[3];
-    int n, z, znum, astr3;
+    int n, z, znum, astr3, packed;
 
     if (   GT3_readHeader(&head, varbuf->fp) < 0
         || GT3_decodeHeaderInt(&astr3, &head, "ASTR3") < 0) {
@@ -305,10 +431,7 @@ ngtstat_var(GT3_Varbuf *varbuf)
         return -1;
     }
 
-    for (n = 0; n < 3; n++) {
-        range[n].str = max(0, g_range[n].str);
-        range[n].end = min(varbuf->fp->dimlen[n], g_range[n].end);
-    }
+    packed = set_range(range, varbuf->fp);
 
     znum = range[2].end - range[2].str;
     if (g_zseq) {
@@ -335,25 +458,9 @@ ngtstat_var(GT3_Varbuf *varbuf)
         } else
             z = n + range[2].str;
 
-        if (GT3_readVarZ(varbuf, z) < 0) {
-            GT3_printErrorMessages(stderr);
-            return -1;
-        }
-
-        /*
-         * (re)allocate work buffer.
-         */
-        if (varbuf->bufsize > worksize) {
-            free(work);
-            if ((work = malloc(varbuf->bufsize)) == NULL) {
-                logging(LOG_SYSERR, NULL);
-                return -1;
-            }
-            worksize = varbuf->bufsize;
-        }
-
         stat[n].zidx = z + astr3;
-        calc_stat(stat + n, varbuf, work, range);
+        if (stat_plane(stat + n, varbuf, z, range, packed, &wbuf) < 0)
+            return -1;
     }
 
     print_stat(stat, znum, varbuf->fp->curr + 1, &head);
@@ -399,6 +506,188 @@ finish:
 }
 
 
+/*
+ * Parallel mode (-j): a task is a z-plane (see chunkmap.c), and the
+ * statistics are printed in order for each chunk.
+ */
+struct plane_stat {
+    struct statics stat;
+    GT3_HEADER head;
+};
+
+/* the planes of the current chunk */
+struct chunk_stat {
+    struct statics *stat;
+    int num, size;
+};
+
+
+static int
+plan_planes(chunkmap *cm, const GT3_File *fp, void *arg)
+{
+    int n, z, zstr, znum;
+
+    zstr = max(0, g_range[2].str);
+    znum = min(fp->dimlen[2], g_range[2].end) - zstr;
+    if (g_zseq) {
+        reinitSeq(g_zseq, 1, fp->dimlen[2]);
+        znum = countSeq(g_zseq);
+    }
+
+    /* no plane: only the header is read. */
+    if (znum <= 0)
+        return chunkmap_add(cm, fp->curr, -1);
+
+    for (n = 0; n < znum; n++) {
+        if (g_zseq) {
+            if (nextSeq(g_zseq) < 0) {
+                logging(LOG_WARN, "NOTREACHED");
+                break;
+            }
+            z = g_zseq->curr - 1;
+        } else
+            z = n + zstr;
+
+        if (chunkmap_add(cm, fp->curr, z) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+static void *
+new_part(void *arg)
+{
+    struct plane_stat *ps;
+
+    if ((ps = malloc(sizeof(struct plane_stat))) == NULL)
+        logging(LOG_SYSERR, NULL);
+    return ps;
+}
+
+
+static void
+free_part(void *part, void *arg)
+{
+    free(part);
+}
+
+
+static int
+new_workbuf(void **local, void *arg)
+{
+    struct workbuf *wb;
+
+    if ((wb = malloc(sizeof(struct workbuf))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    memset(wb, 0, sizeof(struct workbuf));
+    *local = wb;
+    return 0;
+}
+
+
+static void
+free_workbuf(void *local, void *arg)
+{
+    struct workbuf *wb = local;
+
+    free(wb->work);
+    free(wb->red);
+    free(wb);
+}
+
+
+static int
+map_plane(void *part, GT3_Varbuf *var, const struct cm_task *task,
+          void *local, void *arg)
+{
+    struct plane_stat *ps = part;
+    struct range range[3];
+    int astr3, packed;
+
+    if (   GT3_readHeader(&ps->head, var->fp) < 0
+        || GT3_decodeHeaderInt(&astr3, &ps->head, "ASTR3") < 0) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+    if (task->z < 0)
+        return 0;
+
+    packed = set_range(range, var->fp);
+    ps->stat.zidx = task->z + astr3;
+    return stat_plane(&ps->stat, var, task->z, range, packed, local);
+}
+
+
+static int
+emit_plane(void *part, const struct cm_task *task, void *arg)
+{
+    struct plane_stat *ps = part;
+    struct chunk_stat *cs = arg;
+    struct statics *p;
+
+    if (task->z >= 0) {
+        if (cs->num == cs->size) {
+            if ((p = realloc(cs->stat, sizeof(struct statics)
+                             * (cs->size + 64))) == NULL) {
+                logging(LOG_SYSERR, NULL);
+                return -1;
+            }
+            cs->stat = p;
+            cs->size += 64;
+        }
+        cs->stat[cs->num++] = ps->stat;
+    }
+
+    if (task->final) {
+        print_stat(cs->stat, cs->num, task->chunk + 1, &ps->head);
+        cs->num = 0;
+    }
+    return 0;
+}
+
+
+int
+ngtstat_parallel(const char *path, struct sequence *seq)
+{
+    struct chunkmap_ops ops;
+    struct chunk_stat cs;
+    chunkmap *cm;
+    int rval = -1;
+
+    memset(&ops, 0, sizeof ops);
+    ops.open = quick_mode ? GT3_openHistFile : NULL;
+    ops.plan = plan_planes;
+    ops.new_part = new_part;
+    ops.free_part = free_part;
+    ops.new_local = new_workbuf;
+    ops.free_local = free_workbuf;
+    ops.map = map_plane;
+    ops.emit = emit_plane;
+
+    memset(&cs, 0, sizeof cs);
+    if ((cm = new_chunkmap(&ops, &cs, nthreads)) == NULL
+        || chunkmap_add_file(cm, path, seq) < 0) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+
+    print_caption(path);
+    if (chunkmap_each(cm) < 0) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+    rval = 0;
+
+finish:
+    free_chunkmap(cm);
+    free(cs.stat);
+    return rval;
+}
+
+
 void
 usage(void)
 {
@@ -411,6 +700,7 @@ usage(void)
         "    -Q        quick access mode\n"
         "    -h        print help message\n"
         "    -a        display total info of all Z-planes\n"
+        "    -j NUM    use NUM threads (0: all processors)\n"
         "    -s        use sigma for min/max\n"
         "    -t LIST   specify data No.\n"
         "    -x RANGE  specify X-range\n"
@@ -437,7 +727,7 @@ main(int argc, char **argv)
 
     print_stat = print_stat1;
 
-    while ((ch = getopt(argc, argv, "Qahst:x:y:z:")) != -1)
+    while ((ch = getopt(argc, argv, "Qahj:st:x:y:z:")) != -1)
         switch (ch) {
         case 'Q':
             quick_mode = 1;
@@ -445,6 +735,12 @@ main(int argc, char **argv)
         case 'a':
             each_plane = 0;
             break;
+        case 'j':
+            if ((nthreads = get_nthreads(optarg)) < 0) {
+                logging(LOG_ERR, "-j: invalid argument: %s", optarg);
+                exit(1);
+            }
+            break;
         case 's':
             print_stat = print_stat2;
             break;
@@ -489,7 +785,9 @@ main(int argc, char **argv)
         if (seq)
             reinitSeq(seq, 1, 0x7fffffff);
 
-        if (ngtstat(*argv, seq) < 0)
+        if (nthreads > 0
+            ? ngtstat_parallel(*argv, seq) < 0
+            : ngtstat(*argv, seq) < 0)
             rval = 1;
     }
     return rval;
@@ -13,6 +13,7 @@
 #include "gtool3.h"
 #include "seq.h"
 #include "fileiter.h"
+#include "chunkmap.h"
 #include "myutils.h"
 
 #define PROGNAME "ngtsumm"
@@ -26,6 +27,7 @@ static int xrange[] = { 0, 0x7ffffff };
 static int yrange[] = { 0, 0x7ffffff };
 static int zrange[] = { 0, 0x7ffffff };
 static int slicing = 0;
+static int nthreads = 0;        /* -j (0: not parallel) */
 
 
 struct data_profile {
@@ -282,6 +284,153 @@ finish:
 }
 
 
+/*
+ * Parallel mode (-j): a task is a z-plane (see chunkmap.c), and the
+ * profiles are printed in order.
+ */
+struct plane_prof {
+    struct data_profile prof;
+    char item[32];
+    int zstr;
+};
+
+
+static int
+plan_planes(chunkmap *cm, const GT3_File *fp, void *arg)
+{
+    int z, zmax;
+
+    zmax = min(zrange[1], fp->dimlen[2]);
+    if (zrange[0] >= zmax)
+        return chunkmap_add(cm, fp->curr, -1);
+
+    for (z = zrange[0]; z < zmax; z++)
+        if (chunkmap_add(cm, fp->curr, z) < 0)
+            return -1;
+    return 0;
+}
+
+
+static void *
+new_part(void *arg)
+{
+    return malloc(sizeof(struct plane_prof));
+}
+
+
+static void
+free_part(void *part, void *arg)
+{
+    free(part);
+}
+
+
+static int
+map_plane(void *part, GT3_Varbuf *var, const struct cm_task *task,
+          void *local, void *arg)
+{
+    struct plane_prof *pp = part;
+    size_t len, xlen, ylen;
+    void *data;
+
+    /* no plane in the z-range (an error as in print_summary()) */
+    if (task->z < 0 || GT3_readVarZ(var, task->z) < 0)
+        return -1;
+
+    pp->item[0] = '\0';
+    GT3_getVarAttrStr(pp->item, sizeof pp->item, var, "ITEM");
+    GT3_getVarAttrInt(&pp->zstr, var, "ASTR3");
+    init_profile(&pp->prof);
+    pp->prof.miss = var->miss;
+
+    if (!slicing) {
+        len = var->dimlen[0] * var->dimlen[1];
+        if (var->type == GT3_TYPE_FLOAT)
+            get_dataprof_float(var->data, len, &pp->prof);
+        else
+            get_dataprof_double(var->data, len, &pp->prof);
+        return 0;
+    }
+
+    xlen = min(var->dimlen[0], xrange[1] - xrange[0]);
+    ylen = min(var->dimlen[1], yrange[1] - yrange[0]);
+    if (xlen <= 0 || ylen <= 0
+        || (data = malloc(xlen * ylen * 8)) == NULL)
+        return -1;
+
+    if (var->type == GT3_TYPE_FLOAT) {
+        len = pack_slice_float(data, var);
+        get_dataprof_float(data, len, &pp->prof);
+    } else {
+        len = pack_slice_double(data, var);
+        get_dataprof_double(data, len, &pp->prof);
+    }
+    free(data);
+    return 0;
+}
+
+
+static int
+emit_plane(void *part, const struct cm_task *task, void *arg)
+{
+    struct plane_prof *pp = part;
+    struct data_profile *sum = arg;
+    char prefix[64];            /* "%8d %-12s %5d" with item[32] */
+
+    if (each_plane) {
+        snprintf(prefix, sizeof prefix, "%8d %-12s %5d",
+                 task->chunk + 1, pp->item, pp->zstr + task->z);
+        print_profile(stdout, &pp->prof, prefix);
+        return 0;
+    }
+
+    sum->miss_cnt += pp->prof.miss_cnt;
+    sum->nan_cnt  += pp->prof.nan_cnt;
+    sum->pinf_cnt += pp->prof.pinf_cnt;
+    sum->minf_cnt += pp->prof.minf_cnt;
+    if (task->final) {
+        snprintf(prefix, sizeof prefix, "%8d %-12s %5s",
+                 task->chunk + 1, pp->item, "");
+        print_profile(stdout, sum, prefix);
+        init_profile(sum);
+    }
+    return 0;
+}
+
+
+static int
+summ_file_parallel(const char *path, struct sequence *seq)
+{
+    struct chunkmap_ops ops;
+    struct data_profile sum;
+    chunkmap *cm;
+    int rval = -1;
+
+    memset(&ops, 0, sizeof ops);
+    ops.plan = plan_planes;
+    ops.new_part = new_part;
+    ops.free_part = free_part;
+    ops.map = map_plane;
+    ops.emit = emit_plane;
+
+    init_profile(&sum);
+    if ((cm = new_chunkmap(&ops, &sum, nthreads)) == NULL
+        || chunkmap_add_file(cm, path, seq) < 0) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+
+    print_caption(stdout, path);
+    if (chunkmap_each(cm) < 0)
+        goto finish;
+    rval = 0;
+
+finish:
+    free_chunkmap(cm);
+    return rval;
+}
+
+
 static int
 set_range(int range[], const char *str)
 {
@@ -315,6 +464,7 @@ usage(void)
         "\n"
         "Options:\n"
         "    -h        print help message\n"
+        "    -j NUM    use NUM threads (0: all processors)\n"
         "    -l        print for each Z-plane\n"
         "    -t LIST   specify data No.\n"
         "    -x RANGE  specify X-range\n"
@@ -335,8 +485,16 @@ main(int argc, char **argv)
     int ch, rval;
     struct sequence *seq = NULL;
 
-    while ((ch = getopt(argc, argv, "hlt:x:y:z:")) != EOF)
+    while ((ch = getopt(argc, argv, "hj:lt:x:y:z:")) != EOF)
         switch (ch) {
+        case 'j':
+            if ((nthreads = get_nthreads(optarg)) < 0) {
+                fprintf(stderr, PROGNAME ": -j: invalid argument: %s\n",
+                        optarg);
+                exit(1);
+            }
+            break;
+
         case 'l':
             each_plane = 1;
             break;
@@ -374,7 +532,9 @@ main(int argc, char **argv)
         if (seq)
             reinitSeq(seq, 1, 0x7fffffff);
 
-        if (summ_file(*argv, seq) < 0)
+        if (nthreads > 0
+            ? summ_file_parallel(*argv, seq) < 0
+            : summ_file(*argv, seq) < 0)
             rval = 1;
     }
     return rval;
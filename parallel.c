@@ -0,0 +1,229 @@
+/*
+ * parallel.c -- a tiny parallel-for over independent tasks.
+ *
+ * Without pthreads, tasks are run sequentially by the caller.
+ */
+#include "internal.h"
+
+#include <stdlib.h>
+#ifdef HAVE_LIBPTHREAD
+#  include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#define MAX_THREADS 256
+
+
+/*
+ * num_processors() returns the number of online processors (>= 1).
+ */
+int
+num_processors(void)
+{
+    long n = 1;
+
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1)
+        n = 1;
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+    return (int)n;
+}
+
+
+struct task_queue {
+    size_t ntasks;
+    size_t next;                /* next task to run */
+    int nworkers;               /* # of threads started to run */
+    int failed;
+    int (*func)(size_t, int, void *);
+    void *arg;
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+
+static void *
+run_tasks(void *ptr)
+{
+    struct task_queue *q = ptr;
+    size_t i;
+    int id, failed = 0;
+
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_lock(&q->lock);
+#endif
+    id = q->nworkers++;
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_unlock(&q->lock);
+#endif
+
+    for (;;) {
+#ifdef HAVE_LIBPTHREAD
+        pthread_mutex_lock(&q->lock);
+#endif
+        i = q->next++;
+        if (i >= q->ntasks)
+            q->failed |= failed;
+#ifdef HAVE_LIBPTHREAD
+        pthread_mutex_unlock(&q->lock);
+#endif
+        if (i >= q->ntasks)
+            break;
+
+        if (q->func(i, id, q->arg) != 0)
+            failed = 1;
+    }
+    return NULL;
+}
+
+
+/*
+ * parallel_run() calls func(i, id, arg) for i = 0, ..., ntasks-1,
+ * using up to 'nthreads' threads (including the caller).
+ * Tasks are picked up in ascending order, but they may be completed
+ * in any order.  'id' (0, ..., nthreads-1) identifies the thread
+ * running the task, so that each thread can have its own resources.
+ *
+ * func() returns non-zero on failure, and then parallel_run() returns
+ * -1 after all tasks have been done.
+ * The error stack of gt3_error() is thread-local, so that errors raised
+ * in func() by the other threads are not seen by the caller: func()
+ * should save them by copy_last_error(), and the caller raises them
+ * again by raise_error() (see run_block() in chunkmap.c).
+ */
+int
+parallel_run(int nthreads, size_t ntasks,
+             int (*func)(size_t, int, void *), void *arg)
+{
+    struct task_queue q;
+#ifdef HAVE_LIBPTHREAD
+    pthread_t tid_buf[MAX_THREADS];
+    int i, nstarted = 0;
+#endif
+
+    q.ntasks = ntasks;
+    q.next = 0;
+    q.nworkers = 0;
+    q.failed = 0;
+    q.func = func;
+    q.arg = arg;
+
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    if ((size_t)nthreads > ntasks)
+        nthreads = (int)ntasks;
+
+#ifdef HAVE_LIBPTHREAD
+    pthread_mutex_init(&q.lock, NULL);
+    if (nthreads > 1) {
+        /*
+         * If a thread cannot be created, the remaining tasks are
+         * run by fewer threads.
+         */
+        for (i = 0; i < nthreads - 1; i++) {
+            if (pthread_create(tid_buf + i, NULL, run_tasks, &q) != 0)
+                break;
+            nstarted++;
+        }
+        run_tasks(&q);
+
+        for (i = 0; i < nstarted; i++)
+            pthread_join(tid_buf[i], NULL);
+    } else
+        run_tasks(&q);
+
+    pthread_mutex_destroy(&q.lock);
+#else
+    run_tasks(&q);
+#endif
+    return q.failed ? -1 : 0;
+}
+
+
+struct for_arg {
+    int (*func)(size_t, void *);
+    void *arg;
+};
+
+
+static int
+call_for(size_t i, int id, void *ptr)
+{
+    struct for_arg *p = ptr;
+
+    return p->func(i, p->arg);
+}
+
+
+/*
+ * parallel_for() is parallel_run() for func(i, arg), which does not
+ * care which thread runs it.
+ */
+int
+parallel_for(int nthreads, size_t ntasks,
+             int (*func)(size_t, void *), void *arg)
+{
+    struct for_arg p;
+
+    p.func = func;
+    p.arg = arg;
+    return parallel_run(nthreads, ntasks, call_for, &p);
+}
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+
+static int
+square(size_t i, void *arg)
+{
+    double *p = arg;
+
+    p[i] = (double)i * i;
+    return i == 77;             /* fail in one task */
+}
+
+
+static int
+record_id(size_t i, int id, void *arg)
+{
+    int *p = arg;
+
+    p[i] = id;
+    return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    double buf[1000];
+    int ids[1000];
+    int nth, i;
+
+    assert(num_processors() >= 1);
+
+    for (nth = 1; nth < 10; nth++) {
+        for (i = 0; i < 1000; i++)
+            buf[i] = -1.;
+
+        assert(parallel_for(nth, 1000, square, buf) == -1);
+        for (i = 0; i < 1000; i++)
+            assert(buf[i] == (double)i * i);
+
+        assert(parallel_for(nth, 77, square, buf) == 0);
+        assert(parallel_for(nth, 0, square, buf) == 0);
+
+        assert(parallel_run(nth, 1000, record_id, ids) == 0);
+        for (i = 0; i < 1000; i++)
+            assert(ids[i] >= 0 && ids[i] < nth);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,216 @@
+/*
+ * pcache.c -- LRU cache of decoded z-planes (used by GT3_Varbuf).
+ *
+ * Planes are keyed by (chunk, z), and the least recently used ones
+ * are evicted when the total size exceeds the budget.
+ */
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+
+
+struct plane_entry {
+    int ch, z;                  /* key */
+    size_t size;                /* in bytes */
+    void *data;
+
+    struct plane_entry *prev, *next;
+};
+
+
+plane_cache *
+new_plane_cache(size_t budget)
+{
+    plane_cache *pc;
+
+    if ((pc = malloc(sizeof(plane_cache))) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return NULL;
+    }
+    memset(pc, 0, sizeof(plane_cache));
+    pc->budget = budget;
+    return pc;
+}
+
+
+static void
+unlink_entry(plane_cache *pc, plane_entry *ent)
+{
+    if (ent->prev)
+        ent->prev->next = ent->next;
+    else
+        pc->head = ent->next;
+
+    if (ent->next)
+        ent->next->prev = ent->prev;
+    else
+        pc->tail = ent->prev;
+
+    ent->prev = ent->next = NULL;
+}
+
+
+static void
+push_front(plane_cache *pc, plane_entry *ent)
+{
+    ent->prev = NULL;
+    ent->next = pc->head;
+    if (pc->head)
+        pc->head->prev = ent;
+    else
+        pc->tail = ent;
+    pc->head = ent;
+}
+
+
+static void
+evict_lru(plane_cache *pc)
+{
+    plane_entry *ent = pc->tail;
+
+    if (ent) {
+        debug2("evict_lru(): ch=%d, z=%d", ent->ch, ent->z);
+        unlink_entry(pc, ent);
+        pc->used -= ent->size;
+        pc->num--;
+        free(ent->data);
+        free(ent);
+    }
+}
+
+
+/*
+ * remove all the planes (the counters are kept).
+ */
+void
+clear_plane_cache(plane_cache *pc)
+{
+    if (pc)
+        while (pc->tail)
+            evict_lru(pc);
+}
+
+
+void
+free_plane_cache(plane_cache *pc)
+{
+    clear_plane_cache(pc);
+    free(pc);
+}
+
+
+void
+resize_plane_cache(plane_cache *pc, size_t budget)
+{
+    pc->budget = budget;
+    while (pc->used > pc->budget)
+        evict_lru(pc);
+}
+
+
+/*
+ * lookup_plane() returns the cached plane of (ch, z), or NULL.
+ * 'size' must be the size of the plane (in bytes).
+ */
+const void *
+lookup_plane(plane_cache *pc, int ch, int z, size_t size)
+{
+    plane_entry *ent;
+
+    for (ent = pc->head; ent; ent = ent->next)
+        if (ent->ch == ch && ent->z == z && ent->size == size) {
+            if (ent != pc->head) {
+                unlink_entry(pc, ent);
+                push_front(pc, ent);
+            }
+            pc->hits++;
+            return ent->data;
+        }
+
+    pc->misses++;
+    return NULL;
+}
+
+
+/*
+ * store_plane() stores a copy of the plane of (ch, z).
+ * A plane larger than the budget is not stored.
+ * Caching is best-effort: -1 is returned without an error message
+ * if memory is exhausted.
+ */
+int
+store_plane(plane_cache *pc, int ch, int z, const void *data, size_t size)
+{
+    plane_entry *ent;
+
+    if (size > pc->budget)
+        return 0;
+
+    while (pc->used + size > pc->budget)
+        evict_lru(pc);
+
+    if ((ent = malloc(sizeof(plane_entry))) == NULL
+        || (ent->data = malloc(size)) == NULL) {
+        free(ent);
+        return -1;
+    }
+
+    ent->ch = ch;
+    ent->z = z;
+    ent->size = size;
+    memcpy(ent->data, data, size);
+    push_front(pc, ent);
+    pc->used += size;
+    pc->num++;
+    return 0;
+}
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+
+int
+main(int argc, char **argv)
+{
+    plane_cache *pc;
+    double a[4] = { 1., 2., 3., 4. };
+    const double *p;
+
+    pc = new_plane_cache(2 * sizeof a);
+    assert(lookup_plane(pc, 0, 0, sizeof a) == NULL);
+
+    store_plane(pc, 0, 0, a, sizeof a);
+    a[0] = 10.;
+    store_plane(pc, 0, 1, a, sizeof a);
+
+    p = lookup_plane(pc, 0, 0, sizeof a);
+    assert(p && p[0] == 1.);
+
+    /* (0, 1) is the LRU, which is evicted. */
+    a[0] = 100.;
+    store_plane(pc, 1, 0, a, sizeof a);
+    assert(pc->num == 2 && pc->used == 2 * sizeof a);
+    assert(lookup_plane(pc, 0, 1, sizeof a) == NULL);
+    assert(lookup_plane(pc, 0, 0, sizeof a) != NULL);
+    p = lookup_plane(pc, 1, 0, sizeof a);
+    assert(p && p[0] == 100.);
+
+    assert(pc->hits == 3 && pc->misses == 2);
+
+    resize_plane_cache(pc, sizeof a);
+    assert(pc->num == 1);
+    assert(lookup_plane(pc, 1, 0, sizeof a) != NULL);
+
+    /* too large to store */
+    resize_plane_cache(pc, 0);
+    assert(pc->num == 0 && pc->used == 0);
+    store_plane(pc, 2, 0, a, sizeof a);
+    assert(pc->num == 0);
+
+    free_plane_cache(pc);
+    return 0;
+}
+#endif
@@ -77,8 +77,8 @@ sread_dword(void *dest, const void *src)
  * XXX: 'skip' and 'nelem' are not in bytes.
  */
 static int
-read_URCv(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp,
-          UNPACK_FUNC unpack_func)
+read_URCv(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+          GT3_File *fp, UNPACK_FUNC unpack_func)
 {
     unsigned packed[8192];
     unsigned char pbuf[8 + 4 + 4 + 7 * sizeof(fort_size_t)];
@@ -90,22 +90,18 @@ read_URCv(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp,
     int i;
     float *outp;
 
-    off = var->fp->off
+    off = fp->off
         + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t)
         + (8 + 4 + 4
            + 2 * var->dimlen[0] * var->dimlen[1]
            + 8 * sizeof(fort_size_t)) * zpos;
 
-    if (fseeko(fp, off, SEEK_SET) < 0) {
-        gt3_error(SYSERR, NULL);
-        return -1;
-    }
-
     /*
      * Three parameters (ref, D, and E)
      */
-    if (xfread(pbuf, 1, sizeof pbuf, fp) < 0)
+    if (xpread(pbuf, 1, sizeof pbuf, off, fp) < 0)
         return -1;
+    off += sizeof pbuf;
 
     sread_dword(&ref, pbuf + 4); /* ref (double) */
     sread_word(&nd,   pbuf + 20); /* D (integer) */
@@ -126,10 +122,7 @@ read_URCv(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp,
     skip &= ~1U;
     nelem = (nelem + 1) & ~1U;
 
-    if (skip != 0 && fseeko(fp, 2 * skip, SEEK_CUR) < 0) {
-        gt3_error(SYSERR, "read_URCv()");
-        return -1;
-    }
+    off += 2 * skip;
 
     assert(var->type == GT3_TYPE_FLOAT);
     outp = (float *)var->data + skip;
@@ -140,12 +133,9 @@ read_URCv(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp,
     for (i = 0; nelem > 0; i++, nelem -= num) {
         num = min(nelem, sizeof packed / 2);
 
-        if (xfread(packed, 4, num / 2, fp) < 0)
+        if (xpread_words(packed, num / 2, off, fp) < 0)
             return -1;
-
-        /* reversing byte order */
-        if (IS_LITTLE_ENDIAN)
-            reverse_words(packed, num / 2);
+        off += 2 * num;
 
         unpack_func(packed, num / 2, ref, ne, nd,
                     var->miss, outp + i * (sizeof packed / 2));
@@ -155,14 +145,14 @@ read_URCv(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp,
 
 
 int
-read_URC1(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_URC1(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     return read_URCv(var, zpos, skip, nelem, fp, urc1_unpack);
 }
 
 
 int
-read_URC2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_URC2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     return read_URCv(var, zpos, skip, nelem, fp, urc2_unpack);
 }
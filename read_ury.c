@@ -17,7 +17,6 @@
 #include "debug.h"
 
 
-#define RESERVE_SIZE (640*320)
 #define RESERVE_NZ   256
 
 
@@ -37,121 +36,272 @@ get_zero_index(double offset, double scale, unsigned max_count)
 }
 
 
+/*
+ * parameters to decode packed integers.
+ */
+typedef struct {
+    unsigned imiss;             /* code of missing value */
+    unsigned zero_index;        /* code of exact zero (if > 0) */
+    double offset, scale, miss;
+} decoder;
+
+
+static void
+init_decoder(decoder *dec, unsigned nbits,
+             double offset, double scale, double miss)
+{
+    dec->imiss = (1U << nbits) - 1U;
+    dec->zero_index = get_zero_index(offset, scale, dec->imiss);
+    dec->offset = offset;
+    dec->scale = scale;
+    dec->miss = miss;
+}
+
+
+/*
+ * decode unpacked integers into 'outp'.
+ *
+ * The loops have no branch but selecting MISS (which is a
+ * conditional move).  In the zero_index case,
+ * scale * (idata - zero_index) is computed in double, which is exact
+ * and the same value as computed in unsigned with the sign flipped.
+ */
+static void
+decode_packed(double *outp, const unsigned *idata, size_t ndata,
+              const decoder *dec)
+{
+    unsigned imiss = dec->imiss;
+    double zi, v;
+    size_t i;
+
+    if (dec->zero_index > 0) {
+        zi = dec->zero_index;
+        for (i = 0; i < ndata; i++) {
+            v = dec->scale * ((double)idata[i] - zi);
+            outp[i] = idata[i] != imiss ? v : dec->miss;
+        }
+    } else {
+        for (i = 0; i < ndata; i++) {
+            v = dec->offset + idata[i] * dec->scale;
+            outp[i] = idata[i] != imiss ? v : dec->miss;
+        }
+    }
+}
+
+
+/*
+ * unpack and decode 'ndata' values, by a group of 32 values
+ * so that the unpacked integers stay in cache.
+ */
+static void
+unpack_decode(double *outp, const uint32_t *packed, size_t ndata,
+              unsigned nbits, const decoder *dec)
+{
+    unsigned idata[32];
+    unsigned ng;
+
+    for (; ndata > 0; ndata -= ng, outp += ng, packed += nbits) {
+        ng = ndata > 32 ? 32 : (unsigned)ndata;
+
+        unpack_bits_from32(idata, ng, packed, nbits);
+        decode_packed(outp, idata, ng, dec);
+    }
+}
+
+
 /*
  * read packed data in URY-format and decode them.
+ *
+ * If 'mask' is not NULL (MRY), the 'nelems' values are the MASK-ON
+ * ones, and they are expanded into 'outp' (of 'nout' elements)
+ * with MISS at the MASK-OFF elements, by a block of decoded values.
  */
 static int
 read_packed(double *outp, size_t nelems,
             unsigned nbits, double offset, double scale,
-            double miss, FILE *fp)
+            double miss, const GT3_Datamask *mask, size_t nout,
+            off_t off, GT3_File *fp)
 {
 #define URYBUFSIZ 1024
+#define NVALUES 1024
     uint32_t packed[32 * URYBUFSIZ];
-    unsigned idata[32 * URYBUFSIZ], zero_index;
-    uint32_t imiss;
-    size_t npack_per_read, ndata_per_read;
-    size_t i, npack, ndata, nrest, nrest_packed;
-
-    imiss = (1U << nbits) - 1U;
+    double values[NVALUES];
+    decoder dec;
+    const uint32_t *pp;
+    size_t npack, ndata, nrest, nrest_packed, pos, nv, nused;
 
-    npack_per_read = URYBUFSIZ * nbits;
-    ndata_per_read = 32 * URYBUFSIZ;
+    init_decoder(&dec, nbits, offset, scale, miss);
 
     nrest = nelems;
     nrest_packed = pack32_len(nelems, nbits);
-
-    zero_index = get_zero_index(offset, scale, imiss);
+    pos = 0;                    /* position in 'outp' (for MRY) */
 
     while (nrest > 0) {
-        npack = nrest_packed > npack_per_read
-            ? npack_per_read
+        npack = nrest_packed > URYBUFSIZ * nbits
+            ? URYBUFSIZ * nbits
             : nrest_packed;
 
-        ndata = nrest > ndata_per_read
-            ? ndata_per_read
+        ndata = nrest > 32 * URYBUFSIZ
+            ? 32 * URYBUFSIZ
             : nrest;
 
         assert(npack == pack32_len(ndata, nbits));
 
-        if (xfread(packed, 4, npack, fp) < 0)
+        if (xpread_words(packed, npack, off, fp) < 0)
             return -1;
+        off += 4 * npack;
 
-        if (IS_LITTLE_ENDIAN)
-            reverse_words(packed, npack);
-
-        unpack_bits_from32(idata, ndata, packed, nbits);
-
-        if (zero_index > 0) {
-            for (i = 0; i < ndata; i++)
-                if (idata[i] == imiss)
-                    outp[i] = miss;
-                else
-                    outp[i] = (idata[i] >= zero_index)
-                        ? scale * (idata[i] - zero_index)
-                        : -scale * (zero_index - idata[i]);
-        } else {
-            for (i = 0; i < ndata; i++)
-                outp[i] = (idata[i] != imiss)
-                    ? offset + idata[i] * scale
-                    : miss;
-        }
-
-        outp += ndata;
         nrest -= ndata;
         nrest_packed -= npack;
+
+        if (!mask) {
+            unpack_decode(outp, packed, ndata, nbits, &dec);
+            outp += ndata;
+            continue;
+        }
+
+        for (pp = packed; ndata > 0; ndata -= nv, pp += nv / 32 * nbits) {
+            nv = ndata > NVALUES ? NVALUES : ndata;
+
+            unpack_decode(values, pp, nv, nbits, &dec);
+            pos += expand_masked(outp + pos, nout - pos, values, nv,
+                                 mask->mask, pos, miss, &nused);
+            assert(nused == nv);
+        }
     }
     assert(nrest == 0 && nrest_packed == 0);
 
+    /* MASK-OFF elements after the last MASK-ON. */
+    if (mask)
+        pos += expand_masked(outp + pos, nout - pos, NULL, 0,
+                             mask->mask, pos, miss, &nused);
+    assert(!mask || pos == nout);
+
     return 0;
 }
 
 
 /*
- * XXX: 'skip' and 'nelem' are ignored for now.
- * read_URY2() reads all data in a z-plane.
+ * read_packed_range() reads the packed data from 'start' to
+ * 'start + nelems - 1' (in elements) in the packed array at 'off',
+ * and decodes every 'stride'-th of them.
  */
 static int
-read_URY2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
-          FILE *fp, int oldflag)
+read_packed_range(double *outp, size_t start, size_t nelems, int stride,
+                  unsigned nbits, double offset, double scale,
+                  double miss, off_t off, GT3_File *fp)
+{
+    uint32_t packed_buf[1024];
+    unsigned idata_buf[1024];
+    uint32_t *packed = NULL;
+    unsigned *idata = NULL;
+    uint64_t bpos;
+    decoder dec;
+    size_t npack, i, n;
+    int rval = -1;
+
+    if (nelems == 0)
+        return 0;
+
+    bpos = (uint64_t)nbits * start;
+    npack = (size_t)((bpos % 32 + (uint64_t)nbits * nelems + 31) / 32);
+
+    if ((packed = tiny_alloc(packed_buf,
+                             sizeof packed_buf,
+                             sizeof(uint32_t) * npack)) == NULL
+        || (idata = tiny_alloc(idata_buf,
+                               sizeof idata_buf,
+                               sizeof(unsigned) * nelems)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        goto finish;
+    }
+
+    if (xpread_words(packed, npack, off + 4 * (off_t)(bpos / 32), fp) < 0)
+        goto finish;
+
+    unpack_bits_from32_at(idata, nelems, packed, nbits,
+                          (unsigned)(bpos % 32));
+
+    /* pick up every 'stride'-th. */
+    for (i = 0, n = 0; i < nelems; i += stride, n++)
+        idata[n] = idata[i];
+
+    init_decoder(&dec, nbits, offset, scale, miss);
+    decode_packed(outp, idata, n, &dec);
+    rval = 0;
+
+finish:
+    tiny_free(idata, idata_buf);
+    tiny_free(packed, packed_buf);
+    return rval;
+}
+
+
+/*
+ * ury_plane() gets the packing parameters of URY (or URX) in 'zpos',
+ * and the position of the packed data.
+ */
+static int
+ury_plane(double *offset, double *scale, off_t *pos,
+          int zpos, GT3_File *fp, int oldflag)
 {
     off_t off;
-    double dma[2], offset, scale;
+    double dma[2];
     unsigned nbits;
     size_t zelems;              /* # of elements in a z-level */
 
-    /*
-     * XXX: read_URY() always reads all the data in a z-plane.
-     * 'skip' and 'nelem' passed as an argument are ignored.
-     */
-    zelems = var->dimlen[0] * var->dimlen[1];
-    nbits = (unsigned)var->fp->fmt >> GT3_FMT_MBIT;
+    zelems = fp->dimlen[0] * fp->dimlen[1];
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
 
     /*
      * read packing parameters for URY.
      */
-    off = var->fp->off + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t);
-    if (fseeko(fp, off, SEEK_SET) < 0)
-        return -1;
-    if (read_dwords_from_record(dma, 2 * zpos, 2, fp) < 0)
+    off = fp->off + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t);
+    if (read_dwords_from_record(dma, 2 * zpos, 2, &off, fp) < 0)
         return -1;
 
     /*
      * skip to zpos.
      */
-    off = sizeof(fort_size_t) + 4 * zpos * pack32_len(zelems, nbits);
-    if (fseeko(fp, off, SEEK_CUR) < 0)
-        return -1;
+    *pos = off + sizeof(fort_size_t) + 4 * zpos * pack32_len(zelems, nbits);
 
-    offset = dma[0];
-    scale = dma[1];
+    *offset = dma[0];
+    *scale = dma[1];
     if (oldflag)
-        scale = (nbits == 1) ? 0. : dma[1] / ((1U << nbits) - 2);
+        *scale = (nbits == 1) ? 0. : dma[1] / ((1U << nbits) - 2);
+
+    return 0;
+}
+
+
+/*
+ * XXX: 'skip' and 'nelem' are ignored for now.
+ * read_URY2() reads all data in a z-plane.
+ */
+static int
+read_URY2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+          GT3_File *fp, int oldflag)
+{
+    off_t off;
+    double offset, scale;
+    unsigned nbits;
+    size_t zelems;              /* # of elements in a z-level */
+
+    /*
+     * XXX: read_URY() always reads all the data in a z-plane.
+     * 'skip' and 'nelem' passed as an argument are ignored.
+     */
+    zelems = var->dimlen[0] * var->dimlen[1];
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
+
+    if (ury_plane(&offset, &scale, &off, zpos, fp, oldflag) < 0)
+        return -1;
 
     /*
      * read packed DATA-BODY in zpos.
      */
     if (read_packed(var->data, zelems, nbits,
-                    offset, scale, var->miss, fp) < 0)
+                    offset, scale, var->miss, NULL, 0, off, fp) < 0)
         return -1;
 
     return 0;
@@ -159,134 +309,601 @@ read_URY2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
 
 
 /*
- * Note: 3rd argument (skip) is ignored, which should be zero.
+ * mry_plane() gets the packing parameters of MRY (or MRX) in 'zpos',
+ * the position of the packed data, and the # of MASK-ON elements.
  */
 static int
-read_MRY2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
-          FILE *fp, int oldflag)
+mry_plane(double *offset, double *scale, off_t *pos, size_t *num,
+          int zpos, GT3_File *fp, int oldflag)
 {
     off_t off;
-    double dma[2], offset, scale;
-    GT3_Datamask *mask;
+    double dma[2];
     unsigned nbits;
-    size_t skip2, i, n;
-    double *outp;
+    size_t skip2;
+    int i, rval = -1;
     uint32_t nnn_buf[RESERVE_NZ];
-    double data_buf[RESERVE_SIZE];
     uint32_t *nnn = nnn_buf;    /* the Number of Non-missing Number  */
-    double *data = data_buf;
-
-    /*
-     * read MASK.
-     */
-    mask = var->fp->mask;
-    if (!mask && (mask = GT3_newMask()) == NULL)
-        return -1;
-    if (GT3_loadMaskX(mask, zpos, var->fp) != 0)
-        return -1;
-    var->fp->mask = mask;
 
     if ((nnn = tiny_alloc(nnn_buf,
                           sizeof nnn_buf,
-                          sizeof(uint32_t) * var->dimlen[2])) == NULL)
+                          sizeof(uint32_t) * fp->dimlen[2])) == NULL) {
+        gt3_error(SYSERR, NULL);
         return -1;
+    }
 
     /* skip to NNN */
-    off = var->fp->off
+    off = fp->off
         + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t)
         + 4 + 2 * sizeof(fort_size_t);
-    if (fseeko(fp, off, SEEK_SET) < 0)
-        goto error;
 
     /* read NNN. */
-    if (read_words_from_record(nnn, 0, var->dimlen[2], fp) < 0)
-        goto error;
+    if (read_words_from_record(nnn, 0, fp->dimlen[2], &off, fp) < 0)
+        goto finish;
 
     /* skip IZLEN */
-    if (read_words_from_record(NULL, 0, 0, fp) < 0)
-        goto error;
+    if (read_words_from_record(NULL, 0, 0, &off, fp) < 0)
+        goto finish;
 
     /* read DMA. */
-    if (read_dwords_from_record(dma, 2 * zpos, 2, fp) < 0)
-        goto error;
+    if (read_dwords_from_record(dma, 2 * zpos, 2, &off, fp) < 0)
+        goto finish;
 
     /* skip MASK. */
-    if (read_words_from_record(NULL, 0, 0, fp) < 0)
-        goto error;
+    if (read_words_from_record(NULL, 0, 0, &off, fp) < 0)
+        goto finish;
 
-    nbits = (unsigned)var->fp->fmt >> GT3_FMT_MBIT;
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
 
-    offset = dma[0];
-    scale = dma[1];
+    *offset = dma[0];
+    *scale = dma[1];
     if (oldflag)
-        scale = (nbits == 1) ? 0. : dma[1] / ((1U << nbits) - 2);
+        *scale = (nbits == 1) ? 0. : dma[1] / ((1U << nbits) - 2);
 
     /*
      * skip to zpos.
      */
     for (skip2 = sizeof(fort_size_t), i = 0; i < zpos; i++)
         skip2 += 4 * pack32_len(nnn[i], nbits);
-    if (fseeko(fp, skip2, SEEK_CUR) < 0)
-        goto error;
+
+    *pos = off + skip2;
+    *num = nnn[zpos];
+    rval = 0;
+
+finish:
+    tiny_free(nnn, nnn_buf);
+    return rval;
+}
+
+
+/*
+ * Note: 3rd argument (skip) is ignored, which should be zero.
+ */
+static int
+read_MRY2(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem,
+          GT3_File *fp, int oldflag)
+{
+    off_t off;
+    double offset, scale;
+    GT3_Datamask *mask;
+    unsigned nbits;
+    size_t num;
 
     /*
-     * read packed data and decode them.
+     * read MASK.
      */
-    if ((data = tiny_alloc(data_buf,
-                           sizeof data_buf,
-                           sizeof(double) * nnn[zpos])) == NULL
-        || read_packed(data, nnn[zpos], nbits,
-                       offset, scale, var->miss, fp) < 0)
-        goto error;
+    mask = fp->mask;
+    if (!mask && (mask = GT3_newMask()) == NULL)
+        return -1;
+    if (GT3_loadMaskX(mask, zpos, fp) != 0)
+        return -1;
+    fp->mask = mask;
+
+    if (mry_plane(&offset, &scale, &off, &num, zpos, fp, oldflag) < 0)
+        return -1;
+
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
 
     /*
-     * unmask.
+     * read packed data, decode and unmask them.
      */
     assert(var->type == GT3_TYPE_DOUBLE);
-    outp = var->data;
-    for (i = 0, n = 0; i < nelem; i++)
-        if (getMaskValue(mask, i)) {
-            outp[i] = data[n];
-            n++;
-        } else
-            outp[i] = var->miss;
+    assert(num <= nelem);
+    if (read_packed(var->data, num, nbits, offset, scale, var->miss,
+                    mask, nelem, off, fp) < 0)
+        return -1;
 
-    assert(n == nnn[zpos]);
+    return 0;
+}
 
-    tiny_free(nnn, nnn_buf);
-    tiny_free(data, data_buf);
+
+/*
+ * read_URY_slab2() reads a hyperslab in 'zpos':
+ * x = x0, x0 + stride, ..., (nx elements) and
+ * y = y0, y0 + stride, ..., (ny elements).
+ * Only the packed data in the requested rows are read and unpacked.
+ */
+static int
+read_URY_slab2(double *outp, GT3_Varbuf *var, int zpos,
+               int x0, int nx, int y0, int ny, int stride,
+               GT3_File *fp, int oldflag)
+{
+    off_t off;
+    double offset, scale;
+    unsigned nbits;
+    size_t start, span;
+    int j;
+
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
+    if (ury_plane(&offset, &scale, &off, zpos, fp, oldflag) < 0)
+        return -1;
+
+    span = (size_t)(nx - 1) * stride + 1;
+    for (j = 0; j < ny; j++) {
+        start = (size_t)fp->dimlen[0] * (y0 + j * stride) + x0;
+
+        if (read_packed_range(outp, start, span, stride, nbits,
+                              offset, scale, var->miss, off, fp) < 0)
+            return -1;
+        outp += nx;
+    }
     return 0;
+}
 
-error:
-    gt3_error(SYSERR, NULL);
-    tiny_free(nnn, nnn_buf);
+
+/*
+ * MRY version of read_URY_slab2().
+ * Positions of the requested rows in the packed data are found
+ * by the mask index, and only the rows are unpacked.
+ */
+static int
+read_MRY_slab2(double *outp, GT3_Varbuf *var, int zpos,
+               int x0, int nx, int y0, int ny, int stride,
+               GT3_File *fp, int oldflag)
+{
+    off_t off;
+    double offset, scale;
+    GT3_Datamask *mask;
+    unsigned nbits;
+    size_t num, start, span, row, cnt, i, n;
+    double data_buf[1024];
+    double *data = NULL;
+    int j, k, rval = -1;
+
+    mask = fp->mask;
+    if (!mask && (mask = GT3_newMask()) == NULL)
+        return -1;
+    if (GT3_loadMaskX(mask, zpos, fp) != 0)
+        return -1;
+    fp->mask = mask;
+
+    if (GT3_updateMaskIndex(mask, fp->dimlen[0]) < 0)
+        return -1;
+
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
+    if (mry_plane(&offset, &scale, &off, &num, zpos, fp, oldflag) < 0)
+        return -1;
+
+    span = (size_t)(nx - 1) * stride + 1;
+    if ((data = tiny_alloc(data_buf,
+                           sizeof data_buf,
+                           sizeof(double) * span)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
+
+    for (j = 0; j < ny; j++) {
+        row = (size_t)fp->dimlen[0] * (y0 + j * stride);
+
+        /* start: # of MASK-ON elements before x0 in the row. */
+        start = GT3_getMaskRank(mask, row + x0);
+
+        /* cnt: # of MASK-ON elements to read. */
+        cnt = GT3_getMaskRank(mask, row + x0 + span) - start;
+
+        assert(start + cnt <= num);
+        if (read_packed_range(data, start, cnt, 1, nbits,
+                              offset, scale, var->miss, off, fp) < 0)
+            goto finish;
+
+        /*
+         * unmask.
+         */
+        if (stride == 1)
+            expand_masked(outp, nx, data, cnt, mask->mask, row + x0,
+                          var->miss, &n);
+        else
+            for (i = row + x0, n = 0, k = 0; k < nx; i++)
+                if (getMaskValue(mask, i)) {
+                    if ((i - row - x0) % stride == 0)
+                        outp[k++] = data[n];
+                    n++;
+                } else if ((i - row - x0) % stride == 0)
+                    outp[k++] = var->miss;
+
+        outp += nx;
+    }
+    rval = 0;
+
+finish:
     tiny_free(data, data_buf);
-    return -1;
+    return rval;
 }
 
 
 int
-read_URY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_URY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     return read_URY2(var, zpos, skip, nelem, fp, 0);
 }
 
 int
-read_MRY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_MRY(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     return read_MRY2(var, zpos, skip, nelem, fp, 0);
 }
 
 /* XXX: URX is deprecated. */
 int
-read_URX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_URX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     return read_URY2(var, zpos, skip, nelem, fp, 1);
 }
 
 /* XXX: MRX is deprecated. */
 int
-read_MRX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_MRX(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     return read_MRY2(var, zpos, skip, nelem, fp, 1);
 }
+
+
+/*
+ * read_MRY_packed2() reads the MASK-ON values in 'zpos' into var->data
+ * without unmasking them, and sets the # of them in 'num'.
+ * The mask of 'zpos' is left in fp->mask.
+ */
+static int
+read_MRY_packed2(GT3_Varbuf *var, int zpos, size_t *num,
+                 GT3_File *fp, int oldflag)
+{
+    off_t off;
+    double offset, scale;
+    GT3_Datamask *mask;
+    unsigned nbits;
+
+    mask = fp->mask;
+    if (!mask && (mask = GT3_newMask()) == NULL)
+        return -1;
+    if (GT3_loadMaskX(mask, zpos, fp) != 0)
+        return -1;
+    fp->mask = mask;
+
+    if (mry_plane(&offset, &scale, &off, num, zpos, fp, oldflag) < 0)
+        return -1;
+
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
+
+    assert(var->type == GT3_TYPE_DOUBLE);
+    assert(*num <= var->dimlen[0] * var->dimlen[1]);
+    return read_packed(var->data, *num, nbits, offset, scale, var->miss,
+                       NULL, 0, off, fp);
+}
+
+
+int
+read_MRY_packed(GT3_Varbuf *var, int zpos, size_t *num, GT3_File *fp)
+{
+    return read_MRY_packed2(var, zpos, num, fp, 0);
+}
+
+/* XXX: MRX is deprecated. */
+int
+read_MRX_packed(GT3_Varbuf *var, int zpos, size_t *num, GT3_File *fp)
+{
+    return read_MRY_packed2(var, zpos, num, fp, 1);
+}
+
+
+int
+read_URY_slab(double *outp, GT3_Varbuf *var, int zpos,
+              int x0, int nx, int y0, int ny, int stride, GT3_File *fp)
+{
+    return read_URY_slab2(outp, var, zpos, x0, nx, y0, ny, stride, fp, 0);
+}
+
+int
+read_MRY_slab(double *outp, GT3_Varbuf *var, int zpos,
+              int x0, int nx, int y0, int ny, int stride, GT3_File *fp)
+{
+    return read_MRY_slab2(outp, var, zpos, x0, nx, y0, ny, stride, fp, 0);
+}
+
+/* XXX: URX is deprecated. */
+int
+read_URX_slab(double *outp, GT3_Varbuf *var, int zpos,
+              int x0, int nx, int y0, int ny, int stride, GT3_File *fp)
+{
+    return read_URY_slab2(outp, var, zpos, x0, nx, y0, ny, stride, fp, 1);
+}
+
+/* XXX: MRX is deprecated. */
+int
+read_MRX_slab(double *outp, GT3_Varbuf *var, int zpos,
+              int x0, int nx, int y0, int ny, int stride, GT3_File *fp)
+{
+    return read_MRY_slab2(outp, var, zpos, x0, nx, y0, ny, stride, fp, 1);
+}
+
+
+/*
+ * reduce_codes() sets the statistics of 'n' packed codes in 'idata'
+ * (except for MISS), computed on the codes in integers and then
+ * converted into values by the decoder at once.
+ *
+ * The loops are unrolled into NLANE accumulators without branch
+ * so that they can be vectorized.
+ */
+#define NLANE 8
+static void
+reduce_codes(GT3_Reduction *red, const unsigned *idata, size_t n,
+             unsigned nbits, const decoder *dec)
+{
+    unsigned imiss = dec->imiss;
+    unsigned lmin[NLANE], lmax[NLANE], c, valid;
+    uint64_t lsum[NLANE], lsq[NLANE], sum1 = 0, sq = 0;
+    size_t lcnt[NLANE], cnt = 0;
+    unsigned cmin = imiss, cmax = 0, cmid, cc[2];
+    double mean, mm[2], ssd = 0., d;
+    int64_t di;
+    size_t i, k;
+
+    for (k = 0; k < NLANE; k++) {
+        lmin[k] = imiss;
+        lmax[k] = 0;
+        lsum[k] = 0;
+        lcnt[k] = 0;
+    }
+    for (i = 0; i + NLANE <= n; i += NLANE)
+        for (k = 0; k < NLANE; k++) {
+            c = idata[i + k];
+            valid = c != imiss;
+            lmin[k] = c < lmin[k] ? c : lmin[k]; /* imiss is the largest */
+            lmax[k] = (valid && c > lmax[k]) ? c : lmax[k];
+            lsum[k] += valid ? c : 0;
+            lcnt[k] += valid;
+        }
+    for (k = 0; i < n; i++, k++) {
+        c = idata[i];
+        valid = c != imiss;
+        lmin[k] = c < lmin[k] ? c : lmin[k];
+        lmax[k] = (valid && c > lmax[k]) ? c : lmax[k];
+        lsum[k] += valid ? c : 0;
+        lcnt[k] += valid;
+    }
+    for (k = 0; k < NLANE; k++) {
+        cmin = lmin[k] < cmin ? lmin[k] : cmin;
+        cmax = lmax[k] > cmax ? lmax[k] : cmax;
+        sum1 += lsum[k];
+        cnt += lcnt[k];
+    }
+
+    red->count = cnt;
+    if (cnt == 0) {
+        red->sum = red->ssd = 0.;
+        red->min = HUGE_VAL;
+        red->max = -HUGE_VAL;
+        return;
+    }
+
+    /*
+     * squared deviations from 'cmid' (the nearest code to the mean),
+     * which is exact in integers if nbits <= 16.
+     */
+    mean = (double)sum1 / cnt;
+    cmid = (unsigned)(mean + 0.5);
+    if (nbits <= 16) {
+        for (k = 0; k < NLANE; k++)
+            lsq[k] = 0;
+        for (i = 0; i + NLANE <= n; i += NLANE)
+            for (k = 0; k < NLANE; k++) {
+                c = idata[i + k];
+                di = (c != imiss) ? (int64_t)c - cmid : 0;
+                lsq[k] += (uint64_t)(di * di);
+            }
+        for (; i < n; i++) {
+            c = idata[i];
+            di = (c != imiss) ? (int64_t)c - cmid : 0;
+            sq += (uint64_t)(di * di);
+        }
+        for (k = 0; k < NLANE; k++)
+            sq += lsq[k];
+        ssd = (double)sq;
+    } else
+        for (i = 0; i < n; i++) {
+            d = (idata[i] != imiss) ? (double)idata[i] - cmid : 0.;
+            ssd += d * d;
+        }
+    d = mean - cmid;
+    ssd -= cnt * d * d;
+
+    red->ssd = ssd > 0. ? dec->scale * dec->scale * ssd : 0.;
+    if (dec->zero_index > 0)
+        red->sum = dec->scale * ((double)sum1 - (double)cnt * dec->zero_index);
+    else
+        red->sum = cnt * dec->offset + dec->scale * (double)sum1;
+
+    cc[0] = cmin;
+    cc[1] = cmax;
+    decode_packed(mm, cc, 2, dec);
+    red->min = mm[0] < mm[1] ? mm[0] : mm[1]; /* scale might be negative */
+    red->max = mm[0] < mm[1] ? mm[1] : mm[0];
+}
+
+
+/*
+ * reduce_rows() sets the statistics of each row in x0...x1-1 for
+ * y = y0, ..., y1-1 in 'zpos' (URY and MRY), without decoding values.
+ * The packed data of the rows are read at once.
+ */
+static int
+reduce_rows(GT3_Reduction *red, int zpos,
+            int x0, int x1, int y0, int y1, GT3_File *fp, int masked)
+{
+    off_t off;
+    double offset, scale;
+    GT3_Datamask *mask = NULL;
+    unsigned nbits;
+    size_t nx, num, e0, e1, s, t, npack;
+    uint64_t bit0, bpos;
+    uint32_t *packed = NULL;
+    unsigned idata_buf[1024];
+    unsigned *idata = NULL;
+    decoder dec;
+    int y, rval = -1;
+
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
+    nx = fp->dimlen[0];
+
+    if (masked) {
+        mask = fp->mask;
+        if (!mask && (mask = GT3_newMask()) == NULL)
+            return -1;
+        if (GT3_loadMaskX(mask, zpos, fp) != 0)
+            return -1;
+        fp->mask = mask;
+
+        if (GT3_updateMaskIndex(mask, fp->dimlen[0]) < 0
+            || mry_plane(&offset, &scale, &off, &num, zpos, fp, 0) < 0)
+            return -1;
+    } else if (ury_plane(&offset, &scale, &off, zpos, fp, 0) < 0)
+        return -1;
+
+#define ELEM(i) (masked ? GT3_getMaskRank(mask, (i)) : (i))
+    /* the packed elements of the rows: [e0, e1) */
+    e0 = ELEM(nx * y0 + x0);
+    e1 = ELEM(nx * (y1 - 1) + x1);
+
+    bit0 = (uint64_t)nbits * e0 / 32 * 32;
+    npack = (size_t)(((uint64_t)nbits * e1 - bit0 + 31) / 32);
+
+    if ((packed = malloc(sizeof(uint32_t) * (npack > 0 ? npack : 1))) == NULL
+        || (idata = tiny_alloc(idata_buf,
+                               sizeof idata_buf,
+                               sizeof(unsigned) * (x1 - x0))) == NULL) {
+        gt3_error(SYSERR, NULL);
+        goto finish;
+    }
+    if (xpread_words(packed, npack, off + (off_t)(bit0 / 8), fp) < 0)
+        goto finish;
+
+    init_decoder(&dec, nbits, offset, scale, 0.);
+    for (y = y0; y < y1; y++) {
+        s = ELEM(nx * y + x0);
+        t = ELEM(nx * y + x1);
+
+        if (t > s) {
+            bpos = (uint64_t)nbits * s - bit0;
+            unpack_bits_from32_at(idata, t - s, packed + bpos / 32, nbits,
+                                  (unsigned)(bpos % 32));
+        }
+        reduce_codes(red + (y - y0), idata, t - s, nbits, &dec);
+    }
+#undef ELEM
+    rval = 0;
+
+finish:
+    tiny_free(idata, idata_buf);
+    free(packed);
+    return rval;
+}
+
+
+int
+reduce_URY_rows(GT3_Reduction *red, int zpos,
+                int x0, int x1, int y0, int y1, GT3_File *fp)
+{
+    return reduce_rows(red, zpos, x0, x1, y0, y1, fp, 0);
+}
+
+
+int
+reduce_MRY_rows(GT3_Reduction *red, int zpos,
+                int x0, int x1, int y0, int y1, GT3_File *fp)
+{
+    return reduce_rows(red, zpos, x0, x1, y0, y1, fp, 1);
+}
+
+
+/*
+ * read_URY_points2() reads values at 'npts' points, which are given
+ * as (x, y, z) triplets in 'pts'.
+ * Only the packed words containing the points are read.
+ */
+static int
+read_URY_points2(double *outp, const int *pts, int npts, double miss,
+                 GT3_File *fp, int oldflag)
+{
+    off_t off, body;
+    double dma_buf[2 * RESERVE_NZ];
+    double *dma = NULL;
+    double scale;
+    unsigned nbits;
+    size_t zelems, plen, idx;
+    int i, x, y, z, rval = -1;
+
+    nbits = (unsigned)fp->fmt >> GT3_FMT_MBIT;
+    zelems = fp->dimlen[0] * fp->dimlen[1];
+    plen = pack32_len(zelems, nbits);
+
+    if ((dma = tiny_alloc(dma_buf,
+                          sizeof dma_buf,
+                          2 * sizeof(double) * fp->dimlen[2])) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
+
+    /*
+     * read DMA of all the z-planes at once.
+     */
+    off = fp->off + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t);
+    if (read_dwords_from_record(dma, 0, 2 * fp->dimlen[2], &off, fp) < 0)
+        goto finish;
+    body = off + sizeof(fort_size_t);
+
+    for (i = 0; i < npts; i++) {
+        x = pts[3 * i];
+        y = pts[3 * i + 1];
+        z = pts[3 * i + 2];
+        idx = (size_t)fp->dimlen[0] * y + x;
+
+        scale = dma[2 * z + 1];
+        if (oldflag)
+            scale = (nbits == 1) ? 0. : scale / ((1U << nbits) - 2);
+
+        if (read_packed_range(outp + i, idx, 1, 1, nbits,
+                              dma[2 * z], scale, miss,
+                              body + 4 * z * plen, fp) < 0)
+            goto finish;
+    }
+    rval = 0;
+
+finish:
+    tiny_free(dma, dma_buf);
+    return rval;
+}
+
+
+int
+read_URY_points(double *outp, const int *pts, int npts, double miss,
+                GT3_File *fp)
+{
+    return read_URY_points2(outp, pts, npts, miss, fp, 0);
+}
+
+/* XXX: URX is deprecated. */
+int
+read_URX_points(double *outp, const int *pts, int npts, double miss,
+                GT3_File *fp)
+{
+    return read_URY_points2(outp, pts, npts, miss, fp, 1);
+}
@@ -0,0 +1,130 @@
+/*
+ * read_zr.c -- read ZR4 & ZR8.
+ *
+ * The data-body of ZR4/ZR8 comprises 3 records:
+ *   NNN:   the length of packed data (in words).
+ *   IZLEN: the length of packed data in each z-plane (in words).
+ *   DATA:  packed data of all the z-planes (cf. zr_pack.c).
+ */
+#include "internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gtool3.h"
+#include "talloc.h"
+
+
+#define RESERVE_NZ   256
+
+
+/*
+ * zr_plane() gets the position and length of the packed data in 'zpos'.
+ * Only IZLEN[0..zpos] is read, and the z-plane must be within NNN.
+ */
+static int
+zr_plane(off_t *pos, size_t *plen, int zpos, GT3_File *fp)
+{
+    off_t off, izoff;
+    size_t skip;
+    int i, rval = -1;
+    uint32_t nnn;
+    uint32_t izlen_buf[RESERVE_NZ];
+    uint32_t *izlen = izlen_buf;
+
+    if ((izlen = tiny_alloc(izlen_buf,
+                            sizeof izlen_buf,
+                            sizeof(uint32_t) * (zpos + 1))) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
+
+    /* read NNN and IZLEN. */
+    off = fp->off + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t);
+    if (read_words_from_record(&nnn, 0, 1, &off, fp) < 0)
+        goto finish;
+
+    izoff = off;
+    if (read_words_from_record(izlen, 0, zpos + 1, &off, fp) < 0)
+        goto finish;
+
+    if (off != izoff + 4 * (off_t)fp->dimlen[2] + 2 * sizeof(fort_size_t)) {
+        gt3_error(GT3_ERR_BROKEN, "%s: Invalid IZLEN", fp->path);
+        goto finish;
+    }
+
+    for (skip = 0, i = 0; i < zpos; i++)
+        skip += izlen[i];
+
+    if (skip + izlen[zpos] > nnn) {
+        gt3_error(GT3_ERR_BROKEN, "%s: IZLEN exceeds NNN", fp->path);
+        goto finish;
+    }
+
+    *pos = off + sizeof(fort_size_t) + 4 * (off_t)skip;
+    *plen = izlen[zpos];
+    rval = 0;
+
+finish:
+    tiny_free(izlen, izlen_buf);
+    return rval;
+}
+
+
+/*
+ * XXX: 'skip' and 'nelem' are ignored.
+ * The z-plane is decoded as a whole (as in URY).
+ */
+static int
+read_ZRN(GT3_Varbuf *var, size_t width, int zpos, GT3_File *fp)
+{
+    uint32_t *packed = NULL;
+    unsigned char *bytes = NULL;
+    size_t zelems, plen;
+    off_t off;
+    int rval = -1;
+
+    zelems = var->dimlen[0] * var->dimlen[1];
+    assert(var->bufsize >= width * zelems);
+
+    if (zr_plane(&off, &plen, zpos, fp) < 0)
+        return -1;
+
+    if ((packed = malloc(4 * plen + 4)) == NULL
+        || (bytes = malloc(width * zelems)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        goto finish;
+    }
+
+    if (xpread_words(packed, plen, off, fp) < 0)
+        goto finish;
+
+    if (zr_unpack(bytes, zelems, width, packed, plen) < 0) {
+        gt3_error(GT3_ERR_BROKEN, fp->path);
+        goto finish;
+    }
+    zr_unshuffle(var->data, bytes, width, zelems);
+    rval = 0;
+
+finish:
+    free(bytes);
+    free(packed);
+    return rval;
+}
+
+
+int
+read_ZR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
+{
+    assert(var->type == GT3_TYPE_FLOAT);
+    return read_ZRN(var, 4, zpos, fp);
+}
+
+
+int
+read_ZR8(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
+{
+    assert(var->type == GT3_TYPE_DOUBLE);
+    return read_ZRN(var, 8, zpos, fp);
+}
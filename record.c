@@ -4,27 +4,27 @@
 #include "internal.h"
 
 #include <stdio.h>
-#include <string.h>
 
 
+/*
+ * read_from_record() reads the record at '*off' in the file,
+ * and sets '*off' to the position of the next record.
+ */
 static int
 read_from_record(void *ptr, size_t skip, size_t nelem,
-                 size_t size, FILE *fp)
+                 size_t size, off_t *off, const GT3_File *fp)
 {
     fort_size_t recsiz;         /* record size */
-    off_t eor;
     size_t nelem_record;        /* # of elements in the record. */
+    off_t body;
 
-    if (fread(&recsiz, sizeof(fort_size_t), 1, fp) != 1)
+    if (xpread_words(&recsiz, 1, *off, fp) < 0)
         return -1;
-    if (IS_LITTLE_ENDIAN)
-        reverse_words(&recsiz, 1);
 
-    if (recsiz % size != 0)
+    if (recsiz % size != 0) {
+        gt3_error(GT3_ERR_BROKEN, fp->path);
         return -1;
-
-    /* eor: end of record (position) */
-    eor = ftello(fp) + recsiz + sizeof(fort_size_t);
+    }
 
     nelem_record = recsiz / size;
 
@@ -33,15 +33,16 @@ read_from_record(void *ptr, size_t skip, size_t nelem,
     if (nelem > nelem_record - skip)
         nelem = nelem_record - skip;
 
-    if (nelem > 0) {
-        if (skip != 0 && fseeko(fp, size * skip, SEEK_CUR) < 0)
-            return -1;
-
-        if (fread(ptr, size, nelem, fp) != nelem)
-            return -1;
-    }
+    body = *off + sizeof(fort_size_t) + size * skip;
+    if (nelem > 0
+        && (size == 4
+            ? xpread_words(ptr, nelem, body, fp)
+            : xpread_dwords(ptr, nelem, body, fp)) < 0)
+        return -1;
 
-    return fseeko(fp, eor, SEEK_SET);
+    /* the next record */
+    *off += recsiz + 2 * sizeof(fort_size_t);
+    return 0;
 }
 
 
@@ -52,15 +53,10 @@ read_from_record(void *ptr, size_t skip, size_t nelem,
  * WORD: 4-byte in size.
  */
 int
-read_words_from_record(void *ptr, size_t skip, size_t nelem, FILE *fp)
+read_words_from_record(void *ptr, size_t skip, size_t nelem,
+                       off_t *off, const GT3_File *fp)
 {
-    if (read_from_record(ptr, skip, nelem, 4, fp) < 0)
-        return -1;
-
-    if (IS_LITTLE_ENDIAN)
-        reverse_words(ptr, nelem);
-
-    return 0;
+    return read_from_record(ptr, skip, nelem, 4, off, fp);
 }
 
 
@@ -71,15 +67,10 @@ read_words_from_record(void *ptr, size_t skip, size_t nelem, FILE *fp)
  * DWORD: 8-byte in size.
  */
 int
-read_dwords_from_record(void *ptr, size_t skip, size_t nelem, FILE *fp)
+read_dwords_from_record(void *ptr, size_t skip, size_t nelem,
+                        off_t *off, const GT3_File *fp)
 {
-    if (read_from_record(ptr, skip, nelem, 8, fp) < 0)
-        return -1;
-
-    if (IS_LITTLE_ENDIAN)
-        reverse_dwords(ptr, nelem);
-
-    return 0;
+    return read_from_record(ptr, skip, nelem, 8, off, fp);
 }
 
 
@@ -113,7 +104,7 @@ static int
 write_into_record(const void *ptr,
                   size_t size,
                   size_t nelem,
-                  void *(*reverse)(void *, size_t),
+                  void *(*copy_reverse)(void *, const void *, size_t),
                   FILE *fp)
 {
     char data[IO_BUF_SIZE];
@@ -132,8 +123,7 @@ write_into_record(const void *ptr,
         while (nelem2 > 0) {
             len = nelem2 > maxelems ? maxelems : nelem2;
 
-            memcpy(data, ptr2, size * len);
-            reverse(data, len);
+            copy_reverse(data, ptr2, len);
 
             if (fwrite(data, size, len, fp) != len) {
                 gt3_error(SYSERR, NULL);
@@ -159,14 +149,14 @@ write_into_record(const void *ptr,
 int
 write_words_into_record(const void *ptr, size_t nelem, FILE *fp)
 {
-    return write_into_record(ptr, 4, nelem, reverse_words, fp);
+    return write_into_record(ptr, 4, nelem, copy_reverse_words, fp);
 }
 
 
 int
 write_dwords_into_record(const void *ptr, size_t nelem, FILE *fp)
 {
-    return write_into_record(ptr, 8, nelem, reverse_dwords, fp);
+    return write_into_record(ptr, 8, nelem, copy_reverse_dwords, fp);
 }
 
 
@@ -1,24 +1,274 @@
 /*
  * reverse.c -- reversing byte-order.
+ *
+ * The kernels are selected at the first call:
+ *   AVX2 or SSSE3 (pshufb) on x86 if the CPU supports them,
+ *   GCC's generic vector extension, or plain C.
+ * All of them accept unaligned pointers.
  */
 #include "internal.h"
 
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#  define USE_X86_SIMD
+#  include <immintrin.h>
+#endif
+
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#  define USE_VECTOR_EXT
+#endif
+
+typedef void (*swap_func)(void *, const void *, size_t);
+
+
+static uint32_t
+swap32(uint32_t u)
+{
+    return (u >> 24) | ((u & 0xff0000U) >> 8)
+        | ((u & 0xff00U) << 8) | ((u & 0xffU) << 24);
+}
+
 
 /*
- * reverse_words() reverses the byte-order of words (32-bit).
+ * plain C.
  */
-void *
-reverse_words(void *vptr, size_t nwords)
+static void
+swap_words_c(void *dest, const void *src, size_t nwords)
 {
     size_t i;
     uint32_t u;
-    uint32_t *uptr = vptr;
+    unsigned char *q = dest;
+    const unsigned char *p = src;
+
+    for (i = 0; i < nwords; i++, p += 4, q += 4) {
+        memcpy(&u, p, 4);
+        u = swap32(u);
+        memcpy(q, &u, 4);
+    }
+}
+
+
+static void
+swap_dwords_c(void *dest, const void *src, size_t nwords)
+{
+    size_t i;
+    uint32_t u[2], v[2];
+    unsigned char *q = dest;
+    const unsigned char *p = src;
+
+    for (i = 0; i < nwords; i++, p += 8, q += 8) {
+        memcpy(u, p, 8);
+        v[0] = swap32(u[1]);
+        v[1] = swap32(u[0]);
+        memcpy(q, v, 8);
+    }
+}
+
+
+#ifdef USE_VECTOR_EXT
+/*
+ * generic vector extension (16 bytes at a time).
+ */
+typedef unsigned char v16qi_t __attribute__((vector_size(16)));
+
+#ifdef __clang__
+#  define SHUFFLE_W(v) __builtin_shufflevector(v, v, \
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+#  define SHUFFLE_D(v) __builtin_shufflevector(v, v, \
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8)
+#else
+static const v16qi_t idx_w = {
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+static const v16qi_t idx_d = {
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+};
+#  define SHUFFLE_W(v) __builtin_shuffle(v, idx_w)
+#  define SHUFFLE_D(v) __builtin_shuffle(v, idx_d)
+#endif
+
+
+static void
+swap_words_vec(void *dest, const void *src, size_t nwords)
+{
+    v16qi_t v;
+    size_t i;
+    unsigned char *q = dest;
+    const unsigned char *p = src;
+
+    for (i = 0; i + 4 <= nwords; i += 4, p += 16, q += 16) {
+        memcpy(&v, p, 16);
+        v = SHUFFLE_W(v);
+        memcpy(q, &v, 16);
+    }
+    swap_words_c(q, p, nwords - i);
+}
+
+
+static void
+swap_dwords_vec(void *dest, const void *src, size_t nwords)
+{
+    v16qi_t v;
+    size_t i;
+    unsigned char *q = dest;
+    const unsigned char *p = src;
+
+    for (i = 0; i + 2 <= nwords; i += 2, p += 16, q += 16) {
+        memcpy(&v, p, 16);
+        v = SHUFFLE_D(v);
+        memcpy(q, &v, 16);
+    }
+    swap_dwords_c(q, p, nwords - i);
+}
+#endif /* USE_VECTOR_EXT */
+
+
+#ifdef USE_X86_SIMD
+/*
+ * SSSE3 (16 bytes) and AVX2 (32 bytes) by pshufb.
+ */
+__attribute__((target("ssse3")))
+static void
+swap_bytes_ssse3(void *dest, const void *src, size_t nbytes, int size)
+{
+    __m128i idx, v;
+    size_t i;
+    unsigned char *q = dest;
+    const unsigned char *p = src;
+
+    idx = (size == 4)
+        ? _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                       4, 5, 6, 7, 0, 1, 2, 3)
+        : _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                       0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (i = 0; i + 16 <= nbytes; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        _mm_storeu_si128((__m128i *)(q + i), _mm_shuffle_epi8(v, idx));
+    }
+    if (size == 4)
+        swap_words_c(q + i, p + i, (nbytes - i) / 4);
+    else
+        swap_dwords_c(q + i, p + i, (nbytes - i) / 8);
+}
+
+
+__attribute__((target("avx2")))
+static void
+swap_bytes_avx2(void *dest, const void *src, size_t nbytes, int size)
+{
+    __m256i idx, v;
+    size_t i;
+    unsigned char *q = dest;
+    const unsigned char *p = src;
+
+    idx = (size == 4)
+        ? _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                          4, 5, 6, 7, 0, 1, 2, 3,
+                          12, 13, 14, 15, 8, 9, 10, 11,
+                          4, 5, 6, 7, 0, 1, 2, 3)
+        : _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                          0, 1, 2, 3, 4, 5, 6, 7,
+                          8, 9, 10, 11, 12, 13, 14, 15,
+                          0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (i = 0; i + 32 <= nbytes; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+        _mm256_storeu_si256((__m256i *)(q + i), _mm256_shuffle_epi8(v, idx));
+    }
+    if (size == 4)
+        swap_words_c(q + i, p + i, (nbytes - i) / 4);
+    else
+        swap_dwords_c(q + i, p + i, (nbytes - i) / 8);
+}
+
+
+static void
+swap_words_ssse3(void *dest, const void *src, size_t nwords)
+{
+    swap_bytes_ssse3(dest, src, 4 * nwords, 4);
+}
+
+static void
+swap_dwords_ssse3(void *dest, const void *src, size_t nwords)
+{
+    swap_bytes_ssse3(dest, src, 8 * nwords, 8);
+}
+
+static void
+swap_words_avx2(void *dest, const void *src, size_t nwords)
+{
+    swap_bytes_avx2(dest, src, 4 * nwords, 4);
+}
+
+static void
+swap_dwords_avx2(void *dest, const void *src, size_t nwords)
+{
+    swap_bytes_avx2(dest, src, 8 * nwords, 8);
+}
+#endif /* USE_X86_SIMD */
+
+
+static void swap_words_init(void *, const void *, size_t);
+static void swap_dwords_init(void *, const void *, size_t);
 
-    for (i = 0; i < nwords; i++) {
-        u = uptr[i];
-        uptr[i] = (u >> 24) | ((u & 0xff0000U) >> 8)
-            | ((u & 0xff00U) << 8) | ((u & 0xffU) << 24);
+/*
+ * The kernels in use. Setting them more than once (from several
+ * threads) is harmless because the result is always the same.
+ */
+static swap_func swap_words = swap_words_init;
+static swap_func swap_dwords = swap_dwords_init;
+
+
+static void
+select_kernels(void)
+{
+    swap_func w = swap_words_c, d = swap_dwords_c;
+
+#ifdef USE_VECTOR_EXT
+    w = swap_words_vec;
+    d = swap_dwords_vec;
+#endif
+#ifdef USE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        w = swap_words_avx2;
+        d = swap_dwords_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        w = swap_words_ssse3;
+        d = swap_dwords_ssse3;
     }
+#endif
+    swap_words = w;
+    swap_dwords = d;
+}
+
+
+static void
+swap_words_init(void *dest, const void *src, size_t nwords)
+{
+    select_kernels();
+    swap_words(dest, src, nwords);
+}
+
+
+static void
+swap_dwords_init(void *dest, const void *src, size_t nwords)
+{
+    select_kernels();
+    swap_dwords(dest, src, nwords);
+}
+
+
+/*
+ * reverse_words() reverses the byte-order of words (32-bit).
+ */
+void *
+reverse_words(void *vptr, size_t nwords)
+{
+    swap_words(vptr, vptr, nwords);
     return vptr;
 }
 
@@ -29,30 +279,71 @@ reverse_words(void *vptr, size_t nwords)
 void *
 reverse_dwords(void *vptr, size_t nwords)
 {
-    size_t i;
-    uint32_t u1, u2;
-    uint32_t *uptr = vptr;
+    swap_dwords(vptr, vptr, nwords);
+    return vptr;
+}
 
-    for (i = 0; i < 2 * nwords; i += 2) {
-        u1 = uptr[i];
-        u2 = uptr[i+1];
 
-        uptr[i]   = (u2 >> 24) | ((u2 & 0xff0000U) >> 8)
-            | ((u2 & 0xff00U) << 8) | ((u2 & 0xffU) << 24);
-        uptr[i+1] = (u1 >> 24) | ((u1 & 0xff0000U) >> 8)
-            | ((u1 & 0xff00U) << 8) | ((u1 & 0xffU) << 24);
-    }
-    return vptr;
+/*
+ * copy_reverse_words() copies words from 'src' to 'dest' with
+ * reversing the byte-order (in a single pass).
+ * 'dest' and 'src' must be the same or must not overlap.
+ */
+void *
+copy_reverse_words(void *dest, const void *src, size_t nwords)
+{
+    swap_words(dest, src, nwords);
+    return dest;
+}
+
+
+/*
+ * copy_reverse_dwords() is the 64-bit version of copy_reverse_words().
+ */
+void *
+copy_reverse_dwords(void *dest, const void *src, size_t nwords)
+{
+    swap_dwords(dest, src, nwords);
+    return dest;
 }
 
 
 #ifdef TEST_MAIN
 #include <assert.h>
 
+/*
+ * check a kernel against the plain C, with various lengths
+ * and misaligned pointers.
+ */
+static void
+check_kernel(swap_func func, swap_func ref, int size)
+{
+    unsigned char src[256 + 8], dest[256 + 8], expect[256 + 8];
+    int i, n, off;
+
+    for (i = 0; i < sizeof src; i++)
+        src[i] = (unsigned char)(i * 7 + 1);
+
+    for (off = 0; off < 8; off++)
+        for (n = 0; n <= 256 / size; n++) {
+            memset(dest, 0, sizeof dest);
+            memset(expect, 0, sizeof expect);
+            ref(expect + off, src + off, n);
+            func(dest + off, src + off, n);
+            assert(memcmp(dest, expect, sizeof dest) == 0);
+
+            /* in-place */
+            memcpy(dest, src, sizeof dest);
+            func(dest + off, dest + off, n);
+            assert(memcmp(dest + off, expect + off, size * n) == 0);
+        }
+}
+
+
 int
 main(int argc, char **argv)
 {
-    unsigned u[2];
+    unsigned u[2], v[2];
 
     u[0] = 0x12345678;
     u[1] = 0xfedcba98;
@@ -71,6 +362,30 @@ main(int argc, char **argv)
     reverse_words(u, 1);
     assert(u[0] == 0x78563412);
     assert(u[1] == 0xfedcba98);
+
+    u[0] = 0x12345678;
+    u[1] = 0xfedcba98;
+    copy_reverse_dwords(v, u, 1);
+    assert(v[0] == 0x98badcfe);
+    assert(v[1] == 0x78563412);
+    assert(u[0] == 0x12345678);
+
+    check_kernel(swap_words, swap_words_c, 4);
+    check_kernel(swap_dwords, swap_dwords_c, 8);
+#ifdef USE_VECTOR_EXT
+    check_kernel(swap_words_vec, swap_words_c, 4);
+    check_kernel(swap_dwords_vec, swap_dwords_c, 8);
+#endif
+#ifdef USE_X86_SIMD
+    if (__builtin_cpu_supports("ssse3")) {
+        check_kernel(swap_words_ssse3, swap_words_c, 4);
+        check_kernel(swap_dwords_ssse3, swap_dwords_c, 8);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        check_kernel(swap_words_avx2, swap_words_c, 4);
+        check_kernel(swap_dwords_avx2, swap_dwords_c, 8);
+    }
+#endif
     return 0;
 }
 #endif
@@ -55,22 +55,14 @@ calc_urc_param(const float *data, size_t len, double miss,
                double *prmin, double *pfac_e, double *pfac_d,
                int *pne, int *pnd)
 {
-    double rmin = HUGE_VAL, rmax = -HUGE_VAL;
+    double rmin, rmax;
     double fac_e = HUGE_VAL, fac_d = 1.0;
     int ne = IMISS, nd = 0;
-    float vmiss = (float)miss;
-    size_t i;
-
-    for (i = 0; i < len; i++) {
-        if (data[i] == vmiss)
-            continue;
+    vrange r;
 
-        if (data[i] < rmin)
-            rmin = data[i];
-
-        if (data[i] > rmax)
-            rmax = data[i];
-    }
+    get_vrange(&r, data, 4, len, miss, 1);
+    rmin = r.vmin;
+    rmax = r.vmax;
     if (rmax - rmin > 0.0)
         scalefac(rmin, rmax, &fac_e, &fac_d, &ne, &nd);
 
@@ -4,6 +4,7 @@
 #include "internal.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,15 +28,28 @@ struct varbuf_status {
     int ch;                     /* cached chunk-index */
     int z;                      /* cached z-index (-1: not cached) */
     bits_set y;                 /* cached y-index */
+
+    /*
+     * A private copy of the chunk to read (shares FILE with Varbuf.fp).
+     * Readers use this, not Varbuf.fp, so that each Varbuf has its own
+     * decoding state (including mask).
+     */
+    GT3_File file;
+    int pinned;                 /* not follow Varbuf.fp if nonzero */
+
+    plane_cache *cache;         /* decoded planes (NULL: disabled) */
+
+    int *index;                 /* positions of packed values */
+    size_t index_size;          /* # of elements allocated */
 };
 typedef struct varbuf_status varbuf_status;
 
-static int read_UR4(GT3_Varbuf *var, int, size_t, size_t nelem, FILE *fp);
-static int read_UR8(GT3_Varbuf *var, int, size_t, size_t nelem, FILE *fp);
-static int read_MR4(GT3_Varbuf *var, int, size_t, size_t nelem, FILE *fp);
-static int read_MR8(GT3_Varbuf *var, int, size_t, size_t nelem, FILE *fp);
+static int read_UR4(GT3_Varbuf *var, int, size_t, size_t, GT3_File *);
+static int read_UR8(GT3_Varbuf *var, int, size_t, size_t, GT3_File *);
+static int read_MR4(GT3_Varbuf *var, int, size_t, size_t, GT3_File *);
+static int read_MR8(GT3_Varbuf *var, int, size_t, size_t, GT3_File *);
 
-typedef int (*RFptr)(GT3_Varbuf *, int, size_t, size_t, FILE *);
+typedef int (*RFptr)(GT3_Varbuf *, int, size_t, size_t, GT3_File *);
 static RFptr read_fptr[] = {
     read_UR4,
     read_URC2,
@@ -47,133 +61,158 @@ static RFptr read_fptr[] = {
     read_MRX,
     read_URY,
     read_MRY,
+    read_ZR4,
+    read_ZR8,
+    NULL
+};
+
+/*
+ * readers of a hyperslab (for GT3_readVarSlab()).
+ * NULL: read row by row via GT3_readVarZY().
+ */
+typedef int (*SFptr)(double *, GT3_Varbuf *, int,
+                     int, int, int, int, int, GT3_File *);
+static SFptr slab_fptr[] = {
+    NULL,                       /* UR4 */
+    NULL,                       /* URC2 */
+    NULL,                       /* URC1 */
+    NULL,                       /* UR8 */
+    read_URX_slab,
+    NULL,                       /* MR4 */
+    NULL,                       /* MR8 */
+    read_MRX_slab,
+    read_URY_slab,
+    read_MRY_slab,
+    NULL,                       /* ZR4 */
+    NULL,                       /* ZR8 */
     NULL
 };
 
 #define clip(v, l, h) ((v) < (l) ? (l) : ((v) > (h) ? (h) : v))
 
 
+/*
+ * copy the current chunk of 'src' into the private copy 'dest'.
+ * The mask of 'dest' is not shared with 'src'.
+ *
+ * The mask is marked as not loaded, because it may be of another
+ * file: the chunk number alone does not identify it (a Varbuf can be
+ * reattached to another file, which can even be opened at the address
+ * of a closed one).  The rank index is kept if the reloaded mask is
+ * the same (see GT3_loadMask()).
+ */
+static void
+copy_chunk(GT3_File *dest, const GT3_File *src)
+{
+    GT3_Datamask *mask = dest->mask;
+
+    *dest = *src;
+    dest->mask = mask;
+    if (mask)
+        mask->loaded = -1;
+}
+
+
+/*
+ * read_raw() reads 'nelem' elements following 'skip' elements
+ * in the data-body of UR4 (size == 4) or UR8 (size == 8).
+ * The body is a single record, so that any range is contiguous.
+ */
 static int
-read_UR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_raw(void *ptr, size_t size, size_t skip, size_t nelem,
+         const GT3_File *fp)
 {
-    float *ptr;
     off_t off;
-    size_t hsize;
 
-    hsize = var->dimlen[0] * var->dimlen[1];
-    off = var->fp->off
+    off = fp->off
         + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t)
-        + sizeof(float) * (zpos * hsize + skip)
+        + size * skip
         + sizeof(fort_size_t);
 
-    if (fseeko(fp, off, SEEK_SET) < 0) {
-        gt3_error(SYSERR, NULL);
-        return -1;
-    }
-
-    assert(var->type == GT3_TYPE_FLOAT);
-    assert(var->bufsize >= sizeof(float) * nelem);
+    return size == 4
+        ? xpread_words(ptr, nelem, off, fp)
+        : xpread_dwords(ptr, nelem, off, fp);
+}
 
-    ptr = (float *)var->data;
-    ptr += skip;
 
-    if (xfread(ptr, sizeof(float), nelem, fp) < 0)
-        return -1;
+static int
+read_UR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
+{
+    size_t hsize;
 
-    if (IS_LITTLE_ENDIAN)
-        reverse_words(ptr, nelem);
+    assert(var->type == GT3_TYPE_FLOAT);
+    assert(var->bufsize >= sizeof(float) * nelem);
 
-    return 0;
+    hsize = var->dimlen[0] * var->dimlen[1];
+    return read_raw((float *)var->data + skip, sizeof(float),
+                    zpos * hsize + skip, nelem, fp);
 }
 
 
 static int
-read_UR8(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_UR8(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
-    double *ptr;
-    off_t off;
     size_t hsize;
 
-    hsize = var->dimlen[0] * var->dimlen[1];
-    off = var->fp->off
-        + GT3_HEADER_SIZE + 2 * sizeof(fort_size_t)
-        + sizeof(double) * (zpos * hsize + skip)
-        + sizeof(fort_size_t);
-
-    if (fseeko(fp, off, SEEK_SET) < 0) {
-        gt3_error(SYSERR, NULL);
-        return -1;
-    }
-
     assert(var->type == GT3_TYPE_DOUBLE);
-    ptr = (double *)var->data;
-    ptr += skip;
-
-    if (xfread(ptr, sizeof(double), nelem, fp) < 0)
-        return -1;
-
-    if (IS_LITTLE_ENDIAN)
-        reverse_dwords(ptr, nelem);
 
-    return 0;
+    hsize = var->dimlen[0] * var->dimlen[1];
+    return read_raw((double *)var->data + skip, sizeof(double),
+                    zpos * hsize + skip, nelem, fp);
 }
 
 
 /*
- * load the mask data, setup the mask index, and read data body.
- * (common to MR4 and MR8).
+ * load the mask data, setup the mask index, and read data body
+ * (in the native byte-order).  Common to MR4 and MR8.
  */
 static int
 read_MRN_pre(void *temp,
              size_t *nread,
              GT3_Varbuf *var,
              size_t size,       /* size of each data (4 or 8) */
-             int zpos, size_t skip, size_t nelem)
+             int zpos, size_t skip, size_t nelem,
+             GT3_File *fp)
 {
     GT3_Datamask *mask;
-    size_t ncount;
-    int idx0, interval;
+    size_t ncount, pos, rank0;
     off_t off;
 
-    interval = var->dimlen[0];
-    /* assert(skip % interval == 0); */
-    /* assert(nelem % interval == 0); */
-
-    mask = var->fp->mask;
+    mask = fp->mask;
     if (!mask && (mask = GT3_newMask()) == NULL)
         return -1;
 
     /*
      * load mask data.
      */
-    if (GT3_loadMask(mask, var->fp) != 0)
+    if (GT3_loadMask(mask, fp) != 0)
         return -1;
-    var->fp->mask = mask;
+    fp->mask = mask;
 
-    if (GT3_updateMaskIndex(mask, interval) < 0)
+    if (GT3_updateMaskIndex(mask, var->dimlen[0]) < 0)
         return -1;
 
     /*
-     * seek to the begging of the data-body.
+     * the position of data to read (any 'skip' and 'nelem' are OK).
      */
-    idx0 = zpos * var->dimlen[1] + skip / interval;
-    off = var->fp->off + 6 * sizeof(fort_size_t)
+    pos = (size_t)var->dimlen[0] * var->dimlen[1] * zpos + skip;
+    rank0 = GT3_getMaskRank(mask, pos);
+    off = fp->off + 6 * sizeof(fort_size_t)
         + GT3_HEADER_SIZE       /* header */
         + 4                     /* NNN */
         + 4 * ((mask->nelem + 31) / 32) /* MASK */
         + sizeof(fort_size_t)
-        + size * mask->index[idx0];
-
-    if (fseeko(var->fp->fp, off, SEEK_SET) < 0)
-        return -1;
+        + size * rank0;
 
     /*
      * ncount: the # of MASK-ON elements to read.
      */
-    ncount = mask->index[idx0 + nelem / interval] - mask->index[idx0];
+    ncount = GT3_getMaskRank(mask, pos + nelem) - rank0;
     assert(ncount <= nelem);
 
-    if (xfread(temp, size, ncount, var->fp->fp) < 0)
+    if ((size == 4
+         ? xpread_words(temp, ncount, off, fp)
+         : xpread_dwords(temp, ncount, off, fp)) < 0)
         return -1;
 
     *nread = ncount;
@@ -182,11 +221,11 @@ read_MRN_pre(void *temp,
 
 
 static int
-read_MR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_MR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     float masked_buf[RESERVE_SIZE];
     float *outp, *masked = NULL;
-    size_t nread, offnum, i, n;
+    size_t nread, offnum, nused, n;
 
     assert(var->type == GT3_TYPE_FLOAT);
 
@@ -198,25 +237,17 @@ read_MR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
     }
 
     if (read_MRN_pre(masked, &nread, var, sizeof(float),
-                     zpos, skip, nelem) < 0) {
+                     zpos, skip, nelem, fp) < 0) {
         tiny_free(masked, masked_buf);
         return -1;
     }
 
-    if (IS_LITTLE_ENDIAN)
-        reverse_words(masked, nread);
-
     offnum = var->dimlen[0] * var->dimlen[1] * zpos + skip;
     outp = (float *)var->data;
     outp += skip;
-    for (i = 0, n = 0; i < nelem; i++) {
-        if (getMaskValue(var->fp->mask, offnum + i)) {
-            outp[i] = masked[n];
-            n++;
-        } else
-            outp[i] = (float)(var->miss);
-    }
-    assert(n == nread);
+    n = expand_maskedf(outp, nelem, masked, nread, fp->mask->mask,
+                       offnum, (float)(var->miss), &nused);
+    assert(n == nelem && nused == nread);
 
     tiny_free(masked, masked_buf);
 
@@ -225,11 +256,11 @@ read_MR4(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
 
 
 static int
-read_MR8(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
+read_MR8(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, GT3_File *fp)
 {
     double masked_buf[RESERVE_SIZE];
     double *outp, *masked = NULL;
-    size_t nread, offnum, i, n;
+    size_t nread, offnum, nused, n;
 
     assert(var->type == GT3_TYPE_DOUBLE);
 
@@ -241,25 +272,17 @@ read_MR8(GT3_Varbuf *var, int zpos, size_t skip, size_t nelem, FILE *fp)
     }
 
     if (read_MRN_pre(masked, &nread, var, sizeof(double),
-                     zpos, skip, nelem) < 0) {
+                     zpos, skip, nelem, fp) < 0) {
         tiny_free(masked, masked_buf);
         return -1;
     }
 
-    if (IS_LITTLE_ENDIAN)
-        reverse_dwords(masked, nread);
-
     offnum = var->dimlen[0] * var->dimlen[1] * zpos + skip;
     outp = (double *)var->data;
     outp += skip;
-    for (i = 0, n = 0; i < nelem; i++) {
-        if (getMaskValue(var->fp->mask, offnum + i)) {
-            outp[i] = masked[n];
-            n++;
-        } else
-            outp[i] = var->miss;
-    }
-    assert(n == nread);
+    n = expand_masked(outp, nelem, masked, nread, fp->mask->mask,
+                      offnum, var->miss, &nused);
+    assert(n == nelem && nused == nread);
 
     tiny_free(masked, masked_buf);
 
@@ -286,6 +309,7 @@ update_varbuf(GT3_Varbuf *vbuf, GT3_File *fp)
     case GT3_FMT_MR4:
     case GT3_FMT_URC:
     case GT3_FMT_URC1:
+    case GT3_FMT_ZR4:
         type = GT3_TYPE_FLOAT;
         elsize = sizeof(float);
         break;
@@ -341,6 +365,8 @@ update_varbuf(GT3_Varbuf *vbuf, GT3_File *fp)
     GT3_copyHeader(&status->head, &head);
     status->ch = fp->curr;
     status->z = -1;
+    copy_chunk(&status->file, fp);
+    status->pinned = 0;
 
     /*
      * all checks passed.
@@ -369,15 +395,48 @@ update_varbuf(GT3_Varbuf *vbuf, GT3_File *fp)
 }
 
 
+/*
+ * attach_varbuf() attaches Varbuf to (the current chunk of) 'fp',
+ * which may be another file.
+ * The cached planes are dropped, since they are keyed by the chunk
+ * number only.  Even if 'fp' is the same pointer as before, it can be
+ * another file opened after the previous one was closed.
+ */
+static int
+attach_varbuf(GT3_Varbuf *vbuf, GT3_File *fp)
+{
+    varbuf_status *status = (varbuf_status *)vbuf->stat_;
+
+    if (status && status->cache)
+        clear_plane_cache(status->cache);
+
+    return update_varbuf(vbuf, fp);
+}
+
+
 static int
 update2_varbuf(GT3_Varbuf *var)
 {
-    if (!GT3_isHistfile(var->fp)) {
-        varbuf_status *stat = (varbuf_status *)var->stat_;
+    varbuf_status *stat = (varbuf_status *)var->stat_;
 
-        if (stat->ch != var->fp->curr)
-            return update_varbuf(var, var->fp);
-    }
+    /*
+     * The FILE can be reopened by GT3_resume().
+     * (A pooled one is looked up in the pool by xpread().)
+     */
+    if (var->fp->pool_ == NULL)
+        stat->file.fp = var->fp->fp;
+
+    if (stat->pinned || stat->file.curr == var->fp->curr)
+        return 0;
+
+    if (!GT3_isHistfile(var->fp))
+        return update_varbuf(var, var->fp);
+
+    /*
+     * All chunks in a history-file have the same header except for
+     * the date, so only the chunk position is updated.
+     */
+    copy_chunk(&stat->file, var->fp);
     return 0;
 }
 
@@ -408,8 +467,14 @@ GT3_freeVarbuf(GT3_Varbuf *var)
 
         /* XXX GT_File is not closed.  */
         free(var->data);
-        if (stat)
+        if (stat) {
             free_bits_set(&stat->y);
+            if (stat->file.mask)
+                GT3_freeMask(stat->file.mask);
+            free(stat->file.mask);
+            free_plane_cache(stat->cache);
+            free(stat->index);
+        }
         free(var->stat_);
         free(var);
     }
@@ -431,7 +496,7 @@ GT3_getVarbuf2(GT3_Varbuf *old, GT3_File *fp)
         newed = 1;
     }
 
-    if (update_varbuf(old, fp) < 0) {
+    if (attach_varbuf(old, fp) < 0) {
         if (newed)
             GT3_freeVarbuf(old);
         return NULL;
@@ -450,8 +515,9 @@ GT3_getVarbuf(GT3_File *fp)
 int
 GT3_readVarZ(GT3_Varbuf *var, int zpos)
 {
-    size_t nelem;
+    size_t nelem, psize;
     varbuf_status *stat = (varbuf_status *)var->stat_;
+    const void *cached;
     int fmt;
 
     if (update2_varbuf(var) < 0)
@@ -465,25 +531,37 @@ GT3_readVarZ(GT3_Varbuf *var, int zpos)
     /*
      * check if cached.
      */
-    if (stat->ch == var->fp->curr
+    if (stat->ch == stat->file.curr
         && stat->z == zpos
         && BS_TEST(stat->y, var->dimlen[1])) {
-        debug2("cached: t=%d, z=%d", var->fp->curr, zpos);
+        debug2("cached: t=%d, z=%d", stat->file.curr, zpos);
         return 0;
     }
 
     nelem = var->dimlen[0] * var->dimlen[1];
-    fmt = (int)(var->fp->fmt & GT3_FMT_MASK);
-
-    if (read_fptr[fmt](var, zpos, 0, nelem, var->fp->fp) < 0) {
-        debug2("read failed: t=%d, z=%d", var->fp->curr, zpos);
+    fmt = (int)(stat->file.fmt & GT3_FMT_MASK);
+    psize = nelem * (var->type == GT3_TYPE_FLOAT
+                     ? sizeof(float) : sizeof(double));
+
+    if (stat->cache
+        && (cached = lookup_plane(stat->cache,
+                                  stat->file.curr, zpos, psize)) != NULL) {
+        debug2("plane cache hit: t=%d, z=%d", stat->file.curr, zpos);
+        memcpy(var->data, cached, psize);
+    } else {
+        if (read_fptr[fmt](var, zpos, 0, nelem, &stat->file) < 0) {
+            debug2("read failed: t=%d, z=%d", stat->file.curr, zpos);
 
-        stat->z = -1;
-        return -1;
+            stat->z = -1;
+            return -1;
+        }
+        if (stat->cache)
+            store_plane(stat->cache, stat->file.curr, zpos,
+                        var->data, psize);
     }
 
     /* set flags */
-    stat->ch = var->fp->curr;
+    stat->ch = stat->file.curr;
     stat->z = zpos;
     BS_SET(stat->y, var->dimlen[1]);
 
@@ -515,10 +593,16 @@ GT3_readVarZY(GT3_Varbuf *var, int zpos, int ypos)
         return -1;
     }
 
+    /*
+     * With the plane cache, always read whole planes.
+     */
+    if (stat->cache)
+        return GT3_readVarZ(var, zpos);
+
     /*
      * In some format, use GT3_readVarZ().
      */
-    fmt = (int)(var->fp->fmt & GT3_FMT_MASK);
+    fmt = (int)(stat->file.fmt & GT3_FMT_MASK);
     for (i = 0; i < sizeof supported / sizeof(int); i++)
         if (fmt == supported[i])
             break;
@@ -534,18 +618,19 @@ GT3_readVarZY(GT3_Varbuf *var, int zpos, int ypos)
     /*
      * check if cached.
      */
-    if (stat->ch == var->fp->curr
+    if (stat->ch == stat->file.curr
         && stat->z == zpos
         && (BS_TEST(stat->y, ypos) || BS_TEST(stat->y, var->dimlen[1]))) {
 
-        debug3("cached: t=%d, z=%d, y=%d", var->fp->curr, zpos, ypos);
+        debug3("cached: t=%d, z=%d, y=%d", stat->file.curr, zpos, ypos);
         return 0;
     }
 
     skip = ypos * var->dimlen[0];
     nelem = var->dimlen[0];
-    if (read_fptr[fmt](var, zpos, skip, nelem, var->fp->fp) < 0) {
-        debug3("read failed: t=%d, z=%d, y=%d", var->fp->curr, zpos, ypos);
+    if (read_fptr[fmt](var, zpos, skip, nelem, &stat->file) < 0) {
+        debug3("read failed: t=%d, z=%d, y=%d",
+               stat->file.curr, zpos, ypos);
 
         stat->z  = -1;
         return -1;
@@ -554,10 +639,10 @@ GT3_readVarZY(GT3_Varbuf *var, int zpos, int ypos)
     /*
      * set flags
      */
-    if (stat->z != zpos || stat->ch != var->fp->curr) {
+    if (stat->z != zpos || stat->ch != stat->file.curr) {
         BS_CLSALL(stat->y);
     }
-    stat->ch = var->fp->curr;
+    stat->ch = stat->file.curr;
     stat->z = zpos;
     BS_SET(stat->y, ypos);
 
@@ -591,6 +676,398 @@ GT3_readVar(double *rval, GT3_Varbuf *var, int x, int y, int z)
 }
 
 
+/*
+ * read z-planes [zstr, zend) into 'buf' (common to
+ * GT3_readVarZRangeDouble() and GT3_readVarZRangeFloat()).
+ */
+static int
+read_zrange(void *buf, int type, size_t buflen,
+            GT3_Varbuf *var, int zstr, int zend)
+{
+    varbuf_status *stat;
+    size_t hsize, nelem, i;
+    int fmt, z;
+
+    if (update2_varbuf(var) < 0)
+        return -1;
+
+    if (zstr < 0 || zend > var->dimlen[2] || zstr >= zend) {
+        gt3_error(GT3_ERR_INDEX, "GT3_readVarZRange(): z=%d:%d", zstr, zend);
+        return -1;
+    }
+
+    hsize = (size_t)var->dimlen[0] * var->dimlen[1];
+    nelem = hsize * (zend - zstr);
+    if (nelem > INT_MAX) {
+        gt3_error(GT3_ERR_CALL, "GT3_readVarZRange(): too many elements");
+        return -1;
+    }
+    if (buflen < nelem) {
+        gt3_error(GT3_ERR_CALL, "GT3_readVarZRange(): too small buffer");
+        return -1;
+    }
+
+    stat = (varbuf_status *)var->stat_;
+    fmt = (int)(stat->file.fmt & GT3_FMT_MASK);
+
+    /*
+     * UR4 and UR8: read all the planes at once.
+     */
+    if (fmt == GT3_FMT_UR8 && type == GT3_TYPE_DOUBLE) {
+        if (read_raw(buf, sizeof(double), hsize * zstr, nelem,
+                     &stat->file) < 0)
+            return -1;
+
+        return nelem;
+    }
+
+    if (fmt == GT3_FMT_UR4) {
+        if (read_raw(buf, sizeof(float), hsize * zstr, nelem,
+                     &stat->file) < 0)
+            return -1;
+
+        if (type == GT3_TYPE_DOUBLE) {
+            float *src = buf;
+            double *dest = buf;
+
+            /* widen in place, from the tail. */
+            for (i = nelem; i > 0; i--)
+                dest[i - 1] = src[i - 1];
+        }
+        return nelem;
+    }
+
+    /*
+     * other formats: decode plane by plane via Varbuf.
+     */
+    for (z = zstr; z < zend; z++) {
+        if (GT3_readVarZ(var, z) < 0)
+            return -1;
+
+        if (type == GT3_TYPE_DOUBLE)
+            GT3_copyVarDouble((double *)buf + hsize * (z - zstr), hsize,
+                              var, 0, 1);
+        else
+            GT3_copyVarFloat((float *)buf + hsize * (z - zstr), hsize,
+                             var, 0, 1);
+    }
+    return nelem;
+}
+
+
+/*
+ * GT3_readVarZRangeDouble() reads z-planes from 'zstr' to 'zend - 1'
+ * into 'buf', whose shape is dimlen[0] * dimlen[1] * (zend - zstr).
+ *
+ * In UR4 and UR8, the planes are read by a single I/O, directly into
+ * 'buf' (Varbuf's data buffer is left untouched).
+ *
+ * return value: the number of elements read (-1 on error, including
+ * the case that it exceeds INT_MAX).
+ */
+int
+GT3_readVarZRangeDouble(double *buf, size_t buflen,
+                        GT3_Varbuf *var, int zstr, int zend)
+{
+    return read_zrange(buf, GT3_TYPE_DOUBLE, buflen, var, zstr, zend);
+}
+
+
+/*
+ * Float version of GT3_readVarZRangeDouble().
+ */
+int
+GT3_readVarZRangeFloat(float *buf, size_t buflen,
+                       GT3_Varbuf *var, int zstr, int zend)
+{
+    return read_zrange(buf, GT3_TYPE_FLOAT, buflen, var, zstr, zend);
+}
+
+
+/*
+ * GT3_readVarSlab() reads a hyperslab of the current chunk into 'buf':
+ *   x = x0, x0 + stride, ..., (< x1)
+ *   y = y0, y0 + stride, ..., (< y1)
+ *   z = z0, z0 + stride, ..., (< z1)
+ * The x-index varies fastest in 'buf'.
+ *
+ * In URY and MRY, only the requested rows are unpacked
+ * (not the whole z-plane).
+ *
+ * return value: the number of elements read (-1 on error, including
+ * the case that it exceeds INT_MAX).
+ */
+int
+GT3_readVarSlab(double *buf, size_t buflen, GT3_Varbuf *var,
+                int x0, int x1, int y0, int y1, int z0, int z1, int stride)
+{
+    varbuf_status *stat;
+    size_t nelem;
+    int nx, ny, nz, j, k, y, z, fmt;
+
+    if (update2_varbuf(var) < 0)
+        return -1;
+
+    if (stride < 1
+        || x0 < 0 || x1 > var->dimlen[0] || x0 >= x1
+        || y0 < 0 || y1 > var->dimlen[1] || y0 >= y1
+        || z0 < 0 || z1 > var->dimlen[2] || z0 >= z1) {
+        gt3_error(GT3_ERR_INDEX,
+                  "GT3_readVarSlab(): x=%d:%d, y=%d:%d, z=%d:%d, stride=%d",
+                  x0, x1, y0, y1, z0, z1, stride);
+        return -1;
+    }
+
+    nx = (x1 - x0 + stride - 1) / stride;
+    ny = (y1 - y0 + stride - 1) / stride;
+    nz = (z1 - z0 + stride - 1) / stride;
+    nelem = (size_t)nx * ny * nz;
+    if (nelem > INT_MAX) {
+        gt3_error(GT3_ERR_CALL, "GT3_readVarSlab(): too many elements");
+        return -1;
+    }
+    if (buflen < nelem) {
+        gt3_error(GT3_ERR_CALL, "GT3_readVarSlab(): too small buffer");
+        return -1;
+    }
+
+    stat = (varbuf_status *)var->stat_;
+    fmt = (int)(stat->file.fmt & GT3_FMT_MASK);
+
+    for (k = 0; k < nz; k++) {
+        z = z0 + k * stride;
+
+        if (slab_fptr[fmt]) {
+            if (slab_fptr[fmt](buf, var, z, x0, nx, y0, ny, stride,
+                               &stat->file) < 0)
+                return -1;
+
+            buf += (size_t)nx * ny;
+            continue;
+        }
+
+        for (j = 0; j < ny; j++) {
+            y = y0 + j * stride;
+            if (GT3_readVarZY(var, z, y) < 0)
+                return -1;
+
+            GT3_copyVarDouble(buf, nx, var, var->dimlen[0] * y + x0, stride);
+            buf += nx;
+        }
+    }
+    return nelem;
+}
+
+
+/*
+ * GT3_readVarPacked() reads the values of MASK-ON elements in 'zpos'
+ * into var->data, without expanding them into the z-plane (MR4, MR8,
+ * MRY, and MRX).  '*index' is set to the positions of the values in
+ * the z-plane (in ascending order), which is valid until the next
+ * call with 'var'.  The values might be still MISS.
+ *
+ * In other formats, the z-plane is read as GT3_readVarZ(), and
+ * '*index' is set to NULL (the i-th value is at the i-th position).
+ *
+ * Note that var->data does not hold the z-plane afterward in the masked
+ * formats (GT3_readVarZ() reads it again).
+ *
+ * return value: the number of values in var->data (-1 on error).
+ */
+int
+GT3_readVarPacked(GT3_Varbuf *var, int zpos, const int **index)
+{
+    varbuf_status *stat;
+    GT3_Datamask *mask;
+    size_t nelem, num, pos = 0;
+    int fmt, rval;
+
+    if (update2_varbuf(var) < 0)
+        return -1;
+
+    if (zpos < 0 || zpos >= var->dimlen[2]) {
+        gt3_error(GT3_ERR_INDEX, "GT3_readVarPacked(): z=%d", zpos);
+        return -1;
+    }
+
+    stat = (varbuf_status *)var->stat_;
+    fmt = (int)(stat->file.fmt & GT3_FMT_MASK);
+    nelem = (size_t)var->dimlen[0] * var->dimlen[1];
+
+    switch (fmt) {
+    case GT3_FMT_MR4:
+    case GT3_FMT_MR8:
+        pos = nelem * zpos;     /* the mask is of all the z-planes */
+        rval = read_MRN_pre(var->data, &num, var,
+                            fmt == GT3_FMT_MR4 ? sizeof(float) : sizeof(double),
+                            zpos, 0, nelem, &stat->file);
+        break;
+    case GT3_FMT_MRY:
+        rval = read_MRY_packed(var, zpos, &num, &stat->file);
+        break;
+    case GT3_FMT_MRX:
+        rval = read_MRX_packed(var, zpos, &num, &stat->file);
+        break;
+    default:
+        *index = NULL;
+        return GT3_readVarZ(var, zpos) < 0 ? -1 : (int)nelem;
+    }
+
+    /* var->data is not the z-plane. */
+    stat->z = -1;
+    BS_CLSALL(stat->y);
+    if (rval < 0)
+        return -1;
+
+    mask = stat->file.mask;
+    if (GT3_updateMaskIndex(mask, var->dimlen[0]) < 0)
+        return -1;
+    if (GT3_getMaskRank(mask, pos + nelem) - GT3_getMaskRank(mask, pos)
+        != num) {
+        gt3_error(GT3_ERR_BROKEN, stat->file.path);
+        return -1;
+    }
+
+    if (num > stat->index_size) {
+        free(stat->index);
+        if ((stat->index = malloc(sizeof(int) * num)) == NULL) {
+            stat->index_size = 0;
+            gt3_error(SYSERR, NULL);
+            return -1;
+        }
+        stat->index_size = num;
+    }
+    mask_positions(stat->index, mask->mask, pos, nelem);
+
+    *index = stat->index;
+    return (int)num;
+}
+
+
+/*
+ * reduce a row of decoded values (two-pass).
+ */
+#define REDUCE_ROW(TYPE) \
+    do { \
+        const TYPE *p = (const TYPE *)var->data + start; \
+        TYPE miss = (TYPE)var->miss; \
+        \
+        for (i = 0; i < n; i++) \
+            if (p[i] != miss) { \
+                red->count++; \
+                red->sum += p[i]; \
+                if (p[i] < red->min) \
+                    red->min = p[i]; \
+                if (p[i] > red->max) \
+                    red->max = p[i]; \
+            } \
+        if (red->count > 0) { \
+            mean = red->sum / red->count; \
+            for (i = 0; i < n; i++) \
+                if (p[i] != miss) \
+                    red->ssd += (p[i] - mean) * (p[i] - mean); \
+        } \
+    } while (0)
+
+static void
+reduce_row(GT3_Reduction *red, const GT3_Varbuf *var, size_t start, size_t n)
+{
+    double mean;
+    size_t i;
+
+    red->count = 0;
+    red->sum = red->ssd = 0.;
+    red->min = HUGE_VAL;
+    red->max = -HUGE_VAL;
+
+    if (var->type == GT3_TYPE_DOUBLE)
+        REDUCE_ROW(double);
+    else
+        REDUCE_ROW(float);
+}
+#undef REDUCE_ROW
+
+
+/*
+ * GT3_reduceVarRows() sets the statistics of non-missing values
+ * (count, sum, sum of squared deviations, min, and max) in each row
+ * of 'zpos': red[j] for x = x0, ..., x1 - 1 at y = y0 + j (< y1).
+ *
+ * In URY and MRY, the values are not decoded; the statistics are
+ * computed on the packed integers, and converted into values
+ * by the scaling parameters at the end.
+ * In other formats, the z-plane is read and decoded as usual.
+ */
+int
+GT3_reduceVarRows(GT3_Reduction *red, GT3_Varbuf *var, int zpos,
+                  int x0, int x1, int y0, int y1)
+{
+    varbuf_status *stat;
+    unsigned nbits;
+    int fmt, y;
+
+    if (update2_varbuf(var) < 0)
+        return -1;
+
+    if (zpos < 0 || zpos >= var->dimlen[2]
+        || x0 < 0 || x1 > var->dimlen[0] || x0 >= x1
+        || y0 < 0 || y1 > var->dimlen[1] || y0 >= y1) {
+        gt3_error(GT3_ERR_INDEX,
+                  "GT3_reduceVarRows(): x=%d:%d, y=%d:%d, z=%d",
+                  x0, x1, y0, y1, zpos);
+        return -1;
+    }
+
+    stat = (varbuf_status *)var->stat_;
+    fmt = (int)(stat->file.fmt & GT3_FMT_MASK);
+    nbits = (unsigned)stat->file.fmt >> GT3_FMT_MBIT;
+
+    if (fmt == GT3_FMT_URY && nbits > 0)
+        return reduce_URY_rows(red, zpos, x0, x1, y0, y1, &stat->file);
+    if (fmt == GT3_FMT_MRY && nbits > 0)
+        return reduce_MRY_rows(red, zpos, x0, x1, y0, y1, &stat->file);
+
+    if (GT3_readVarZ(var, zpos) < 0)
+        return -1;
+
+    for (y = y0; y < y1; y++)
+        reduce_row(red + (y - y0), var,
+                   (size_t)var->dimlen[0] * y + x0, x1 - x0);
+    return 0;
+}
+
+
+/*
+ * GT3_mergeReduction() merges 'src' into 'dest', as if the values
+ * of both were reduced at once (Chan et al.).
+ * A reduction with count == 0 is empty (other members are ignored).
+ */
+void
+GT3_mergeReduction(GT3_Reduction *dest, const GT3_Reduction *src)
+{
+    double delta;
+    size_t n;
+
+    if (src->count == 0)
+        return;
+    if (dest->count == 0) {
+        *dest = *src;
+        return;
+    }
+
+    n = dest->count + src->count;
+    delta = src->sum / src->count - dest->sum / dest->count;
+    dest->ssd += src->ssd
+        + delta * delta * ((double)dest->count * src->count / n);
+    dest->sum += src->sum;
+    dest->count = n;
+    if (src->min < dest->min)
+        dest->min = src->min;
+    if (src->max > dest->max)
+        dest->max = src->max;
+}
+
+
 /*
  * NOTE
  * GT3_{copy,get}XXX() functions do not update GT3_Varbuf.
@@ -749,7 +1226,108 @@ GT3_reattachVarbuf(GT3_Varbuf *var, GT3_File *fp)
     if (var == NULL)
         return -1;
 
-    return update_varbuf(var, fp);
+    return attach_varbuf(var, fp);
+}
+
+
+/*
+ * GT3_setVarbufCache() enables the LRU cache of decoded z-planes,
+ * keyed by (chunk, z), up to 'maxbytes' in total.
+ * 'maxbytes == 0' disables the cache (and resets the counters).
+ *
+ * With the cache, GT3_readVarZY() reads whole planes, so that
+ * access patterns which go back and forth between levels
+ * (e.g., vertical profiles by GT3_readVar()) do not decode the same
+ * plane again.
+ * The cache is cleared whenever Varbuf is attached to a file by
+ * GT3_getVarbuf2(), GT3_reattachVarbuf(), or GT3_pinVarbuf().
+ */
+int
+GT3_setVarbufCache(GT3_Varbuf *var, size_t maxbytes)
+{
+    varbuf_status *stat;
+
+    if (var == NULL || var->stat_ == NULL) {
+        gt3_error(GT3_ERR_CALL, "GT3_setVarbufCache()");
+        return -1;
+    }
+    stat = (varbuf_status *)var->stat_;
+
+    if (maxbytes == 0) {
+        free_plane_cache(stat->cache);
+        stat->cache = NULL;
+        return 0;
+    }
+
+    if (stat->cache)
+        resize_plane_cache(stat->cache, maxbytes);
+    else if ((stat->cache = new_plane_cache(maxbytes)) == NULL)
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * GT3_getVarbufCacheStats() gets the number of hits and misses of
+ * the plane cache. A request for the plane already in Varbuf.data
+ * is not counted.
+ */
+void
+GT3_getVarbufCacheStats(const GT3_Varbuf *var,
+                        unsigned long *hits, unsigned long *misses)
+{
+    varbuf_status *stat = (varbuf_status *)var->stat_;
+
+    *hits = *misses = 0;
+    if (stat && stat->cache) {
+        *hits = stat->cache->hits;
+        *misses = stat->cache->misses;
+    }
+}
+
+
+/*
+ * GT3_getVarbufMaskStats() gets the statistics of the mask used by
+ * Varbuf (see GT3_getMaskStats()).
+ */
+void
+GT3_getVarbufMaskStats(const GT3_Varbuf *var,
+                       unsigned long *loaded, unsigned long *reused)
+{
+    varbuf_status *stat = (varbuf_status *)var->stat_;
+
+    *loaded = *reused = 0;
+    if (stat && stat->file.mask)
+        GT3_getMaskStats(stat->file.mask, loaded, reused);
+}
+
+
+/*
+ * GT3_pinVarbuf() attaches Varbuf to the current chunk of 'fp'.
+ * Unlike GT3_reattachVarbuf(), the Varbuf keeps reading the chunk
+ * even after 'fp' moves to another chunk (GT3_next(), GT3_seek()).
+ *
+ * Data are read by positional I/O (pread(2) or the mapped image),
+ * and the file position of 'fp' is left untouched. So, several
+ * threads can read one GT3_File concurrently, as long as each
+ * thread uses its own Varbuf.
+ *
+ * GT3_pinVarbuf() itself reads the header via 'fp', so it must not
+ * be called concurrently with other functions using 'fp'.
+ * Use GT3_reattachVarbuf() to follow 'fp' again.
+ */
+int
+GT3_pinVarbuf(GT3_Varbuf *var, GT3_File *fp)
+{
+    if (var == NULL)
+        return -1;
+
+    if (attach_varbuf(var, fp) < 0)
+        return -1;
+
+    ((varbuf_status *)var->stat_)->pinned = 1;
+    return 0;
 }
 
 
@@ -804,3 +1382,342 @@ main(int argc, char **argv)
     return 0;
 }
 #endif
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+
+#define NX 8
+#define NY 5
+#define NZ 3
+
+/*
+ * the n-th test file: masked at different points in each file.
+ */
+static double
+test_value(int n, int t, int i)
+{
+    return (i % (3 + 2 * n) == n) ? -999. : 1000. * n + 100. * t + 0.5 * i;
+}
+
+
+static void
+write_test_file(const char *path, int n, const char **fmts, int nfmts)
+{
+    GT3_HEADER head;
+    FILE *output;
+    double data[NX * NY * NZ];
+    int i, t;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    for (t = 0; t < nfmts; t++) {
+        for (i = 0; i < NX * NY * NZ; i++)
+            data[i] = test_value(n, t, i);
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, NX, NY, NZ,
+                         &head, fmts[t], output) == 0);
+    }
+    fclose(output);
+}
+
+
+static void
+check_plane(GT3_Varbuf *var, int n, int t, int z)
+{
+    double value;
+    int x, y, i;
+
+    assert(GT3_readVarZ(var, z) == 0);
+    for (y = 0; y < NY; y++)
+        for (x = 0; x < NX; x++) {
+            i = x + NX * (y + NY * z);
+            assert(GT3_readVar(&value, var, x, y, z) == 0);
+            assert(fabs(value - test_value(n, t, i)) < 1e-2);
+        }
+}
+
+
+/*
+ * one Varbuf is reattached to the same chunk of files with
+ * different masks.
+ */
+static void
+test_reattach(void)
+{
+    const char *path[] = { "varbuf-test0.gt", "varbuf-test1.gt" };
+    const char *fmts[] = { "MR4", "MRY16", "MR8" };
+    GT3_File *fp[2];
+    GT3_Varbuf *var = NULL;
+    int n, t, z;
+
+    for (n = 0; n < 2; n++)
+        write_test_file(path[n], n, fmts, 3);
+
+    for (n = 0; n < 2; n++) {
+        fp[n] = GT3_open(path[n]);
+        assert(fp[n]);
+    }
+
+    for (t = 0; t < 3; t++)
+        for (z = 0; z < NZ; z++)
+            for (n = 0; n < 2; n++) {
+                assert(GT3_seek(fp[n], t, SEEK_SET) == 0);
+                var = GT3_getVarbuf2(var, fp[n]);
+                assert(var);
+                check_plane(var, n, t, z);
+            }
+
+    /* another file opened in turn (possibly at the same address) */
+    for (t = 0; t < 3; t++)
+        for (n = 0; n < 2; n++) {
+            GT3_close(fp[0]);
+            fp[0] = GT3_open(path[n]);
+            assert(fp[0]);
+            assert(GT3_seek(fp[0], t, SEEK_SET) == 0);
+            assert(GT3_reattachVarbuf(var, fp[0]) == 0);
+            for (z = 0; z < NZ; z++)
+                check_plane(var, n, t, z);
+        }
+
+    GT3_freeVarbuf(var);
+    for (n = 0; n < 2; n++) {
+        GT3_close(fp[n]);
+        remove(path[n]);
+    }
+}
+
+
+/*
+ * the plane cache is not used for another file opened at the address
+ * of the closed one.
+ */
+static void
+test_cache(void)
+{
+    const char *path[] = { "varbuf-test0.gt", "varbuf-test1.gt" };
+    const char *fmts[] = { "UR8", "URY16" };
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    unsigned long hits, misses;
+    int n, t, z;
+
+    for (n = 0; n < 2; n++)
+        write_test_file(path[n], n, fmts, 2);
+
+    fp = GT3_open(path[0]);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    assert(GT3_setVarbufCache(var, 1024 * 1024) == 0);
+
+    for (t = 0; t < 2; t++) {
+        for (n = 0; n < 2; n++) {
+            GT3_close(fp);
+            fp = GT3_open(path[n]);
+            assert(fp);
+            assert(GT3_seek(fp, t, SEEK_SET) == 0);
+            if (t == 0)
+                assert(GT3_reattachVarbuf(var, fp) == 0);
+            else
+                assert(GT3_pinVarbuf(var, fp) == 0);
+
+            /* z = 0 is cached after reading z = 1. */
+            for (z = NZ - 1; z >= 0; z--)
+                check_plane(var, n, t, z);
+            check_plane(var, n, t, NZ - 1);
+            GT3_getVarbufCacheStats(var, &hits, &misses);
+            assert(hits >= 1);
+        }
+    }
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    for (n = 0; n < 2; n++)
+        remove(path[n]);
+}
+
+
+/*
+ * GT3_readVarSlab() gives the same values as GT3_readVarZ().
+ */
+static void
+test_slab(void)
+{
+    const char *path = "varbuf-test0.gt";
+    const char *fmts[] = { "UR4", "UR8", "MR4", "URY16", "MRY16", "ZR4" };
+    int range[][7] = {
+        /* x0, x1, y0, y1, z0, z1, stride */
+        { 0, NX, 0, NY, 0, NZ, 1 },
+        { 1, 7, 0, 5, 0, 3, 2 },
+        { 2, 3, 4, 5, 2, 3, 1 },
+        { 0, NX, 1, NY, 0, NZ, 3 },
+        { 3, NX, 0, 4, 1, NZ, 4 }
+    };
+    double buf[NX * NY * NZ], value;
+    GT3_File *fp;
+    GT3_Varbuf *var, *ref;
+    int *r, n, m, i, x, y, z, num;
+
+    write_test_file(path, 0, fmts, 6);
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    ref = GT3_getVarbuf(fp);
+    assert(var && ref);
+
+    for (n = 0; n < 6; n++) {
+        for (m = 0; m < sizeof range / sizeof range[0]; m++) {
+            r = range[m];
+            num = GT3_readVarSlab(buf, NX * NY * NZ, var,
+                                  r[0], r[1], r[2], r[3], r[4], r[5], r[6]);
+            assert(num == ((r[1] - r[0] + r[6] - 1) / r[6])
+                   * ((r[3] - r[2] + r[6] - 1) / r[6])
+                   * ((r[5] - r[4] + r[6] - 1) / r[6]));
+
+            i = 0;
+            for (z = r[4]; z < r[5]; z += r[6]) {
+                assert(GT3_readVarZ(ref, z) == 0);
+                for (y = r[2]; y < r[3]; y += r[6])
+                    for (x = r[0]; x < r[1]; x += r[6]) {
+                        assert(GT3_readVar(&value, ref, x, y, z) == 0);
+                        assert(buf[i] == value);
+                        assert(fabs(value
+                                    - test_value(0, n,
+                                                 x + NX * (y + NY * z)))
+                               < 1e-2);
+                        i++;
+                    }
+            }
+            assert(i == num);
+        }
+
+        /* errors */
+        assert(GT3_readVarSlab(buf, NX * NY * NZ - 1, var,
+                               0, NX, 0, NY, 0, NZ, 1) < 0);
+        assert(GT3_readVarSlab(buf, NX * NY * NZ, var,
+                               0, NX + 1, 0, NY, 0, NZ, 1) < 0);
+        assert(GT3_readVarSlab(buf, NX * NY * NZ, var,
+                               0, NX, 0, NY, 0, NZ, 0) < 0);
+        GT3_clearLastError();
+
+        if (n < 5)
+            assert(GT3_next(fp) == 0);
+    }
+
+    GT3_freeVarbuf(var);
+    GT3_freeVarbuf(ref);
+    GT3_close(fp);
+    remove(path);
+}
+
+
+/*
+ * the number of elements to be read must not exceed INT_MAX.
+ */
+static void
+test_zrange(void)
+{
+    const char *path = "varbuf-test0.gt";
+    const char *fmts[] = { "UR8", "URY16" };
+    double buf[NX * NY * NZ];
+    float fbuf[NX * NY * NZ];
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    int n, i;
+
+    write_test_file(path, 0, fmts, 2);
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+
+    for (n = 0; n < 2; n++) {
+        assert(GT3_readVarZRangeDouble(buf, NX * NY * NZ, var, 1, NZ)
+               == NX * NY * (NZ - 1));
+        assert(GT3_readVarZRangeFloat(fbuf, NX * NY * NZ, var, 0, NZ)
+               == NX * NY * NZ);
+        for (i = 0; i < NX * NY * (NZ - 1); i++) {
+            assert(fabs(buf[i] - test_value(0, n, i + NX * NY)) < 1e-2);
+            assert(fabs(fbuf[i + NX * NY] - buf[i]) < 1e-4);
+        }
+        assert(GT3_readVarZRangeDouble(buf, NX * NY * NZ - 1, var, 0, NZ)
+               < 0);
+        if (n == 0)
+            assert(GT3_next(fp) == 0);
+    }
+
+    /* (a fake shape of the current chunk) */
+    var->dimlen[0] = 1 << 16;
+    var->dimlen[1] = 1 << 15;
+    var->dimlen[2] = NZ;
+    assert(GT3_readVarZRangeDouble(buf, (size_t)-1, var, 0, 1) < 0);
+    assert(GT3_readVarZRangeFloat(fbuf, (size_t)-1, var, 0, 2) < 0);
+    assert(GT3_readVarSlab(buf, (size_t)-1, var,
+                           0, 1 << 16, 0, 1 << 15, 0, 1, 1) < 0);
+    GT3_clearLastError();
+
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    remove(path);
+}
+
+
+/*
+ * Varbuf follows the FILE reopened by GT3_resume().
+ */
+static void
+test_suspend(void)
+{
+    const char *path[] = { "varbuf-test0.gt", "varbuf-test1.gt" };
+    const char *fmts[] = { "UR8", "MR4" };
+    GT3_File *fp, *other;
+    GT3_Varbuf *var;
+    int t, z;
+
+    write_test_file(path[0], 0, fmts, 2);
+    write_test_file(path[1], 1, fmts, 2);
+
+    fp = GT3_open(path[0]);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+
+    for (t = 0; t < 2; t++) {
+        check_plane(var, 0, t, 0);
+
+        assert(GT3_suspend(fp) == 0);
+        assert(GT3_readVarZ(var, 1) < 0);
+        GT3_clearLastError();
+
+        /* which may take the descriptor of 'fp'. */
+        other = GT3_open(path[1]);
+        assert(other);
+        assert(GT3_resume(fp) == 0);
+        GT3_close(other);
+
+        for (z = 1; z < NZ; z++)
+            check_plane(var, 0, t, z);
+        check_plane(var, 0, t, 0);
+
+        assert(GT3_next(fp) == 0);
+    }
+
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    remove(path[0]);
+    remove(path[1]);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    test_suspend();
+    test_reattach();
+    test_cache();
+    test_slab();
+    test_zrange();
+    return 0;
+}
+#endif /* TEST_MAIN */
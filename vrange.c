@@ -0,0 +1,295 @@
+/*
+ * vrange.c -- the range of non-missing values.
+ *
+ * get_vrange() finds the minimum, the maximum, and the number of
+ * non-missing values (and NaNs) in one pass, which is shared by
+ * the writers to determine packing parameters.
+ */
+#include "internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifndef HUGE_VALF
+#  define HUGE_VALF 1e38
+#endif
+
+/*
+ * The loops are unrolled into NLANE independent accumulators, with no
+ * branch but conditional moves, so that they can be vectorized.
+ */
+#define NLANE 8
+
+/*
+ * A large array is split into pieces of VRANGE_PIECE elements (at least)
+ * to be scanned concurrently.
+ */
+#define VRANGE_PIECE (256 * 1024)
+
+
+static void
+init_vrange(vrange *r)
+{
+    r->vmin = HUGE_VAL;
+    r->vmax = -HUGE_VAL;
+    r->count = 0;
+    r->nnan = 0;
+}
+
+
+static void
+merge_vrange(vrange *r, const vrange *r2)
+{
+    if (r2->vmin < r->vmin)
+        r->vmin = r2->vmin;
+    if (r2->vmax > r->vmax)
+        r->vmax = r2->vmax;
+    r->count += r2->count;
+    r->nnan += r2->nnan;
+}
+
+
+static void
+scan_float(vrange *r, const float *data, size_t nelems, float miss)
+{
+    float lmin[NLANE], lmax[NLANE], x, v1, v2;
+    size_t lcnt[NLANE], lnan[NLANE];
+    size_t i, k, nmain;
+    int valid;
+
+    for (k = 0; k < NLANE; k++) {
+        lmin[k] = HUGE_VALF;
+        lmax[k] = -HUGE_VALF;
+        lcnt[k] = lnan[k] = 0;
+    }
+
+    nmain = nelems - nelems % NLANE;
+    for (i = 0; i < nmain; i += NLANE)
+        for (k = 0; k < NLANE; k++) {
+            x = data[i + k];
+            valid = x != miss;
+            v1 = valid ? x : HUGE_VALF;
+            v2 = valid ? x : -HUGE_VALF;
+            lmin[k] = v1 < lmin[k] ? v1 : lmin[k];
+            lmax[k] = v2 > lmax[k] ? v2 : lmax[k];
+            lcnt[k] += valid;
+            lnan[k] += x != x;
+        }
+    for (k = 0; i < nelems; i++, k++) {
+        x = data[i];
+        valid = x != miss;
+        v1 = valid ? x : HUGE_VALF;
+        v2 = valid ? x : -HUGE_VALF;
+        lmin[k] = v1 < lmin[k] ? v1 : lmin[k];
+        lmax[k] = v2 > lmax[k] ? v2 : lmax[k];
+        lcnt[k] += valid;
+        lnan[k] += x != x;
+    }
+
+    for (k = 0; k < NLANE; k++) {
+        if (lmin[k] < r->vmin)
+            r->vmin = lmin[k];
+        if (lmax[k] > r->vmax)
+            r->vmax = lmax[k];
+        r->count += lcnt[k];
+        r->nnan += lnan[k];
+    }
+}
+
+
+static void
+scan_double(vrange *r, const double *data, size_t nelems, double miss)
+{
+    double lmin[NLANE], lmax[NLANE], x, v1, v2;
+    size_t lcnt[NLANE], lnan[NLANE];
+    size_t i, k, nmain;
+    int valid;
+
+    for (k = 0; k < NLANE; k++) {
+        lmin[k] = HUGE_VAL;
+        lmax[k] = -HUGE_VAL;
+        lcnt[k] = lnan[k] = 0;
+    }
+
+    nmain = nelems - nelems % NLANE;
+    for (i = 0; i < nmain; i += NLANE)
+        for (k = 0; k < NLANE; k++) {
+            x = data[i + k];
+            valid = x != miss;
+            v1 = valid ? x : HUGE_VAL;
+            v2 = valid ? x : -HUGE_VAL;
+            lmin[k] = v1 < lmin[k] ? v1 : lmin[k];
+            lmax[k] = v2 > lmax[k] ? v2 : lmax[k];
+            lcnt[k] += valid;
+            lnan[k] += x != x;
+        }
+    for (k = 0; i < nelems; i++, k++) {
+        x = data[i];
+        valid = x != miss;
+        v1 = valid ? x : HUGE_VAL;
+        v2 = valid ? x : -HUGE_VAL;
+        lmin[k] = v1 < lmin[k] ? v1 : lmin[k];
+        lmax[k] = v2 > lmax[k] ? v2 : lmax[k];
+        lcnt[k] += valid;
+        lnan[k] += x != x;
+    }
+
+    for (k = 0; k < NLANE; k++) {
+        if (lmin[k] < r->vmin)
+            r->vmin = lmin[k];
+        if (lmax[k] > r->vmax)
+            r->vmax = lmax[k];
+        r->count += lcnt[k];
+        r->nnan += lnan[k];
+    }
+}
+
+
+static void
+scan(vrange *r, const void *ptr, size_t size, size_t nelems, double miss)
+{
+    init_vrange(r);
+    if (size == 4)
+        scan_float(r, ptr, nelems, (float)miss);
+    else
+        scan_double(r, ptr, nelems, miss);
+
+    /* no value but NaN (HUGE_VALF might be finite). */
+    if (r->count == r->nnan) {
+        r->vmin = HUGE_VAL;
+        r->vmax = -HUGE_VAL;
+    }
+}
+
+
+struct vrange_arg {
+    const char *ptr;
+    size_t size;
+    size_t nelems;
+    size_t piece;               /* # of elements in a piece */
+    double miss;
+    vrange *result;             /* of each piece */
+};
+
+
+static int
+scan_piece(size_t i, void *ptr)
+{
+    struct vrange_arg *arg = ptr;
+    size_t len;
+
+    len = arg->nelems - i * arg->piece;
+    if (len > arg->piece)
+        len = arg->piece;
+
+    scan(arg->result + i, arg->ptr + i * arg->piece * arg->size,
+         arg->size, len, arg->miss);
+    return 0;
+}
+
+
+/*
+ * get_vrange() scans 'nelems' values of float (size = 4) or double
+ * (size = 8), with 'nthreads' threads for a large array.
+ *
+ * r->count is the number of values other than 'miss' (NaN included),
+ * and r->nnan is the number of NaNs in them.
+ * r->vmin and r->vmax are the minimum and maximum of them (NaN
+ * excluded); if there is no such value, r->vmin > r->vmax.
+ * The result does not depend on 'nthreads'.
+ */
+void
+get_vrange(vrange *r, const void *ptr, size_t size, size_t nelems,
+           double miss, int nthreads)
+{
+    struct vrange_arg arg;
+    vrange result_buf[64];
+    size_t npiece, i;
+
+    if (nthreads > 64)
+        nthreads = 64;
+    if (nthreads < 2 || nelems < 2 * VRANGE_PIECE) {
+        scan(r, ptr, size, nelems, miss);
+        return;
+    }
+
+    arg.piece = (nelems + nthreads - 1) / nthreads;
+    if (arg.piece < VRANGE_PIECE)
+        arg.piece = VRANGE_PIECE;
+    npiece = (nelems + arg.piece - 1) / arg.piece;
+
+    arg.ptr = ptr;
+    arg.size = size;
+    arg.nelems = nelems;
+    arg.miss = miss;
+    arg.result = result_buf;
+    parallel_for(nthreads, npiece, scan_piece, &arg);
+
+    init_vrange(r);
+    for (i = 0; i < npiece; i++)
+        merge_vrange(r, result_buf + i);
+}
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+#include <stdio.h>
+
+int
+main(int argc, char **argv)
+{
+    static double data[3 * VRANGE_PIECE];
+    static float dataf[3 * VRANGE_PIECE];
+    size_t n, i;
+    vrange r, r2;
+    int nth;
+
+    /* no value */
+    for (i = 0; i < 10; i++)
+        data[i] = dataf[i] = -999.f;
+    get_vrange(&r, data, 8, 10, -999., 1);
+    assert(r.count == 0 && r.nnan == 0 && r.vmin > r.vmax);
+    get_vrange(&r, dataf, 4, 10, -999., 1);
+    assert(r.count == 0 && r.nnan == 0 && r.vmin > r.vmax);
+    get_vrange(&r, dataf, 4, 0, -999., 1);
+    assert(r.count == 0 && r.vmin > r.vmax);
+
+    /* NaN only */
+    data[3] = dataf[3] = (float)NAN;
+    get_vrange(&r, data, 8, 10, -999., 1);
+    assert(r.count == 1 && r.nnan == 1 && r.vmin > r.vmax);
+
+    for (n = 1; n < 20; n++) {
+        for (i = 0; i < n; i++)
+            data[i] = dataf[i] = (i % 3 == 1) ? -999.f : (float)i - 5.f;
+        if (n > 6)
+            data[6] = dataf[6] = (float)NAN;
+
+        get_vrange(&r, data, 8, n, -999., 1);
+        get_vrange(&r2, dataf, 4, n, -999., 1);
+        assert(r.vmin == -5. && r2.vmin == -5.);
+        assert(r.vmax == r2.vmax);
+        assert(r.count == r2.count && r.nnan == r2.nnan);
+        assert(r.count == n - (n + 1) / 3);
+        assert(r.nnan == (n > 6));
+    }
+
+    /* multi-threaded */
+    for (i = 0; i < 3 * VRANGE_PIECE; i++)
+        data[i] = dataf[i] = (i % 11 == 0) ? -999.f : (float)(i % 1000);
+    data[2 * VRANGE_PIECE + 6] = dataf[2 * VRANGE_PIECE + 6] = -2000.f;
+    data[VRANGE_PIECE / 3] = dataf[VRANGE_PIECE / 3] = (float)NAN;
+
+    for (nth = 1; nth < 8; nth++) {
+        get_vrange(&r, data, 8, 3 * VRANGE_PIECE, -999., nth);
+        assert(r.vmin == -2000. && r.vmax == 999.);
+        assert(r.count == 3 * VRANGE_PIECE - (3 * VRANGE_PIECE + 10) / 11);
+        assert(r.nnan == 1);
+
+        get_vrange(&r2, dataf, 4, 3 * VRANGE_PIECE, -999., nth);
+        assert(r2.vmin == r.vmin && r2.vmax == r.vmax);
+        assert(r2.count == r.count && r2.nnan == 1);
+    }
+    return 0;
+}
+#endif /* TEST_MAIN */
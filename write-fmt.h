@@ -5,6 +5,13 @@
 #include <stdio.h>
 
 
+/* write.c */
+typedef size_t (*ENCODE_FUNC)(void *buf, void *work, size_t z, void *arg);
+
+int num_encode_threads(void);
+int write_planes(size_t nz, size_t bufsize, size_t worksize,
+                 ENCODE_FUNC encode, void *arg, FILE *fp);
+
 /* write-urx.c */
 int write_urx_via_double(const void *ptr,
                          size_t zelem, size_t nz,
@@ -43,6 +50,9 @@ int write_mr8_via_float(const float *data, size_t nelems,
                         double miss, FILE *fp);
 
 /* write-ury.c */
+unsigned ury_nbits(const void *ptr, size_t size, size_t zelem, size_t nz,
+                   double miss, double bound, int relative);
+
 int write_ury_via_double(const void *ptr,
                          size_t zelem, size_t nz,
                          unsigned nbits, double miss, FILE *fp);
@@ -80,4 +90,10 @@ int write_mry_man_via_float(const void *ptr,
                             double offset, double scale,
                             FILE *fp);
 
+/* write-zr.c */
+int write_zr_via_double(const void *ptr, size_t zelem, size_t nz,
+                        size_t width, FILE *fp);
+int write_zr_via_float(const void *ptr, size_t zelem, size_t nz,
+                       size_t width, FILE *fp);
+
 #endif
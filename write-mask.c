@@ -113,23 +113,10 @@ masked_copy(size_t *nread,
 size_t
 masked_count(const void *ptr, size_t size, size_t nelems, double miss)
 {
-    size_t i, cnt;
-
-    if (size == 4) {
-        const float *data = ptr;
-        float missf = (float)miss;
-
-        for (cnt = 0, i = 0; i < nelems; i++)
-            if (data[i] != missf)
-                cnt++;
-    } else {
-        const double *data = ptr;
+    vrange r;
 
-        for (cnt = 0, i = 0; i < nelems; i++)
-            if (data[i] != miss)
-                cnt++;
-    }
-    return cnt;
+    get_vrange(&r, ptr, size, nelems, miss, num_encode_threads());
+    return r.count;
 }
 
 
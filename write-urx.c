@@ -18,10 +18,6 @@
 
 #include "write-fmt.h"
 
-#ifndef HUGE_VALF
-#  define HUGE_VALF 1e38
-#endif
-
 static uint32_t
 maxval_uint32(const uint32_t *vals, size_t num)
 {
@@ -35,56 +31,21 @@ maxval_uint32(const uint32_t *vals, size_t num)
 }
 
 
+/*
+ * the scaling parameters of URX/MRX from the range of values.
+ */
 static void
-get_urx_parameterf(double *dma,
-                   const float *data, size_t nelems,
-                   double miss, unsigned nbits)
-{
-    float vmin = HUGE_VALF, vmax = -HUGE_VALF;
-    float missf = (float)miss;
-    int num = (1U << nbits) - 2;
-    size_t i;
-
-    for (i = 0; i < nelems; i++) {
-        if (data[i] != missf) {
-            vmin = data[i] < vmin ? data[i] : vmin;
-            vmax = data[i] > vmax ? data[i] : vmax;
-        }
-    }
-    if (vmin > vmax) {          /* no value */
-        dma[0] = 0.;
-        dma[1] = 0.;
-    } else {
-        if (num < 1)
-            num = 1;
-        scaling_parameters(dma, vmin, vmax, num);
-        dma[1] *= num;
-    }
-}
-
-
-static void
-get_urx_parameter(double *dma,
-                  const double *data, size_t nelems,
-                  double miss, unsigned nbits)
+set_urx_parameter(double *dma, const vrange *r, unsigned nbits)
 {
-    double vmin = HUGE_VAL, vmax = -HUGE_VAL;
     int num = (1U << nbits) - 2;
-    size_t i;
 
-    for (i = 0; i < nelems; i++) {
-        if (data[i] != miss) {
-            vmin = data[i] < vmin ? data[i] : vmin;
-            vmax = data[i] > vmax ? data[i] : vmax;
-        }
-    }
-    if (vmin > vmax) {          /* no value */
+    if (r->vmin > r->vmax) {    /* no value */
         dma[0] = 0.;
         dma[1] = 0.;
     } else {
         if (num < 1)
             num = 1;
-        scaling_parameters(dma, vmin, vmax, num);
+        scaling_parameters(dma, r->vmin, r->vmax, num);
         dma[1] *= num;
     }
 }
@@ -104,6 +65,7 @@ write_urx(const void *ptr,
     unsigned imiss;
     size_t i, nelems, len, plen, packed_len;
     const char *ptr2;
+    vrange r;
 #define URXBUFSIZ (32 * 1024)
     unsigned idata[URXBUFSIZ];
     uint32_t packed[URXBUFSIZ];
@@ -121,20 +83,10 @@ write_urx(const void *ptr,
     /*
      * determine scaling parameters (auto-scaling)
      */
-    if (size == 4) {
-        const float *data = ptr;
-
-        for (i = 0; i < nz; i++)
-            get_urx_parameterf(dma + 2 * i,
-                               data + i * zelem,
-                               zelem, miss, nbits);
-    } else {
-        const double *data = ptr;
-
-        for (i = 0; i < nz; i++)
-            get_urx_parameter(dma + 2 * i,
-                              data + i * zelem,
-                              zelem, miss, nbits);
+    for (i = 0; i < nz; i++) {
+        get_vrange(&r, (const char *)ptr + i * zelem * size,
+                   size, zelem, miss, num_encode_threads());
+        set_urx_parameter(dma + 2 * i, &r, nbits);
     }
 
     /*
@@ -229,7 +181,7 @@ write_mrx(const void *ptr2,
     uint32_t cnt_buf[128];
     uint32_t plen_buf[128];
     double dma_buf[256];
-    size_t cnt0;
+    vrange r;
     uint32_t *cnt = cnt_buf;
     uint32_t *plen = plen_buf;
     double *dma = dma_buf;
@@ -254,21 +206,16 @@ write_mrx(const void *ptr2,
     }
 
     for (ptr = ptr2, i = 0; i < nz; i++, ptr += zelems * size) {
-        cnt0 = masked_count(ptr, size, zelems, miss);
-        if (cnt0 > 0xffffffffU) {
+        get_vrange(&r, ptr, size, zelems, miss, num_encode_threads());
+        if (r.count > 0xffffffffU) {
             gt3_error(GT3_ERR_TOOLONG, "Use URY");
             goto finish;
         }
-        cnt[i] = (uint32_t)cnt0;
+        cnt[i] = (uint32_t)r.count;
         plen[i] = (uint32_t)pack32_len(cnt[i], nbits);
         plen_all += plen[i];
 
-        if (size == 4)
-            get_urx_parameterf(dma + 2 * i, (float *)ptr,
-                               zelems, miss, nbits);
-        else
-            get_urx_parameter(dma + 2 * i, (double *)ptr,
-                              zelems, miss, nbits);
+        set_urx_parameter(dma + 2 * i, &r, nbits);
     }
 
     if (4 * plen_all > 0xffffffffU) {
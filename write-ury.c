@@ -16,10 +16,6 @@
 
 #include "write-fmt.h"
 
-#ifndef HUGE_VALF
-#  define HUGE_VALF 1e38
-#endif
-
 static uint32_t
 maxval_uint32(const uint32_t *vals, size_t num)
 {
@@ -34,21 +30,10 @@ maxval_uint32(const uint32_t *vals, size_t num)
 
 
 static void
-get_ury_parameterf(double *dma,
-                   const float *data, size_t nelems,
-                   double miss, unsigned nbits)
+set_scaling(double *dma, double vmin, double vmax, unsigned nbits)
 {
-    float vmin = HUGE_VALF, vmax = -HUGE_VALF;
-    float missf = (float)miss;
     int num = (1U << nbits) - 2;
-    size_t i;
 
-    for (i = 0; i < nelems; i++) {
-        if (data[i] != missf) {
-            vmin = data[i] < vmin ? data[i] : vmin;
-            vmax = data[i] > vmax ? data[i] : vmax;
-        }
-    }
     if (vmin > vmax) {          /* no value */
         dma[0] = 0.;
         dma[1] = 0.;
@@ -60,29 +45,132 @@ get_ury_parameterf(double *dma,
 }
 
 
-static void
-get_ury_parameter(double *dma,
-                  const double *data, size_t nelems,
-                  double miss, unsigned nbits)
+/*
+ * ury_nbits() returns the smallest number of bits for URY/MRY
+ * (auto-scaling), with which the quantization error (a half of
+ * the scale) does not exceed 'bound' in all the z-planes.
+ * If 'relative', the bound is relative to the largest magnitude of
+ * values in each z-plane.
+ * If the bound cannot be met even with 31 bits, 0 is returned.
+ */
+unsigned
+ury_nbits(const void *ptr, size_t size, size_t zelem, size_t nz,
+          double miss, double bound, int relative)
 {
-    double vmin = HUGE_VAL, vmax = -HUGE_VAL;
-    int num = (1U << nbits) - 2;
+    double tol, dma[2];
+    unsigned nbits = 1;
+    vrange r;
     size_t i;
 
-    for (i = 0; i < nelems; i++) {
-        if (data[i] != miss) {
-            vmin = data[i] < vmin ? data[i] : vmin;
-            vmax = data[i] > vmax ? data[i] : vmax;
+    for (i = 0; i < nz; i++) {
+        get_vrange(&r, (const char *)ptr + i * zelem * size,
+                   size, zelem, miss, num_encode_threads());
+
+        if (r.vmin >= r.vmax)
+            continue;           /* no value or constant: exact */
+
+        tol = bound;
+        if (relative)
+            tol *= (fabs(r.vmin) > fabs(r.vmax)) ? fabs(r.vmin) : fabs(r.vmax);
+
+        for (;; nbits++) {
+            set_scaling(dma, r.vmin, r.vmax, nbits);
+            if (0.5 * dma[1] <= tol)
+                break;
+            if (nbits == 31)
+                return 0;
         }
     }
-    if (vmin > vmax) {          /* no value */
-        dma[0] = 0.;
-        dma[1] = 0.;
-    } else {
-        if (num < 1)
-            num = 1;
-        scaling_parameters(dma, vmin, vmax, num);
+    return nbits;
+}
+
+
+/*
+ * Parameters of a chunk to be encoded in URY/MRY, for each z-plane.
+ */
+struct ury_arg {
+    const void *ptr;
+    size_t size;                /* 4(float) or 8(double) */
+    size_t zelem;               /* # of elements in a z-plane */
+    double miss;
+    const double *params;       /* array [2 * nz] */
+    unsigned nbits;             /* # of bits (1 <= nbits <= 31) */
+    double *dma;                /* output of set_ury_parameter() */
+    const uint32_t *cnt;        /* # of non-missing values (MRY) */
+};
+
+#define URYBUFSIZ (8 * 1024)
+
+
+/*
+ * set_ury_parameter() determines the scaling parameters of the z-th
+ * plane (auto-scaling).
+ */
+static int
+set_ury_parameter(size_t z, void *ptr)
+{
+    const struct ury_arg *arg = ptr;
+    vrange r;
+
+    get_vrange(&r, (const char *)arg->ptr + z * arg->zelem * arg->size,
+               arg->size, arg->zelem, arg->miss, 1);
+    set_scaling(arg->dma + 2 * z, r.vmin, r.vmax, arg->nbits);
+    return 0;
+}
+
+
+static void
+set_ury_parameters(double *dma, const void *ptr, size_t size,
+                   size_t zelem, size_t nz, double miss, unsigned nbits)
+{
+    struct ury_arg arg;
+
+    arg.ptr = ptr;
+    arg.size = size;
+    arg.zelem = zelem;
+    arg.miss = miss;
+    arg.nbits = nbits;
+    arg.dma = dma;
+    parallel_for(num_encode_threads(), nz, set_ury_parameter, &arg);
+}
+
+
+/*
+ * encode_ury_plane() packs the z-th plane into 'buf'.
+ */
+static size_t
+encode_ury_plane(void *buf, void *work, size_t z, void *ptr)
+{
+    const struct ury_arg *arg = ptr;
+    uint32_t imiss = (1U << arg->nbits) - 1;
+    const double *params = arg->params + 2 * z;
+    const char *ptr2;
+    unsigned idata[URYBUFSIZ];
+    uint32_t *packed = buf;
+    size_t nelems, len, plen = 0;
+
+    assert(URYBUFSIZ % 32 == 0);
+
+    ptr2 = (const char *)arg->ptr + z * arg->zelem * arg->size;
+    for (nelems = arg->zelem; nelems > 0; nelems -= len) {
+        len = (nelems > URYBUFSIZ) ? URYBUFSIZ : nelems;
+
+        if (arg->size == 4)
+            scalingf(idata, (const float *)ptr2, len,
+                     params[0], params[1], imiss, arg->miss);
+        else
+            scaling(idata, (const double *)ptr2, len,
+                    params[0], params[1], imiss, arg->miss);
+
+        /* 'len' is a multiple of 32 except the last. */
+        plen += pack_bits_into32(packed + plen, idata, len, arg->nbits);
+        ptr2 += len * arg->size;
     }
+
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(packed, plen);
+
+    return 4 * plen;
 }
 
 
@@ -99,72 +187,33 @@ write_ury(const void *ptr,
           unsigned nbits,       /* # of bits (1 <= nbits <= 31) */
           FILE *fp)
 {
-    uint32_t imiss = (1U << nbits) - 1;
-    size_t i, packed_len, nelems, len, plen;
-    const char *ptr2;
-#define URYBUFSIZ (32 * 1024)
-    unsigned idata[URYBUFSIZ];
-    uint32_t packed[URYBUFSIZ];
-    int rval = -1;
-
-    assert(URYBUFSIZ % 32 == 0);
+    struct ury_arg arg;
+    size_t packed_len;
 
     /*
      * write scaling parameters
      */
     if (write_dwords_into_record(params, 2 * nz, fp) < 0)
-        goto finish;
+        return -1;
 
     packed_len = pack32_len(zelem, nbits);
 
     /* HEADER */
     if (write_record_sep((uint64_t)4 * packed_len * nz, fp) < 0)
-        goto finish;
+        return -1;
 
     /* BODY */
-    for (i = 0; i < nz; i++) {
-        ptr2 = (const char *)ptr + i * zelem * size;
-        nelems = zelem;
-
-        while (nelems > 0) {
-            len = (nelems > URYBUFSIZ) ? URYBUFSIZ : nelems;
-
-            if (size == 4)
-                scalingf(idata,
-                         (float *)ptr2,
-                         len,
-                         params[2*i], params[1+2*i],
-                         imiss, miss);
-            else
-                scaling(idata,
-                        (double *)ptr2,
-                        len,
-                        params[2*i], params[1+2*i],
-                        imiss, miss);
-
-            plen = pack_bits_into32(packed, idata, len, nbits);
-
-            if (IS_LITTLE_ENDIAN)
-                reverse_words(packed, plen);
-
-            if (fwrite(packed, 4, plen, fp) != plen) {
-                gt3_error(SYSERR, NULL);
-                goto finish;
-            }
-
-            ptr2 += len * size;
-            nelems -= len;
-        }
-    }
+    arg.ptr = ptr;
+    arg.size = size;
+    arg.zelem = zelem;
+    arg.miss = miss;
+    arg.params = params;
+    arg.nbits = nbits;
+    if (write_planes(nz, 4 * packed_len, 0, encode_ury_plane, &arg, fp) < 0)
+        return -1;
 
     /* TRAILER */
-    if (write_record_sep((uint64_t)4 * packed_len * nz, fp) < 0)
-        goto finish;
-
-    rval = 0;
-
-finish:
-    return rval;
+    return write_record_sep((uint64_t)4 * packed_len * nz, fp);
 }
 
 
@@ -181,7 +230,6 @@ write_ury_auto(const void *ptr,
 {
     double dma_buf[256];
     double *dma = dma_buf;
-    size_t i;
     int rval;
 
     if ((dma = tiny_alloc(dma_buf,
@@ -194,21 +242,7 @@ write_ury_auto(const void *ptr,
     /*
      * determine scaling parameters (auto-scaling).
      */
-    if (size == 4) {
-        const float *data = ptr;
-
-        for (i = 0; i < nz; i++)
-            get_ury_parameterf(dma + 2 * i,
-                               data + i * zelem,
-                               zelem, miss, nbits);
-    } else {
-        const double *data = ptr;
-
-        for (i = 0; i < nz; i++)
-            get_ury_parameter(dma + 2 * i,
-                              data + i * zelem,
-                              zelem, miss, nbits);
-    }
+    set_ury_parameters(dma, ptr, size, zelem, nz, miss, nbits);
 
     rval = write_ury(ptr, size, zelem, nz, miss, dma, nbits, fp);
 
@@ -255,6 +289,38 @@ write_ury_manual(const void *ptr,
 }
 
 
+/*
+ * encode_mry_plane() packs non-missing values of the z-th plane into
+ * 'buf', using 'work' for cnt[z] integers.
+ */
+static size_t
+encode_mry_plane(void *buf, void *work, size_t z, void *ptr)
+{
+    const struct ury_arg *arg = ptr;
+    uint32_t imiss = (1U << arg->nbits) - 1;
+    const double *params = arg->params + 2 * z;
+    const char *ptr2;
+    unsigned *idata = work;
+    uint32_t *packed = buf;
+    size_t ncopied, len;
+
+    ptr2 = (const char *)arg->ptr + z * arg->zelem * arg->size;
+    if (arg->size == 4)
+        ncopied = masked_scalingf(idata, (const float *)ptr2, arg->zelem,
+                                  params[0], params[1], imiss, arg->miss);
+    else
+        ncopied = masked_scaling(idata, (const double *)ptr2, arg->zelem,
+                                 params[0], params[1], imiss, arg->miss);
+
+    assert(ncopied == arg->cnt[z]);
+    len = pack_bits_into32(packed, idata, ncopied, arg->nbits);
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(packed, len);
+
+    return 4 * len;
+}
+
+
 /*
  * write data in MRY format.
  * bitpacking with missing mask.
@@ -277,7 +343,7 @@ write_mry(const void *ptr2,
     uint32_t *plen = plen_buf;
     uint64_t plen_all = 0;
     uint32_t plen_a;
-    unsigned imiss = (1U << nbits) - 1;
+    struct ury_arg arg;
     int rval = -1;
     size_t i;
 
@@ -324,55 +390,18 @@ write_mry(const void *ptr2,
         goto finish;
 
     /* BODY */
-    {
-        size_t ncopied, len;
-        unsigned idata_buf[32 * 1024];
-        uint32_t packed_buf[32 * 1024];
-        unsigned *idata = idata_buf;
-        uint32_t *packed = packed_buf;
-
-        if ((idata = tiny_alloc(
-                 idata_buf,
-                 sizeof idata_buf,
-                 sizeof(unsigned) * maxval_uint32(cnt, nz))) == NULL
-            || (packed = tiny_alloc(
-                    packed_buf,
-                    sizeof packed_buf,
-                    sizeof(uint32_t) * maxval_uint32(plen, nz))) == NULL) {
-
-            tiny_free(idata, idata_buf);
-            tiny_free(packed, packed_buf);
-            goto finish;
-        }
-
-        for (i = 0; i < nz; i++) {
-            ptr = (const char *)ptr2 + i * zelems * size;
-
-            if (size == 4)
-                ncopied = masked_scalingf(idata,
-                                          (float *)ptr,
-                                          zelems,
-                                          params[2*i], params[1+2*i],
-                                          imiss, miss);
-            else
-                ncopied = masked_scaling(idata,
-                                         (double *)ptr,
-                                         zelems,
-                                         params[2*i], params[1+2*i],
-                                         imiss, miss);
-
-            assert(ncopied == cnt[i]);
-            len = pack_bits_into32(packed, idata, ncopied, nbits);
-            if (IS_LITTLE_ENDIAN)
-                reverse_words(packed, len);
-
-            if (fwrite(packed, 4, len, fp) != len)
-                goto finish;
-        }
-
-        tiny_free(idata, idata_buf);
-        tiny_free(packed, packed_buf);
-    }
+    arg.ptr = ptr2;
+    arg.size = size;
+    arg.zelem = zelems;
+    arg.miss = miss;
+    arg.params = params;
+    arg.nbits = nbits;
+    arg.cnt = cnt;
+    if (write_planes(nz,
+                     sizeof(uint32_t) * maxval_uint32(plen, nz),
+                     sizeof(unsigned) * maxval_uint32(cnt, nz),
+                     encode_mry_plane, &arg, fp) < 0)
+        goto finish;
 
     /* TRAILER */
     if (write_record_sep(4 * plen_all, fp) < 0)
@@ -397,7 +426,6 @@ write_mry_auto(const void *ptr,
 {
     double dma_buf[256];
     double *dma = dma_buf;
-    size_t i;
     int rval;
 
     if ((dma = tiny_alloc(dma_buf,
@@ -410,19 +438,7 @@ write_mry_auto(const void *ptr,
     /*
      * determine scaling parameters (auto-scaling).
      */
-    if (size == 4) {
-        const float *data = ptr;
-
-        for (i = 0; i < nz; i++)
-            get_ury_parameterf(dma + 2 * i, data + i * zelems,
-                               zelems, miss, nbits);
-    } else {
-        const double *data = ptr;
-
-        for (i = 0; i < nz; i++)
-            get_ury_parameter(dma + 2 * i, data + i * zelems,
-                              zelems, miss, nbits);
-    }
+    set_ury_parameters(dma, ptr, size, zelems, nz, miss, nbits);
 
     rval = write_mry(ptr, size, zelems, nz, miss, dma, nbits, fp);
 
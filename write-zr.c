@@ -0,0 +1,164 @@
+/*
+ * write-zr.c  -- writing data in ZR4/ZR8 (lossless).
+ */
+#include "internal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gtool3.h"
+#include "talloc.h"
+
+#include "write-fmt.h"
+
+
+struct zr_arg {
+    const void *ptr;
+    size_t size;                /* 4(float) or 8(double) */
+    size_t width;               /* 4(ZR4) or 8(ZR8) */
+    size_t zelem;               /* # of elements in a z-plane */
+    size_t ntab;                /* # of blocks in a z-plane */
+    unsigned char *nbits;       /* nbits of blocks [nz * ntab] */
+    uint32_t *plen;             /* packed length [nz] */
+};
+
+
+/*
+ * the first pass: determine nbits of each block and the packed length
+ * of a z-plane.
+ */
+static int
+measure_zr_plane(size_t z, void *ptr)
+{
+    struct zr_arg *arg = ptr;
+    unsigned char *bytes;
+
+    if ((bytes = malloc(arg->width * arg->zelem)) == NULL)
+        return -1;
+
+    zr_shuffle(bytes,
+               (const char *)arg->ptr + z * arg->zelem * arg->size,
+               arg->size, arg->width, arg->zelem);
+    zr_delta(bytes, arg->zelem, arg->width);
+    arg->plen[z] = (uint32_t)zr_packed_len(arg->nbits + z * arg->ntab,
+                                           bytes, arg->zelem, arg->width);
+    free(bytes);
+    return 0;
+}
+
+
+/*
+ * the second pass: pack a z-plane (cf. write_planes()).
+ */
+static size_t
+encode_zr_plane(void *buf, void *work, size_t z, void *ptr)
+{
+    struct zr_arg *arg = ptr;
+    uint32_t *packed = buf;
+    unsigned char *bytes = work;
+    size_t len;
+
+    zr_shuffle(bytes,
+               (const char *)arg->ptr + z * arg->zelem * arg->size,
+               arg->size, arg->width, arg->zelem);
+    zr_delta(bytes, arg->zelem, arg->width);
+    len = zr_pack(packed, bytes, arg->nbits + z * arg->ntab,
+                  arg->zelem, arg->width);
+    assert(len == arg->plen[z]);
+
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(packed, len);
+
+    return 4 * len;
+}
+
+
+static int
+write_zr(const void *ptr, size_t size, size_t width,
+         size_t zelem, size_t nz, FILE *fp)
+{
+    uint32_t plen_buf[128];
+    uint32_t *plen = plen_buf;
+    uint64_t plen_all = 0;
+    uint32_t plen_a, plen_max = 0;
+    struct zr_arg arg;
+    int rval = -1;
+    size_t i;
+
+    arg.ptr = ptr;
+    arg.size = size;
+    arg.width = width;
+    arg.zelem = zelem;
+    arg.ntab = width * zr_nblocks(zelem);
+    arg.nbits = NULL;
+
+    if (zr_maxlen(zelem, width) > 0xffffffffU) {
+        gt3_error(GT3_ERR_TOOLONG, "Use %s", width == 4 ? "UR4" : "UR8");
+        return -1;
+    }
+    if ((plen = tiny_alloc(plen_buf,
+                           sizeof plen_buf,
+                           sizeof(uint32_t) * nz)) == NULL
+        || (arg.nbits = malloc(arg.ntab * nz)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        goto finish;
+    }
+    arg.plen = plen;
+
+    if (parallel_for(num_encode_threads(), nz, measure_zr_plane, &arg) < 0) {
+        gt3_error(SYSERR, NULL);
+        goto finish;
+    }
+
+    for (i = 0; i < nz; i++) {
+        plen_all += plen[i];
+        if (plen[i] > plen_max)
+            plen_max = plen[i];
+    }
+    if (4 * plen_all > 0xffffffffU) {
+        gt3_error(GT3_ERR_TOOLONG, "Use %s", width == 4 ? "UR4" : "UR8");
+        goto finish;
+    }
+    plen_a = (uint32_t)plen_all;
+
+    if (write_words_into_record(&plen_a, 1, fp) < 0
+        || write_words_into_record(plen, nz, fp) < 0)
+        goto finish;
+
+    /* HEADER */
+    if (write_record_sep(4 * plen_all, fp) < 0)
+        goto finish;
+
+    /* BODY */
+    if (write_planes(nz, sizeof(uint32_t) * plen_max, width * zelem,
+                     encode_zr_plane, &arg, fp) < 0)
+        goto finish;
+
+    /* TRAILER */
+    if (write_record_sep(4 * plen_all, fp) < 0)
+        goto finish;
+
+    rval = 0;
+
+finish:
+    free(arg.nbits);
+    tiny_free(plen, plen_buf);
+    return rval;
+}
+
+
+int
+write_zr_via_double(const void *ptr, size_t zelem, size_t nz,
+                    size_t width, FILE *fp)
+{
+    return write_zr(ptr, 8, width, zelem, nz, fp);
+}
+
+
+int
+write_zr_via_float(const void *ptr, size_t zelem, size_t nz,
+                   size_t width, FILE *fp)
+{
+    return write_zr(ptr, 4, width, zelem, nz, fp);
+}
@@ -22,6 +22,113 @@
 typedef void (*PACKING_FUNC)(uint32_t *, const float *, int, double,
                              double, double, double);
 
+/*
+ * The number of threads to encode z-planes (URC, URY, MRY, and ZR).
+ */
+static int encode_threads = 1;
+
+
+/*
+ * GT3_setEncodeThreads() sets the number of threads to encode
+ * z-planes concurrently in GT3_write() and its relatives.
+ * If 'nthreads' is 0 (or less), the number of online processors is used.
+ * The output is identical regardless of the number.
+ *
+ * This setting is process-wide. Set it before starting threads.
+ */
+void
+GT3_setEncodeThreads(int nthreads)
+{
+    encode_threads = (nthreads > 0) ? nthreads : num_processors();
+}
+
+
+int
+num_encode_threads(void)
+{
+    return encode_threads;
+}
+
+
+struct plane_batch {
+    ENCODE_FUNC encode;
+    void *arg;
+    char *buf;                  /* slots of the planes in a batch */
+    size_t slotsize;
+    size_t worksize;
+    size_t zstart;
+    size_t *len;                /* encoded lengths */
+};
+
+
+static int
+encode_plane(size_t i, void *ptr)
+{
+    struct plane_batch *b = ptr;
+    char *slot = b->buf + i * b->slotsize;
+    char *work = slot + (b->slotsize - b->worksize);
+
+    b->len[i] = b->encode(slot, work, b->zstart + i, b->arg);
+    return 0;
+}
+
+
+/*
+ * write_planes() writes 'nz' z-planes in order, which are encoded by
+ * encode(buf, work, z, arg) into 'buf' (up to 'bufsize' bytes) using
+ * 'work' ('worksize' bytes) as scratch space.
+ * encode() returns the length to write, and it must not fail.
+ *
+ * Planes are encoded in batches, concurrently with multiple threads
+ * (cf. GT3_setEncodeThreads()).
+ */
+int
+write_planes(size_t nz, size_t bufsize, size_t worksize,
+             ENCODE_FUNC encode, void *arg, FILE *fp)
+{
+    struct plane_batch b;
+    size_t nbatch, n, i;
+    int nthreads = encode_threads;
+    int rval = -1;
+
+    nbatch = (nthreads > 1) ? 2 * (size_t)nthreads : 1;
+    if (nbatch > nz)
+        nbatch = nz;
+
+    b.encode = encode;
+    b.arg = arg;
+    b.worksize = (worksize + 7) & ~(size_t)7;
+    b.slotsize = ((bufsize + 7) & ~(size_t)7) + b.worksize;
+    if (b.slotsize == 0)
+        b.slotsize = 8;         /* not to call malloc(0) */
+    b.buf = malloc(b.slotsize * nbatch);
+    b.len = malloc(sizeof(size_t) * nbatch);
+    if (b.buf == NULL || b.len == NULL) {
+        gt3_error(SYSERR, NULL);
+        goto finish;
+    }
+
+    for (b.zstart = 0; b.zstart < nz; b.zstart += n) {
+        n = (nz - b.zstart > nbatch) ? nbatch : nz - b.zstart;
+
+        parallel_for(nthreads, n, encode_plane, &b);
+
+        for (i = 0; i < n; i++)
+            if (fwrite(b.buf + i * b.slotsize, 1, b.len[i], fp)
+                != b.len[i]) {
+                gt3_error(SYSERR, NULL);
+                goto finish;
+            }
+    }
+    rval = 0;
+
+finish:
+    free(b.len);
+    free(b.buf);
+    return rval;
+}
+
+
 
 static int
 write_ur4_via_double(const double *data, size_t nelems, FILE *fp)
@@ -109,21 +216,66 @@ write_ur8_via_float(const float *data, size_t nelems, FILE *fp)
 }
 
 
-static int
-write_urc_zslice(const float *data, size_t len, double miss,
-                 PACKING_FUNC packing, FILE *fp)
+/*
+ * put_record_sep() is write_record_sep() into memory.
+ */
+static void
+put_record_sep(unsigned char *dest, uint64_t size0)
 {
+    fort_size_t size;
+
+    size = (size0 > 0xffffffffU) ? 0xffffffffU : size0;
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(&size, 1);
+    memcpy(dest, &size, 4);
+}
+
+
+struct urc_arg {
+    const void *ptr;
+    size_t size;                /* 4(float) or 8(double) */
+    size_t len;                 /* # of elements in a z-slice */
+    double miss;
+    PACKING_FUNC packing;
+};
+
+/*
+ * the size of buffer for encode_urc_zslice().
+ * (the last word of packed data might be half-used.)
+ */
+#define URC_BUFSIZE(len) (40 + 4 + 4 * (((len) + 1) / 2) + 4)
+
+
+/*
+ * encode_urc_zslice() encodes the z-th slice in URC: three packing
+ * parameters (REF, ND, and NE) and packed data, with the record
+ * separators.  Returns the length in bytes.
+ */
+static size_t
+encode_urc_zslice(void *buf, void *work, size_t z, void *ptr)
+{
+    const struct urc_arg *arg = ptr;
+    unsigned char *parambuf = buf;
     char siz4[] = { 0, 0, 0, 4 };
     char siz8[] = { 0, 0, 0, 8 };
-    uint64_t siz;
-    uint32_t packed[8192];
-    unsigned char parambuf[8 + 4 + 4 + 3 * 2 * 4];
+    const float *data;
+    uint32_t *packed;
     double rmin, ref, fac_e, fac_d;
     int ne, nd;
-    int len_pack;
-    int maxelem;
+    size_t len = arg->len, len_pack, n;
 
-    calc_urc_param(data, len, miss, &rmin, &fac_e, &fac_d, &ne, &nd);
+    if (arg->size == 4)
+        data = (const float *)arg->ptr + z * len;
+    else {
+        const double *input = (const double *)arg->ptr + z * len;
+        float *copied = work;
+
+        for (n = 0; n < len; n++)
+            copied[n] = (float)input[n];
+        data = copied;
+    }
+
+    calc_urc_param(data, len, arg->miss, &rmin, &fac_e, &fac_d, &ne, &nd);
 
     /*
      * three packing parameters (REF, ND, and NE)
@@ -144,46 +296,44 @@ write_urc_zslice(const float *data, size_t len, double miss,
         memcpy(parambuf + 20, &nd,  4);
         memcpy(parambuf + 32, &ne,  4);
     }
-    if (fwrite(parambuf, 1, sizeof parambuf, fp) != sizeof parambuf) {
-        gt3_error(SYSERR, NULL);
-        return -1;
-    }
 
     /* HEADER */
-    siz = 2 * len;
-    if (write_record_sep(siz, fp) < 0)
-        return -1;
+    put_record_sep(parambuf + 40, (uint64_t)2 * len);
 
     /*
-     * data body
+     * data body (2-byte packing)
      */
-    maxelem = sizeof packed / 2;
-    while (len > 0) {
-        len_pack = (len > maxelem) ? maxelem : len;
+    packed = (uint32_t *)(parambuf + 44);
+    for (n = 0; n < len; n += len_pack) {
+        len_pack = (len - n > 8192) ? 8192 : len - n;
 
-        /*
-         * 2-byte packing
-         */
-        packing(packed, data, len_pack, miss, rmin, fac_e, fac_d);
+        arg->packing(packed + n / 2, data + n, (int)len_pack, arg->miss,
+                     rmin, fac_e, fac_d);
+    }
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(packed, (len + 1) / 2);
 
-        if (IS_LITTLE_ENDIAN)
-            reverse_words(packed, (len_pack + 1) / 2);
+    /* TRAILER */
+    put_record_sep(parambuf + 44 + 2 * len, (uint64_t)2 * len);
 
-        /* write packed data */
-        if (fwrite(packed, 2, len_pack, fp) != len_pack) {
-            gt3_error(SYSERR, NULL);
-            return -1;
-        }
+    return 40 + 4 + 2 * len + 4;
+}
 
-        data += len_pack;
-        len -= len_pack;
-    }
 
-    /* TRAILER */
-    if (write_record_sep(siz, fp) < 0)
-        return -1;
+static int
+write_urc(const void *ptr, size_t size, size_t len, int nz, double miss,
+          PACKING_FUNC packing, FILE *fp)
+{
+    struct urc_arg arg;
 
-    return 0;
+    arg.ptr = ptr;
+    arg.size = size;
+    arg.len = len;
+    arg.miss = miss;
+    arg.packing = packing;
+
+    return write_planes(nz, URC_BUFSIZE(len), size == 8 ? 4 * len : 0,
+                        encode_urc_zslice, &arg, fp);
 }
 
 
@@ -191,13 +341,7 @@ static int
 write_urc_via_float(const float *data, size_t len, int nz, double miss,
                     PACKING_FUNC packing, FILE *fp)
 {
-    int i;
-
-    for (i = 0; i < nz; i++) {
-        write_urc_zslice(data, len, miss, packing, fp);
-        data += len;
-    }
-    return 0;
+    return write_urc(data, 4, len, nz, miss, packing, fp);
 }
 
 
@@ -205,33 +349,61 @@ static int
 write_urc_via_double(const double *input, size_t len, int nz, double miss,
                      PACKING_FUNC packing, FILE *fp)
 {
-    int i;
-    size_t n;
-    float *data;
+    return write_urc(input, 8, len, nz, miss, packing, fp);
+}
 
-    if ((data = malloc(sizeof(float) * len)) == NULL) {
-        gt3_error(SYSERR, NULL);
+
+/*
+ * parse_bound() parses an error-bounded format of URY or MRY:
+ * "URY:tol=X" (absolute error) or "URY:rel=X" (relative error),
+ * case-insensitive.  It returns the format id (with nbits = 0).
+ */
+static int
+parse_bound(double *bound, int *relative, const char *str)
+{
+    char *endptr;
+    int fmt;
+
+    if (strncasecmp(str, "URY:", 4) == 0)
+        fmt = GT3_FMT_URY;
+    else if (strncasecmp(str, "MRY:", 4) == 0)
+        fmt = GT3_FMT_MRY;
+    else
         return -1;
-    }
-    for (i = 0; i < nz; i++) {
-        for (n = 0; n < len; n++)
-            data[n] = (float)input[n];
 
-        write_urc_zslice(data, len, miss, packing, fp);
-        input += len;
-    }
-    free(data);
-    return 0;
+    str += 4;
+    if (strncasecmp(str, "tol=", 4) == 0)
+        *relative = 0;
+    else if (strncasecmp(str, "rel=", 4) == 0)
+        *relative = 1;
+    else
+        return -1;
+
+    str += 4;
+    *bound = strtod(str, &endptr);
+    if (endptr == str || *endptr != '\0' || !(*bound > 0.))
+        return -1;
+
+    return fmt;
 }
 
 
 /*
  * GT3_output_format() gives actual output format from user-specified name.
+ *
+ * For an error-bounded format ("URY:tol=X", etc.), nbits is not
+ * determined yet, and 'dfmt' is "URY" or "MRY" (cf. GT3_chooseFormat()).
  */
 int
 GT3_output_format(char *dfmt, const char *str)
 {
-    int fmt;
+    double bound;
+    int fmt, relative;
+
+    if ((fmt = parse_bound(&bound, &relative, str)) >= 0) {
+        strcpy(dfmt, fmt == GT3_FMT_URY ? "URY" : "MRY");
+        return fmt;
+    }
 
     if (strcmp(str, "URC1") == 0)
         fmt = GT3_FMT_URC1;     /* deprecated format */
@@ -251,6 +423,46 @@ GT3_output_format(char *dfmt, const char *str)
 }
 
 
+/*
+ * GT3_chooseFormat() is GT3_output_format() for the data to be written.
+ *
+ * For an error-bounded format, "URY:tol=X" or "MRY:tol=X", the smallest
+ * nbits is chosen so that the quantization error does not exceed X
+ * in all the z-planes.  "URY:rel=X" or "MRY:rel=X" bounds the error
+ * relative to the largest magnitude of values in each z-plane.
+ * The chosen format (e.g., "URY12") is stored in 'dfmt'.
+ *
+ * If the bound cannot be met even with 31 bits, the data are written
+ * without loss instead: UR8 or MR8 (UR4 or MR4 for float data).
+ * The caller can tell it by the returned format (or 'dfmt').
+ */
+int
+GT3_chooseFormat(char *dfmt, const char *str,
+                 const void *ptr, int type, int nx, int ny, int nz,
+                 double miss)
+{
+    double bound;
+    int fmt, relative;
+    unsigned nbits;
+
+    if ((fmt = parse_bound(&bound, &relative, str)) < 0)
+        return GT3_output_format(dfmt, str);
+
+    nbits = ury_nbits(ptr, type == GT3_TYPE_FLOAT ? 4 : 8,
+                      (size_t)nx * ny, nz, miss, bound, relative);
+    if (nbits == 0) {
+        /* lossless fallback */
+        if (fmt == GT3_FMT_URY)
+            fmt = type == GT3_TYPE_FLOAT ? GT3_FMT_UR4 : GT3_FMT_UR8;
+        else
+            fmt = type == GT3_TYPE_FLOAT ? GT3_FMT_MR4 : GT3_FMT_MR8;
+    } else
+        fmt |= nbits << GT3_FMT_MBIT;
+    GT3_format_string(dfmt, fmt);
+    return fmt;
+}
+
+
 /*
  * GT3_write() writes data into a stream.
  *
@@ -261,11 +473,30 @@ GT3_output_format(char *dfmt, const char *str)
  *  nz:     data length for Z-dimension.
  *  headin: a pointer to header.
  *  dfmt:   format name (if NULL is specified, UR4 or UR8  is selected)
+ *          or an error-bounded format (cf. GT3_chooseFormat()).
+ *
+ * The stream is flushed at the end (use GT3_Writer not to flush).
  */
 int
 GT3_write(const void *ptr, int type,
           int nx, int ny, int nz,
           const GT3_HEADER *headin, const char *dfmt, FILE *fp)
+{
+    int rval;
+
+    rval = write_chunk(ptr, type, nx, ny, nz, headin, dfmt, fp);
+    fflush(fp);
+    return rval;
+}
+
+
+/*
+ * write_chunk() is GT3_write() without flushing the stream.
+ */
+int
+write_chunk(const void *ptr, int type,
+            int nx, int ny, int nz,
+            const GT3_HEADER *headin, const char *dfmt, FILE *fp)
 {
     char fmtstr[17];
     const char *astr[] = { "ASTR1", "ASTR2", "ASTR3" };
@@ -295,6 +526,8 @@ GT3_write(const void *ptr, int type,
         return -1;
     }
 
+    GT3_decodeHeaderDouble(&miss, headin, "MISS");
+
     if (!dfmt) {
         if (type == GT3_TYPE_FLOAT) {
             fmt = GT3_FMT_UR4;
@@ -304,7 +537,8 @@ GT3_write(const void *ptr, int type,
             strcpy(fmtstr, "UR8");
         }
     } else
-        if ((fmt = GT3_output_format(fmtstr, dfmt)) < 0) {
+        if ((fmt = GT3_chooseFormat(fmtstr, dfmt, ptr, type,
+                                    nx, ny, nz, miss)) < 0) {
             gt3_error(GT3_ERR_CALL,
                       "GT3_write(): \"%s\" unknown format", dfmt);
             return -1;
@@ -344,7 +578,6 @@ GT3_write(const void *ptr, int type,
      */
     zsize = nx * ny;
     asize = zsize * nz;
-    GT3_decodeHeaderDouble(&miss, &head, "MISS");
     nbits = (unsigned)fmt >> GT3_FMT_MBIT;
 
     if (type == GT3_TYPE_DOUBLE)
@@ -381,6 +614,12 @@ GT3_write(const void *ptr, int type,
         case GT3_FMT_MRY:
             rval = write_mry_via_double(ptr, zsize, nz, nbits, miss, fp);
             break;
+        case GT3_FMT_ZR4:
+            rval = write_zr_via_double(ptr, zsize, nz, 4, fp);
+            break;
+        case GT3_FMT_ZR8:
+            rval = write_zr_via_double(ptr, zsize, nz, 8, fp);
+            break;
         }
     else
         switch (fmt & GT3_FMT_MASK) {
@@ -416,9 +655,14 @@ GT3_write(const void *ptr, int type,
         case GT3_FMT_MRY:
             rval = write_mry_via_float(ptr, zsize, nz, nbits, miss, fp);
             break;
+        case GT3_FMT_ZR4:
+            rval = write_zr_via_float(ptr, zsize, nz, 4, fp);
+            break;
+        case GT3_FMT_ZR8:
+            rval = write_zr_via_float(ptr, zsize, nz, 8, fp);
+            break;
         }
 
-    fflush(fp);
     return rval;
 }
 
@@ -521,6 +765,435 @@ GT3_write_bitpack(const void *ptr, int type,
 
 
 #ifdef TEST_MAIN
+#include <math.h>
+
+/*
+ * write a chunk into a temporary file, and return its contents.
+ */
+static char *
+write_tmp(size_t *len, const void *ptr, int type, int nz, const char *dfmt)
+{
+    GT3_HEADER head;
+    FILE *fp;
+    char *buf;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+
+    fp = tmpfile();
+    assert(fp);
+    assert(GT3_write(ptr, type, 37, 11, nz, &head, dfmt, fp) == 0);
+    *len = (size_t)ftell(fp);
+    buf = malloc(*len);
+    assert(buf);
+    rewind(fp);
+    assert(fread(buf, 1, *len, fp) == *len);
+    fclose(fp);
+    return buf;
+}
+
+
+/*
+ * the output must not depend on the number of encoding threads.
+ */
+void
+test_threads(void)
+{
+    const char *fmts[] = {
+        "URC", "URC1", "URY16", "MRY12", "MRY3", "ZR4", "ZR8"
+    };
+    double data[37 * 11 * 23];
+    float dataf[37 * 11 * 23];
+    char *buf1, *buf2;
+    size_t len1, len2;
+    int i, type, nth, nz;
+
+    for (i = 0; i < 37 * 11 * 23; i++) {
+        data[i] = (i % 5 == 0) ? -999. : (i % 37) * 0.5 - i * 1e-3;
+        dataf[i] = (float)data[i];
+    }
+    /* all missing in the 3rd plane */
+    for (i = 37 * 11 * 2; i < 37 * 11 * 3; i++)
+        data[i] = dataf[i] = -999.f;
+
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++)
+        for (type = 0; type < 2; type++)
+            for (nz = 1; nz < 24; nz += 11) {
+                const void *ptr = type ? (void *)dataf : (void *)data;
+                int dtype = type ? GT3_TYPE_FLOAT : GT3_TYPE_DOUBLE;
+
+                GT3_setEncodeThreads(1);
+                buf1 = write_tmp(&len1, ptr, dtype, nz, fmts[i]);
+                for (nth = 2; nth < 6; nth += 3) {
+                    GT3_setEncodeThreads(nth);
+                    buf2 = write_tmp(&len2, ptr, dtype, nz, fmts[i]);
+                    assert(len1 == len2);
+                    assert(memcmp(buf1, buf2, len1) == 0);
+                    free(buf2);
+                }
+                free(buf1);
+            }
+    GT3_setEncodeThreads(1);
+}
+
+
+/*
+ * error-bounded URY/MRY.
+ */
+void
+test_bound(void)
+{
+    const char *path = "write-test.gt";
+    const char *fmts[] = {
+        "URY:tol=0.01", "mry:TOL=0.01", "URY:rel=1e-4", "MRY:tol=1e-12"
+    };
+    double bounds[] = { 0.01, 0.01, 0.01, 0. }; /* max. magnitude < 100 */
+    double data[50 * 3], value;
+    float dataf[50];
+    GT3_HEADER head;
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    FILE *output;
+    char dfmt[17];
+    int i, n, z, fmt;
+
+    for (i = 0; i < 50 * 3; i++)
+        data[i] = (i % 13 == 0) ? -999. : 2. * (i % 50) + 0.001 * i;
+
+    /* [0, 100]: 2**13 - 2 >= 100 / (2 * 0.01) */
+    fmt = GT3_chooseFormat(dfmt, "URY:tol=0.01", data, GT3_TYPE_DOUBLE,
+                           50, 1, 1, -999.);
+    assert(fmt == (GT3_FMT_URY | 13 << GT3_FMT_MBIT));
+    assert(strcmp(dfmt, "URY13") == 0);
+
+    fmt = GT3_chooseFormat(dfmt, "MRY:rel=0.01", data, GT3_TYPE_DOUBLE,
+                           50, 1, 1, -999.);
+    assert(fmt == (GT3_FMT_MRY | 6 << GT3_FMT_MBIT));
+
+    fmt = GT3_chooseFormat(dfmt, "UR4", data, GT3_TYPE_DOUBLE,
+                           50, 1, 1, -999.);
+    assert(fmt == GT3_FMT_UR4);
+
+    /* [2, 98]: 2**31 - 2 < 96 / (2 * 1e-9): lossless fallback */
+    fmt = GT3_chooseFormat(dfmt, "URY:tol=1e-9", data, GT3_TYPE_DOUBLE,
+                           50, 1, 1, -999.);
+    assert(fmt == GT3_FMT_UR8 && strcmp(dfmt, "UR8") == 0);
+    fmt = GT3_chooseFormat(dfmt, "MRY:rel=1e-12", data, GT3_TYPE_DOUBLE,
+                           50, 1, 3, -999.);
+    assert(fmt == GT3_FMT_MR8 && strcmp(dfmt, "MR8") == 0);
+    for (i = 0; i < 50; i++)
+        dataf[i] = (float)data[i];
+    fmt = GT3_chooseFormat(dfmt, "URY:tol=1e-9", dataf, GT3_TYPE_FLOAT,
+                           50, 1, 1, -999.);
+    assert(fmt == GT3_FMT_UR4);
+    fmt = GT3_chooseFormat(dfmt, "MRY:tol=1e-9", dataf, GT3_TYPE_FLOAT,
+                           50, 1, 1, -999.);
+    assert(fmt == GT3_FMT_MR4);
+
+    /* 2**29 - 2 >= 96 / (2 * 1e-7) > 2**28 - 2 */
+    fmt = GT3_chooseFormat(dfmt, "URY:tol=1e-7", data, GT3_TYPE_DOUBLE,
+                           50, 1, 1, -999.);
+    assert(fmt == (GT3_FMT_URY | 29 << GT3_FMT_MBIT));
+
+    assert(GT3_output_format(dfmt, "URY:tol=1e-3") == GT3_FMT_URY);
+    assert(GT3_output_format(dfmt, "URY:tol=") < 0);
+    assert(GT3_output_format(dfmt, "URY:tol=-1") < 0);
+    assert(GT3_output_format(dfmt, "URY:abs=1") < 0);
+
+    /*
+     * the error must not exceed the bound.
+     */
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++)
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 50, 1, 3,
+                         &head, fmts[i], output) == 0);
+    fclose(output);
+
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++) {
+        for (z = 0; z < 3; z++) {
+            assert(GT3_readVarZ(var, z) == 0);
+            for (n = 0; n < 50; n++) {
+                double x = data[n + 50 * z];
+
+                assert(GT3_readVar(&value, var, n, 0, z) == 0);
+                if (x == -999.)
+                    assert(value == -999.);
+                else
+                    assert(fabs(value - x) <= bounds[i] + 1e-12);
+            }
+        }
+        GT3_next(fp);
+    }
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    remove(path);
+}
+
+
+/*
+ * ZR4 and ZR8 are lossless.
+ */
+void
+test_zr(void)
+{
+    const char *path = "write-test.gt";
+    double data[37 * 11 * 5], value;
+    float dataf[37 * 11 * 5];
+    GT3_HEADER head;
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    FILE *output;
+    size_t len, rawlen;
+    char *buf;
+    int c, i, n, z;
+
+    for (i = 0; i < 37 * 11 * 5; i++) {
+        data[i] = 280. + 10. * sin(0.01 * i) + 1e-9 * (i % 7);
+        dataf[i] = (float)data[i];
+    }
+    data[100] = dataf[100] = -999.f;
+    for (i = 37 * 11 * 2; i < 37 * 11 * 3; i++)
+        data[i] = dataf[i] = 0.f;
+
+    /* smooth data are compressed. */
+    /* smooth data are compressed (the noise of 'data' limits ZR8). */
+    buf = write_tmp(&len, dataf, GT3_TYPE_FLOAT, 5, "ZR4");
+    free(buf);
+    buf = write_tmp(&rawlen, dataf, GT3_TYPE_FLOAT, 5, "UR4");
+    free(buf);
+    assert(len < rawlen / 1.5);
+    buf = write_tmp(&len, data, GT3_TYPE_DOUBLE, 5, "ZR8");
+    free(buf);
+    buf = write_tmp(&rawlen, data, GT3_TYPE_DOUBLE, 5, "UR8");
+    free(buf);
+    assert(len < rawlen * 0.75);
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    assert(GT3_write(dataf, GT3_TYPE_FLOAT, 37, 11, 5,
+                     &head, "ZR4", output) == 0);
+    assert(GT3_write(data, GT3_TYPE_DOUBLE, 37, 11, 5,
+                     &head, "ZR8", output) == 0);
+    assert(GT3_write(data, GT3_TYPE_DOUBLE, 37, 11, 5,
+                     &head, "ZR4", output) == 0);
+    assert(GT3_write(dataf, GT3_TYPE_FLOAT, 37, 11, 5,
+                     &head, "UR4", output) == 0);
+    fclose(output);
+
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    for (i = 0; i < 3; i++) {
+        assert(fp->fmt == (i == 1 ? GT3_FMT_ZR8 : GT3_FMT_ZR4));
+
+        for (z = 4; z >= 0; z--) {
+            assert(GT3_readVarZ(var, z) == 0);
+            for (n = 0; n < 37 * 11; n++) {
+                assert(GT3_readVar(&value, var, n % 37, n / 37, z) == 0);
+                if (i == 1)
+                    assert(value == data[n + 37 * 11 * z]);
+                else
+                    assert(value == dataf[n + 37 * 11 * z]);
+            }
+        }
+        GT3_next(fp);
+    }
+    assert(fp->fmt == GT3_FMT_UR4);
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+
+    /*
+     * IZLEN[4] of the 1st chunk is broken: the last z-plane exceeds
+     * NNN (into the next chunk).
+     * (header: 4 + 1024 + 4 bytes, NNN: 4 + 4 + 4 bytes)
+     */
+    output = fopen(path, "r+b");
+    assert(output);
+    assert(fseek(output, 1032 + 12 + 4 + 4 * 4 + 2, SEEK_SET) == 0);
+    c = fgetc(output);
+    assert(fseek(output, -1, SEEK_CUR) == 0);
+    assert(fputc(c + 1, output) != EOF);
+    fclose(output);
+
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    assert(GT3_readVarZ(var, 3) == 0);
+    assert(GT3_readVarZ(var, 4) < 0);
+    assert(GT3_getLastError() == GT3_ERR_BROKEN);
+    GT3_clearLastError();
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    remove(path);
+}
+
+
+/*
+ * the reduction of URY/MRY (on packed integers) must agree with
+ * that of decoded values.
+ */
+void
+test_reduce(void)
+{
+    const char *path = "write-test.gt";
+    const char *fmts[] = { "URY16", "MRY12", "MRY20", "URY1", "UR4" };
+    double data[37 * 11 * 3], value, mean, ssd;
+    double tsum;
+    GT3_Reduction red[11], all;
+    GT3_HEADER head;
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    FILE *output;
+    size_t cnt, total;
+    int i, x, y, z;
+
+    for (i = 0; i < 37 * 11 * 3; i++)
+        data[i] = (i % 7 == 0) ? -999. : 250. + 0.1 * (i % 37) - 1e-3 * i;
+    for (i = 37 * 11; i < 37 * 11 * 2; i++)
+        data[i] = -999.;        /* all missing in z = 1 */
+    for (i = 0; i < 37; i++)
+        data[37 * 11 * 2 + 37 * 4 + i] = -999.;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++)
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 37, 11, 3,
+                         &head, fmts[i], output) == 0);
+    fclose(output);
+
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++) {
+        for (z = 2; z >= 0; z--) {
+            assert(GT3_reduceVarRows(red, var, z, 3, 30, 0, 11) == 0);
+            all.count = total = 0;
+            all.sum = all.ssd = tsum = 0.;
+            for (y = 0; y < 11; y++) {
+                GT3_mergeReduction(&all, red + y);
+
+                /* the row computed with decoded values */
+                cnt = 0;
+                mean = ssd = 0.;
+                for (x = 3; x < 30; x++) {
+                    assert(GT3_readVar(&value, var, x, y, z) == 0);
+                    if (value != -999.) {
+                        cnt++;
+                        mean += value;
+                    }
+                }
+                assert(red[y].count == cnt);
+                total += cnt;
+                tsum += mean;
+                if (cnt == 0) {
+                    assert(red[y].min > red[y].max);
+                    continue;
+                }
+                assert(fabs(red[y].sum - mean) <= 1e-9 * fabs(mean));
+                mean /= cnt;
+                for (x = 3; x < 30; x++) {
+                    assert(GT3_readVar(&value, var, x, y, z) == 0);
+                    if (value != -999.) {
+                        ssd += (value - mean) * (value - mean);
+                        assert(red[y].min <= value && value <= red[y].max);
+                    }
+                }
+                assert(fabs(red[y].ssd - ssd) <= 1e-9 * (ssd + 1.));
+            }
+
+            assert(all.count == total);
+            assert(fabs(all.sum - tsum) <= 1e-9 * fabs(tsum));
+        }
+        assert(GT3_reduceVarRows(red, var, 3, 0, 37, 0, 11) < 0);
+        assert(GT3_reduceVarRows(red, var, 0, 0, 38, 0, 11) < 0);
+        GT3_next(fp);
+    }
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    remove(path);
+}
+
+
+/*
+ * packed values of masked data must be those in the z-plane.
+ */
+void
+test_packed(void)
+{
+    const char *path = "write-test.gt";
+    const char *fmts[] = { "MR4", "MR8", "MRY12", "UR4" };
+    double data[37 * 11 * 3], value;
+    GT3_HEADER head;
+    GT3_File *fp;
+    GT3_Varbuf *var;
+    FILE *output;
+    const int *index;
+    int i, k, n, z, num;
+
+    for (i = 0; i < 37 * 11 * 3; i++)
+        data[i] = (i % 3 == 0 || i % 37 > 30) ? -999. : 0.25 * i;
+    for (i = 37 * 11; i < 37 * 11 * 2; i++)
+        data[i] = -999.;        /* all missing in z = 1 */
+
+    GT3_initHeader(&head);
+    GT3_setHeaderMiss(&head, -999.);
+    output = fopen(path, "wb");
+    assert(output);
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++)
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 37, 11, 3,
+                         &head, fmts[i], output) == 0);
+    fclose(output);
+
+    fp = GT3_open(path);
+    assert(fp);
+    var = GT3_getVarbuf(fp);
+    assert(var);
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++) {
+        for (z = 2; z >= 0; z--) {
+            num = GT3_readVarPacked(var, z, &index);
+            assert(num >= 0);
+            assert((index == NULL) == (i == 3));
+
+            for (k = 0, n = 0; n < 37 * 11; n++) {
+                if (index && data[n + 37 * 11 * z] == -999.)
+                    continue;
+
+                assert(k < num && (index == NULL || index[k] == n));
+                value = var->type == GT3_TYPE_FLOAT
+                    ? ((float *)var->data)[k]
+                    : ((double *)var->data)[k];
+                assert(fabs(value - data[n + 37 * 11 * z]) < 0.1);
+                k++;
+            }
+            assert(k == num);
+
+            /* the z-plane is read again. */
+            assert(GT3_readVarZ(var, z) == 0);
+            assert(GT3_readVar(&value, var, 1, 0, z) == 0);
+            assert(fabs(value - data[1 + 37 * 11 * z]) < 0.1);
+        }
+        GT3_next(fp);
+    }
+    GT3_freeVarbuf(var);
+    GT3_close(fp);
+    remove(path);
+}
+
+
 int
 main(int argc, char **argv)
 {
@@ -548,6 +1221,11 @@ main(int argc, char **argv)
     assert((fmt >> GT3_FMT_MBIT) == 12);
     assert(strcmp(dfmt, "URX12") == 0);
 
+    test_threads();
+    test_bound();
+    test_zr();
+    test_reduce();
+    test_packed();
     return 0;
 }
 #endif
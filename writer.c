@@ -0,0 +1,538 @@
+/*
+ * writer.c -- buffered output of chunks (GT3_Writer).
+ *
+ * GT3_write() flushes the stream at every call, which costs
+ * system calls when many small chunks are written.
+ * GT3_Writer owns the output stream with a large buffer, and it is
+ * flushed only when the buffer is full, or by GT3_writerFlush() and
+ * GT3_writerClose().
+ */
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#  include <pthread.h>
+#endif
+
+#include "gtool3.h"
+
+#define DEFAULT_BUFSIZE (4 * 1024 * 1024)
+
+
+/*
+ * A chunk to be written by the background thread.
+ */
+struct job {
+    void *data;                 /* a copy of the user's data */
+    size_t reserved;            /* allocated size of 'data' */
+    int type;
+    int nx, ny, nz;
+    GT3_HEADER head;
+    char *dfmt;                 /* NULL: default (cf. GT3_write()) */
+    int bitpack;                /* by GT3_write_bitpack() */
+    double offset, scale;
+    unsigned nbits, is_mask;
+};
+
+
+struct GT3_Writer {
+    FILE *fp;
+    char *buf;                  /* buffer of the stream */
+
+    int async;
+#ifdef HAVE_LIBPTHREAD
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending;                /* 'job' is waiting or being written */
+    int quit;
+    struct job job;
+
+    /* the first error in the background (sticky) */
+    int errcode;
+    int errnum;
+    char errmsg[256];
+#endif
+};
+
+
+static int
+write_job(const struct job *job, FILE *fp)
+{
+    if (job->bitpack)
+        return GT3_write_bitpack(job->data, job->type,
+                                 job->nx, job->ny, job->nz, &job->head,
+                                 job->offset, job->scale,
+                                 job->nbits, job->is_mask, fp);
+
+    return write_chunk(job->data, job->type,
+                       job->nx, job->ny, job->nz, &job->head,
+                       job->dfmt, fp);
+}
+
+
+#ifdef HAVE_LIBPTHREAD
+static void *
+background(void *ptr)
+{
+    GT3_Writer *w = ptr;
+    int rval;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->pending && !w->quit)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->pending)
+            break;
+
+        /*
+         * Do not lock while writing: the job is not touched by others
+         * until 'pending' is cleared.
+         */
+        pthread_mutex_unlock(&w->lock);
+        rval = (w->errcode == 0) ? write_job(&w->job, w->fp) : 0;
+        pthread_mutex_lock(&w->lock);
+
+        /*
+         * A failure must be kept even if no error has been pushed
+         * (it would be dropped silently with errcode == 0).
+         */
+        if (rval < 0
+            && (w->errcode = copy_last_error(&w->errnum, w->errmsg,
+                                             sizeof w->errmsg)) == 0) {
+            w->errcode = GT3_ERR_UNDEF;
+            w->errnum = 0;
+            w->errmsg[0] = '\0';
+        }
+        w->pending = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+
+/*
+ * wait_idle() waits for the background thread to finish the last job,
+ * and reports its error, if any.
+ */
+static int
+wait_idle(GT3_Writer *w)
+{
+    int rval = 0;
+
+    if (!w->async)
+        return 0;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->pending)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if (w->errcode != 0) {
+        raise_error(w->errcode, w->errnum, w->errmsg);
+        rval = -1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return rval;
+}
+
+
+/*
+ * submit() passes a copy of the chunk to the background thread.
+ * 'w->job' has been set up except for its data.
+ */
+static int
+submit(GT3_Writer *w, const void *ptr)
+{
+    size_t size;
+    void *p;
+
+    /* 'w->job' is free after wait_idle(). */
+    size = (size_t)w->job.nx * w->job.ny * w->job.nz
+        * (w->job.type == GT3_TYPE_FLOAT ? sizeof(float) : sizeof(double));
+    if (size > w->job.reserved) {
+        if ((p = realloc(w->job.data, size)) == NULL) {
+            gt3_error(SYSERR, NULL);
+            return -1;
+        }
+        w->job.data = p;
+        w->job.reserved = size;
+    }
+    memcpy(w->job.data, ptr, size);
+
+    pthread_mutex_lock(&w->lock);
+    w->pending = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+
+static int
+check_job(const void *ptr, int type, int nx, int ny, int nz)
+{
+    if (ptr == NULL || nx < 1 || ny < 1 || nz < 1
+        || (type != GT3_TYPE_DOUBLE && type != GT3_TYPE_FLOAT)) {
+        gt3_error(GT3_ERR_CALL, "GT3_Writer: Invalid argument");
+        return -1;
+    }
+    return 0;
+}
+
+
+static int
+start_background(GT3_Writer *w)
+{
+    memset(&w->job, 0, sizeof w->job);
+    w->pending = 0;
+    w->quit = 0;
+    w->errcode = 0;
+
+    if (pthread_mutex_init(&w->lock, NULL) != 0)
+        return -1;
+    if (pthread_cond_init(&w->cond, NULL) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        return -1;
+    }
+    if (pthread_create(&w->thread, NULL, background, w) != 0) {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void
+stop_background(GT3_Writer *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->quit = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->job.data);
+    free(w->job.dfmt);
+}
+#else /* !HAVE_LIBPTHREAD */
+#  define wait_idle(w) 0
+#endif /* !HAVE_LIBPTHREAD */
+
+
+static GT3_Writer *
+open_writer(const char *path, const char *mode, size_t bufsize)
+{
+    GT3_Writer *w;
+
+    if (bufsize == 0)
+        bufsize = DEFAULT_BUFSIZE;
+
+    if ((w = malloc(sizeof(GT3_Writer))) == NULL
+        || (w->buf = malloc(bufsize)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        free(w);
+        return NULL;
+    }
+
+    if ((w->fp = fopen(path, mode)) == NULL) {
+        gt3_error(SYSERR, path);
+        free(w->buf);
+        free(w);
+        return NULL;
+    }
+
+    if (setvbuf(w->fp, w->buf, _IOFBF, bufsize) != 0) {
+        /* not fatal: the default buffer of stdio is used. */
+        free(w->buf);
+        w->buf = NULL;
+    }
+    w->async = 0;
+    return w;
+}
+
+
+/*
+ * GT3_openWriter() opens 'path' for output with an output buffer of
+ * 'bufsize' bytes (the default size if 0).
+ * 'mode' is the same as fopen(3) ("wb", "ab", etc.).
+ */
+GT3_Writer *
+GT3_openWriter(const char *path, const char *mode, size_t bufsize)
+{
+    return open_writer(path, mode, bufsize);
+}
+
+
+/*
+ * GT3_openAsyncWriter() is the same as GT3_openWriter(), but chunks are
+ * encoded and written by a background thread.
+ *
+ * GT3_writerWrite() copies the data into the writer, and returns
+ * without waiting for it to be written (except while the previous
+ * chunk is still being written), so that the caller can compute the
+ * next chunk meanwhile.  The chunks are written in order.
+ * An error in the background is reported by the next call of
+ * GT3_writerWrite(), GT3_writerFlush(), or GT3_writerClose().
+ *
+ * Without pthreads, this is the same as GT3_openWriter().
+ */
+GT3_Writer *
+GT3_openAsyncWriter(const char *path, const char *mode, size_t bufsize)
+{
+    GT3_Writer *w;
+
+    if ((w = open_writer(path, mode, bufsize)) == NULL)
+        return NULL;
+
+#ifdef HAVE_LIBPTHREAD
+    if (start_background(w) < 0) {
+        gt3_error(SYSERR, NULL);
+        fclose(w->fp);
+        free(w->buf);
+        free(w);
+        return NULL;
+    }
+    w->async = 1;
+#endif
+    return w;
+}
+
+
+/*
+ * GT3_writerWrite() is the same as GT3_write(), except that the output
+ * is not flushed.
+ */
+int
+GT3_writerWrite(GT3_Writer *w, const void *ptr, int type,
+                int nx, int ny, int nz,
+                const GT3_HEADER *head, const char *dfmt)
+{
+#ifdef HAVE_LIBPTHREAD
+    char fmtstr[17];
+#endif
+
+    if (!w->async)
+        return write_chunk(ptr, type, nx, ny, nz, head, dfmt, w->fp);
+
+#ifdef HAVE_LIBPTHREAD
+    if (wait_idle(w) < 0 || check_job(ptr, type, nx, ny, nz) < 0)
+        return -1;
+
+    if (dfmt && GT3_output_format(fmtstr, dfmt) < 0) {
+        gt3_error(GT3_ERR_CALL, "GT3_Writer: \"%s\" unknown format", dfmt);
+        return -1;
+    }
+    free(w->job.dfmt);
+    w->job.dfmt = NULL;
+    if (dfmt && (w->job.dfmt = strdup(dfmt)) == NULL) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
+    w->job.type = type;
+    w->job.nx = nx;
+    w->job.ny = ny;
+    w->job.nz = nz;
+    GT3_copyHeader(&w->job.head, head);
+    w->job.bitpack = 0;
+    return submit(w, ptr);
+#else
+    return -1;
+#endif
+}
+
+
+/*
+ * GT3_writerWriteBitpack() is the GT3_Writer version of
+ * GT3_write_bitpack().
+ */
+int
+GT3_writerWriteBitpack(GT3_Writer *w, const void *ptr, int type,
+                       int nx, int ny, int nz,
+                       const GT3_HEADER *head,
+                       double offset, double scale,
+                       unsigned nbits, unsigned is_mask)
+{
+    if (!w->async)
+        return GT3_write_bitpack(ptr, type, nx, ny, nz, head,
+                                 offset, scale, nbits, is_mask, w->fp);
+
+#ifdef HAVE_LIBPTHREAD
+    if (wait_idle(w) < 0 || check_job(ptr, type, nx, ny, nz) < 0)
+        return -1;
+
+    w->job.type = type;
+    w->job.nx = nx;
+    w->job.ny = ny;
+    w->job.nz = nz;
+    GT3_copyHeader(&w->job.head, head);
+    w->job.bitpack = 1;
+    w->job.offset = offset;
+    w->job.scale = scale;
+    w->job.nbits = nbits;
+    w->job.is_mask = is_mask;
+    return submit(w, ptr);
+#else
+    return -1;
+#endif
+}
+
+
+/*
+ * GT3_writerFlush() waits for all the chunks to be written (in the
+ * async mode), and flushes the stream.
+ */
+int
+GT3_writerFlush(GT3_Writer *w)
+{
+    if (wait_idle(w) < 0)
+        return -1;
+
+    if (fflush(w->fp) != 0) {
+        gt3_error(SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * GT3_writerStream() returns the output stream, e.g., to write
+ * something other than chunks.  Do not close it.
+ * In the async mode, this waits for all the chunks to be written.
+ */
+FILE *
+GT3_writerStream(GT3_Writer *w)
+{
+    if (wait_idle(w) < 0)
+        return NULL;
+    return w->fp;
+}
+
+
+/*
+ * GT3_writerClose() flushes the output, and closes it.
+ * 'w' is freed even if an error occurs.
+ */
+int
+GT3_writerClose(GT3_Writer *w)
+{
+    int rval = 0;
+
+    if (!w)
+        return 0;
+
+    if (wait_idle(w) < 0)
+        rval = -1;
+#ifdef HAVE_LIBPTHREAD
+    if (w->async)
+        stop_background(w);
+#endif
+
+    if (fclose(w->fp) != 0) {
+        gt3_error(SYSERR, NULL);
+        rval = -1;
+    }
+    free(w->buf);
+    free(w);
+    return rval;
+}
+
+
+#ifdef TEST_MAIN
+#include <assert.h>
+
+static void
+compare_files(const char *path1, const char *path2)
+{
+    FILE *fp1, *fp2;
+    int c1, c2;
+
+    fp1 = fopen(path1, "rb");
+    fp2 = fopen(path2, "rb");
+    assert(fp1 && fp2);
+    do {
+        c1 = getc(fp1);
+        c2 = getc(fp2);
+        assert(c1 == c2);
+    } while (c1 != EOF);
+    fclose(fp1);
+    fclose(fp2);
+}
+
+
+/*
+ * The output of GT3_Writer should be identical to GT3_write().
+ */
+int
+main(int argc, char **argv)
+{
+    const char *path1 = "writer-test1.gt", *path2 = "writer-test2.gt";
+    const char *path3 = "writer-test3.gt";
+    const char *fmts[] = { "UR4", "URC", "MR8", "URY12", "MRY16" };
+    double data[20 * 10 * 3];
+    GT3_HEADER head;
+    GT3_Writer *w, *aw;
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < 20 * 10 * 3; i++)
+        data[i] = (i % 7 == 0) ? -999. : i * 0.5;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "ITEM", "TEST");
+    GT3_setHeaderMiss(&head, -999.);
+
+    fp = fopen(path1, "wb");
+    assert(fp);
+    w = GT3_openWriter(path2, "wb", 100);
+    aw = GT3_openAsyncWriter(path3, "wb", 0);
+    assert(w && aw);
+    for (i = 0; i < sizeof fmts / sizeof fmts[0]; i++) {
+        assert(GT3_write(data, GT3_TYPE_DOUBLE, 20, 10, 3,
+                         &head, fmts[i], fp) == 0);
+        assert(GT3_writerWrite(w, data, GT3_TYPE_DOUBLE, 20, 10, 3,
+                               &head, fmts[i]) == 0);
+        assert(GT3_writerWrite(aw, data, GT3_TYPE_DOUBLE, 20, 10, 3,
+                               &head, fmts[i]) == 0);
+        data[0] += 1.;          /* the writer has its own copy */
+    }
+    assert(GT3_write_bitpack(data, GT3_TYPE_DOUBLE, 20, 10, 3, &head,
+                             0., 0.5, 12, 1, fp) == 0);
+    assert(GT3_writerWriteBitpack(w, data, GT3_TYPE_DOUBLE, 20, 10, 3,
+                                  &head, 0., 0.5, 12, 1) == 0);
+    assert(GT3_writerWriteBitpack(aw, data, GT3_TYPE_DOUBLE, 20, 10, 3,
+                                  &head, 0., 0.5, 12, 1) == 0);
+    assert(GT3_writerWrite(aw, data, GT3_TYPE_DOUBLE, 20, 10, 3,
+                           &head, "XXX") < 0);
+    assert(GT3_writerFlush(w) == 0);
+    assert(GT3_writerFlush(aw) == 0);
+    fclose(fp);
+    assert(GT3_writerClose(w) == 0);
+    assert(GT3_writerClose(aw) == 0);
+
+    compare_files(path1, path2);
+    compare_files(path1, path3);
+    remove(path1);
+    remove(path2);
+    remove(path3);
+
+    /*
+     * An error in the background is reported later.
+     */
+    if ((aw = GT3_openAsyncWriter("/dev/full", "wb", 100)) != NULL) {
+        int rval = 0;
+
+        GT3_clearLastError();
+        for (i = 0; i < 3 && rval == 0; i++)
+            rval = GT3_writerWrite(aw, data, GT3_TYPE_DOUBLE, 20, 10, 3,
+                                   &head, "UR8");
+        assert(GT3_writerClose(aw) < 0);
+        assert(GT3_getLastError() == GT3_ERR_SYS);
+    }
+    return 0;
+}
+#endif
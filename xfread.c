@@ -3,7 +3,15 @@
  */
 #include "internal.h"
 #include <sys/types.h>
+#include <errno.h>
 #include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#if defined(HAVE_PREAD) && defined(HAVE_UNISTD_H)
+#  define USE_PREAD
+#endif
 
 
 /*
@@ -22,3 +30,113 @@ xfread(void *ptr, size_t size, size_t nmemb, FILE *fp)
     }
     return 0;
 }
+
+
+/*
+ * xpread() reads 'nmemb' elements at 'off' in the file.
+ *
+ * The file position of fp->fp is not used nor changed, so that
+ * several threads can read one GT3_File at the same time.
+ * Without pread(2), this falls back to fseeko() and fread(),
+ * which is not thread-safe.
+ */
+int
+xpread(void *ptr, size_t size, size_t nmemb, off_t off, const GT3_File *fp)
+{
+    size_t len = size * nmemb;
+    FILE *stream;
+    int rval = 0;
+#ifdef USE_PREAD
+    char *p = ptr;
+    ssize_t nread;
+    int fd;
+#endif
+
+    if (fp->map_)
+        return copy_mapped(ptr, len, off, fp);
+
+    /*
+     * 'fp' might be pooled (fpool.c), and its FILE is kept open
+     * until release_stream().
+     */
+    if ((stream = acquire_stream(fp)) == NULL)
+        return -1;
+
+#ifdef USE_PREAD
+    fd = fileno(stream);
+    while (len > 0) {
+        if ((nread = pread(fd, p, len, off)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            gt3_error(SYSERR, "I/O Error");
+            rval = -1;
+            break;
+        }
+        if (nread == 0) {
+            gt3_error(GT3_ERR_BROKEN, "Unexpected EOF");
+            rval = -1;
+            break;
+        }
+        p += nread;
+        off += nread;
+        len -= nread;
+    }
+#else
+    if (fseeko(stream, off, SEEK_SET) < 0) {
+        gt3_error(SYSERR, NULL);
+        rval = -1;
+    } else
+        rval = xfread(ptr, size, nmemb, stream);
+#endif
+    release_stream(fp);
+    return rval;
+}
+
+
+/*
+ * xpread_words() reads 'nmemb' big-endian words (32-bit) at 'off',
+ * and stores them in the native byte-order.
+ * From a mapped image, they are swapped while copying.
+ */
+int
+xpread_words(void *ptr, size_t nmemb, off_t off, const GT3_File *fp)
+{
+    const void *src;
+
+    if (fp->map_ && IS_LITTLE_ENDIAN) {
+        if ((src = mapped_range(off, 4 * nmemb, fp)) == NULL)
+            return -1;
+        copy_reverse_words(ptr, src, nmemb);
+        return 0;
+    }
+
+    if (xpread(ptr, 4, nmemb, off, fp) < 0)
+        return -1;
+    if (IS_LITTLE_ENDIAN)
+        reverse_words(ptr, nmemb);
+    return 0;
+}
+
+
+/*
+ * xpread_dwords() is the 64-bit version of xpread_words().
+ */
+int
+xpread_dwords(void *ptr, size_t nmemb, off_t off, const GT3_File *fp)
+{
+    const void *src;
+
+    if (fp->map_ && IS_LITTLE_ENDIAN) {
+        if ((src = mapped_range(off, 8 * nmemb, fp)) == NULL)
+            return -1;
+        copy_reverse_dwords(ptr, src, nmemb);
+        return 0;
+    }
+
+    if (xpread(ptr, 8, nmemb, off, fp) < 0)
+        return -1;
+    if (IS_LITTLE_ENDIAN)
+        reverse_dwords(ptr, nmemb);
+    return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * zr_pack.c -- lossless packing of ZR4/ZR8.
+ *
+ * A z-plane of 'n' values (4 or 8 bytes each) is stored as follows:
+ *
+ *   1. Shuffle: the values are split into byte-planes, from the most
+ *      significant byte to the least.
+ *   2. Delta: each byte-plane is replaced with the differences from
+ *      the previous byte (mod 256), mapped to 0...255 by zigzag coding
+ *      so that small differences of either sign become small codes.
+ *   3. Packing: each byte-plane is split into blocks of ZR_BLOCK codes,
+ *      and each block is packed with the fewest bits (0...8) to hold
+ *      its largest code.
+ *
+ * The packed plane is the table of the number of bits of all blocks
+ * (4-bit each), followed by the packed blocks, in 32-bit words.
+ * A block of 0-bit (all the bytes are the same as the previous)
+ * takes no word.
+ */
+#include "internal.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "int_pack.h"
+
+
+size_t
+zr_nblocks(size_t n)
+{
+    return (n + ZR_BLOCK - 1) / ZR_BLOCK;
+}
+
+
+/*
+ * zr_maxlen() returns the maximum length (in words) of a packed plane.
+ */
+size_t
+zr_maxlen(size_t n, size_t width)
+{
+    return pack32_len(width * zr_nblocks(n), 4) + width * pack32_len(n, 8);
+}
+
+
+/*
+ * zr_shuffle() splits 'n' values into byte-planes 'bytes' (width * n).
+ * The input 'ptr' is float (size = 4) or double (size = 8), which is
+ * converted into float (width = 4) or double (width = 8) if needed.
+ */
+void
+zr_shuffle(unsigned char *bytes, const void *ptr, size_t size,
+           size_t width, size_t n)
+{
+    const float *fptr = ptr;
+    const double *dptr = ptr;
+    uint32_t u;
+    uint64_t u8;
+    float fv;
+    double dv;
+    size_t i, k;
+
+    if (width == 4)
+        for (i = 0; i < n; i++) {
+            fv = (size == 4) ? fptr[i] : (float)dptr[i];
+            memcpy(&u, &fv, 4);
+
+            bytes[i]         = (unsigned char)(u >> 24);
+            bytes[i + n]     = (unsigned char)(u >> 16);
+            bytes[i + 2 * n] = (unsigned char)(u >> 8);
+            bytes[i + 3 * n] = (unsigned char)u;
+        }
+    else
+        for (i = 0; i < n; i++) {
+            dv = (size == 8) ? dptr[i] : (double)fptr[i];
+            memcpy(&u8, &dv, 8);
+
+            for (k = 0; k < 8; k++)
+                bytes[i + k * n] = (unsigned char)(u8 >> (56 - 8 * k));
+        }
+}
+
+
+/*
+ * zr_unshuffle() is the inverse of zr_shuffle(), and 'ptr' is float
+ * (width = 4) or double (width = 8).
+ */
+void
+zr_unshuffle(void *ptr, const unsigned char *bytes, size_t width, size_t n)
+{
+    uint32_t u;
+    uint64_t u8;
+    size_t i, k;
+
+    if (width == 4)
+        for (i = 0; i < n; i++) {
+            u = (uint32_t)bytes[i] << 24
+                | (uint32_t)bytes[i + n] << 16
+                | (uint32_t)bytes[i + 2 * n] << 8
+                | (uint32_t)bytes[i + 3 * n];
+            memcpy((float *)ptr + i, &u, 4);
+        }
+    else
+        for (i = 0; i < n; i++) {
+            for (u8 = 0, k = 0; k < 8; k++)
+                u8 = u8 << 8 | bytes[i + k * n];
+            memcpy((double *)ptr + i, &u8, 8);
+        }
+}
+
+
+/*
+ * zr_delta() replaces each byte-plane with zigzag-coded differences.
+ */
+void
+zr_delta(unsigned char *bytes, size_t n, size_t width)
+{
+    unsigned prev, d;
+    size_t i, k;
+
+    for (k = 0; k < width; k++, bytes += n)
+        for (prev = 0, i = 0; i < n; i++) {
+            d = (bytes[i] - prev) & 0xffU;
+            prev = bytes[i];
+            bytes[i] = (unsigned char)((d << 1) ^ ((d & 0x80U) ? 0xffU : 0));
+        }
+}
+
+
+/*
+ * zr_packed_len() sets the number of bits of each block in 'nbits'
+ * (width * zr_nblocks(n)), and returns the length of the packed plane
+ * (in words).  'bytes' is the output of zr_delta().
+ */
+size_t
+zr_packed_len(unsigned char *nbits, const unsigned char *bytes,
+              size_t n, size_t width)
+{
+    size_t i, j, k, m, nblk, len;
+    unsigned v, nb;
+
+    nblk = zr_nblocks(n);
+    len = pack32_len(width * nblk, 4);
+    for (k = 0; k < width; k++, bytes += n)
+        for (i = 0; i < nblk; i++) {
+            m = (n - i * ZR_BLOCK > ZR_BLOCK) ? ZR_BLOCK : n - i * ZR_BLOCK;
+
+            for (v = 0, j = 0; j < m; j++)
+                v |= bytes[i * ZR_BLOCK + j];
+            for (nb = 0; v >> nb; nb++)
+                ;
+            *nbits++ = (unsigned char)nb;
+            len += nb > 0 ? pack32_len(m, nb) : 0;
+        }
+    return len;
+}
+
+
+/*
+ * zr_pack() packs the output of zr_delta() with 'nbits' given by
+ * zr_packed_len(), and returns the length of 'packed' (in words).
+ */
+size_t
+zr_pack(uint32_t *packed, const unsigned char *bytes,
+        const unsigned char *nbits, size_t n, size_t width)
+{
+    unsigned vals[ZR_BLOCK];
+    size_t i, j, k, m, ntab, nblk, len;
+
+    nblk = zr_nblocks(n);
+    ntab = width * nblk;
+
+    /* the table of nbits (by a group of 32, which is word-aligned) */
+    for (len = 0, i = 0; i < ntab; i += m) {
+        m = (ntab - i > 32) ? 32 : ntab - i;
+
+        for (j = 0; j < m; j++)
+            vals[j] = nbits[i + j];
+        len += pack_bits_into32(packed + len, vals, m, 4);
+    }
+
+    for (k = 0; k < width; k++, bytes += n)
+        for (i = 0; i < nblk; i++, nbits++) {
+            if (*nbits == 0)
+                continue;
+
+            m = (n - i * ZR_BLOCK > ZR_BLOCK) ? ZR_BLOCK : n - i * ZR_BLOCK;
+            for (j = 0; j < m; j++)
+                vals[j] = bytes[i * ZR_BLOCK + j];
+
+            len += pack_bits_into32(packed + len, vals, m, *nbits);
+        }
+    return len;
+}
+
+
+/*
+ * zr_unpack() decodes a packed plane of 'plen' words into byte-planes,
+ * which are the input of zr_unshuffle().
+ * It returns -1 if 'packed' is broken.
+ */
+int
+zr_unpack(unsigned char *bytes, size_t n, size_t width,
+          const uint32_t *packed, size_t plen)
+{
+    unsigned vals[ZR_BLOCK];
+    unsigned tab[32];           /* a group of the nbits table */
+    unsigned nb, prev, d;
+    size_t i, j, k, m, ntab, nblk, pos, len, itab;
+
+    nblk = zr_nblocks(n);
+    ntab = width * nblk;
+    pos = pack32_len(ntab, 4);
+    if (pos > plen)
+        return -1;
+
+    for (itab = 0, k = 0; k < width; k++, bytes += n)
+        for (prev = 0, i = 0; i < nblk; i++, itab++) {
+            if (itab % 32 == 0)
+                unpack_bits_from32(tab, ntab - itab > 32 ? 32 : ntab - itab,
+                                   packed + itab / 8, 4);
+
+            m = (n - i * ZR_BLOCK > ZR_BLOCK) ? ZR_BLOCK : n - i * ZR_BLOCK;
+            nb = tab[itab % 32];
+            if (nb > 8)
+                return -1;
+
+            if (nb > 0) {
+                len = pack32_len(m, nb);
+                if (pos + len > plen)
+                    return -1;
+
+                unpack_bits_from32(vals, m, packed + pos, nb);
+                pos += len;
+            } else
+                memset(vals, 0, sizeof(unsigned) * m);
+
+            for (j = 0; j < m; j++) {
+                d = (vals[j] >> 1) ^ ((vals[j] & 1U) ? 0xffU : 0);
+                prev = (prev + d) & 0xffU;
+                bytes[i * ZR_BLOCK + j] = (unsigned char)prev;
+            }
+        }
+    return 0;
+}
+
+
+#ifdef TEST_MAIN
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void
+roundtrip(const void *ptr, size_t size, size_t width, size_t n)
+{
+    unsigned char *bytes, *nbits;
+    uint32_t *packed;
+    void *out;
+    size_t len, len2;
+
+    bytes = malloc(width * n);
+    nbits = malloc(width * zr_nblocks(n));
+    packed = malloc(4 * zr_maxlen(n, width));
+    out = malloc(width * n);
+    assert(bytes && nbits && packed && out);
+
+    zr_shuffle(bytes, ptr, size, width, n);
+    zr_delta(bytes, n, width);
+    len = zr_packed_len(nbits, bytes, n, width);
+    len2 = zr_pack(packed, bytes, nbits, n, width);
+    assert(len == len2);
+    assert(len <= zr_maxlen(n, width));
+
+    memset(bytes, 0xaa, width * n);
+    assert(zr_unpack(bytes, n, width, packed, len) == 0);
+    zr_unshuffle(out, bytes, width, n);
+
+    if (size == width)
+        assert(memcmp(out, ptr, width * n) == 0);
+    else {
+        size_t i;
+
+        for (i = 0; i < n; i++)
+            if (width == 4)
+                assert(((float *)out)[i] == (float)((double *)ptr)[i]);
+            else
+                assert(((double *)out)[i] == ((float *)ptr)[i]);
+    }
+
+    /* broken data */
+    if (len > 0)
+        assert(zr_unpack(bytes, n, width, packed, len - 1) < 0);
+
+    free(out);
+    free(packed);
+    free(nbits);
+    free(bytes);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    static float fdata[1000];
+    static double ddata[1000];
+    size_t n[] = { 1, 31, 128, 129, 1000 };
+    int i, j;
+
+    for (i = 0; i < 1000; i++) {
+        ddata[i] = 280. + 20. * sin(0.01 * i) - 1e-3 * i;
+        fdata[i] = (float)ddata[i];
+    }
+    ddata[10] = fdata[10] = -999.f;
+    ddata[500] = -ddata[500];
+
+    for (j = 0; j < sizeof n / sizeof n[0]; j++) {
+        roundtrip(fdata, 4, 4, n[j]);
+        roundtrip(ddata, 8, 8, n[j]);
+        roundtrip(ddata, 8, 4, n[j]);
+        roundtrip(fdata, 4, 8, n[j]);
+    }
+
+    /* constant data: only the table is stored. */
+    {
+        unsigned char bytes[4 * 200], nbits[8];
+        uint32_t packed[16];
+
+        for (i = 0; i < 200; i++)
+            fdata[i] = 0.f;
+        zr_shuffle(bytes, fdata, 4, 4, 200);
+        zr_delta(bytes, 200, 4);
+        assert(zr_packed_len(nbits, bytes, 200, 4) == 1);
+        assert(zr_pack(packed, bytes, nbits, 200, 4) == 1);
+        assert(packed[0] == 0);
+    }
+    return 0;
+}
+#endif /* TEST_MAIN */